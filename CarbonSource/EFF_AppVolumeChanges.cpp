@@ -0,0 +1,114 @@
+//
+//  EFF_AppVolumeChanges.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_AppVolumeChanges.h"
+
+// Local Includes
+#include "EFF_BundleIDs.h"
+#include "EFF_CustomProperties.h"
+
+// STL Includes
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+EFF_AppVolumeChanges::EFF_AppVolumeChanges()
+{
+    // Microseconds since 1970, so it's larger than any sequence number from before coreaudiod last
+    // restarted, unless there were more than a million changes a second.
+    auto theTime = std::chrono::system_clock::now().time_since_epoch();
+    mSequence = static_cast<UInt64>(std::chrono::duration_cast<std::chrono::microseconds>(theTime).count());
+    mOldestSequence = mSequence;
+}
+
+#pragma mark Accessors
+
+void    EFF_AppVolumeChanges::Append(const EFF_Client& inClient)
+{
+    if(mChanges.size() == kMaxChanges)
+    {
+        mOldestSequence = mChanges.front().sequence;
+        mChanges.pop_front();
+    }
+
+    mChanges.push_back({ ++mSequence, inClient });
+}
+
+bool    EFF_AppVolumeChanges::CopyChangesSince(UInt64 inSequence,
+                                               std::vector<EFF_Client>& outClients) const
+{
+    if(inSequence < mOldestSequence || inSequence > mSequence)
+    {
+        return false;
+    }
+
+    outClients.clear();
+
+    // Walk back from the latest change, skipping older changes to clients we've already seen.
+    for(auto theItr = mChanges.rbegin(); theItr != mChanges.rend() && theItr->sequence > inSequence; theItr++)
+    {
+        bool theClientIsNew = std::none_of(outClients.begin(), outClients.end(), [&] (const EFF_Client& inClient) {
+            return inClient.mClientID == theItr->client.mClientID;
+        });
+
+        if(theClientIsNew)
+        {
+            outClients.push_back(theItr->client);
+        }
+    }
+
+    std::reverse(outClients.begin(), outClients.end());
+
+    return true;
+}
+
+//static
+CFDataRef    EFF_AppVolumeChanges::CopyEncoded(UInt64 inSequence,
+                                               bool inIsSnapshot,
+                                               const std::vector<EFF_Client>& inClients,
+                                               const EFF_VolumeCurveTable& inVolumeCurve)
+{
+    std::vector<UInt8> theBytes(sizeof(EFF_AppVolumeChangesHeader));
+
+    EFF_AppVolumeChangesHeader theHeader;
+    theHeader.sequence = inSequence;
+    theHeader.numChanges = static_cast<UInt32>(inClients.size());
+    theHeader.flags = inIsSnapshot ? kEFFAppVolumeChangesFlag_Snapshot : 0;
+    std::memcpy(theBytes.data(), &theHeader, sizeof(theHeader));
+
+    for(const EFF_Client& theClient : inClients)
+    {
+        const char* theBundleID = EFF_BundleIDs::GetCString(theClient.mBundleID);
+
+        EFF_AppVolumeChange theChange;
+        theChange.processID = theClient.mProcessID;
+        // Reverse the volume conversion from SetClientsRelativeVolumes, as
+        // CopyClientRelativeVolumesAsAppVolumes does.
+        theChange.relativeVolume = inVolumeCurve.ConvertScalarToRaw(theClient.mRelativeVolume / 4);
+        theChange.panPosition = theClient.mPanPosition;
+        theChange.bundleIDLength = static_cast<UInt32>(std::strlen(theBundleID));
+
+        size_t theOffset = theBytes.size();
+        size_t thePaddedLength = (theChange.bundleIDLength + 3) & ~size_t(3);
+
+        // The padding is zeroed by resize.
+        theBytes.resize(theOffset + sizeof(theChange) + thePaddedLength);
+        std::memcpy(&theBytes[theOffset], &theChange, sizeof(theChange));
+        std::memcpy(&theBytes[theOffset + sizeof(theChange)], theBundleID, theChange.bundleIDLength);
+    }
+
+    return CFDataCreate(kCFAllocatorDefault, theBytes.data(), static_cast<CFIndex>(theBytes.size()));
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,90 @@
+//
+//  EFF_AppVolumeChanges.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_AppVolumeChanges_h
+#define EFF_AppVolumeChanges_h
+
+// Local Includes
+#include "EFF_Client.h"
+#include "EFF_VolumeCurveTable.h"
+
+// STL Includes
+#include <deque>
+#include <vector>
+
+// System Includes
+#include <CoreFoundation/CoreFoundation.h>
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_AppVolumeChanges
+//
+//  A log of the changes to clients' volumes and pans, so kAudioDeviceCustomPropertyAppVolumeChanges
+//  can give EFFApp just the changes since its last read instead of every app each time.
+//
+//  Each change gets the next sequence number. The log holds the last kMaxChanges changes, and a
+//  reader asking for the changes since a sequence number older than that gets a snapshot instead.
+//  The first sequence number is taken from the time the log was created, so sequence numbers from
+//  before coreaudiod restarted are older than any in the log and also get a snapshot.
+//
+//  Not thread safe or real-time safe. EFF_ClientMap only uses it with its shadow maps mutex held.
+//==================================================================================================
+
+class EFF_AppVolumeChanges
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_AppVolumeChanges();
+
+#pragma mark Accessors
+
+    // Logs the client's current volume and pan.
+    void                        Append(const EFF_Client& inClient);
+
+    // The sequence number of the latest change.
+    UInt64                      GetSequence() const { return mSequence; }
+
+    // Copies the latest change to each client that has changed since inSequence into outClients,
+    // oldest first, and returns true. Returns false if the log doesn't go back that far.
+    bool                        CopyChangesSince(UInt64 inSequence,
+                                                 std::vector<EFF_Client>& outClients) const;
+
+    // Encodes the clients in the format of kAudioDeviceCustomPropertyAppVolumeChanges. The caller
+    // is responsible for releasing the returned CFData.
+    static CFDataRef            CopyEncoded(UInt64 inSequence,
+                                            bool inIsSnapshot,
+                                            const std::vector<EFF_Client>& inClients,
+                                            const EFF_VolumeCurveTable& inVolumeCurve);
+
+#pragma mark Implementation
+
+private:
+    static const size_t         kMaxChanges = 256;
+
+    struct Change
+    {
+        UInt64                  sequence;
+        EFF_Client              client;
+    };
+
+    // Oldest first.
+    std::deque<Change>          mChanges;
+    UInt64                      mSequence;
+    // CopyChangesSince can only answer for sequence numbers at least this.
+    UInt64                      mOldestSequence;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_AppVolumeChanges_h */
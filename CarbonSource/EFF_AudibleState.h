@@ -40,6 +40,13 @@ public:
      */
     EFFDeviceAudibleState       GetState() const noexcept;
 
+    /*!
+     @return The sample time of the latest audible frame read by UpdateWithClientIO from a client
+             that isn't the music player, or 0 if there hasn't been one.
+     */
+    Float64                     GetLatestAudibleNonMusicSampleTime() const noexcept
+                                    { return mSampleTimes.latestAudibleNonMusic; }
+
     /*! Set the audible state back to kEFFDeviceIsSilent and ignore all previous IO. */
     void                        Reset() noexcept;
     
@@ -69,12 +76,17 @@ public:
                                                   Float64 inOutputSampleTime,
                                                   const Float32* inBuffer);
     
-private:
-    bool                        RecalculateState(Float64 inEndFrameSampleTime);
+    /*!
+     @return True if the buffer's samples vary by more than the margin that counts as silence.
 
+     Real-time safe. Thread safe.
+     */
     static bool                 BufferIsAudible(UInt32 inIOBufferFrameSize,
                                                 const Float32* inBuffer);
 
+private:
+    bool                        RecalculateState(Float64 inEndFrameSampleTime);
+
     EFFDeviceAudibleState       mState;
 
     // TODO: figure out what these exactly are and give appropriate names
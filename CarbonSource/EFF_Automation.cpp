@@ -0,0 +1,637 @@
+//
+//  EFF_Automation.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_Automation.h"
+
+// Local Includes
+#include "EFF_Types.h"
+#include "EFF_MuteControl.h"
+#include "EFF_PlugIn.h"
+#include "EFF_VolumeControl.h"
+#include "EFF_Utils.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CADispatchQueue.h"
+#include "CAException.h"
+
+// STL Includes
+#include <cmath>
+#include <limits>
+#include <vector>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+EFF_Automation::EFF_Automation(AudioObjectID inOwnerDeviceID,
+                               EFF_Clients& inClients,
+                               EFF_VolumeControl& inVolumeControl,
+                               EFF_MuteControl& inMuteControl)
+:
+    mOwnerDeviceID(inOwnerDeviceID),
+    mClients(inClients),
+    mVolumeControl(inVolumeControl),
+    mMuteControl(inMuteControl),
+    mMutex("Automation")
+{
+}
+
+#pragma mark IO Operations
+
+UInt32    EFF_Automation::GetClientSegmentsRT(UInt32 inClientID,
+                                              Float64 inSampleTime,
+                                              UInt32 inFrameCount,
+                                              Float32 inRelativeVolume,
+                                              SInt32 inPanPosition,
+                                              ClientSegment outSegments[kMaxSegments])
+{
+    auto theIsClientEvent = [inClientID] (const Event& inEvent) {
+        return inEvent.target == kTargetClient && inEvent.clientID == inClientID;
+    };
+
+    UInt32 theNumSegments = 0;
+    UInt32 theFrame = 0;
+
+    while(true)
+    {
+        Float64 theNextEventTime = StartDueEventsRT(inSampleTime + theFrame, theIsClientEvent);
+
+        ClientSegment& theSegment = outSegments[theNumSegments++];
+        theSegment = { theFrame, inRelativeVolume, inPanPosition };
+
+        const ClientOverride* theOverride = FindClientOverrideRT(inClientID, false);
+
+        if(theOverride != nullptr)
+        {
+            if(OverrideIsCurrentRT(theOverride->volumeState))
+            {
+                theSegment.relativeVolume = theOverride->relativeVolume;
+            }
+
+            if(OverrideIsCurrentRT(theOverride->panState))
+            {
+                theSegment.panPosition = theOverride->panPosition;
+            }
+        }
+
+        // The next event starts on the first frame at or after its sample time. It's always after
+        // this segment's first frame because StartDueEventsRT started every event up to that.
+        Float64 theNextEventFrame = std::ceil(theNextEventTime - inSampleTime);
+
+        if(!(theNextEventFrame < inFrameCount) || theNumSegments == kMaxSegments)
+        {
+            break;
+        }
+
+        theFrame = static_cast<UInt32>(theNextEventFrame);
+    }
+
+    return theNumSegments;
+}
+
+UInt32    EFF_Automation::GetDeviceVolumeRT(Float64 inSampleTime,
+                                            UInt32 inFrameCount,
+                                            Float32& ioAmplitudeGain)
+{
+    Float64 theNextEventTime = StartDueEventsRT(inSampleTime, [] (const Event& inEvent) {
+        return inEvent.target == kTargetDevice;
+    });
+
+    if(OverrideIsCurrentRT(mDeviceVolumeStateRT))
+    {
+        ioAmplitudeGain = mDeviceVolumeRT;
+    }
+
+    Float64 theNextEventFrame = std::ceil(theNextEventTime - inSampleTime);
+
+    return (theNextEventFrame < inFrameCount) ? static_cast<UInt32>(theNextEventFrame) : inFrameCount;
+}
+
+UInt32    EFF_Automation::GetDeviceMuteRT(Float64 inSampleTime,
+                                          UInt32 inFrameCount,
+                                          bool& ioMuted)
+{
+    Float64 theNextEventTime = StartDueEventsRT(inSampleTime, [] (const Event& inEvent) {
+        return inEvent.target == kTargetDeviceMute;
+    });
+
+    if(OverrideIsCurrentRT(mDeviceMuteStateRT))
+    {
+        ioMuted = mDeviceMuteRT;
+    }
+
+    Float64 theNextEventFrame = std::ceil(theNextEventTime - inSampleTime);
+
+    return (theNextEventFrame < inFrameCount) ? static_cast<UInt32>(theNextEventFrame) : inFrameCount;
+}
+
+bool    EFF_Automation::EndCycleRT(Float64 inEndSampleTime)
+{
+    // An event is due this cycle if it starts on one of the cycle's frames, i.e. its sample time is
+    // at most the last frame's.
+    StartDueEventsRT(inEndSampleTime - 1, [] (const Event&) { return true; });
+
+    bool theNeedsCommit = mNeedsCommitRT;
+    mNeedsCommitRT = false;
+    return theNeedsCommit;
+}
+
+void    EFF_Automation::CommitNonRT()
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    bool theAppVolumesChanged = false;
+    bool theScheduleChanged = false;
+
+    UInt32 theHead = mReportsHead.load(std::memory_order_relaxed);
+    const UInt32 theTail = mReportsTail.load(std::memory_order_acquire);
+
+    while(theHead != theTail)
+    {
+        const Report theReport = mReports[theHead & (kMaxEvents - 1)];
+        auto theChangeItr = mScheduled.find(theReport.sequence);
+
+        if(theChangeItr != mScheduled.end())
+        {
+            ScheduledChange& theChange = theChangeItr->second;
+
+            // An app's change is made to all of its clients at once, so only the first of its events
+            // to start commits it.
+            if(theReport.started && !theChange.isCommitted)
+            {
+                theChange.isCommitted = true;
+                theScheduleChanged = true;
+
+                if(theChange.hasDeviceVolume)
+                {
+                    // Sends the control's notifications itself.
+                    mVolumeControl.SetVolumeScalar(theChange.deviceVolumeScalar);
+                }
+                else if(theChange.hasDeviceMute)
+                {
+                    mMuteControl.SetMuted(theChange.deviceMute);
+                }
+                else
+                {
+                    CACFArray theAppVolumes(true);
+                    theAppVolumes.AppendDictionary(theChange.appVolume.GetDict());
+
+                    EFFLogAndSwallowExceptions("EFF_Automation::CommitNonRT", [&] {
+                        if(mClients.SetClientsRelativeVolumes(theAppVolumes))
+                        {
+                            theAppVolumesChanged = true;
+                        }
+                    });
+                }
+            }
+
+            mNumOutstanding--;
+            theChange.numOutstanding--;
+
+            if(theChange.numOutstanding == 0)
+            {
+                theScheduleChanged = theScheduleChanged || !(theChange.isCommitted || theChange.isCancelled);
+                mScheduled.erase(theChangeItr);
+            }
+        }
+
+        // Publish each report as soon as it's committed, so the IO thread goes back to the
+        // control's value, which is now the same as its own, and doesn't override a later change.
+        theHead++;
+        mReportsHead.store(theHead, std::memory_order_release);
+    }
+
+    if(theAppVolumesChanged || theScheduleChanged)
+    {
+        AudioObjectID theDeviceID = mOwnerDeviceID;
+
+        CADispatchQueue::GetGlobalSerialQueue().Dispatch(false, ^{
+            AudioObjectPropertyAddress theChangedProperties[2];
+            UInt32 theNumChangedProperties = 0;
+
+            if(theAppVolumesChanged)
+            {
+                theChangedProperties[theNumChangedProperties++] = {
+                    kAudioDeviceCustomPropertyAppVolumes,
+                    kAudioObjectPropertyScopeGlobal,
+                    kAudioObjectPropertyElementMaster
+                };
+            }
+
+            if(theScheduleChanged)
+            {
+                theChangedProperties[theNumChangedProperties++] = {
+                    kAudioDeviceCustomPropertyAutomation,
+                    kAudioObjectPropertyScopeGlobal,
+                    kAudioObjectPropertyElementMaster
+                };
+            }
+
+            EFF_PlugIn::Host_PropertiesChanged(theDeviceID, theNumChangedProperties, theChangedProperties);
+        });
+    }
+}
+
+void    EFF_Automation::StopIO()
+{
+    // IO has stopped, so we can act as the IO thread.
+    DrainQueueRT();
+
+    while(mNumPendingRT > 0)
+    {
+        mNumPendingRT--;
+        ReportRT(mPendingRT[mNumPendingRT].sequence, false);
+    }
+
+    mNeedsCommitRT = false;
+}
+
+#pragma mark Accessors
+
+void    EFF_Automation::ScheduleEvents(const CACFArray& inEvents)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    if(inEvents.GetNumberItems() == 0)
+    {
+        // Cancel the events that haven't started. The IO thread reports them as dropped when it sees
+        // the new generation.
+        mGeneration.fetch_add(1, std::memory_order_release);
+
+        for(auto& theChangeEntry : mScheduled)
+        {
+            theChangeEntry.second.isCancelled = true;
+        }
+
+        return;
+    }
+
+    // Parse all of the events and find the clients they're for before scheduling any of them.
+    struct ParsedChange
+    {
+        ScheduledChange         change;
+        EFF_Clients::AppVolume  appVolume;
+        std::vector<UInt32>     clientIDs;
+    };
+
+    std::vector<ParsedChange> theChanges;
+    UInt32 theNumEvents = 0;
+
+    for(UInt32 i = 0; i < inEvents.GetNumberItems(); i++)
+    {
+        CACFDictionary theEventDict(false);
+        ThrowIf(!inEvents.GetCACFDictionary(i, theEventDict),
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_Automation::ScheduleEvents: Expected a CFDictionary for each event");
+
+        ParsedChange theParsedChange;
+        ScheduledChange& theChange = theParsedChange.change;
+
+        ThrowIf(!theEventDict.GetFloat64(CFSTR(kEFFAutomationKey_SampleTime), theChange.sampleTime) ||
+                    !(theChange.sampleTime >= 0.0),
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_Automation::ScheduleEvents: Missing or invalid sample time");
+
+        CACFDictionary theAppVolume(false);
+        bool theHasAppVolume =
+            theEventDict.GetCACFDictionary(CFSTR(kEFFAutomationKey_AppVolume), theAppVolume);
+        theChange.hasDeviceVolume =
+            theEventDict.GetFloat32(CFSTR(kEFFAutomationKey_DeviceVolume), theChange.deviceVolumeScalar);
+        theChange.hasDeviceMute =
+            theEventDict.GetBool(CFSTR(kEFFAutomationKey_DeviceMute), theChange.deviceMute);
+
+        ThrowIf(theHasAppVolume + theChange.hasDeviceVolume + theChange.hasDeviceMute != 1,
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_Automation::ScheduleEvents: Each event needs one of an app volume, a device volume or a device mute");
+
+        if(theHasAppVolume)
+        {
+            theParsedChange.appVolume = mClients.ParseAppVolume(theAppVolume);
+            theParsedChange.clientIDs = mClients.GetClientIDs(theParsedChange.appVolume);
+
+            CFRetain(theAppVolume.GetDict());
+            theChange.appVolume = CACFDictionary(theAppVolume.GetDict(), true);
+        }
+        else if(theChange.hasDeviceVolume)
+        {
+            ThrowIf(!(theChange.deviceVolumeScalar >= 0.0f && theChange.deviceVolumeScalar <= 1.0f),
+                    CAException(kAudioHardwareIllegalOperationError),
+                    "EFF_Automation::ScheduleEvents: Device volume out of valid range");
+        }
+
+        // An app with no clients still gets one event, so its change is committed on time.
+        theChange.numOutstanding = std::max(static_cast<UInt32>(theParsedChange.clientIDs.size()), 1U);
+        theNumEvents += theChange.numOutstanding;
+
+        theChanges.push_back(theParsedChange);
+    }
+
+    ThrowIf(theNumEvents > kMaxEvents - mNumOutstanding,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_Automation::ScheduleEvents: Too many events waiting");
+
+    // Queue the events. There's always room because every event in the ring is outstanding.
+    const UInt32 theGeneration = mGeneration.load(std::memory_order_relaxed);
+    UInt32 theTail = mQueueTail.load(std::memory_order_relaxed);
+
+    auto theQueueEvent = [&] (const Event& inEvent) {
+        mQueue[theTail & (kMaxEvents - 1)] = inEvent;
+        theTail++;
+    };
+
+    for(const ParsedChange& theParsedChange : theChanges)
+    {
+        const ScheduledChange& theChange = theParsedChange.change;
+        const EFF_Clients::AppVolume& theAppVolume = theParsedChange.appVolume;
+        const UInt64 theSequence = mNextSequence++;
+
+        Event theEvent = {};
+        theEvent.sampleTime = theChange.sampleTime;
+        theEvent.sequence = theSequence;
+        theEvent.generation = theGeneration;
+
+        if(theChange.hasDeviceVolume)
+        {
+            theEvent.target = kTargetDevice;
+            theEvent.hasVolume = true;
+            theEvent.volume = mVolumeControl.ConvertScalarToAmplitudeGain(theChange.deviceVolumeScalar);
+            theQueueEvent(theEvent);
+        }
+        else if(theChange.hasDeviceMute)
+        {
+            theEvent.target = kTargetDeviceMute;
+            theEvent.muted = theChange.deviceMute;
+            theQueueEvent(theEvent);
+        }
+        else if(theParsedChange.clientIDs.empty())
+        {
+            theEvent.target = kTargetNone;
+            theQueueEvent(theEvent);
+        }
+        else
+        {
+            theEvent.target = kTargetClient;
+            theEvent.hasVolume = theAppVolume.hasVolume;
+            theEvent.volume = theAppVolume.relativeVolume;
+            theEvent.hasPanPosition = theAppVolume.hasPanPosition;
+            theEvent.panPosition = theAppVolume.panPosition;
+
+            for(UInt32 theClientID : theParsedChange.clientIDs)
+            {
+                theEvent.clientID = theClientID;
+                theQueueEvent(theEvent);
+            }
+        }
+
+        mScheduled[theSequence] = theChange;
+        mNumOutstanding += theChange.numOutstanding;
+    }
+
+    mQueueTail.store(theTail, std::memory_order_release);
+
+    DebugMsg("EFF_Automation::ScheduleEvents: Scheduled %u events", theNumEvents);
+}
+
+CACFArray    EFF_Automation::CopyScheduledEvents()
+const
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    CACFArray theEvents(false);
+
+    for(auto& theChangeEntry : mScheduled)
+    {
+        const ScheduledChange& theChange = theChangeEntry.second;
+
+        if(theChange.isCommitted || theChange.isCancelled)
+        {
+            continue;
+        }
+
+        CACFDictionary theEvent(false);
+        theEvent.AddFloat64(CFSTR(kEFFAutomationKey_SampleTime), theChange.sampleTime);
+
+        if(theChange.hasDeviceVolume)
+        {
+            theEvent.AddFloat32(CFSTR(kEFFAutomationKey_DeviceVolume), theChange.deviceVolumeScalar);
+        }
+        else if(theChange.hasDeviceMute)
+        {
+            theEvent.AddBool(CFSTR(kEFFAutomationKey_DeviceMute), theChange.deviceMute);
+        }
+        else
+        {
+            theEvent.AddDictionary(CFSTR(kEFFAutomationKey_AppVolume), theChange.appVolume.GetDict());
+        }
+
+        theEvents.AppendDictionary(theEvent.GetDict());
+    }
+
+    return theEvents;
+}
+
+#pragma mark Implementation
+
+void    EFF_Automation::DrainQueueRT()
+{
+    auto theDropPendingEvents = [&] {
+        while(mNumPendingRT > 0)
+        {
+            mNumPendingRT--;
+            ReportRT(mPendingRT[mNumPendingRT].sequence, false);
+        }
+    };
+
+    // Drop the waiting events if they've been cancelled.
+    UInt32 theGeneration = mGeneration.load(std::memory_order_acquire);
+
+    if(theGeneration != mGenerationRT)
+    {
+        theDropPendingEvents();
+        mGenerationRT = theGeneration;
+    }
+
+    UInt32 theHead = mQueueHead.load(std::memory_order_relaxed);
+    const UInt32 theTail = mQueueTail.load(std::memory_order_acquire);
+
+    for(; theHead != theTail; theHead++)
+    {
+        const Event& theEvent = mQueue[theHead & (kMaxEvents - 1)];
+
+        if(theEvent.generation != mGenerationRT)
+        {
+            if(static_cast<SInt32>(theEvent.generation - mGenerationRT) < 0)
+            {
+                // Queued before a cancel.
+                ReportRT(theEvent.sequence, false);
+                continue;
+            }
+
+            // Queued after a cancel we hadn't seen when we checked the generation above.
+            theDropPendingEvents();
+            mGenerationRT = theEvent.generation;
+        }
+
+        // Insert the event after any others with the same sample time, so they start in the order
+        // they were scheduled. There's always room because every pending event is outstanding.
+        UInt32 theIndex = mNumPendingRT;
+
+        while(theIndex > 0 && mPendingRT[theIndex - 1].sampleTime > theEvent.sampleTime)
+        {
+            mPendingRT[theIndex] = mPendingRT[theIndex - 1];
+            theIndex--;
+        }
+
+        mPendingRT[theIndex] = theEvent;
+        mNumPendingRT++;
+    }
+
+    mQueueHead.store(theHead, std::memory_order_release);
+}
+
+template <typename Matcher>
+Float64    EFF_Automation::StartDueEventsRT(Float64 inSampleTime, Matcher inMatches)
+{
+    DrainQueueRT();
+
+    UInt32 theIndex = 0;
+
+    // The events are sorted, so the due ones are at the start.
+    while(theIndex < mNumPendingRT && mPendingRT[theIndex].sampleTime <= inSampleTime)
+    {
+        if(inMatches(mPendingRT[theIndex]))
+        {
+            StartEventRT(theIndex);
+        }
+        else
+        {
+            theIndex++;
+        }
+    }
+
+    for(; theIndex < mNumPendingRT; theIndex++)
+    {
+        if(inMatches(mPendingRT[theIndex]))
+        {
+            return mPendingRT[theIndex].sampleTime;
+        }
+    }
+
+    return std::numeric_limits<Float64>::infinity();
+}
+
+void    EFF_Automation::StartEventRT(UInt32 inIndex)
+{
+    const Event theEvent = mPendingRT[inIndex];
+
+    for(UInt32 i = inIndex + 1; i < mNumPendingRT; i++)
+    {
+        mPendingRT[i - 1] = mPendingRT[i];
+    }
+
+    mNumPendingRT--;
+
+    ReportRT(theEvent.sequence, true);
+
+    // The value is current until this event's report has been committed.
+    const OverrideValue theState = { true, mReportsTail.load(std::memory_order_relaxed) };
+
+    if(theEvent.target == kTargetDevice)
+    {
+        mDeviceVolumeRT = theEvent.volume;
+        mDeviceVolumeStateRT = theState;
+    }
+    else if(theEvent.target == kTargetDeviceMute)
+    {
+        mDeviceMuteRT = theEvent.muted;
+        mDeviceMuteStateRT = theState;
+    }
+    else if(theEvent.target == kTargetClient)
+    {
+        ClientOverride* theOverride = FindClientOverrideRT(theEvent.clientID, true);
+
+        // If there's no room, the change starts when it's committed instead.
+        if(theOverride != nullptr)
+        {
+            if(theEvent.hasVolume)
+            {
+                theOverride->relativeVolume = theEvent.volume;
+                theOverride->volumeState = theState;
+            }
+
+            if(theEvent.hasPanPosition)
+            {
+                theOverride->panPosition = theEvent.panPosition;
+                theOverride->panState = theState;
+            }
+        }
+    }
+}
+
+void    EFF_Automation::ReportRT(UInt64 inSequence, bool inStarted)
+{
+    // There's always room because every report in the ring is for an outstanding event.
+    UInt32 theTail = mReportsTail.load(std::memory_order_relaxed);
+    mReports[theTail & (kMaxEvents - 1)] = { inSequence, inStarted };
+    mReportsTail.store(theTail + 1, std::memory_order_release);
+
+    mNeedsCommitRT = true;
+}
+
+bool    EFF_Automation::OverrideIsCurrentRT(const OverrideValue& inValue)
+const
+{
+    return inValue.isSet &&
+           static_cast<SInt32>(inValue.reportIndex - mReportsHead.load(std::memory_order_acquire)) > 0;
+}
+
+EFF_Automation::ClientOverride* __nullable    EFF_Automation::FindClientOverrideRT(UInt32 inClientID,
+                                                                                   bool inCreate)
+{
+    if(mNumClientOverridesRT == 0 && !inCreate)
+    {
+        return nullptr;
+    }
+
+    ClientOverride* theFreeOverride = nullptr;
+
+    for(ClientOverride& theOverride : mClientOverridesRT)
+    {
+        if(theOverride.inUse &&
+           !OverrideIsCurrentRT(theOverride.volumeState) &&
+           !OverrideIsCurrentRT(theOverride.panState))
+        {
+            // Both of its values have been committed, so it's no longer needed.
+            theOverride = ClientOverride();
+            mNumClientOverridesRT--;
+        }
+
+        if(theOverride.inUse && theOverride.clientID == inClientID)
+        {
+            return &theOverride;
+        }
+        else if(!theOverride.inUse && theFreeOverride == nullptr)
+        {
+            theFreeOverride = &theOverride;
+        }
+    }
+
+    if(inCreate && theFreeOverride != nullptr)
+    {
+        theFreeOverride->inUse = true;
+        theFreeOverride->clientID = inClientID;
+        mNumClientOverridesRT++;
+    }
+
+    return inCreate ? theFreeOverride : nullptr;
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,305 @@
+//
+//  EFF_Automation.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_Automation_h
+#define EFF_Automation_h
+
+// Local Includes
+#include "EFF_CustomProperties.h"
+#include "EFF_Clients.h"
+
+// PublicUtility Includes
+#include "CAMutex.h"
+#include "CACFArray.h"
+#include "CACFDictionary.h"
+
+// STL Includes
+#include <atomic>
+#include <map>
+
+// System Includes
+#include <CoreAudio/AudioServerPlugIn.h>
+
+
+// Forward Declarations
+class EFF_VolumeControl;
+class EFF_MuteControl;
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_Automation
+//
+//  Volume, pan and mute changes scheduled with kAudioDeviceCustomPropertyAutomation to happen at
+//  given sample times on the device's output timeline, rather than whenever the next IO cycle after the
+//  property is set happens to start.
+//
+//  Scheduling an app's change finds the app's clients and queues one event for each of them, so the
+//  IO thread only deals with client IDs and gains. Events go to the IO thread through a lock-free
+//  single-producer single-consumer ring, and the IO thread keeps the ones that aren't due yet
+//  sorted by sample time. The gain kernels and the device's volume and mute controls ask for the
+//  events in each buffer and split it at them, so each change starts on the first frame at or after
+//  its sample time.
+//
+//  Once an event has started, the IO thread uses its value in place of the control's until the
+//  change has been committed, i.e. made to the clients' relative volumes or the device's volume or
+//  mute control through the normal setters on a non-real-time thread. That keeps the properties and
+//  notifications the same as if the change had been set directly. The IO thread reports each
+//  started or dropped event through a second ring and asks for CommitNonRT to be called. Events
+//  are reported and committed in the order they started, so one counter of committed reports is
+//  enough for the IO thread to tell which of its own values are stale.
+//
+//  Events whose sample times are already past when the IO thread sees them start at the beginning
+//  of the next buffer. The output timeline restarts when IO does, so StopIO drops the events that
+//  haven't started.
+//
+//  Methods whose names end with "RT" can only safely be called from real-time threads and must be
+//  called with the device's IO mutex held. The others aren't real-time safe.
+//==================================================================================================
+
+class EFF_Automation
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_Automation(AudioObjectID inOwnerDeviceID,
+                                               EFF_Clients& inClients,
+                                               EFF_VolumeControl& inVolumeControl,
+                                               EFF_MuteControl& inMuteControl);
+                                EFF_Automation(const EFF_Automation&) = delete;
+                                EFF_Automation& operator=(const EFF_Automation&) = delete;
+
+#pragma mark IO Operations
+
+    // The maximum number of segments GetClientSegmentsRT splits a buffer into. Any more events in
+    // the buffer start at the beginning of the next one.
+    static constexpr UInt32     kMaxSegments = 16;
+
+    struct ClientSegment
+    {
+        UInt32                  startFrame;
+        Float32                 relativeVolume;
+        SInt32                  panPosition;
+    };
+
+    /*!
+     Split a buffer of a client's audio at the events scheduled for the client.
+
+     @param inClientID The client.
+     @param inSampleTime The output sample time of the first frame in the buffer.
+     @param inFrameCount The number of frames in the buffer.
+     @param inRelativeVolume The client's relative volume, used for the segments before its first
+                             volume event.
+     @param inPanPosition The client's pan position, used for the segments before its first pan
+                          event.
+     @param outSegments The segments, in order. The first starts at frame 0 and each one lasts until
+                        the next starts.
+     @return The number of segments, at least 1.
+     */
+    UInt32                      GetClientSegmentsRT(UInt32 inClientID,
+                                                    Float64 inSampleTime,
+                                                    UInt32 inFrameCount,
+                                                    Float32 inRelativeVolume,
+                                                    SInt32 inPanPosition,
+                                                    ClientSegment outSegments[kMaxSegments]);
+
+    /*!
+     Start the device volume events due by inSampleTime and find the next one.
+
+     @param inSampleTime The output sample time of the first frame to apply the volume to.
+     @param inFrameCount The number of frames left in the buffer.
+     @param ioAmplitudeGain Pass the volume control's gain. Set to the gain to apply.
+     @return The number of frames to apply ioAmplitudeGain to, at least 1.
+     */
+    UInt32                      GetDeviceVolumeRT(Float64 inSampleTime,
+                                                  UInt32 inFrameCount,
+                                                  Float32& ioAmplitudeGain);
+
+    /*!
+     Start the device mute events due by inSampleTime and find the next one.
+
+     @param inSampleTime The output sample time of the first frame to apply the mute to.
+     @param inFrameCount The number of frames left in the buffer.
+     @param ioMuted Pass the mute control's value. Set to whether to mute.
+     @return The number of frames to apply ioMuted to, at least 1.
+     */
+    UInt32                      GetDeviceMuteRT(Float64 inSampleTime,
+                                                UInt32 inFrameCount,
+                                                bool& ioMuted);
+
+    /*!
+     Start every event due during the IO cycle that hasn't already started, e.g. events for clients
+     that didn't play anything this cycle. Called once per IO cycle, after the gain kernels.
+
+     @param inEndSampleTime The output sample time of the frame after the cycle's last frame.
+     @return True if the caller should arrange for CommitNonRT to be called.
+     */
+    bool                        EndCycleRT(Float64 inEndSampleTime);
+
+    /*! Commit the events the IO thread has started and forget the ones it has dropped. */
+    void                        CommitNonRT();
+
+    /*!
+     Drop every event that hasn't started. Must be called with the device's IO mutex held, after IO
+     has stopped. CommitNonRT should be called afterwards, without the IO mutex held.
+     */
+    void                        StopIO();
+
+#pragma mark Accessors
+
+    /*!
+     Schedule events.
+
+     @param inEvents An array in the format of kAudioDeviceCustomPropertyAutomation. An empty array
+                     cancels every event that hasn't started.
+     @throws CAException(kAudioHardwareIllegalOperationError) if any of the events are invalid or
+             there are too many waiting, or the exceptions EFF_Clients::ParseAppVolume throws. In
+             either case none of the events are scheduled.
+     */
+    void                        ScheduleEvents(const CACFArray& inEvents);
+    // Copies the events that haven't been committed or cancelled into an array in the format of
+    // kAudioDeviceCustomPropertyAutomation.
+    CACFArray                   CopyScheduledEvents() const;
+
+#pragma mark Implementation
+
+private:
+    enum : UInt32
+    {
+        // The most events the IO thread can have queued, waiting or uncommitted. Must be a power of
+        // two. An app's change counts once for each of its clients.
+        kMaxEvents = 256,
+        // The most clients that can have uncommitted values at once.
+        kMaxOverrides = 64
+    };
+
+    enum EventTarget : UInt32
+    {
+        kTargetClient,
+        kTargetDevice,
+        kTargetDeviceMute,
+        // An app with no clients. The event only needs to be committed.
+        kTargetNone
+    };
+
+    // What the IO thread is sent. Only the values the target uses are set.
+    struct Event
+    {
+        Float64                 sampleTime;
+        // The scheduled change the event is for. A key into mScheduled.
+        UInt64                  sequence;
+        // Events queued before the last cancel are dropped.
+        UInt32                  generation;
+        EventTarget             target;
+        UInt32                  clientID;
+        bool                    hasVolume;
+        // The client's relative volume or the device's amplitude gain.
+        Float32                 volume;
+        bool                    hasPanPosition;
+        SInt32                  panPosition;
+        bool                    muted;
+    };
+
+    // What the IO thread sends back.
+    struct Report
+    {
+        UInt64                  sequence;
+        // False if the event was dropped.
+        bool                    started;
+    };
+
+    // A value an event has set, used until the event is committed.
+    struct OverrideValue
+    {
+        bool                    isSet           = false;
+        // The number of reports that will have been committed once this value has been.
+        UInt32                  reportIndex     = 0;
+    };
+
+    struct ClientOverride
+    {
+        bool                    inUse           = false;
+        UInt32                  clientID        = 0;
+        OverrideValue           volumeState;
+        Float32                 relativeVolume  = 1.0f;
+        OverrideValue           panState;
+        SInt32                  panPosition     = 0;
+    };
+
+    // A change scheduled by ScheduleEvents. Guarded by mMutex.
+    struct ScheduledChange
+    {
+        Float64                 sampleTime;
+        // Set for app changes, in the format of kAudioDeviceCustomPropertyAppVolumes.
+        CACFDictionary          appVolume       { false };
+        bool                    hasDeviceVolume = false;
+        Float32                 deviceVolumeScalar;
+        bool                    hasDeviceMute   = false;
+        bool                    deviceMute;
+        // The number of its events the IO thread hasn't reported yet.
+        UInt32                  numOutstanding;
+        bool                    isCommitted     = false;
+        bool                    isCancelled     = false;
+    };
+
+    // Moves the queued events into mPendingRT.
+    void                        DrainQueueRT();
+    // Starts the event at index inIndex in mPendingRT and removes it.
+    void                        StartEventRT(UInt32 inIndex);
+    void                        ReportRT(UInt64 inSequence, bool inStarted);
+    bool                        OverrideIsCurrentRT(const OverrideValue& inValue) const;
+    // Returns the client's override, or nullptr if it has none. Frees it if it's stale.
+    ClientOverride* __nullable  FindClientOverrideRT(UInt32 inClientID, bool inCreate);
+    // Starts the events due by inSampleTime that match inMatches and returns the sample time of the
+    // next one, or infinity.
+    template <typename Matcher>
+    Float64                     StartDueEventsRT(Float64 inSampleTime, Matcher inMatches);
+
+    const AudioObjectID         mOwnerDeviceID;
+    EFF_Clients&                mClients;
+    EFF_VolumeControl&          mVolumeControl;
+    EFF_MuteControl&            mMuteControl;
+
+    // ScheduleEvents to the IO thread.
+    Event                       mQueue[kMaxEvents];
+    std::atomic<UInt32>         mQueueHead          { 0 };
+    std::atomic<UInt32>         mQueueTail          { 0 };
+    std::atomic<UInt32>         mGeneration         { 0 };
+
+    // The IO thread to CommitNonRT.
+    Report                      mReports[kMaxEvents];
+    std::atomic<UInt32>         mReportsHead        { 0 };
+    std::atomic<UInt32>         mReportsTail        { 0 };
+
+    // Only accessed by the IO thread, except in StopIO.
+    UInt32                      mGenerationRT       = 0;
+    // The events that haven't started, sorted by sample time.
+    Event                       mPendingRT[kMaxEvents];
+    UInt32                      mNumPendingRT       = 0;
+    ClientOverride              mClientOverridesRT[kMaxOverrides];
+    UInt32                      mNumClientOverridesRT = 0;
+    OverrideValue               mDeviceVolumeStateRT;
+    Float32                     mDeviceVolumeRT     = 1.0f;
+    OverrideValue               mDeviceMuteStateRT;
+    bool                        mDeviceMuteRT       = false;
+    bool                        mNeedsCommitRT      = false;
+
+    // Guards the scheduled changes and committing them.
+    mutable CAMutex             mMutex;
+    std::map<UInt64, ScheduledChange> mScheduled;
+    UInt64                      mNextSequence       = 1;
+    // The number of events that have been queued and not reported yet.
+    UInt32                      mNumOutstanding     = 0;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_Automation_h */
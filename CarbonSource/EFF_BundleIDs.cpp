@@ -0,0 +1,177 @@
+//
+//  EFF_BundleIDs.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_BundleIDs.h"
+
+// PublicUtility Includes
+#include "CAMutex.h"
+#include "CADebugMacros.h"
+
+// STL Includes
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Table
+
+namespace
+{
+    struct Entry
+    {
+        CACFString              bundleID;
+        std::string             cString;
+    };
+
+    struct Table
+    {
+        CAMutex                 mutex { "Bundle IDs" };
+        std::map<CACFString, EFF_BundleIDs::ID> ids;
+        // The same IDs, keyed by the entries' C strings.
+        std::map<std::string, EFF_BundleIDs::ID, std::less<>> idsByCString;
+        // Indexed by ID minus one. A deque so the entries, and their C strings, never move.
+        std::deque<Entry>       entries;
+    };
+
+    Table&    GetTable()
+    {
+        // Never destroyed, so it can still be used while other statics are being destroyed.
+        static Table* sTable = new Table;
+        return *sTable;
+    }
+
+    std::string    CopyUTF8(CFStringRef inString)
+    {
+        const char* theCStringPtr = CFStringGetCStringPtr(inString, kCFStringEncodingUTF8);
+
+        if(theCStringPtr != nullptr)
+        {
+            return theCStringPtr;
+        }
+
+        CFIndex theMaxSize =
+            CFStringGetMaximumSizeForEncoding(CFStringGetLength(inString), kCFStringEncodingUTF8) + 1;
+        std::string theCString(static_cast<size_t>(theMaxSize), '\0');
+
+        if(!CFStringGetCString(inString, &theCString[0], theMaxSize, kCFStringEncodingUTF8))
+        {
+            return "";
+        }
+
+        theCString.resize(std::strlen(theCString.c_str()));
+        return theCString;
+    }
+}
+
+#pragma mark Interning
+
+EFF_BundleIDs::ID    EFF_BundleIDs::Intern(CFStringRef __nullable inBundleID)
+{
+    if(inBundleID == nullptr)
+    {
+        return kNone;
+    }
+
+    // Wrap the string without retaining it, just to look it up.
+    return Intern(CACFString(inBundleID, false));
+}
+
+EFF_BundleIDs::ID    EFF_BundleIDs::Intern(const CACFString& inBundleID)
+{
+    if(!inBundleID.IsValid())
+    {
+        return kNone;
+    }
+
+    Table& theTable = GetTable();
+    CAMutex::Locker theLocker(theTable.mutex);
+
+    auto theItr = theTable.ids.find(inBundleID);
+
+    if(theItr != theTable.ids.end())
+    {
+        return theItr->second;
+    }
+
+    // Keep our own immutable copy, since the caller's string could be mutable or only borrowed.
+    CACFString theBundleID(CFStringCreateCopy(kCFAllocatorDefault, inBundleID.GetCFString()));
+    ID theID = static_cast<ID>(theTable.entries.size() + 1);
+
+    theTable.entries.push_back({ theBundleID, CopyUTF8(theBundleID.GetCFString()) });
+    theTable.ids[theBundleID] = theID;
+    theTable.idsByCString.emplace(theTable.entries.back().cString, theID);
+
+    DebugMsg("EFF_BundleIDs::Intern: Interned %s as %u", theTable.entries.back().cString.c_str(), theID);
+
+    return theID;
+}
+
+EFF_BundleIDs::ID    EFF_BundleIDs::Find(const CACFString& inBundleID)
+{
+    if(!inBundleID.IsValid())
+    {
+        return kNone;
+    }
+
+    Table& theTable = GetTable();
+    CAMutex::Locker theLocker(theTable.mutex);
+
+    auto theItr = theTable.ids.find(inBundleID);
+    return (theItr != theTable.ids.end()) ? theItr->second : kNone;
+}
+
+EFF_BundleIDs::ID    EFF_BundleIDs::FindCString(const char* inBundleID)
+{
+    if(inBundleID[0] == '\0')
+    {
+        return kNone;
+    }
+
+    Table& theTable = GetTable();
+    CAMutex::Locker theLocker(theTable.mutex);
+
+    auto theItr = theTable.idsByCString.find(inBundleID);
+    return (theItr != theTable.idsByCString.end()) ? theItr->second : kNone;
+}
+
+#pragma mark Accessors
+
+CACFString    EFF_BundleIDs::GetBundleID(ID inID)
+{
+    if(inID == kNone)
+    {
+        return CACFString();
+    }
+
+    Table& theTable = GetTable();
+    CAMutex::Locker theLocker(theTable.mutex);
+
+    Assert(inID <= theTable.entries.size(), "EFF_BundleIDs::GetBundleID: Unknown ID");
+    return (inID <= theTable.entries.size()) ? theTable.entries[inID - 1].bundleID : CACFString();
+}
+
+const char*    EFF_BundleIDs::GetCString(ID inID)
+{
+    if(inID == kNone)
+    {
+        return "";
+    }
+
+    Table& theTable = GetTable();
+    CAMutex::Locker theLocker(theTable.mutex);
+
+    Assert(inID <= theTable.entries.size(), "EFF_BundleIDs::GetCString: Unknown ID");
+    return (inID <= theTable.entries.size()) ? theTable.entries[inID - 1].cString.c_str() : "";
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,75 @@
+//
+//  EFF_BundleIDs.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_BundleIDs_h
+#define EFF_BundleIDs_h
+
+// PublicUtility Includes
+#include "CACFString.h"
+
+// System Includes
+#include <CoreFoundation/CoreFoundation.h>
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_BundleIDs
+//
+//  A driver-wide intern table for bundle IDs. Each distinct bundle ID is given a small integer ID
+//  the first time it's interned, which it keeps for the life of the driver, so clients, app
+//  settings and ducking rules can be stored, compared and looked up by bundle ID without comparing,
+//  retaining or releasing CFStrings. The CFString and a UTF-8 copy of it, for log messages, are
+//  kept in the table.
+//
+//  Clients' bundle IDs are interned when the EFF_Client is constructed. Bundle IDs sent in property
+//  data are interned if we'll keep them, or just looked up with Find if they're only used to find
+//  clients, since a bundle ID that hasn't been interned can't belong to any client.
+//
+//  Entries are never removed, but there's one per app that has been a client or been named in a
+//  property, so the table stays small. All of the methods are thread safe, but none of them are
+//  real-time safe.
+//==================================================================================================
+
+class EFF_BundleIDs
+{
+
+public:
+    typedef UInt32              ID;
+
+    // The ID of a client with no bundle ID. Never given to a bundle ID.
+    static constexpr ID         kNone = 0;
+
+#pragma mark Interning
+
+    // Returns the bundle ID's ID, adding it to the table if it isn't already. Returns kNone if
+    // inBundleID is NULL or invalid.
+    static ID                   Intern(CFStringRef __nullable inBundleID);
+    static ID                   Intern(const CACFString& inBundleID);
+
+    // Returns the bundle ID's ID, or kNone if it has never been interned.
+    static ID                   Find(const CACFString& inBundleID);
+    // The same, for a UTF-8 bundle ID, so bundle IDs read from packed property data can be looked up
+    // without making CFStrings of them.
+    static ID                   FindCString(const char* inBundleID);
+
+#pragma mark Accessors
+
+    // Returns the bundle ID with the given ID, or an invalid CACFString for kNone.
+    static CACFString           GetBundleID(ID inID);
+
+    // Returns the bundle ID as a UTF-8 C string, for log messages. Returns "" for kNone. The string
+    // is never freed.
+    static const char*          GetCString(ID inID);
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_BundleIDs_h */
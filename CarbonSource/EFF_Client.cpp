@@ -17,14 +17,10 @@ EFF_Client::EFF_Client(const AudioServerPlugInClientInfo* inClientInfo)
     mClientID(inClientInfo->mClientID),
     mProcessID(inClientInfo->mProcessID),
     mIsNativeEndian(inClientInfo->mIsNativeEndian),
-    mBundleID(inClientInfo->mBundleID)
+    mBundleID(EFF_BundleIDs::Intern(inClientInfo->mBundleID))
 {
-    // The bundle ID ref we were passed is only valid until our plugin returns control to the HAL, so we need to retain
-    // it. (CACFString will handle the rest of its ownership/destruction.)
-    if(inClientInfo->mBundleID != NULL)
-    {
-        CFRetain(inClientInfo->mBundleID);
-    }
+    // The bundle ID ref we were passed is only valid until our plugin returns control to the HAL, but we don't need to
+    // retain it because EFF_BundleIDs keeps its own copy.
 }
 
 void    EFF_Client::Copy(const EFF_Client& inClient)
@@ -33,7 +29,6 @@ void    EFF_Client::Copy(const EFF_Client& inClient)
     mProcessID = inClient.mProcessID;
     mBundleID = inClient.mBundleID;
     mIsNativeEndian = inClient.mIsNativeEndian;
-    mDoingIO = inClient.mDoingIO;
     mIsMusicPlayer = inClient.mIsMusicPlayer;
     mRelativeVolume = inClient.mRelativeVolume;
     mPanPosition = inClient.mPanPosition;
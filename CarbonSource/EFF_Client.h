@@ -9,8 +9,8 @@
 #ifndef EFF_Client_h
 #define EFF_Client_h
 
-// PublicUtility Includes
-#include "CACFString.h"
+// Local Includes
+#include "EFF_BundleIDs.h"
 
 // System Includes
 #include <CoreAudio/AudioServerPlugIn.h>
@@ -48,17 +48,13 @@ private:
 
 public:
     // These fields are duplicated from AudioServerPlugInClientInfo (except the mBundleID CFStringRef is
-    // wrapped in a CACFString here).
+    // interned in EFF_BundleIDs here, so clients can be compared and looked up by bundle ID without
+    // touching CFStrings).
     UInt32                      mClientID;
     pid_t                       mProcessID;
     Boolean                     mIsNativeEndian = true;
-    CACFString                  mBundleID;
+    EFF_BundleIDs::ID           mBundleID = EFF_BundleIDs::kNone;
     
-    // Becomes true when the client triggers the plugin host to call StartIO or to begin
-    // kAudioServerPlugInIOOperationThread, and false again on StopIO or when
-    // kAudioServerPlugInIOOperationThread ends
-    bool                        mDoingIO = false;
-
     // True if EFFApp has set this client as belonging to the music player app
     bool                        mIsMusicPlayer = false;
 
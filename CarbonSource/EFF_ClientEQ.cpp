@@ -0,0 +1,524 @@
+//
+//  EFF_ClientEQ.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_ClientEQ.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CAException.h"
+
+// STL Includes
+#include <cmath>
+#include <cstring>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+EFF_ClientEQ::EFF_ClientEQ()
+:
+    mMutex("Client EQ"),
+    mSampleRate(44100.0)
+{
+}
+
+void    EFF_ClientEQ::AddClient(UInt32 inClientID, pid_t inProcessID, EFF_BundleIDs::ID inBundleID)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    mSlots.Claim(inClientID, [&] (Slot& theSlot) {
+        theSlot.sequence.store(0, std::memory_order_relaxed);
+        theSlot.numBands.store(0, std::memory_order_relaxed);
+        theSlot.sequenceRT = 0;
+        theSlot.numBandsRT = 0;
+        theSlot.processID = inProcessID;
+        theSlot.bundleID = inBundleID;
+        theSlot.bands.clear();
+
+        const BandList* theAppEQ = FindAppEQ(inProcessID, inBundleID);
+
+        if(theAppEQ != nullptr)
+        {
+            PublishBands(theSlot, *theAppEQ);
+        }
+    });
+}
+
+void    EFF_ClientEQ::RemoveClient(UInt32 inClientID)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    Slot* theRemovedSlot = mSlots.Release(inClientID);
+
+    if(theRemovedSlot == nullptr)
+    {
+        return;
+    }
+
+    theRemovedSlot->bundleID = EFF_BundleIDs::kNone;
+    theRemovedSlot->bands.clear();
+
+    // Forget an EQ set by PID once the process has no clients left, since the PID could be reused.
+    bool theProcessHasOtherClients = false;
+
+    mSlots.ForEach([&] (UInt32, const Slot& theSlot) {
+        theProcessHasOtherClients =
+            theProcessHasOtherClients || (theSlot.processID == theRemovedSlot->processID);
+    });
+
+    if(!theProcessHasOtherClients)
+    {
+        mAppEQsByProcessID.erase(theRemovedSlot->processID);
+    }
+}
+
+void    EFF_ClientEQ::SetSampleRate(Float64 inSampleRate)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    mSampleRate = inSampleRate;
+
+    mSlots.ForEach([&] (UInt32, Slot& theSlot) {
+        if(!theSlot.bands.empty())
+        {
+            // Copy the bands because PublishBands replaces them.
+            BandList theBands = theSlot.bands;
+            PublishBands(theSlot, theBands);
+        }
+    });
+}
+
+#pragma mark IO Operations
+
+void    EFF_ClientEQ::ApplyEQRT(UInt32 inClientID, UInt32 inFrameCount, Float32* ioBuffer)
+{
+    Slot* theSlotPtr = mSlots.Find(inClientID);
+
+    if(theSlotPtr == nullptr)
+    {
+        return;
+    }
+
+    Slot& theSlot = *theSlotPtr;
+
+    // Pick up new coefficients if they've been published since the last buffer.
+    UInt32 theSequence = theSlot.sequence.load(std::memory_order_acquire);
+
+    if(theSequence != theSlot.sequenceRT && (theSequence & 1) == 0)
+    {
+        UInt32 theNumBands = theSlot.numBands.load(std::memory_order_relaxed);
+        Float32 theCoefficients[kEFFAppEQMaxBands][kNumCoefficients];
+
+        for(UInt32 i = 0; i < theNumBands; i++)
+        {
+            for(UInt32 j = 0; j < kNumCoefficients; j++)
+            {
+                theCoefficients[i][j] = theSlot.coefficients[i][j].load(std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // If the coefficients were changed while we copied them, keep the old ones for now.
+        if(theSlot.sequence.load(std::memory_order_relaxed) == theSequence)
+        {
+            // Bands that weren't running yet start from silence. The others keep their state so
+            // changing a band's settings doesn't click.
+            const simd_float2 theSilence = { 0.0f, 0.0f };
+
+            for(UInt32 i = theSlot.numBandsRT; i < theNumBands; i++)
+            {
+                theSlot.z1RT[i] = theSilence;
+                theSlot.z2RT[i] = theSilence;
+            }
+
+            memcpy(theSlot.coefficientsRT, theCoefficients, sizeof(theCoefficients));
+            theSlot.numBandsRT = theNumBands;
+            theSlot.sequenceRT = theSequence;
+        }
+    }
+
+    const UInt32 theNumBands = theSlot.numBandsRT;
+
+    if(theNumBands == 0)
+    {
+        return;
+    }
+
+    // Run the cascade one frame at a time, with the left and right samples in the two lanes of a
+    // vector so both channels are filtered at once.
+    for(UInt32 theFrame = 0; theFrame < inFrameCount; theFrame++)
+    {
+        simd_float2 theSample = { ioBuffer[theFrame * 2], ioBuffer[(theFrame * 2) + 1] };
+
+        for(UInt32 i = 0; i < theNumBands; i++)
+        {
+            const Float32* theBandCoefficients = theSlot.coefficientsRT[i];
+            simd_float2 theOutput = (theBandCoefficients[kB0] * theSample) + theSlot.z1RT[i];
+
+            theSlot.z1RT[i] = (theBandCoefficients[kB1] * theSample) -
+                              (theBandCoefficients[kA1] * theOutput) +
+                              theSlot.z2RT[i];
+            theSlot.z2RT[i] = (theBandCoefficients[kB2] * theSample) -
+                              (theBandCoefficients[kA2] * theOutput);
+
+            theSample = theOutput;
+        }
+
+        ioBuffer[theFrame * 2] = theSample[0];
+        ioBuffer[(theFrame * 2) + 1] = theSample[1];
+    }
+
+    // Flush the state to zero once the input goes quiet so the filters don't decay into denormals,
+    // which are very slow on some CPUs.
+    for(UInt32 i = 0; i < theNumBands; i++)
+    {
+        for(UInt32 theChannel = 0; theChannel < 2; theChannel++)
+        {
+            if(std::fabs(theSlot.z1RT[i][theChannel]) < 1.0e-15f &&
+               std::fabs(theSlot.z2RT[i][theChannel]) < 1.0e-15f)
+            {
+                theSlot.z1RT[i][theChannel] = 0.0f;
+                theSlot.z2RT[i][theChannel] = 0.0f;
+            }
+        }
+    }
+}
+
+#pragma mark Accessors
+
+bool    EFF_ClientEQ::SetAppEQs(const CACFArray& inAppEQs)
+{
+    struct AppEQ
+    {
+        bool                    hasProcessID = false;
+        pid_t                   processID = 0;
+        EFF_BundleIDs::ID       bundleID = EFF_BundleIDs::kNone;
+        BandList                bands;
+    };
+
+    // Parse all of the EQs before changing anything, so an invalid one doesn't leave us with only
+    // some of them applied.
+    std::vector<AppEQ> theAppEQs;
+
+    for(UInt32 i = 0; i < inAppEQs.GetNumberItems(); i++)
+    {
+        CACFDictionary theAppEQDict(false);
+        ThrowIf(!inAppEQs.GetCACFDictionary(i, theAppEQDict),
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_ClientEQ::SetAppEQs: Expected a CFDictionary for each app");
+
+        AppEQ theAppEQ;
+
+        SInt32 theProcessID = 0;
+        theAppEQ.hasProcessID = theAppEQDict.GetSInt32(CFSTR(kEFFAppEQKey_ProcessID), theProcessID);
+        theAppEQ.processID = theAppEQ.hasProcessID ? theProcessID : 0;
+
+        CFStringRef theBundleIDRef = nullptr;
+        if(theAppEQDict.GetString(CFSTR(kEFFAppEQKey_BundleID), theBundleIDRef))
+        {
+            // Interned rather than just looked up because we keep the EQ for the bundle ID.
+            theAppEQ.bundleID = EFF_BundleIDs::Intern(theBundleIDRef);
+        }
+
+        ThrowIf(!theAppEQ.hasProcessID && theAppEQ.bundleID == EFF_BundleIDs::kNone,
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_ClientEQ::SetAppEQs: EQ was sent without PID or bundle ID for app");
+
+        CACFArray theBands(false);
+        ThrowIf(!theAppEQDict.GetCACFArray(CFSTR(kEFFAppEQKey_Bands), theBands),
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_ClientEQ::SetAppEQs: No bands in request");
+        ThrowIf(theBands.GetNumberItems() > kEFFAppEQMaxBands,
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_ClientEQ::SetAppEQs: Too many bands for app");
+
+        for(UInt32 j = 0; j < theBands.GetNumberItems(); j++)
+        {
+            CACFDictionary theBand(false);
+            ThrowIf(!theBands.GetCACFDictionary(j, theBand),
+                    CAException(kAudioHardwareIllegalOperationError),
+                    "EFF_ClientEQ::SetAppEQs: Expected a CFDictionary for each band");
+
+            theAppEQ.bands.push_back(ParseBand(theBand));
+        }
+
+        theAppEQs.push_back(theAppEQ);
+    }
+
+    CAMutex::Locker theLocker(mMutex);
+
+    bool didChangeAppEQs = false;
+
+    // Stores an app's EQ in one of the maps, or removes it if it has no bands.
+    auto theUpdateMap = [&] (auto& ioMap, const auto& inKey, const BandList& inBands) {
+        auto theItr = ioMap.find(inKey);
+        bool theMapHasKey = (theItr != ioMap.end());
+
+        if(inBands.empty())
+        {
+            if(theMapHasKey)
+            {
+                ioMap.erase(theItr);
+                didChangeAppEQs = true;
+            }
+        }
+        else if(!theMapHasKey || !(theItr->second == inBands))
+        {
+            ioMap[inKey] = inBands;
+            didChangeAppEQs = true;
+        }
+    };
+
+    for(const AppEQ& theAppEQ : theAppEQs)
+    {
+        if(theAppEQ.bundleID != EFF_BundleIDs::kNone)
+        {
+            theUpdateMap(mAppEQsByBundleID, theAppEQ.bundleID, theAppEQ.bands);
+        }
+
+        if(theAppEQ.hasProcessID)
+        {
+            theUpdateMap(mAppEQsByProcessID, theAppEQ.processID, theAppEQ.bands);
+        }
+    }
+
+    // Apply the EQs to the apps' clients. Look each client's EQ up the same way AddClient does,
+    // rather than applying the EQs in the order they were sent, so an EQ set by PID takes
+    // precedence over one set by bundle ID for existing clients too.
+    const BandList theNoBands;
+
+    mSlots.ForEach([&] (UInt32 theSlotClientID, Slot& theSlot) {
+        const BandList* theAppEQ = FindAppEQ(theSlot.processID, theSlot.bundleID);
+        const BandList& theBands = (theAppEQ != nullptr) ? *theAppEQ : theNoBands;
+
+        if(!(theSlot.bands == theBands))
+        {
+            DebugMsg("EFF_ClientEQ::SetAppEQs: Setting %lu bands for client %u",
+                     theBands.size(),
+                     theSlotClientID);
+            PublishBands(theSlot, theBands);
+            didChangeAppEQs = true;
+        }
+    });
+
+    return didChangeAppEQs;
+}
+
+CACFArray    EFF_ClientEQ::CopyAppEQs()
+const
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    CACFArray theAppEQs(false);
+
+    auto theCopyBands = [] (const BandList& inBands) {
+        CACFArray theBands(false);
+
+        for(const Band& theBand : inBands)
+        {
+            CACFDictionary theBandDict(false);
+            theBandDict.AddSInt32(CFSTR(kEFFEQBandKey_Type), theBand.type);
+            theBandDict.AddFloat32(CFSTR(kEFFEQBandKey_Frequency), theBand.frequency);
+            theBandDict.AddFloat32(CFSTR(kEFFEQBandKey_Gain), theBand.gain);
+            theBandDict.AddFloat32(CFSTR(kEFFEQBandKey_Q), theBand.q);
+            theBands.AppendDictionary(theBandDict.GetDict());
+        }
+
+        return theBands;
+    };
+
+    for(auto& theAppEQEntry : mAppEQsByBundleID)
+    {
+        CACFDictionary theAppEQ(false);
+        theAppEQ.AddString(CFSTR(kEFFAppEQKey_BundleID),
+                           EFF_BundleIDs::GetBundleID(theAppEQEntry.first).GetCFString());
+        theAppEQ.AddArray(CFSTR(kEFFAppEQKey_Bands), theCopyBands(theAppEQEntry.second).GetCFArray());
+        theAppEQs.AppendDictionary(theAppEQ.GetDict());
+    }
+
+    for(auto& theAppEQEntry : mAppEQsByProcessID)
+    {
+        CACFDictionary theAppEQ(false);
+        theAppEQ.AddSInt32(CFSTR(kEFFAppEQKey_ProcessID), theAppEQEntry.first);
+        theAppEQ.AddArray(CFSTR(kEFFAppEQKey_Bands), theCopyBands(theAppEQEntry.second).GetCFArray());
+        theAppEQs.AppendDictionary(theAppEQ.GetDict());
+    }
+
+    return theAppEQs;
+}
+
+#pragma mark Implementation
+
+bool    EFF_ClientEQ::Band::operator==(const Band& inOther)
+const
+{
+    return type == inOther.type &&
+           frequency == inOther.frequency &&
+           gain == inOther.gain &&
+           q == inOther.q;
+}
+
+//static
+EFF_ClientEQ::Band    EFF_ClientEQ::ParseBand(const CACFDictionary& inBand)
+{
+    Band theBand = { kEFFEQBandType_Peak, 0.0f, 0.0f, static_cast<Float32>(M_SQRT1_2) };
+
+    ThrowIf(!inBand.GetSInt32(CFSTR(kEFFEQBandKey_Type), theBand.type) ||
+            theBand.type < kEFFEQBandType_Peak ||
+            theBand.type > kEFFEQBandType_HighPass,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_ClientEQ::ParseBand: Missing or invalid band type");
+
+    ThrowIf(!inBand.GetFloat32(CFSTR(kEFFEQBandKey_Frequency), theBand.frequency) ||
+            !(theBand.frequency > 0.0f),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_ClientEQ::ParseBand: Missing or invalid band frequency");
+
+    // The gain and Q are optional.
+    inBand.GetFloat32(CFSTR(kEFFEQBandKey_Gain), theBand.gain);
+    inBand.GetFloat32(CFSTR(kEFFEQBandKey_Q), theBand.q);
+
+    ThrowIf(!(theBand.gain >= -24.0f && theBand.gain <= 24.0f),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_ClientEQ::ParseBand: Band gain out of valid range");
+    ThrowIf(!(theBand.q > 0.0f),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_ClientEQ::ParseBand: Invalid band Q");
+
+    return theBand;
+}
+
+void    EFF_ClientEQ::PublishBands(Slot& ioSlot, const BandList& inBands)
+{
+    ioSlot.bands = inBands;
+
+    Float32 theCoefficients[kEFFAppEQMaxBands][kNumCoefficients];
+
+    for(UInt32 i = 0; i < inBands.size(); i++)
+    {
+        ComputeCoefficients(inBands[i], theCoefficients[i]);
+    }
+
+    // Make the sequence number odd while we write so the IO thread won't use half-written
+    // coefficients, then even again once they're all written.
+    UInt32 theSequence = ioSlot.sequence.load(std::memory_order_relaxed);
+    ioSlot.sequence.store(theSequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    ioSlot.numBands.store(static_cast<UInt32>(inBands.size()), std::memory_order_relaxed);
+
+    for(UInt32 i = 0; i < inBands.size(); i++)
+    {
+        for(UInt32 j = 0; j < kNumCoefficients; j++)
+        {
+            ioSlot.coefficients[i][j].store(theCoefficients[i][j], std::memory_order_relaxed);
+        }
+    }
+
+    ioSlot.sequence.store(theSequence + 2, std::memory_order_release);
+}
+
+void    EFF_ClientEQ::ComputeCoefficients(const Band& inBand, Float32 outCoefficients[kNumCoefficients])
+const
+{
+    // These are the formulae from Robert Bristow-Johnson's Audio EQ Cookbook. Frequencies at or
+    // above Nyquist are clamped to just under it so the filters stay stable.
+    Float64 theFrequency = std::fmin(inBand.frequency, mSampleRate * 0.49);
+    Float64 theW0 = 2.0 * M_PI * theFrequency / mSampleRate;
+    Float64 theCosW0 = std::cos(theW0);
+    Float64 theAlpha = std::sin(theW0) / (2.0 * inBand.q);
+    Float64 theA = std::pow(10.0, inBand.gain / 40.0);
+    Float64 theTwoSqrtAAlpha = 2.0 * std::sqrt(theA) * theAlpha;
+
+    Float64 b0, b1, b2, a0, a1, a2;
+
+    switch(inBand.type)
+    {
+        case kEFFEQBandType_LowShelf:
+            b0 =        theA * ((theA + 1) - (theA - 1) * theCosW0 + theTwoSqrtAAlpha);
+            b1 =  2.0 * theA * ((theA - 1) - (theA + 1) * theCosW0);
+            b2 =        theA * ((theA + 1) - (theA - 1) * theCosW0 - theTwoSqrtAAlpha);
+            a0 =               (theA + 1) + (theA - 1) * theCosW0 + theTwoSqrtAAlpha;
+            a1 = -2.0 *        ((theA - 1) + (theA + 1) * theCosW0);
+            a2 =               (theA + 1) + (theA - 1) * theCosW0 - theTwoSqrtAAlpha;
+            break;
+
+        case kEFFEQBandType_HighShelf:
+            b0 =        theA * ((theA + 1) + (theA - 1) * theCosW0 + theTwoSqrtAAlpha);
+            b1 = -2.0 * theA * ((theA - 1) + (theA + 1) * theCosW0);
+            b2 =        theA * ((theA + 1) + (theA - 1) * theCosW0 - theTwoSqrtAAlpha);
+            a0 =               (theA + 1) - (theA - 1) * theCosW0 + theTwoSqrtAAlpha;
+            a1 =  2.0 *        ((theA - 1) - (theA + 1) * theCosW0);
+            a2 =               (theA + 1) - (theA - 1) * theCosW0 - theTwoSqrtAAlpha;
+            break;
+
+        case kEFFEQBandType_LowPass:
+            b0 = (1.0 - theCosW0) / 2.0;
+            b1 =  1.0 - theCosW0;
+            b2 = (1.0 - theCosW0) / 2.0;
+            a0 =  1.0 + theAlpha;
+            a1 = -2.0 * theCosW0;
+            a2 =  1.0 - theAlpha;
+            break;
+
+        case kEFFEQBandType_HighPass:
+            b0 =  (1.0 + theCosW0) / 2.0;
+            b1 = -(1.0 + theCosW0);
+            b2 =  (1.0 + theCosW0) / 2.0;
+            a0 =   1.0 + theAlpha;
+            a1 =  -2.0 * theCosW0;
+            a2 =   1.0 - theAlpha;
+            break;
+
+        case kEFFEQBandType_Peak:
+        default:
+            b0 =  1.0 + theAlpha * theA;
+            b1 = -2.0 * theCosW0;
+            b2 =  1.0 - theAlpha * theA;
+            a0 =  1.0 + theAlpha / theA;
+            a1 = -2.0 * theCosW0;
+            a2 =  1.0 - theAlpha / theA;
+            break;
+    }
+
+    outCoefficients[kB0] = static_cast<Float32>(b0 / a0);
+    outCoefficients[kB1] = static_cast<Float32>(b1 / a0);
+    outCoefficients[kB2] = static_cast<Float32>(b2 / a0);
+    outCoefficients[kA1] = static_cast<Float32>(a1 / a0);
+    outCoefficients[kA2] = static_cast<Float32>(a2 / a0);
+}
+
+const EFF_ClientEQ::BandList* __nullable    EFF_ClientEQ::FindAppEQ(pid_t inProcessID,
+                                                                    EFF_BundleIDs::ID inBundleID)
+const
+{
+    // An EQ set by PID is more specific than one set by bundle ID, so it takes precedence.
+    auto theProcessIDItr = mAppEQsByProcessID.find(inProcessID);
+
+    if(theProcessIDItr != mAppEQsByProcessID.end())
+    {
+        return &theProcessIDItr->second;
+    }
+
+    if(inBundleID != EFF_BundleIDs::kNone)
+    {
+        auto theBundleIDItr = mAppEQsByBundleID.find(inBundleID);
+
+        if(theBundleIDItr != mAppEQsByBundleID.end())
+        {
+            return &theBundleIDItr->second;
+        }
+    }
+
+    return nullptr;
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,151 @@
+//
+//  EFF_ClientEQ.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_ClientEQ_h
+#define EFF_ClientEQ_h
+
+// Local Includes
+#include "EFF_BundleIDs.h"
+#include "EFF_ClientSlots.h"
+#include "EFF_CustomProperties.h"
+
+// PublicUtility Includes
+#include "CAMutex.h"
+#include "CACFArray.h"
+#include "CACFDictionary.h"
+
+// STL Includes
+#include <atomic>
+#include <map>
+#include <vector>
+
+// System Includes
+#include <CoreAudio/AudioServerPlugIn.h>
+#include <simd/simd.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_ClientEQ
+//
+//  The parametric EQs set for apps with kAudioDeviceCustomPropertyAppEQ, and the filters that apply
+//  them to each client's audio during ProcessOutput.
+//
+//  Each client gets a slot in an EFF_ClientSlots that holds its filters' coefficients and state,
+//  so applying an EQ never allocates on the IO thread. The
+//  coefficients are computed on the thread that sets the property and published to the slot
+//  through a seqlock. The IO thread checks the slot's sequence number at the start of each buffer
+//  and copies the new coefficients if it has changed. If they're being written at that moment, it
+//  keeps using the old ones and tries again next buffer.
+//
+//  The filters are cascades of up to kEFFAppEQMaxBands biquads in transposed direct form II. Both
+//  channels share the same coefficients, so they're processed together as one two-lane vector.
+//
+//  Methods whose names end with "RT" can only safely be called from real-time threads. The others
+//  aren't real-time safe.
+//==================================================================================================
+
+class EFF_ClientEQ
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_ClientEQ();
+                                EFF_ClientEQ(const EFF_ClientEQ&) = delete;
+                                EFF_ClientEQ& operator=(const EFF_ClientEQ&) = delete;
+
+    // Claims a slot for the client and applies its app's EQ if one has been set.
+    void                        AddClient(UInt32 inClientID,
+                                          pid_t inProcessID,
+                                          EFF_BundleIDs::ID inBundleID);
+    void                        RemoveClient(UInt32 inClientID);
+
+    // Recomputes the coefficients for the new sample rate. Shouldn't be called while IO is running.
+    void                        SetSampleRate(Float64 inSampleRate);
+
+#pragma mark IO Operations
+
+    // Applies the client's EQ, if it has one, to a buffer of interleaved stereo audio. Only one
+    // thread can call this for a given client at a time.
+    void                        ApplyEQRT(UInt32 inClientID, UInt32 inFrameCount, Float32* ioBuffer);
+
+#pragma mark Accessors
+
+    // inAppEQs is an array in the format of kAudioDeviceCustomPropertyAppEQ. Returns true if any
+    // apps' EQs were changed.
+    //
+    // Throws CAException(kAudioHardwareIllegalOperationError) if any element of inAppEQs is invalid,
+    // in which case none of them are applied.
+    bool                        SetAppEQs(const CACFArray& inAppEQs);
+    // Copies the EQs that have been set into an array in the format of
+    // kAudioDeviceCustomPropertyAppEQ.
+    CACFArray                   CopyAppEQs() const;
+
+#pragma mark Implementation
+
+private:
+    struct Band
+    {
+        SInt32                  type;
+        Float32                 frequency;
+        Float32                 gain;
+        Float32                 q;
+
+        bool                    operator==(const Band& inOther) const;
+    };
+
+    typedef std::vector<Band>   BandList;
+
+    // The normalised coefficients of one biquad.
+    enum { kB0, kB1, kB2, kA1, kA2, kNumCoefficients };
+
+    struct Slot
+    {
+        // Written with mMutex held and read by the IO thread. Guarded by sequence.
+        std::atomic<UInt32>     sequence       { 0 };
+        std::atomic<UInt32>     numBands       { 0 };
+        std::atomic<Float32>    coefficients[kEFFAppEQMaxBands][kNumCoefficients];
+
+        // Only accessed by the IO thread, except that AddClient resets them before claiming the slot.
+        UInt32                  sequenceRT     = 0;
+        UInt32                  numBandsRT     = 0;
+        Float32                 coefficientsRT[kEFFAppEQMaxBands][kNumCoefficients];
+        simd_float2             z1RT[kEFFAppEQMaxBands];
+        simd_float2             z2RT[kEFFAppEQMaxBands];
+
+        // Guarded by mMutex.
+        pid_t                   processID      = 0;
+        EFF_BundleIDs::ID       bundleID       = EFF_BundleIDs::kNone;
+        BandList                bands;
+    };
+
+    // Parses an element of kAudioDeviceCustomPropertyAppEQ's bands array.
+    static Band                 ParseBand(const CACFDictionary& inBand);
+    // Computes the coefficients for inBands and publishes them to the slot. mMutex must be held.
+    void                        PublishBands(Slot& ioSlot, const BandList& inBands);
+    void                        ComputeCoefficients(const Band& inBand,
+                                                    Float32 outCoefficients[kNumCoefficients]) const;
+    // Returns the EQ set for the app the client belongs to, or nullptr if none has been.
+    const BandList* __nullable  FindAppEQ(pid_t inProcessID, EFF_BundleIDs::ID inBundleID) const;
+
+    EFF_ClientSlots<Slot>       mSlots;
+
+    CAMutex                     mMutex;
+    Float64                     mSampleRate;
+    // The EQs that have been set for apps. An app's EQ is kept when all of its clients are removed
+    // so it can be applied again if the app comes back, unless it was only identified by its PID.
+    std::map<EFF_BundleIDs::ID, BandList> mAppEQsByBundleID;
+    std::map<pid_t, BandList>   mAppEQsByProcessID;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_ClientEQ_h */
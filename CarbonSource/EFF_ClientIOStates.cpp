@@ -0,0 +1,115 @@
+//
+//  EFF_ClientIOStates.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_ClientIOStates.h"
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+void    EFF_ClientIOStates::AddClient(UInt32 inClientID, bool inIsEFFApp)
+{
+    mSlots.Claim(inClientID, [&] (Slot& theSlot) {
+        theSlot.state.store(ClaimedState(inClientID) | (inIsEFFApp ? kStateIsEFFApp : 0),
+                            std::memory_order_relaxed);
+    });
+}
+
+EFF_ClientIOStates::Transition    EFF_ClientIOStates::RemoveClient(UInt32 inClientID)
+{
+    Transition theTransition;
+    Slot* theSlot = mSlots.Release(inClientID);
+
+    if(theSlot == nullptr)
+    {
+        return theTransition;
+    }
+
+    theTransition.foundClient = true;
+
+    // Clearing the state makes any StartIO or StopIO that found this slot before it was released
+    // fail its compare-and-swap, so if the client was doing IO, only we can take it out of the
+    // counts.
+    UInt64 theState = theSlot->state.exchange(0, std::memory_order_acq_rel);
+
+    if((theState & kStateDoingIO) != 0)
+    {
+        UpdateCounts(theState, false, theTransition);
+    }
+
+    return theTransition;
+}
+
+#pragma mark IO Operations
+
+EFF_ClientIOStates::Transition    EFF_ClientIOStates::UpdateIOState(UInt32 inClientID, bool inDoingIO)
+{
+    Transition theTransition;
+    Slot* theSlot = mSlots.Find(inClientID);
+
+    if(theSlot == nullptr)
+    {
+        return theTransition;
+    }
+
+    UInt64 theState = theSlot->state.load(std::memory_order_acquire);
+
+    while(true)
+    {
+        if((theState & ~static_cast<UInt64>(kStateDoingIO | kStateIsEFFApp)) != ClaimedState(inClientID))
+        {
+            // The client was removed after we found its slot.
+            return theTransition;
+        }
+
+        if(((theState & kStateDoingIO) != 0) == inDoingIO)
+        {
+            theTransition.foundClient = true;
+            return theTransition;
+        }
+
+        UInt64 theNewState = inDoingIO ? (theState | kStateDoingIO) : (theState & ~static_cast<UInt64>(kStateDoingIO));
+
+        if(theSlot->state.compare_exchange_weak(theState,
+                                                theNewState,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire))
+        {
+            break;
+        }
+    }
+
+    theTransition.foundClient = true;
+    UpdateCounts(theState, inDoingIO, theTransition);
+
+    return theTransition;
+}
+
+#pragma mark Implementation
+
+void    EFF_ClientIOStates::UpdateCounts(UInt64 inState, bool inDoingIO, Transition& ioTransition)
+{
+    // The count before the change is zero if this client was the first to start, and one if it
+    // was the last to stop.
+    SInt32 theLimit = inDoingIO ? 0 : 1;
+    SInt32 theChange = inDoingIO ? 1 : -1;
+
+    ioTransition.changedIsRunning =
+        (mNumClientsDoingIO.fetch_add(theChange, std::memory_order_acq_rel) == theLimit);
+
+    if((inState & kStateIsEFFApp) == 0)
+    {
+        ioTransition.changedIsRunningSomewhereOtherThanEFFApp =
+            (mNumClientsOtherThanEFFAppDoingIO.fetch_add(theChange, std::memory_order_acq_rel) == theLimit);
+    }
+}
+
+#pragma clang assume_nonnull end
+
@@ -0,0 +1,120 @@
+//
+//  EFF_ClientIOStates.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_ClientIOStates_h
+#define EFF_ClientIOStates_h
+
+// Local Includes
+#include "EFF_ClientSlots.h"
+
+// STL Includes
+#include <atomic>
+
+// System Includes
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_ClientIOStates
+//
+//  Whether each client is doing IO, and how many are, so the device can tell whether a client
+//  starting IO was the first to start and whether one stopping was the last to stop.
+//
+//  StartIO and StopIO are called by the HAL's StartIO/StopIO and when kAudioServerPlugInIOOperationThread
+//  begins and ends, on the IO thread, so they don't lock or allocate. Each client gets a slot in an
+//  EFF_ClientSlots, and the slot's state holds the client ID and flags in one atomic word. Starting
+//  or stopping IO is a compare-and-swap on that word, so when two threads change the same client's
+//  state at once they're applied in a single order and only one of them counts, and a slot that has
+//  been given to another client in the meantime is never changed. The counts are
+//  updated after the swap, so the thread that moves a count away from or back to zero is the one
+//  that sees the device start or stop.
+//
+//  Slots are claimed and released by AddClient/RemoveClient, which aren't real-time safe and must
+//  not be called concurrently with each other. (EFF_Clients calls them while holding its mutex.)
+//==================================================================================================
+
+class EFF_ClientIOStates
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_ClientIOStates() = default;
+                                EFF_ClientIOStates(const EFF_ClientIOStates&) = delete;
+                                EFF_ClientIOStates& operator=(const EFF_ClientIOStates&) = delete;
+
+    // What starting or stopping IO for a client changed.
+    struct Transition
+    {
+        bool                    foundClient                              = false;
+        // True if this was the first client to start IO or the last to stop.
+        bool                    changedIsRunning                         = false;
+        // The same, but not counting EFFApp's client.
+        bool                    changedIsRunningSomewhereOtherThanEFFApp = false;
+    };
+
+    // Claims a slot for the client.
+    void                        AddClient(UInt32 inClientID, bool inIsEFFApp);
+    // If the client is still doing IO, it stops counting towards IsRunning and the returned
+    // transition says whether it was the last client running.
+    Transition                  RemoveClient(UInt32 inClientID);
+
+#pragma mark IO Operations
+
+    // Real-time safe. If the client was already doing IO (or already not doing IO), these only set
+    // foundClient.
+    Transition                  StartIO(UInt32 inClientID) { return UpdateIOState(inClientID, true); }
+    Transition                  StopIO(UInt32 inClientID)  { return UpdateIOState(inClientID, false); }
+
+#pragma mark Accessors
+
+    bool                        IsRunning() const
+                                    { return mNumClientsDoingIO.load(std::memory_order_acquire) > 0; }
+    bool                        IsRunningSomewhereOtherThanEFFApp() const
+                                    { return mNumClientsOtherThanEFFAppDoingIO.load(std::memory_order_acquire) > 0; }
+
+#pragma mark Implementation
+
+private:
+    Transition                  UpdateIOState(UInt32 inClientID, bool inDoingIO);
+    // Adds the client with state inState to the counts, or takes it out, and records whether that
+    // changed IsRunning or IsRunningSomewhereOtherThanEFFApp.
+    void                        UpdateCounts(UInt64 inState, bool inDoingIO, Transition& ioTransition);
+
+    // The flags in the low bits of a slot's state. The client ID is in the high 32 bits. A released
+    // slot's state is 0, so it doesn't match any client.
+    enum : UInt64
+    {
+        kStateClaimed = 1 << 0,
+        kStateDoingIO = 1 << 1,
+        kStateIsEFFApp = 1 << 2
+    };
+
+    static UInt64               ClaimedState(UInt32 inClientID)
+                                    { return (static_cast<UInt64>(inClientID) << 32) | kStateClaimed; }
+
+    struct Slot
+    {
+        std::atomic<UInt64>     state { 0 };
+    };
+
+    EFF_ClientSlots<Slot>       mSlots;
+
+    // Signed because a client's StopIO can update them before the StartIO it was ordered after. In
+    // that case the count dips below zero and comes back, and neither call sees a transition.
+    std::atomic<SInt32>         mNumClientsDoingIO { 0 };
+    std::atomic<SInt32>         mNumClientsOtherThanEFFAppDoingIO { 0 };
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_ClientIOStates_h */
+
@@ -17,26 +17,30 @@
 #include "CACFDictionary.h"
 #include "CAException.h"
 
+// STL Includes
+#include <algorithm>
+
 
 #pragma clang assume_nonnull begin
 
+void    EFF_ClientMap::OpenPastClients(CFStringRef inDeviceUID)
+{
+    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
+    mPastClients.Open(inDeviceUID);
+}
+
 void    EFF_ClientMap::AddClient(EFF_Client inClient)
 {
     // Only the shadow map needs to be locked; main map access is normal
     CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
     
     // If this client has been a client in the past (and has a bundle ID), copy its previous audio settings
-    auto pastClientItr = inClient.mBundleID.IsValid()
-                         ? mPastClientMap.find(inClient.mBundleID)
-                         : mPastClientMap.end();
-    if(pastClientItr != mPastClientMap.end())
+    if(mPastClients.Find(inClient))
     {
         DebugMsg("EFF_ClientMap::AddClient: Found previous volume %f and pan %d for client %u",
-                 pastClientItr->second.mRelativeVolume,
-                 pastClientItr->second.mPanPosition,
+                 inClient.mRelativeVolume,
+                 inClient.mPanPosition,
                  inClient.mClientID);
-        inClient.mRelativeVolume = pastClientItr->second.mRelativeVolume;
-        inClient.mPanPosition    = pastClientItr->second.mPanPosition;
     }
 
     // Add the new client to the shadow maps
@@ -49,15 +53,55 @@ void    EFF_ClientMap::AddClient(EFF_Client inClient)
     // keep the sets of maps identical.
     AddClientToShadowMaps(inClient);
 
-    // Insert the client into the past clients map. We do this here rather than in RemoveClient
-    // because some apps add multiple clients with the same bundle ID and we want to give them all
-    // the same settings (volume, etc.).
-    if(inClient.mBundleID.IsValid())
+    // Store the client's settings as its app's past settings. We do this here as well as in
+    // RemoveClient because some apps add multiple clients with the same bundle ID and we want to give
+    // them all the same settings (volume, etc.).
+    mPastClients.Store(inClient);
+
+    // A new client only counts as a change if it started with settings EFFApp would want to show.
+    if(HasNonDefaultSettings(inClient))
     {
-        mPastClientMap[inClient.mBundleID] = inClient;
+        mAppVolumeChanges.Append(inClient);
     }
 }
 
+void    EFF_ClientMap::RemoveClientFromShadowMaps(UInt32 inClientID)
+{
+    auto theClientItr = mClientMapShadow.find(inClientID);
+
+    if(theClientItr == mClientMapShadow.end())
+    {
+        return;
+    }
+
+    // The pointer maps' lists point into mClientMapShadow, so this is the pointer to remove.
+    const EFF_Client* theClientPtr = &theClientItr->second;
+
+    auto theRemoveFromList = [theClientPtr] (auto& ioMap, const auto& inKey) {
+        auto theListItr = ioMap.find(inKey);
+
+        if(theListItr != ioMap.end())
+        {
+            EFF_ClientPtrList& theList = theListItr->second;
+            theList.erase(std::remove(theList.begin(), theList.end(), theClientPtr), theList.end());
+
+            if(theList.empty())
+            {
+                ioMap.erase(theListItr);
+            }
+        }
+    };
+
+    theRemoveFromList(mClientMapByPIDShadow, theClientPtr->mProcessID);
+
+    if(theClientPtr->mBundleID != EFF_BundleIDs::kNone)
+    {
+        theRemoveFromList(mClientMapByBundleIDShadow, theClientPtr->mBundleID);
+    }
+
+    mClientMapShadow.erase(theClientItr);
+}
+
 void    EFF_ClientMap::AddClientToShadowMaps(EFF_Client inClient)
 {
     ThrowIf(mClientMapShadow.count(inClient.mClientID) != 0,
@@ -74,7 +118,7 @@ void    EFF_ClientMap::AddClientToShadowMaps(EFF_Client inClient)
     mClientMapByPIDShadow[inClient.mProcessID].push_back(&clientInMap);
 
     // Add to the bundle ID shadow map
-    if(inClient.mBundleID.IsValid())
+    if(inClient.mBundleID != EFF_BundleIDs::kNone)
     {
         mClientMapByBundleIDShadow[inClient.mBundleID].push_back(&clientInMap);
     }
@@ -94,32 +138,25 @@ EFF_Client    EFF_ClientMap::RemoveClient(UInt32 inClientID)
     EFF_Client theClient = theClientItr->second;
 
     // Remove the client from the shadow maps
-    mClientMapShadow.erase(theClientItr);
-    mClientMapByPIDShadow.erase(theClient.mProcessID);
-    if(theClient.mBundleID.IsValid())
-    {
-        mClientMapByBundleID.erase(theClient.mBundleID);
-    }
+    RemoveClientFromShadowMaps(inClientID);
     
     // Swap the maps with their shadow maps
     SwapInShadowMaps();
     
-    // Erase the client again so the maps and their shadow maps are kept identical
-    mClientMapShadow.erase(inClientID);
-    mClientMapByPIDShadow.erase(theClient.mProcessID);
-    if(theClient.mBundleID.IsValid())
-    {
-        mClientMapByBundleID.erase(theClient.mBundleID);
-    }
+    // Remove the client again so the maps and their shadow maps are kept identical
+    RemoveClientFromShadowMaps(inClientID);
+
+    // Remember the settings the client ended up with, which might have changed since it was added.
+    mPastClients.Store(theClient);
     
     return theClient;
 }
 
-bool    EFF_ClientMap::GetClientRT(UInt32 inClientID, EFF_Client* outClient)
+bool    EFF_ClientMap::GetClientRT(UInt32 inClientID, EFF_ClientTable::Entry& outClient)
 const
 {
     CAMutex::Locker theMapsLocker(mMapsMutex);
-    return GetClient(mClientMap, inClientID, outClient);
+    return mClientTable.Find(inClientID, outClient);
 }
 
 bool    EFF_ClientMap::GetClientNonRT(UInt32 inClientID, EFF_Client* outClient)
@@ -164,48 +201,68 @@ const
     return theClients;
 }
 
+std::vector<EFF_Client> EFF_ClientMap::GetClientsByBundleID(const CACFString& inBundleID)
+const
+{
+    // A bundle ID that was never interned can't belong to any of the clients.
+    return GetClientsByBundleID(EFF_BundleIDs::Find(inBundleID));
+}
+
+std::vector<EFF_Client> EFF_ClientMap::GetClientsByBundleID(EFF_BundleIDs::ID inBundleID)
+const
+{
+    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
+
+    std::vector<EFF_Client> theClients;
+
+    auto theMapItr = mClientMapByBundleIDShadow.find(inBundleID);
+    if(theMapItr != mClientMapByBundleIDShadow.end())
+    {
+        for(auto& theClientPtrsItr : theMapItr->second)
+        {
+            theClients.push_back(*theClientPtrsItr);
+        }
+    }
+    
+    return theClients;
+}
+
 
 #pragma mark Music Player
 
 void    EFF_ClientMap::UpdateMusicPlayerFlags(pid_t inMusicPlayerPID)
 {
-    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
-    
-    auto theIsMusicPlayerTest = [&] (EFF_Client theClient) {
-        return (theClient.mProcessID == inMusicPlayerPID);
-    };
-    
-    UpdateMusicPlayerFlagsInShadowMaps(theIsMusicPlayerTest);
-    SwapInShadowMaps();
-    UpdateMusicPlayerFlagsInShadowMaps(theIsMusicPlayerTest);
+    Transaction theTransaction(*this);
+    theTransaction.UpdateMusicPlayerFlags(inMusicPlayerPID);
+    theTransaction.Commit();
 }
 
 void    EFF_ClientMap::UpdateMusicPlayerFlags(CACFString inMusicPlayerBundleID)
 {
-    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
-    
-    auto theIsMusicPlayerTest = [&] (EFF_Client theClient) {
-        return (theClient.mBundleID.IsValid() && theClient.mBundleID == inMusicPlayerBundleID);
-    };
-    
-    UpdateMusicPlayerFlagsInShadowMaps(theIsMusicPlayerTest);
-    SwapInShadowMaps();
-    UpdateMusicPlayerFlagsInShadowMaps(theIsMusicPlayerTest);
+    Transaction theTransaction(*this);
+    theTransaction.UpdateMusicPlayerFlags(inMusicPlayerBundleID);
+    theTransaction.Commit();
 }
 
-void    EFF_ClientMap::UpdateMusicPlayerFlagsInShadowMaps(std::function<bool(EFF_Client)> inIsMusicPlayerTest)
+bool    EFF_ClientMap::UpdateMusicPlayerFlagsInShadowMaps(std::function<bool(const EFF_Client&)> inIsMusicPlayerTest)
 {
+    bool didChangeFlags = false;
+
     for(auto& theItr : mClientMapShadow)
     {
         EFF_Client& theClient = theItr.second;
-        theClient.mIsMusicPlayer = inIsMusicPlayerTest(theClient);
+        bool theIsMusicPlayer = inIsMusicPlayerTest(theClient);
+        didChangeFlags = didChangeFlags || (theClient.mIsMusicPlayer != theIsMusicPlayer);
+        theClient.mIsMusicPlayer = theIsMusicPlayer;
     }
+
+    return didChangeFlags;
 }
 
 
 #pragma mark App Volumes
 
-CACFArray   EFF_ClientMap::CopyClientRelativeVolumesAsAppVolumes(CAVolumeCurve inVolumeCurve)
+CACFArray   EFF_ClientMap::CopyClientRelativeVolumesAsAppVolumes(const EFF_VolumeCurveTable& inVolumeCurve)
 const
 {
     // Since this is a read-only, non-real-time operation, we can read from the shadow maps to avoid
@@ -219,26 +276,89 @@ const
         CopyClientIntoAppVolumesArray(theClientEntry.second, inVolumeCurve, theAppVolumes);
     }
     
-    for(auto& thePastClientEntry : mPastClientMap)
-    {
-        CopyClientIntoAppVolumesArray(thePastClientEntry.second, inVolumeCurve, theAppVolumes);
-    }
+    mPastClients.ForEach([&] (const EFF_Client& inPastClient) {
+        CopyClientIntoAppVolumesArray(inPastClient, inVolumeCurve, theAppVolumes);
+    });
     
     return theAppVolumes;
 }
 
-void    EFF_ClientMap::CopyClientIntoAppVolumesArray(EFF_Client inClient,
-                                                     CAVolumeCurve inVolumeCurve,
+CFDataRef   EFF_ClientMap::CopyAppVolumeChanges(UInt64 inSequence, const EFF_VolumeCurveTable& inVolumeCurve)
+const
+{
+    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
+
+    std::vector<EFF_Client> theClients;
+
+    if(inSequence != 0 && mAppVolumeChanges.CopyChangesSince(inSequence, theClients))
+    {
+        return EFF_AppVolumeChanges::CopyEncoded(mAppVolumeChanges.GetSequence(),
+                                                 false,
+                                                 theClients,
+                                                 inVolumeCurve);
+    }
+
+    // The log doesn't go back far enough, so send the same clients
+    // CopyClientRelativeVolumesAsAppVolumes would.
+    CopyClientsWithNonDefaultSettingsInShadowMaps(theClients);
+
+    return EFF_AppVolumeChanges::CopyEncoded(mAppVolumeChanges.GetSequence(),
+                                             true,
+                                             theClients,
+                                             inVolumeCurve);
+}
+
+std::vector<EFF_Client>    EFF_ClientMap::CopyClientsWithNonDefaultSettings()
+const
+{
+    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
+
+    std::vector<EFF_Client> theClients;
+    CopyClientsWithNonDefaultSettingsInShadowMaps(theClients);
+
+    return theClients;
+}
+
+void    EFF_ClientMap::CopyClientsWithNonDefaultSettingsInShadowMaps(std::vector<EFF_Client>& outClients)
+const
+{
+    outClients.clear();
+
+    for(auto& theClientEntry : mClientMapShadow)
+    {
+        if(HasNonDefaultSettings(theClientEntry.second))
+        {
+            outClients.push_back(theClientEntry.second);
+        }
+    }
+
+    mPastClients.ForEach([&] (const EFF_Client& inPastClient) {
+        if(HasNonDefaultSettings(inPastClient))
+        {
+            outClients.push_back(inPastClient);
+        }
+    });
+}
+
+//static
+bool    EFF_ClientMap::HasNonDefaultSettings(const EFF_Client& inClient)
+{
+    return inClient.mRelativeVolume != 1.0 || inClient.mPanPosition != 0;
+}
+
+void    EFF_ClientMap::CopyClientIntoAppVolumesArray(const EFF_Client& inClient,
+                                                     const EFF_VolumeCurveTable& inVolumeCurve,
                                                      CACFArray& ioAppVolumes)
 const
 {
     // Only include clients set to a non-default volume or pan
-    if(inClient.mRelativeVolume != 1.0 || inClient.mPanPosition != 0)
+    if(HasNonDefaultSettings(inClient))
     {
         CACFDictionary theAppVolume(false);
 
         theAppVolume.AddSInt32(CFSTR(kEFFAppVolumesKey_ProcessID), inClient.mProcessID);
-        theAppVolume.AddString(CFSTR(kEFFAppVolumesKey_BundleID), inClient.mBundleID.CopyCFString());
+        theAppVolume.AddString(CFSTR(kEFFAppVolumesKey_BundleID),
+                               EFF_BundleIDs::GetBundleID(inClient.mBundleID).GetCFString());
         // Reverse the volume conversion from SetClientsRelativeVolumes
         theAppVolume.AddSInt32(CFSTR(kEFFAppVolumesKey_RelativeVolume),
                                inVolumeCurve.ConvertScalarToRaw(inClient.mRelativeVolume / 4));
@@ -262,12 +382,12 @@ std::vector<EFF_Client*> * _Nullable EFF_ClientMap::GetClients(pid_t inAppPid) {
     return GetClientsFromMap(mClientMapByPIDShadow, inAppPid);
 }
 
-std::vector<EFF_Client*> * _Nullable EFF_ClientMap::GetClients(CACFString inAppBundleID) {
+std::vector<EFF_Client*> * _Nullable EFF_ClientMap::GetClients(EFF_BundleIDs::ID inAppBundleID) {
     return GetClientsFromMap(mClientMapByBundleIDShadow, inAppBundleID);
 }
 
 void ShowSetRelativeVolumeMessage(pid_t inAppPID, EFF_Client* theClient);
-void ShowSetRelativeVolumeMessage(CACFString inAppBundleID, EFF_Client* theClient);
+void ShowSetRelativeVolumeMessage(EFF_BundleIDs::ID inAppBundleID, EFF_Client* theClient);
 
 void ShowSetRelativeVolumeMessage(pid_t inAppPID, EFF_Client* theClient) {
     (void)inAppPID;
@@ -278,43 +398,65 @@ void ShowSetRelativeVolumeMessage(pid_t inAppPID, EFF_Client* theClient) {
              inAppPID);
 }
 
-void ShowSetRelativeVolumeMessage(CACFString inAppBundleID, EFF_Client* theClient) {
+void ShowSetRelativeVolumeMessage(EFF_BundleIDs::ID inAppBundleID, EFF_Client* theClient) {
     (void)inAppBundleID;
     (void)theClient;
     DebugMsg("EFF_ClientMap::ShowSetRelativeVolumeMessage: Set volume %f for client %u by bundle ID (%s)",
              theClient->mRelativeVolume,
              theClient->mClientID,
-             CFStringGetCStringPtr(inAppBundleID.GetCFString(), kCFStringEncodingUTF8));
+             EFF_BundleIDs::GetCString(inAppBundleID));
 }
 
-// Template method declarations are running into LLVM bug 23987
-// TODO: template these.
+bool EFF_ClientMap::SetClientsRelativeVolume(pid_t inAppPID, Float32 inRelativeVolume)
+{
+    Transaction theTransaction(*this);
+    theTransaction.SetClientsRelativeVolume(inAppPID, inRelativeVolume);
+    return theTransaction.Commit();
+}
+
+bool EFF_ClientMap::SetClientsRelativeVolume(CACFString inAppBundleID, Float32 inRelativeVolume)
+{
+    Transaction theTransaction(*this);
+    theTransaction.SetClientsRelativeVolume(inAppBundleID, inRelativeVolume);
+    return theTransaction.Commit();
+}
+
+bool EFF_ClientMap::SetClientsPanPosition(pid_t inAppPID, SInt32 inPanPosition)
+{
+    Transaction theTransaction(*this);
+    theTransaction.SetClientsPanPosition(inAppPID, inPanPosition);
+    return theTransaction.Commit();
+}
 
-//bool EFF_ClientMap::SetClientsRelativeVolume(pid_t inAppPID, Float32 inRelativeVolume) {
-//    return SetClientsRelativeVolumeT<pid_t>(inAppPID, inRelativeVolume);
-//}
+bool EFF_ClientMap::SetClientsPanPosition(CACFString inAppBundleID, SInt32 inPanPosition)
+{
+    Transaction theTransaction(*this);
+    theTransaction.SetClientsPanPosition(inAppBundleID, inPanPosition);
+    return theTransaction.Commit();
+}
 
-//bool EFF_ClientMap::SetClientsRelativeVolume(CACFString inAppBundleID, Float32 inRelativeVolume) {
-//    return SetClientsRelativeVolumeT<CACFString>(inAppBundleID, inRelativeVolume)
-//}
 
-//template <typename T>
-//bool EFF_ClientMap::SetClientsRelativeVolume(T searchKey, Float32 inRelativeVolume)
+#pragma mark Transactions
 
-bool EFF_ClientMap::SetClientsRelativeVolume(pid_t searchKey, Float32 inRelativeVolume)
+// Template method declarations are running into LLVM bug 23987
+// TODO: template these.
+
+void    EFF_ClientMap::Transaction::SetClientsRelativeVolume(pid_t searchKey, Float32 inRelativeVolume)
 {
-    bool didChangeVolume = false;
-    
-    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
-    
-    auto theSetVolumesInShadowMapsFunc = [&] {
+    mEdits.push_back([this, searchKey, inRelativeVolume] {
+        bool didChangeVolume = false;
+
         // Look up the clients for the key and update their volumes
-        
-        auto theClients = GetClients(searchKey);
+        auto theClients = mClientMap.GetClients(searchKey);
         if(theClients != nullptr)
         {
             for(EFF_Client* theClient : *theClients)
             {
+                if(theClient->mRelativeVolume != inRelativeVolume)
+                {
+                    mChangedClientIDs.push_back(theClient->mClientID);
+                }
+
                 theClient->mRelativeVolume = inRelativeVolume;
                 
                 ShowSetRelativeVolumeMessage(searchKey, theClient);
@@ -322,29 +464,33 @@ bool EFF_ClientMap::SetClientsRelativeVolume(pid_t searchKey, Float32 inRelative
                 didChangeVolume = true;
             }
         }
-    };
-    
-    theSetVolumesInShadowMapsFunc();
-    SwapInShadowMaps();
-    theSetVolumesInShadowMapsFunc();
-    
-    return didChangeVolume;
+
+        return didChangeVolume;
+    });
 }
 
-bool EFF_ClientMap::SetClientsRelativeVolume(CACFString searchKey, Float32 inRelativeVolume)
+void    EFF_ClientMap::Transaction::SetClientsRelativeVolume(CACFString inAppBundleID, Float32 inRelativeVolume)
 {
-    bool didChangeVolume = false;
-    
-    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
-    
-    auto theSetVolumesInShadowMapsFunc = [&] {
+    // Look the bundle ID up once, rather than each time the edit is made.
+    SetClientsRelativeVolume(EFF_BundleIDs::Find(inAppBundleID), inRelativeVolume);
+}
+
+void    EFF_ClientMap::Transaction::SetClientsRelativeVolume(EFF_BundleIDs::ID searchKey, Float32 inRelativeVolume)
+{
+    mEdits.push_back([this, searchKey, inRelativeVolume] {
+        bool didChangeVolume = false;
+
         // Look up the clients for the key and update their volumes
-        
-        auto theClients = GetClients(searchKey);
+        auto theClients = mClientMap.GetClients(searchKey);
         if(theClients != nullptr)
         {
             for(EFF_Client* theClient : *theClients)
             {
+                if(theClient->mRelativeVolume != inRelativeVolume)
+                {
+                    mChangedClientIDs.push_back(theClient->mClientID);
+                }
+
                 theClient->mRelativeVolume = inRelativeVolume;
                 
                 ShowSetRelativeVolumeMessage(searchKey, theClient);
@@ -352,77 +498,144 @@ bool EFF_ClientMap::SetClientsRelativeVolume(CACFString searchKey, Float32 inRel
                 didChangeVolume = true;
             }
         }
-    };
-    
-    theSetVolumesInShadowMapsFunc();
-    SwapInShadowMaps();
-    theSetVolumesInShadowMapsFunc();
-    
-    return didChangeVolume;
+
+        return didChangeVolume;
+    });
 }
 
-bool EFF_ClientMap::SetClientsPanPosition(pid_t searchKey, SInt32 inPanPosition)
+void    EFF_ClientMap::Transaction::SetClientsPanPosition(pid_t searchKey, SInt32 inPanPosition)
 {
-    bool didChangePanPosition = false;
-    
-    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
-    
-    auto theSetPansInShadowMapsFunc = [&] {
+    mEdits.push_back([this, searchKey, inPanPosition] {
+        bool didChangePanPosition = false;
+
         // Look up the clients for the key and update their pan positions
-        auto theClients = GetClients(searchKey);
+        auto theClients = mClientMap.GetClients(searchKey);
         if(theClients != nullptr) {
             for(auto theClient: *theClients) {
+                if(theClient->mPanPosition != inPanPosition) {
+                    mChangedClientIDs.push_back(theClient->mClientID);
+                }
+
                 theClient->mPanPosition = inPanPosition;
                 didChangePanPosition = true;
             }
         }
-    };
-    
-    theSetPansInShadowMapsFunc();
-    SwapInShadowMaps();
-    theSetPansInShadowMapsFunc();
-    
-    return didChangePanPosition;
+
+        return didChangePanPosition;
+    });
 }
 
-bool EFF_ClientMap::SetClientsPanPosition(CACFString searchKey, SInt32 inPanPosition)
+void    EFF_ClientMap::Transaction::SetClientsPanPosition(CACFString inAppBundleID, SInt32 inPanPosition)
 {
-    bool didChangePanPosition = false;
-    
-    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
-    
-    auto theSetPansInShadowMapsFunc = [&] {
+    SetClientsPanPosition(EFF_BundleIDs::Find(inAppBundleID), inPanPosition);
+}
+
+void    EFF_ClientMap::Transaction::SetClientsPanPosition(EFF_BundleIDs::ID searchKey, SInt32 inPanPosition)
+{
+    mEdits.push_back([this, searchKey, inPanPosition] {
+        bool didChangePanPosition = false;
+
         // Look up the clients for the key and update their pan positions
-        auto theClients = GetClients(searchKey);
+        auto theClients = mClientMap.GetClients(searchKey);
         if(theClients != nullptr) {
             for(auto theClient: *theClients) {
+                if(theClient->mPanPosition != inPanPosition) {
+                    mChangedClientIDs.push_back(theClient->mClientID);
+                }
+
                 theClient->mPanPosition = inPanPosition;
                 didChangePanPosition = true;
             }
         }
-    };
-    
-    theSetPansInShadowMapsFunc();
-    SwapInShadowMaps();
-    theSetPansInShadowMapsFunc();
-    
-    return didChangePanPosition;
+
+        return didChangePanPosition;
+    });
 }
 
+void    EFF_ClientMap::Transaction::UpdateMusicPlayerFlags(pid_t inMusicPlayerPID)
+{
+    mEdits.push_back([this, inMusicPlayerPID] {
+        return mClientMap.UpdateMusicPlayerFlagsInShadowMaps([&] (const EFF_Client& theClient) {
+            return (theClient.mProcessID == inMusicPlayerPID);
+        });
+    });
+}
 
-#pragma mark Mechanism
+void    EFF_ClientMap::Transaction::UpdateMusicPlayerFlags(CACFString inMusicPlayerBundleID)
+{
+    EFF_BundleIDs::ID theMusicPlayerBundleID = EFF_BundleIDs::Find(inMusicPlayerBundleID);
+
+    mEdits.push_back([this, theMusicPlayerBundleID] {
+        return mClientMap.UpdateMusicPlayerFlagsInShadowMaps([&] (const EFF_Client& theClient) {
+            return (theMusicPlayerBundleID != EFF_BundleIDs::kNone &&
+                    theClient.mBundleID == theMusicPlayerBundleID);
+        });
+    });
+}
 
-void    EFF_ClientMap::UpdateClientIOStateNonRT(UInt32 inClientID, bool inDoingIO)
+bool    EFF_ClientMap::Transaction::Commit()
 {
-    CAMutex::Locker theShadowMapsLocker(mShadowMapsMutex);
-    
-    mClientMapShadow[inClientID].mDoingIO = inDoingIO;
-    SwapInShadowMaps();
-    mClientMapShadow[inClientID].mDoingIO = inDoingIO;
+    if(mEdits.empty())
+    {
+        return false;
+    }
+
+    bool didChangeClients = false;
+
+    {
+        CAMutex::Locker theShadowMapsLocker(mClientMap.mShadowMapsMutex);
+
+        for(auto& theEdit : mEdits)
+        {
+            didChangeClients = theEdit() || didChangeClients;
+        }
+
+        // The edits find the same changes when they're repeated, so only keep the first pass's.
+        size_t theNumChangedClients = mChangedClientIDs.size();
+
+        mClientMap.SwapInShadowMaps();
+
+        // Repeat the edits so the shadow maps match the maps we just swapped in.
+        for(auto& theEdit : mEdits)
+        {
+            theEdit();
+        }
+
+        mChangedClientIDs.resize(theNumChangedClients);
+
+        // Log each changed client once, with its settings after all of the edits, and store the
+        // settings as its app's past settings, so they survive coreaudiod restarting while the app
+        // is still running.
+        std::sort(mChangedClientIDs.begin(), mChangedClientIDs.end());
+        mChangedClientIDs.erase(std::unique(mChangedClientIDs.begin(), mChangedClientIDs.end()),
+                                mChangedClientIDs.end());
+
+        for(UInt32 theClientID : mChangedClientIDs)
+        {
+            auto theClientItr = mClientMap.mClientMapShadow.find(theClientID);
+
+            if(theClientItr != mClientMap.mClientMapShadow.end())
+            {
+                mClientMap.mAppVolumeChanges.Append(theClientItr->second);
+                mClientMap.mPastClients.Store(theClientItr->second);
+            }
+        }
+    }
+
+    mEdits.clear();
+    mChangedClientIDs.clear();
+
+    return didChangeClients;
 }
 
+
+#pragma mark Mechanism
+
 void    EFF_ClientMap::SwapInShadowMaps()
 {
+    // Rebuild the table here, rather than in SwapInShadowMapsRT, because it might have to allocate.
+    mClientTableShadow.Assign(mClientMapShadow);
+
     mTaskQueue->QueueSync_SwapClientShadowMaps(this);
 }
 
@@ -444,6 +657,7 @@ void    EFF_ClientMap::SwapInShadowMapsRT()
     mClientMap.swap(mClientMapShadow);
     mClientMapByPID.swap(mClientMapByPIDShadow);
     mClientMapByBundleID.swap(mClientMapByBundleIDShadow);
+    mClientTable.Swap(mClientTableShadow);
 }
 
 #pragma clang assume_nonnull end
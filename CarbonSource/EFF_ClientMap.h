@@ -11,14 +11,17 @@
 
 
 // Local Includes
+#include "EFF_AppVolumeChanges.h"
 #include "EFF_Client.h"
+#include "EFF_ClientTable.h"
+#include "EFF_PastClients.h"
 #include "EFF_TaskQueue.h"
+#include "EFF_VolumeCurveTable.h"
 
 // PublicUtility Includes
 #include "CAMutex.h"
 #include "CACFString.h"
 #include "CACFArray.h"
-#include "CAVolumeCurve.h"
 
 // STL Includes
 #include <map>
@@ -35,9 +38,10 @@ class EFF_ClientTasks;
 //    EFF_ClientMap
 //
 //  This class stores the clients (EFF_Client) that have been registered with EFFDevice by the HAL.
-//  It also maintains maps from clients' PIDs and bundle IDs to the clients. When a client is
-//  removed by the HAL we add it to a map of past clients to keep track of settings specific to that
-//  client. (Currently only the client's volume.)
+//  It also maintains maps from clients' PIDs and bundle IDs to the clients. Bundle IDs are keyed by
+//  their EFF_BundleIDs IDs, so the maps never compare CFStrings. The settings specific to each
+//  client's app (currently the volume and pan) are kept in an EFF_PastClients, which is saved to a
+//  file, so they can be restored if the app is added again, even after coreaudiod restarts.
 //
 //  Since the maps are read from during IO, this class has to to be real-time safe when accessing
 //  them. So each map has an identical "shadow" map, which we use to buffer update
@@ -48,7 +52,15 @@ class EFF_ClientTasks;
 //  safe.
 //
 //  Methods that only read from the maps and are called on non-real-time threads will just read
-//  from the shadow maps because it's easier.
+//  from the shadow maps because it's easier. The IO thread only needs a few of each client's
+//  fields, so it reads them from an EFF_ClientTable, which is rebuilt from the shadow client map
+//  and swapped in along with the maps.
+//
+//  Each swap is a synchronous round trip to the real-time thread, so edits to many clients should
+//  be gathered in a Transaction, which makes all of them with a single swap.
+//
+//  Changes to clients' volumes and pans are also logged in an EFF_AppVolumeChanges, so EFFApp can
+//  read just the ones it hasn't seen yet through kAudioDeviceCustomPropertyAppVolumeChanges.
 //
 //  Methods whose names end with "RT" and "NonRT" can only safely be called from real-time and
 //  non-real-time threads respectively. (Methods with neither are most likely non-RT.)
@@ -71,14 +83,21 @@ public:
 
 #pragma mark API
 
+    // Maps the file the past clients' settings are saved in. Should be called before any clients are
+    // added.
+    void                        OpenPastClients(CFStringRef inDeviceUID);
+
     void                        AddClient(EFF_Client inClient);
     EFF_Client                  RemoveClient(UInt32 inClientID);
     
-    // These methods are functionally identical except that GetClientRT must only be called from real-time threads
-    // and GetClientNonRT must only be called from non-real-time threads. Both return true if a client was found.
-    bool                        GetClientRT(UInt32 inClientID, EFF_Client* outClient) const;
+    // GetClientRT must only be called from real-time threads and GetClientNonRT must only be called from
+    // non-real-time threads. GetClientRT only copies the fields used during IO. Both return true if a client
+    // was found.
+    bool                        GetClientRT(UInt32 inClientID, EFF_ClientTable::Entry& outClient) const;
     bool                        GetClientNonRT(UInt32 inClientID, EFF_Client* outClient) const;
     std::vector<EFF_Client>     GetClientsByPID(pid_t inPID) const;
+    std::vector<EFF_Client>     GetClientsByBundleID(const CACFString& inBundleID) const;
+    std::vector<EFF_Client>     GetClientsByBundleID(EFF_BundleIDs::ID inBundleID) const;
     
     // Set the isMusicPlayer flag for each client. (True if the client has the given bundle ID/PID, false otherwise.)
     void                        UpdateMusicPlayerFlags(pid_t inMusicPlayerPID);
@@ -87,7 +106,15 @@ public:
     // Copies the current and past clients into an array in the format expected for
     // kAudioDeviceCustomPropertyAppVolumes. (Except that CACFArray and CACFDictionary are used instead
     // of unwrapped CFArray and CFDictionary refs.)
-    CACFArray                   CopyClientRelativeVolumesAsAppVolumes(CAVolumeCurve inVolumeCurve) const;
+    CACFArray                   CopyClientRelativeVolumesAsAppVolumes(const EFF_VolumeCurveTable& inVolumeCurve) const;
+
+    // Returns the value of kAudioDeviceCustomPropertyAppVolumeChanges for inSequence, the sequence
+    // number EFFApp last read, or 0 for a snapshot. The caller is responsible for releasing it.
+    CFDataRef                   CopyAppVolumeChanges(UInt64 inSequence, const EFF_VolumeCurveTable& inVolumeCurve) const;
+
+    // Copies the current and past clients that would be included in
+    // CopyClientRelativeVolumesAsAppVolumes.
+    std::vector<EFF_Client>     CopyClientsWithNonDefaultSettings() const;
     
     // Using the template function hits LLVM Bug 23987
     // TODO Switch to template function
@@ -109,22 +136,66 @@ public:
     // Returns true if a client for bundle ID inAppBundleID was found and its pan position changed.
     bool                        SetClientsPanPosition(CACFString inAppBundleID, SInt32 inPanPosition);
     
-    void                        StartIONonRT(UInt32 inClientID) { UpdateClientIOStateNonRT(inClientID, true ); }
-    void                        StopIONonRT(UInt32 inClientID)  { UpdateClientIOStateNonRT(inClientID, false); }
+    // A batch of edits to the clients that are made together, with one swap of the shadow maps,
+    // when the transaction is committed. The edits are made in the order they were added and
+    // nothing is changed until Commit is called, so a transaction that's destroyed without being
+    // committed has no effect.
+    //
+    // The setters work the same way as EFF_ClientMap's methods with the same names.
+    class Transaction
+    {
+
+    public:
+                                Transaction(EFF_ClientMap& inClientMap) : mClientMap(inClientMap) { };
+                                Transaction(const Transaction&) = delete;
+                                Transaction& operator=(const Transaction&) = delete;
+
+        void                    SetClientsRelativeVolume(pid_t inAppPID, Float32 inRelativeVolume);
+        void                    SetClientsRelativeVolume(CACFString inAppBundleID, Float32 inRelativeVolume);
+        void                    SetClientsRelativeVolume(EFF_BundleIDs::ID inAppBundleID, Float32 inRelativeVolume);
+        void                    SetClientsPanPosition(pid_t inAppPID, SInt32 inPanPosition);
+        void                    SetClientsPanPosition(CACFString inAppBundleID, SInt32 inPanPosition);
+        void                    SetClientsPanPosition(EFF_BundleIDs::ID inAppBundleID, SInt32 inPanPosition);
+        void                    UpdateMusicPlayerFlags(pid_t inMusicPlayerPID);
+        void                    UpdateMusicPlayerFlags(CACFString inMusicPlayerBundleID);
+
+        bool                    IsEmpty() const { return mEdits.empty(); }
+
+        // Makes the edits and clears the transaction. Returns true if any of the edits found a
+        // client to change.
+        bool                    Commit();
+
+    private:
+        EFF_ClientMap&          mClientMap;
+        // Each edit is made to the shadow maps and returns true if it found a client to change.
+        // They're each run twice, once before the swap and once after, like the rest of the
+        // shadow maps' modifications.
+        std::vector<std::function<bool()>> mEdits;
+        // The IDs of the clients whose volumes or pans the edits changed, so Commit can log them.
+        std::vector<UInt32>     mChangedClientIDs;
+
+    };
 
     
 #pragma mark Implementation
 
 private:
     void                        AddClientToShadowMaps(EFF_Client inClient);
+    // Removes the client from mClientMapShadow and its pointer from the PID and bundle ID shadow
+    // maps' lists. A list is only removed once it's empty, since other clients can share its key.
+    void                        RemoveClientFromShadowMaps(UInt32 inClientID);
     static bool                 GetClient(const std::map<UInt32, EFF_Client>& inClientMap,
                                           UInt32 inClientID,
                                           EFF_Client* outClient);
-    void                        UpdateMusicPlayerFlagsInShadowMaps(std::function<bool(EFF_Client)> inIsMusicPlayerTest);
-    void                        CopyClientIntoAppVolumesArray(EFF_Client inClient,
-                                                              CAVolumeCurve inVolumeCurve,
+    // Returns true if any client's flag changed.
+    bool                        UpdateMusicPlayerFlagsInShadowMaps(std::function<bool(const EFF_Client&)> inIsMusicPlayerTest);
+    // True if the client's volume or pan isn't the default, so EFFApp should be told about it.
+    static bool                 HasNonDefaultSettings(const EFF_Client& inClient);
+    // The shadow maps mutex must be locked when calling this method.
+    void                        CopyClientsWithNonDefaultSettingsInShadowMaps(std::vector<EFF_Client>& outClients) const;
+    void                        CopyClientIntoAppVolumesArray(const EFF_Client& inClient,
+                                                              const EFF_VolumeCurveTable& inVolumeCurve,
                                                               CACFArray& ioAppVolumes) const;
-    void                        UpdateClientIOStateNonRT(UInt32 inClientID, bool inDoingIO);
     
     // Has a real-time thread call SwapInShadowMapsRT. (Synchronously queues the call as a task on mTaskQueue.)
     // The shadow maps mutex must be locked when calling this method.
@@ -136,16 +207,15 @@ private:
     // Client lookup for PID inAppPID
     std::vector<EFF_Client*> * _Nullable            GetClients(pid_t inAppPid);
     // Client lookup for bundle ID inAppBundleID
-    std::vector<EFF_Client*> * _Nullable            GetClients(CACFString inAppBundleID);
+    std::vector<EFF_Client*> * _Nullable            GetClients(EFF_BundleIDs::ID inAppBundleID);
     
 
 #pragma mark Members
 
     EFF_TaskQueue*                                  mTaskQueue;
     
-    // Must be held to access mClientMap or mClientMapByPID. Code that runs while holding this mutex needs
-    // to be real-time safe. Should probably not be held for most operations on mClientMapByBundleID because,
-    // as far as I can tell, code that works with CFStrings is unlikely to be real-time safe.
+    // Must be held to access mClientMap, mClientMapByPID or mClientMapByBundleID. Code that runs while holding
+    // this mutex needs to be real-time safe.
     CAMutex                                         mMapsMutex;
     // Should only be locked by non-real-time threads. Should not be released until the maps have been
     // made identical to their shadow maps.
@@ -156,18 +226,26 @@ private:
     // We keep this in sync with mClientMap so it can be modified outside of real-time safe sections and
     // then swapped in on a real-time thread, which is safe.
     std::map<UInt32, EFF_Client>                    mClientMapShadow;
+
+    // The fields of the clients in mClientMap/mClientMapShadow that are read during IO. mClientTableShadow
+    // is rebuilt from mClientMapShadow just before each swap.
+    EFF_ClientTable                                 mClientTable;
+    EFF_ClientTable                                 mClientTableShadow;
     
     // These maps hold lists of pointers to clients in mClientMap/mClientMapShadow. Lists because a process
     // can have multiple clients and clients can have the same bundle ID.
     std::map<pid_t, EFF_ClientPtrList>              mClientMapByPID;
     std::map<pid_t, EFF_ClientPtrList>              mClientMapByPIDShadow;
     
-    std::map<CACFString, EFF_ClientPtrList>         mClientMapByBundleID;
-    std::map<CACFString, EFF_ClientPtrList>         mClientMapByBundleIDShadow;
+    std::map<EFF_BundleIDs::ID, EFF_ClientPtrList>  mClientMapByBundleID;
+    std::map<EFF_BundleIDs::ID, EFF_ClientPtrList>  mClientMapByBundleIDShadow;
     
-    // Clients are added to mPastClientMap so we can restore settings specific to them if they get
-    // added again.
-    std::map<CACFString, EFF_Client>                mPastClientMap;
+    // Clients' settings are stored in mPastClients so we can restore them if they get added again.
+    // Guarded by mShadowMapsMutex.
+    EFF_PastClients                                 mPastClients;
+
+    // Guarded by mShadowMapsMutex.
+    EFF_AppVolumeChanges                            mAppVolumeChanges;
 };
 
 #pragma clang assume_nonnull end
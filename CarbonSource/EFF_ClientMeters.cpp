@@ -0,0 +1,126 @@
+//
+//  EFF_ClientMeters.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_ClientMeters.h"
+
+// Local Includes
+#include "EFF_CustomProperties.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CACFDictionary.h"
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+void    EFF_ClientMeters::AddClient(UInt32 inClientID, pid_t inProcessID)
+{
+    mSlots.Claim(inClientID, [&] (Slot& theSlot) {
+        theSlot.processID.store(inProcessID, std::memory_order_relaxed);
+        theSlot.sequence.store(0, std::memory_order_relaxed);
+    });
+}
+
+void    EFF_ClientMeters::RemoveClient(UInt32 inClientID)
+{
+    mSlots.Release(inClientID);
+}
+
+#pragma mark IO Operations
+
+void    EFF_ClientMeters::StoreLevelsRT(UInt32 inClientID,
+                                        Float64 inSampleTime,
+                                        const Float32 inPeak[2],
+                                        const Float32 inRMS[2])
+{
+    Slot* theSlotPtr = mSlots.Find(inClientID);
+
+    if(theSlotPtr == nullptr)
+    {
+        return;
+    }
+
+    Slot& theSlot = *theSlotPtr;
+
+    // Make the sequence number odd so readers know to wait, write the levels and then make it even
+    // again. We're the only writer, so a relaxed load is enough.
+    UInt32 theSequence = theSlot.sequence.load(std::memory_order_relaxed);
+    theSlot.sequence.store(theSequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    theSlot.sampleTime.store(inSampleTime, std::memory_order_relaxed);
+    theSlot.peak[0].store(inPeak[0], std::memory_order_relaxed);
+    theSlot.peak[1].store(inPeak[1], std::memory_order_relaxed);
+    theSlot.rms[0].store(inRMS[0], std::memory_order_relaxed);
+    theSlot.rms[1].store(inRMS[1], std::memory_order_relaxed);
+
+    theSlot.sequence.store(theSequence + 2, std::memory_order_release);
+}
+
+#pragma mark Accessors
+
+CACFArray    EFF_ClientMeters::CopyLevels()
+const
+{
+    CACFArray theLevels(false);
+
+    mSlots.ForEach([&] (UInt32 theClientID, const Slot& theSlot) {
+        Float64 theSampleTime = 0.0;
+        Float32 thePeak[2] = { 0.0f, 0.0f };
+        Float32 theRMS[2] = { 0.0f, 0.0f };
+        bool didRead = false;
+
+        for(UInt32 theAttempt = 0; theAttempt < kMaxReadAttempts && !didRead; theAttempt++)
+        {
+            UInt32 theSequenceBefore = theSlot.sequence.load(std::memory_order_acquire);
+
+            // Zero means the client hasn't played anything yet. Odd means the IO thread is writing.
+            if(theSequenceBefore == 0)
+            {
+                break;
+            }
+            else if((theSequenceBefore & 1) != 0)
+            {
+                continue;
+            }
+
+            theSampleTime = theSlot.sampleTime.load(std::memory_order_relaxed);
+            thePeak[0] = theSlot.peak[0].load(std::memory_order_relaxed);
+            thePeak[1] = theSlot.peak[1].load(std::memory_order_relaxed);
+            theRMS[0] = theSlot.rms[0].load(std::memory_order_relaxed);
+            theRMS[1] = theSlot.rms[1].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            didRead = (theSlot.sequence.load(std::memory_order_relaxed) == theSequenceBefore);
+        }
+
+        if(didRead)
+        {
+            CACFDictionary theClientLevels(false);
+
+            theClientLevels.AddSInt32(CFSTR(kEFFClientLevelsKey_ClientID),
+                                      static_cast<SInt32>(theClientID));
+            theClientLevels.AddSInt32(CFSTR(kEFFClientLevelsKey_ProcessID),
+                                      theSlot.processID.load(std::memory_order_relaxed));
+            theClientLevels.AddFloat64(CFSTR(kEFFClientLevelsKey_SampleTime), theSampleTime);
+            theClientLevels.AddFloat32(CFSTR(kEFFClientLevelsKey_PeakLeft), thePeak[0]);
+            theClientLevels.AddFloat32(CFSTR(kEFFClientLevelsKey_PeakRight), thePeak[1]);
+            theClientLevels.AddFloat32(CFSTR(kEFFClientLevelsKey_RMSLeft), theRMS[0]);
+            theClientLevels.AddFloat32(CFSTR(kEFFClientLevelsKey_RMSRight), theRMS[1]);
+
+            theLevels.AppendDictionary(theClientLevels.GetDict());
+        }
+    });
+
+    return theLevels;
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,98 @@
+//
+//  EFF_ClientMeters.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_ClientMeters_h
+#define EFF_ClientMeters_h
+
+// Local Includes
+#include "EFF_ClientSlots.h"
+
+// PublicUtility Includes
+#include "CACFArray.h"
+
+// STL Includes
+#include <atomic>
+
+// System Includes
+#include <CoreAudio/AudioServerPlugIn.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_ClientMeters
+//
+//  The peak and RMS levels of the last buffer each client played, for
+//  kAudioDeviceCustomPropertyClientLevels.
+//
+//  The levels are written on the IO thread during ProcessOutput and read by whichever thread the
+//  HAL uses to get the property, so neither side takes a lock. Each client gets a slot in an
+//  EFF_ClientSlots and each slot is a seqlock: the IO thread makes the slot's sequence number odd
+//  while it writes and even again after, and readers retry if the number was odd or changed while
+//  they were copying the levels out.
+//
+//  Slots are claimed and released by AddClient/RemoveClient, which aren't real-time safe and must
+//  not be called concurrently with each other. (EFF_Clients calls them while holding its mutex.)
+//  Methods whose names end with "RT" can only safely be called from real-time threads.
+//==================================================================================================
+
+class EFF_ClientMeters
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_ClientMeters() = default;
+                                EFF_ClientMeters(const EFF_ClientMeters&) = delete;
+                                EFF_ClientMeters& operator=(const EFF_ClientMeters&) = delete;
+
+    // Claims a slot for the client.
+    void                        AddClient(UInt32 inClientID, pid_t inProcessID);
+    void                        RemoveClient(UInt32 inClientID);
+
+#pragma mark IO Operations
+
+    // Publishes the levels of the buffer at inSampleTime for the client. Does nothing if the client
+    // doesn't have a slot. Only one thread can call this for a given client at a time.
+    void                        StoreLevelsRT(UInt32 inClientID,
+                                              Float64 inSampleTime,
+                                              const Float32 inPeak[2],
+                                              const Float32 inRMS[2]);
+
+#pragma mark Accessors
+
+    // Copies the levels into an array in the format of kAudioDeviceCustomPropertyClientLevels.
+    // Clients that haven't played any audio yet are left out.
+    CACFArray                   CopyLevels() const;
+
+#pragma mark Implementation
+
+private:
+    enum : UInt32
+    {
+        // How many times a reader will retry a slot that keeps being written to before skipping it.
+        kMaxReadAttempts = 8
+    };
+
+    struct Slot
+    {
+        std::atomic<pid_t>      processID  { 0 };
+        std::atomic<UInt32>     sequence   { 0 };
+        // Guarded by sequence.
+        std::atomic<Float64>    sampleTime { 0.0 };
+        std::atomic<Float32>    peak[2]    { { 0.0f }, { 0.0f } };
+        std::atomic<Float32>    rms[2]     { { 0.0f }, { 0.0f } };
+    };
+
+    EFF_ClientSlots<Slot>       mSlots;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_ClientMeters_h */
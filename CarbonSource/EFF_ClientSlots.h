@@ -0,0 +1,247 @@
+//
+//  EFF_ClientSlots.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_ClientSlots_h
+#define EFF_ClientSlots_h
+
+// STL Includes
+#include <atomic>
+
+// System Includes
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_ClientSlots
+//
+//  A table of per-client data that the IO thread can look up by client ID without locking or
+//  allocating. Each client gets a preallocated slot, found by probing from the client's ID, and the
+//  slot's Payload holds whatever the owning class keeps for the client.
+//
+//  The slots come in segments of kSegmentSize. When every slot is in use, Claim adds a segment, so
+//  the table never runs out. Segments are only freed when the table is destroyed, so a reader never
+//  uses freed memory, but a slot can be released and given to another client while a reader is
+//  using it. Payloads that need to detect that have to do it themselves.
+//
+//  Claim and Release aren't real-time safe and must not be called concurrently with each other.
+//  (The owning classes call them while holding a mutex.) Find and ForEach can be called from any
+//  thread.
+//==================================================================================================
+
+template <typename Payload>
+class EFF_ClientSlots
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_ClientSlots() = default;
+                                ~EFF_ClientSlots();
+                                EFF_ClientSlots(const EFF_ClientSlots&) = delete;
+                                EFF_ClientSlots& operator=(const EFF_ClientSlots&) = delete;
+
+    // Gives the client a slot, calls inInitialize(Payload&) with the slot's payload and then
+    // publishes the slot, so readers never see a payload that hasn't been initialized. Returns
+    // false, without calling inInitialize, if the client already has a slot. Throws std::bad_alloc
+    // if it has to add a segment and can't.
+    template <typename Initializer>
+    bool                        Claim(UInt32 inClientID, Initializer inInitialize);
+    // Releases the client's slot and returns its payload, or nullptr if it didn't have one. The
+    // payload can still be read until the next call to Claim.
+    Payload* __nullable         Release(UInt32 inClientID);
+
+#pragma mark Accessors
+
+    // Returns the client's payload, or nullptr if it doesn't have a slot. Real-time safe.
+    Payload* __nullable         Find(UInt32 inClientID)
+                                    { Slot* theSlot = FindSlot(inClientID); return theSlot ? &theSlot->payload : nullptr; }
+    const Payload* __nullable   Find(UInt32 inClientID) const
+                                    { return const_cast<EFF_ClientSlots*>(this)->Find(inClientID); }
+
+    // Calls inFunction(UInt32 inClientID, Payload& ioPayload) for each client that has a slot.
+    // Real-time safe if inFunction is.
+    template <typename Function>
+    void                        ForEach(Function inFunction);
+    template <typename Function>
+    void                        ForEach(Function inFunction) const;
+
+#pragma mark Implementation
+
+private:
+    enum : UInt32
+    {
+        // Must be a power of two.
+        kSegmentSize = 64
+    };
+
+    // A slot's key is its client's ID offset past these, so any client ID can have a slot.
+    enum : UInt64
+    {
+        // A slot that has never been used. Probing stops at these.
+        kSlotEmpty = 0,
+        // A slot that was released. Probing continues past these, but Claim can reuse them.
+        kSlotReleased = 1,
+        kFirstClientKey = 2
+    };
+
+    struct Slot
+    {
+        std::atomic<UInt64>     key { kSlotEmpty };
+        Payload                 payload;
+    };
+
+    struct Segment
+    {
+        Slot                    slots[kSegmentSize];
+        std::atomic<Segment*>   next { nullptr };
+    };
+
+    static UInt64               KeyFor(UInt32 inClientID)
+                                    { return static_cast<UInt64>(inClientID) + kFirstClientKey; }
+
+    Slot* __nullable            FindSlot(UInt32 inClientID);
+
+    Segment                     mFirstSegment;
+
+};
+
+#pragma mark Template Definitions
+
+template <typename Payload>
+EFF_ClientSlots<Payload>::~EFF_ClientSlots()
+{
+    Segment* theSegment = mFirstSegment.next.load(std::memory_order_relaxed);
+
+    while(theSegment != nullptr)
+    {
+        Segment* theNextSegment = theSegment->next.load(std::memory_order_relaxed);
+        delete theSegment;
+        theSegment = theNextSegment;
+    }
+}
+
+template <typename Payload>
+template <typename Initializer>
+bool    EFF_ClientSlots<Payload>::Claim(UInt32 inClientID, Initializer inInitialize)
+{
+    if(FindSlot(inClientID) != nullptr)
+    {
+        return false;
+    }
+
+    Segment* theSegment = &mFirstSegment;
+
+    while(true)
+    {
+        for(UInt32 i = 0; i < kSegmentSize; i++)
+        {
+            Slot& theSlot = theSegment->slots[(inClientID + i) & (kSegmentSize - 1)];
+            UInt64 theKey = theSlot.key.load(std::memory_order_relaxed);
+
+            if(theKey == kSlotEmpty || theKey == kSlotReleased)
+            {
+                // Nothing can be using the slot, so we can reset it before publishing the client ID.
+                inInitialize(theSlot.payload);
+                theSlot.key.store(KeyFor(inClientID), std::memory_order_release);
+                return true;
+            }
+        }
+
+        Segment* theNextSegment = theSegment->next.load(std::memory_order_relaxed);
+
+        if(theNextSegment == nullptr)
+        {
+            // Every slot is in use. The new segment's slots are all empty, so readers can probe it
+            // as soon as it's linked.
+            theNextSegment = new Segment;
+            theSegment->next.store(theNextSegment, std::memory_order_release);
+        }
+
+        theSegment = theNextSegment;
+    }
+}
+
+template <typename Payload>
+Payload* __nullable    EFF_ClientSlots<Payload>::Release(UInt32 inClientID)
+{
+    Slot* theSlot = FindSlot(inClientID);
+
+    if(theSlot == nullptr)
+    {
+        return nullptr;
+    }
+
+    theSlot->key.store(kSlotReleased, std::memory_order_release);
+
+    return &theSlot->payload;
+}
+
+template <typename Payload>
+template <typename Function>
+void    EFF_ClientSlots<Payload>::ForEach(Function inFunction)
+{
+    for(Segment* theSegment = &mFirstSegment;
+        theSegment != nullptr;
+        theSegment = theSegment->next.load(std::memory_order_acquire))
+    {
+        for(Slot& theSlot : theSegment->slots)
+        {
+            UInt64 theKey = theSlot.key.load(std::memory_order_acquire);
+
+            if(theKey != kSlotEmpty && theKey != kSlotReleased)
+            {
+                inFunction(static_cast<UInt32>(theKey - kFirstClientKey), theSlot.payload);
+            }
+        }
+    }
+}
+
+template <typename Payload>
+template <typename Function>
+void    EFF_ClientSlots<Payload>::ForEach(Function inFunction)
+const
+{
+    const_cast<EFF_ClientSlots*>(this)->ForEach([&] (UInt32 inClientID, const Payload& inPayload) {
+        inFunction(inClientID, inPayload);
+    });
+}
+
+template <typename Payload>
+typename EFF_ClientSlots<Payload>::Slot* __nullable    EFF_ClientSlots<Payload>::FindSlot(UInt32 inClientID)
+{
+    UInt64 theKey = KeyFor(inClientID);
+
+    // The client is in the first segment whose probe sequence reaches it before an empty slot.
+    for(Segment* theSegment = &mFirstSegment;
+        theSegment != nullptr;
+        theSegment = theSegment->next.load(std::memory_order_acquire))
+    {
+        for(UInt32 i = 0; i < kSegmentSize; i++)
+        {
+            UInt64 theSlotKey = theSegment->slots[(inClientID + i) & (kSegmentSize - 1)].key.load(std::memory_order_acquire);
+
+            if(theSlotKey == theKey)
+            {
+                return &theSegment->slots[(inClientID + i) & (kSegmentSize - 1)];
+            }
+            else if(theSlotKey == kSlotEmpty)
+            {
+                break;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_ClientSlots_h */
+
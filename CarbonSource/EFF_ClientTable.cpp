@@ -0,0 +1,137 @@
+//
+//  EFF_ClientTable.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_ClientTable.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+
+// STL Includes
+#include <algorithm>
+#include <iterator>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+EFF_ClientTable::EFF_ClientTable()
+:
+    mBuckets(kMinNumBuckets),
+    mBucketMask(kMinNumBuckets - 1)
+{
+    for(Bucket& theBucket : mBuckets)
+    {
+        std::fill(std::begin(theBucket.clientIDs), std::end(theBucket.clientIDs), kEmptyClientID);
+    }
+}
+
+#pragma mark Accessors
+
+void    EFF_ClientTable::Assign(const std::map<UInt32, EFF_Client>& inClients)
+{
+    // Keep the table at most half full so probes are short.
+    size_t theNumBuckets = kMinNumBuckets;
+
+    while(theNumBuckets * kSlotsPerBucket < inClients.size() * 2)
+    {
+        theNumBuckets *= 2;
+    }
+
+    if(theNumBuckets > mBuckets.size())
+    {
+        DebugMsg("EFF_ClientTable::Assign: Growing to %zu buckets for %zu clients",
+                 theNumBuckets,
+                 inClients.size());
+        mBuckets.resize(theNumBuckets);
+        mBucketMask = static_cast<UInt32>(theNumBuckets - 1);
+    }
+
+    for(Bucket& theBucket : mBuckets)
+    {
+        std::fill(std::begin(theBucket.clientIDs), std::end(theBucket.clientIDs), kEmptyClientID);
+    }
+
+    for(auto& theClientEntry : inClients)
+    {
+        const EFF_Client& theClient = theClientEntry.second;
+        UInt32 theBucketIndex = BucketIndex(theClient.mClientID);
+        bool didInsert = false;
+
+        // There's always an empty slot because the table is at most half full.
+        while(!didInsert)
+        {
+            Bucket& theBucket = mBuckets[theBucketIndex];
+
+            for(UInt32 i = 0; i < kSlotsPerBucket && !didInsert; i++)
+            {
+                if(theBucket.clientIDs[i] == kEmptyClientID)
+                {
+                    theBucket.clientIDs[i] = theClient.mClientID;
+                    theBucket.entries[i].relativeVolume = theClient.mRelativeVolume;
+                    theBucket.entries[i].panPosition = theClient.mPanPosition;
+                    theBucket.entries[i].isMusicPlayer = theClient.mIsMusicPlayer;
+                    didInsert = true;
+                }
+            }
+
+            theBucketIndex = (theBucketIndex + 1) & mBucketMask;
+        }
+    }
+}
+
+bool    EFF_ClientTable::Find(UInt32 inClientID, Entry& outEntry)
+const
+{
+    if(inClientID == kEmptyClientID)
+    {
+        return false;
+    }
+
+    UInt32 theBucketIndex = BucketIndex(inClientID);
+
+    // Stops at the first empty slot, and there's always one because the table is at most half full.
+    while(true)
+    {
+        const Bucket& theBucket = mBuckets[theBucketIndex];
+
+        for(UInt32 i = 0; i < kSlotsPerBucket; i++)
+        {
+            if(theBucket.clientIDs[i] == inClientID)
+            {
+                outEntry = theBucket.entries[i];
+                return true;
+            }
+            else if(theBucket.clientIDs[i] == kEmptyClientID)
+            {
+                return false;
+            }
+        }
+
+        theBucketIndex = (theBucketIndex + 1) & mBucketMask;
+    }
+}
+
+void    EFF_ClientTable::Swap(EFF_ClientTable& ioOther)
+{
+    mBuckets.swap(ioOther.mBuckets);
+    std::swap(mBucketMask, ioOther.mBucketMask);
+}
+
+#pragma mark Implementation
+
+UInt32    EFF_ClientTable::BucketIndex(UInt32 inClientID)
+const
+{
+    // The HAL gives out client IDs in sequence, which would fill the buckets evenly anyway, but
+    // spread them with a Fibonacci hash in case it doesn't.
+    return (inClientID * 2654435769u) >> 16 & mBucketMask;
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,104 @@
+//
+//  EFF_ClientTable.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_ClientTable_h
+#define EFF_ClientTable_h
+
+// Local Includes
+#include "EFF_Client.h"
+
+// STL Includes
+#include <map>
+#include <vector>
+
+// System Includes
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_ClientTable
+//
+//  The fields of each client that the IO thread reads, in an open-addressed hash table keyed by
+//  client ID. EFF_ClientMap keeps one of these next to each of its client maps and swaps them
+//  together, so looking a client up during IO is a hash and a scan of one or two cache lines,
+//  rather than walking a std::map's nodes and copying the whole EFF_Client, which retains and
+//  releases its bundle ID.
+//
+//  The slots are grouped into cache-line-aligned buckets. Probing scans a bucket's client IDs and
+//  moves on to the next bucket if they're all taken, until it finds the client or an empty slot.
+//  The table is rebuilt from scratch by Assign, so there are no tombstones, and is kept at most
+//  half full. Assign only allocates when the table has to grow, which it does on the non-real-time
+//  thread that edits the shadow maps. Swapping tables never allocates.
+//
+//  Find is real-time safe. The other methods aren't. Nothing here is thread safe.
+//==================================================================================================
+
+class EFF_ClientTable
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_ClientTable();
+                                EFF_ClientTable(const EFF_ClientTable&) = delete;
+                                EFF_ClientTable& operator=(const EFF_ClientTable&) = delete;
+
+#pragma mark Accessors
+
+    // The fields of a client that are used during IO. See EFF_Client.
+    struct Entry
+    {
+        Float32                 relativeVolume  = 1.0f;
+        SInt32                  panPosition     = 0;
+        bool                    isMusicPlayer   = false;
+    };
+
+    // Replaces the table's contents with the clients in inClients, growing the table first if they
+    // wouldn't fit.
+    void                        Assign(const std::map<UInt32, EFF_Client>& inClients);
+
+    // Returns true and sets outEntry if the client is in the table. Real-time safe.
+    bool                        Find(UInt32 inClientID, Entry& outEntry) const;
+
+    void                        Swap(EFF_ClientTable& ioOther);
+
+#pragma mark Implementation
+
+private:
+    enum : UInt32
+    {
+        // Client IDs are never 0, so it marks the empty slots.
+        kEmptyClientID = 0,
+        kSlotsPerBucket = 4,
+        // Enough for 32 clients without growing. Must be a power of two.
+        kMinNumBuckets = 16
+    };
+
+    // One cache line. The client IDs are together so a probe only reads four of them, and the
+    // fields of a client in the bucket are in the same line.
+    struct alignas(64) Bucket
+    {
+        UInt32                  clientIDs[kSlotsPerBucket];
+        Entry                   entries[kSlotsPerBucket];
+    };
+
+    static_assert(sizeof(Bucket) == 64, "EFF_ClientTable::Bucket should fill exactly one cache line");
+
+    UInt32                      BucketIndex(UInt32 inClientID) const;
+
+    std::vector<Bucket>         mBuckets;
+    // mBuckets.size() - 1.
+    UInt32                      mBucketMask;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_ClientTable_h */
@@ -12,7 +12,6 @@
 #define EFF_ClientTasks_h
 
 // Local Includes
-#include "EFF_Clients.h"
 #include "EFF_ClientMap.h"
 
 
@@ -27,10 +26,6 @@ class EFF_ClientTasks
     friend class EFF_TaskQueue;
 
 private:
-    static bool                 StartIONonRT(EFF_Clients* inClients, UInt32 inClientID)
-                                    { return inClients->StartIONonRT(inClientID); }
-    static bool                 StopIONonRT(EFF_Clients* inClients, UInt32 inClientID)
-                                    { return inClients->StopIONonRT(inClientID); }
     static void                 SwapInShadowMapsRT(EFF_ClientMap* inClientMap)
                                     { inClientMap->SwapInShadowMapsRT(); }
 };
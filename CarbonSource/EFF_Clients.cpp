@@ -16,7 +16,9 @@
 // PublicUtility Includes
 #include "CAException.h"
 #include "CACFDictionary.h"
-#include "CADispatchQueue.h"
+
+// STL Includes
+#include <algorithm>
 
 
 #pragma mark Construction/Destruction
@@ -25,12 +27,18 @@ EFF_Clients::EFF_Clients(AudioObjectID inOwnerDeviceID,
                          EFF_TaskQueue* inTaskQueue)
 :
     mOwnerDeviceID(inOwnerDeviceID),
-    mClientMap(inTaskQueue)
+    mTaskQueue(inTaskQueue),
+    mClientMap(inTaskQueue),
+    mRelativeVolumeTable([] {
+        CAVolumeCurve theCurve;
+        theCurve.AddRange(kAppRelativeVolumeMinRawValue,
+                          kAppRelativeVolumeMaxRawValue,
+                          kAppRelativeVolumeMinDbValue,
+                          kAppRelativeVolumeMaxDbValue);
+        return theCurve;
+    }()),
+    mEFFAppBundleID(EFF_BundleIDs::Intern(CFSTR(kEFFAppBundleID)))
 {
-    mRelativeVolumeCurve.AddRange(kAppRelativeVolumeMinRawValue,
-                                  kAppRelativeVolumeMaxRawValue,
-                                  kAppRelativeVolumeMinDbValue,
-                                  kAppRelativeVolumeMaxDbValue);
 }
 
 
@@ -44,9 +52,8 @@ void    EFF_Clients::AddClient(EFF_Client inClient)
     bool pidMatchesMusicPlayerProperty =
         (mMusicPlayerProcessIDProperty != 0 && inClient.mProcessID == mMusicPlayerProcessIDProperty);
     bool bundleIDMatchesMusicPlayerProperty =
-        (mMusicPlayerBundleIDProperty != "" &&
-         inClient.mBundleID.IsValid() &&
-         inClient.mBundleID == mMusicPlayerBundleIDProperty);
+        (mMusicPlayerBundleID != EFF_BundleIDs::kNone &&
+         inClient.mBundleID == mMusicPlayerBundleID);
     inClient.mIsMusicPlayer = (pidMatchesMusicPlayerProperty || bundleIDMatchesMusicPlayerProperty);
 
     if(inClient.mIsMusicPlayer)
@@ -55,9 +62,13 @@ void    EFF_Clients::AddClient(EFF_Client inClient)
     }
 
     mClientMap.AddClient(inClient);
+    mClientIOStates.AddClient(inClient.mClientID, inClient.mBundleID == mEFFAppBundleID);
+    mClientMeters.AddClient(inClient.mClientID, inClient.mProcessID);
+    mClientEQ.AddClient(inClient.mClientID, inClient.mProcessID, inClient.mBundleID);
+    mDuckingRules.AddClient(inClient.mClientID, inClient.mBundleID);
 
     // If we're adding EFFApp, update our local copy of its client ID
-    if(inClient.mBundleID.IsValid() && inClient.mBundleID == kEFFAppBundleID)
+    if(inClient.mBundleID == mEFFAppBundleID)
     {
         mEFFAppClientID = inClient.mClientID;
     }
@@ -68,6 +79,12 @@ void    EFF_Clients::RemoveClient(const UInt32 inClientID)
     CAMutex::Locker theLocker(mMutex);
     
     EFF_Client theRemovedClient = mClientMap.RemoveClient(inClientID);
+    // Take the client out of the IO counts if the HAL removed it without stopping its IO, so the
+    // device doesn't report that it's running forever.
+    SendIORunningNotifications(mClientIOStates.RemoveClient(inClientID));
+    mClientMeters.RemoveClient(inClientID);
+    mClientEQ.RemoveClient(inClientID);
+    mDuckingRules.RemoveClient(inClientID);
     
     // If we're removing EFFApp, clear our local copy of its client ID
     if(theRemovedClient.mClientID == mEFFAppClientID)
@@ -79,153 +96,70 @@ void    EFF_Clients::RemoveClient(const UInt32 inClientID)
 
 #pragma mark IO Status
 
-// Start IO for inClientID and update stats.
-// Return true if no other clients were running IO before this one started, which means the device should start IO
-bool    EFF_Clients::StartIONonRT(UInt32 inClientID)
+bool    EFF_Clients::StartIO(UInt32 inClientID)
 {
-    CAMutex::Locker theLocker(mMutex);
-    // get client from inClientID
-    EFF_Client theClient;
-    bool didFindClient = mClientMap.GetClientNonRT(inClientID, &theClient);
-    ThrowIf(!didFindClient,
-            EFF_InvalidClientException(),
-            "EFF_Clients::StartIO: Cannot start IO for client that was never added");
-
-    bool didStartIO = false; // the value to be returned
-    bool sendIsRunningNotification = false;
-    bool sendIsRunningSomewhereOtherThanEFFAppNotification = false;
-
-    if(!theClient.mDoingIO)
-    {
-        // Make sure we can start
-        ThrowIf(mStartCount == UINT64_MAX,
-                CAException(kAudioHardwareIllegalOperationError),
-                "EFF_Clients::StartIO: failed to start because the ref count was maxxed out already");
-
-        DebugMsg("EFF_Clients::StartIO: Client %u (%s, %d) starting IO",
-                 inClientID,
-                 CFStringGetCStringPtr(theClient.mBundleID.GetCFString(), kCFStringEncodingUTF8),
-                 theClient.mProcessID);
-        
-        mClientMap.StartIONonRT(inClientID);
-        
-        mStartCount++;
-        
-        // Update mStartCountExcludingEFFApp
-        if(!IsEFFApp(inClientID))
-        {
-            ThrowIf(mStartCountExcludingEFFApp == UINT64_MAX,
-                    CAException(kAudioHardwareIllegalOperationError),
-                    "EFF_Clients::StartIO: failed to start because mStartCountExcludingEFFApp was maxxed out already");
+    EFF_ClientIOStates::Transition theTransition = mClientIOStates.StartIO(inClientID);
 
-            mStartCountExcludingEFFApp++;
-            
-            if(mStartCountExcludingEFFApp == 1)
-            {
-                sendIsRunningSomewhereOtherThanEFFAppNotification = true;
-            }
-        }
-        
-        didStartIO = (mStartCount == 1);
-        sendIsRunningNotification = didStartIO;
+    if(!theTransition.foundClient)
+    {
+        // The HAL can race a client's StartIO with removing it. There's nothing to start.
+        DebugMsg("EFF_Clients::StartIO: Ignoring unknown client %u", inClientID);
+        return false;
     }
-    
-    Assert(mStartCountExcludingEFFApp == mStartCount - 1 || mStartCountExcludingEFFApp == mStartCount,
-           "mStartCount and mStartCountExcludingEFFApp are out of sync");
-    
-    SendIORunningNotifications(sendIsRunningNotification,
-                               sendIsRunningSomewhereOtherThanEFFAppNotification);
 
-    return didStartIO;
+    DebugMsg("EFF_Clients::StartIO: Client %u started IO. changedIsRunning=%d",
+             inClientID,
+             theTransition.changedIsRunning);
+
+    SendIORunningNotifications(theTransition);
+
+    return theTransition.changedIsRunning;
 }
 
-// Stop IO for inClientID and update stats.
-// Return true if we stopped IO entirely (i.e. there are no clients still running IO)
-bool    EFF_Clients::StopIONonRT(UInt32 inClientID)
+bool    EFF_Clients::StopIO(UInt32 inClientID)
 {
-    CAMutex::Locker theLocker(mMutex);
+    EFF_ClientIOStates::Transition theTransition = mClientIOStates.StopIO(inClientID);
 
-    // get client from inClientID
-    EFF_Client theClient;
-    bool didFindClient = mClientMap.GetClientNonRT(inClientID, &theClient);
-    ThrowIf(!didFindClient,
-            EFF_InvalidClientException(),
-            "EFF_Clients::StopIO: Cannot stop IO for client that was never added");
-    
-    bool didStopIO = false; // the value to be returned
-    bool sendIsRunningNotification = false;
-    bool sendIsRunningSomewhereOtherThanEFFAppNotification = false;
-    
-    if(theClient.mDoingIO)
+    if(!theTransition.foundClient)
     {
-        DebugMsg("EFF_Clients::StopIO: Client %u (%s, %d) stopping IO",
-                 inClientID,
-                 CFStringGetCStringPtr(theClient.mBundleID.GetCFString(), kCFStringEncodingUTF8),
-                 theClient.mProcessID);
-        
-        mClientMap.StopIONonRT(inClientID);
-        
-        ThrowIf(mStartCount <= 0,
-                CAException(kAudioHardwareIllegalOperationError),
-                "EFF_Clients::StopIO: Underflowed mStartCount");
-        
-        mStartCount--;
-        
-        // Update mStartCountExcludingEFFApp
-        if(!IsEFFApp(inClientID))
-        {
-            ThrowIf(mStartCountExcludingEFFApp <= 0,
-                    CAException(kAudioHardwareIllegalOperationError),
-                    "EFF_Clients::StopIO: Underflowed mStartCountExcludingEFFApp");
-            
-            mStartCountExcludingEFFApp--;
-            
-            if(mStartCountExcludingEFFApp == 0)
-            {
-                sendIsRunningSomewhereOtherThanEFFAppNotification = true;
-            }
-        }
-
-        didStopIO = (mStartCount == 0);
-        sendIsRunningNotification = didStopIO;
+        // RemoveClient already stopped the client's IO, if it was doing any.
+        DebugMsg("EFF_Clients::StopIO: Ignoring unknown client %u", inClientID);
+        return false;
     }
-    
-    Assert(mStartCountExcludingEFFApp == mStartCount - 1 || mStartCountExcludingEFFApp == mStartCount,
-           "mStartCount and mStartCountExcludingEFFApp are out of sync");
-    
-    SendIORunningNotifications(sendIsRunningNotification, sendIsRunningSomewhereOtherThanEFFAppNotification);
-    
-    return didStopIO;
+
+    DebugMsg("EFF_Clients::StopIO: Client %u stopped IO. changedIsRunning=%d",
+             inClientID,
+             theTransition.changedIsRunning);
+
+    SendIORunningNotifications(theTransition);
+
+    return theTransition.changedIsRunning;
+}
+
+void    EFF_Clients::StartIORT(UInt32 inClientID)
+{
+    SendIORunningNotifications(mClientIOStates.StartIO(inClientID));
+}
+
+void    EFF_Clients::StopIORT(UInt32 inClientID)
+{
+    SendIORunningNotifications(mClientIOStates.StopIO(inClientID));
 }
 
 // Sends PropertiesChanged notifications for kAudioDevicePropertyDeviceIsRunning and
 // kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp
-void    EFF_Clients::SendIORunningNotifications(bool sendIsRunningNotification,
-                                                bool sendIsRunningSomewhereOtherThanEFFAppNotification)
+void    EFF_Clients::SendIORunningNotifications(const EFF_ClientIOStates::Transition& inTransition)
 const
 {
-    if(sendIsRunningNotification || sendIsRunningSomewhereOtherThanEFFAppNotification)
+    if(inTransition.changedIsRunning)
     {
-        CADispatchQueue::GetGlobalSerialQueue().Dispatch(false, ^{
-            AudioObjectPropertyAddress theChangedProperties[2];
-            UInt32 theNotificationCount = 0;
-
-            if(sendIsRunningNotification)
-            {
-                DebugMsg("EFF_Clients::SendIORunningNotifications: Sending kAudioDevicePropertyDeviceIsRunning");
-                theChangedProperties[0] = { kAudioDevicePropertyDeviceIsRunning, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster };
-                theNotificationCount++;
-            }
-
-            if(sendIsRunningSomewhereOtherThanEFFAppNotification)
-            {
-                DebugMsg("EFF_Clients::SendIORunningNotifications: Sending kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp");
-                theChangedProperties[theNotificationCount] = kEFFRunningSomewhereOtherThanEFFAppAddress;
-                theNotificationCount++;
-            }
+        mTaskQueue->QueueAsync_SendPropertyNotification(kAudioDevicePropertyDeviceIsRunning, mOwnerDeviceID);
+    }
 
-            EFF_PlugIn::Host_PropertiesChanged(mOwnerDeviceID, theNotificationCount, theChangedProperties);
-        });
+    if(inTransition.changedIsRunningSomewhereOtherThanEFFApp)
+    {
+        mTaskQueue->QueueAsync_SendPropertyNotification(kEFFRunningSomewhereOtherThanEFFAppAddress.mSelector,
+                                                        mOwnerDeviceID);
     }
 }
 
@@ -248,6 +182,7 @@ bool    EFF_Clients::SetMusicPlayer(const pid_t inPID)
     mMusicPlayerProcessIDProperty = inPID;
     // Unset the bundle ID property
     mMusicPlayerBundleIDProperty = "";
+    mMusicPlayerBundleID = EFF_BundleIDs::kNone;
     
     DebugMsg("EFF_Clients::SetMusicPlayer: Setting music player by PID. inPID=%d", inPID);
     
@@ -270,11 +205,12 @@ bool    EFF_Clients::SetMusicPlayer(const CACFString inBundleID)
     }
 
     mMusicPlayerBundleIDProperty = inBundleID;
+    mMusicPlayerBundleID = (inBundleID == "") ? EFF_BundleIDs::kNone : EFF_BundleIDs::Intern(inBundleID);
     // Unset the PID property
     mMusicPlayerProcessIDProperty = 0;
     
     DebugMsg("EFF_Clients::SetMusicPlayer: Setting music player by bundle ID. inBundleID=%s",
-             CFStringGetCStringPtr(inBundleID.GetCFString(), kCFStringEncodingUTF8));
+             EFF_BundleIDs::GetCString(mMusicPlayerBundleID));
     
     // Update the clients' mIsMusicPlayer fields
     mClientMap.UpdateMusicPlayerFlags(inBundleID);
@@ -285,9 +221,9 @@ bool    EFF_Clients::SetMusicPlayer(const CACFString inBundleID)
 bool    EFF_Clients::IsMusicPlayerRT(const UInt32 inClientID)
 const
 {
-    EFF_Client theClient;
-    bool didGetClient = mClientMap.GetClientRT(inClientID, &theClient);
-    return didGetClient && theClient.mIsMusicPlayer;
+    EFF_ClientTable::Entry theClient;
+    bool didGetClient = mClientMap.GetClientRT(inClientID, theClient);
+    return didGetClient && theClient.isMusicPlayer;
 }
 
 #pragma mark App Volumes
@@ -296,108 +232,237 @@ const
 Float32 EFF_Clients::GetClientRelativeVolumeRT(UInt32 inClientID)
 const
 {
-    EFF_Client theClient;
-    bool didGetClient = mClientMap.GetClientRT(inClientID, &theClient);
-    return (didGetClient ? theClient.mRelativeVolume : 1.0f);
+    EFF_ClientTable::Entry theClient;
+    bool didGetClient = mClientMap.GetClientRT(inClientID, theClient);
+    return (didGetClient ? theClient.relativeVolume : 1.0f);
 }
 
 // same for this one, see GetClientRelativeVolumeRT(UInt32)
 SInt32 EFF_Clients::GetClientPanPositionRT(UInt32 inClientID)
 const
 {
-    EFF_Client theClient;
-    bool didGetClient = mClientMap.GetClientRT(inClientID, &theClient);
-    return (didGetClient ? theClient.mPanPosition : kAppPanCenterRawValue);
+    EFF_ClientTable::Entry theClient;
+    bool didGetClient = mClientMap.GetClientRT(inClientID, theClient);
+    return (didGetClient ? theClient.panPosition : kAppPanCenterRawValue);
 }
 
 bool    EFF_Clients::SetClientsRelativeVolumes(const CACFArray inAppVolumes)
 {
-    bool didChangeAppVolumes = false;
+    // Parse every element first, so an invalid one means none of the changes are made.
+    std::vector<AppVolume> theAppVolumes;
+    theAppVolumes.reserve(inAppVolumes.GetNumberItems());
     
     // Each element in appVolumes is a CFDictionary containing the process id and/or bundle id of an app, and its
     // new relative volume
     for(UInt32 i = 0; i < inAppVolumes.GetNumberItems(); i++)
     {
-        CACFDictionary theAppVolume(false);
-        inAppVolumes.GetCACFDictionary(i, theAppVolume);
-        
-        // Get the app's PID from the dict
-        pid_t theAppPID;
-        bool didFindPID = theAppVolume.GetSInt32(CFSTR(kEFFAppVolumesKey_ProcessID), theAppPID);
+        CACFDictionary theAppVolumeDict(false);
+        inAppVolumes.GetCACFDictionary(i, theAppVolumeDict);
         
-        // Get the app's bundle ID from the dict
-        CACFString theAppBundleID;
-        theAppBundleID.DontAllowRelease();
-        theAppVolume.GetCACFString(CFSTR(kEFFAppVolumesKey_BundleID), theAppBundleID);
-        
-        ThrowIf(!didFindPID && !theAppBundleID.IsValid(),
-                EFF_InvalidClientRelativeVolumeException(),
-                "EFF_Clients::SetClientsRelativeVolumes: App volume was sent without PID or bundle ID for app");
-        
-        bool didGetVolume;
+        theAppVolumes.push_back(ParseAppVolume(theAppVolumeDict));
+    }
+    
+    return SetClientsRelativeVolumes(theAppVolumes);
+}
+
+bool    EFF_Clients::SetClientsRelativeVolumes(const EFF_PackedProperties::Reader& inAppVolumes)
+{
+    std::vector<AppVolume> theAppVolumes;
+    theAppVolumes.reserve(inAppVolumes.GetNumEntries());
+    
+    for(UInt32 i = 0; i < inAppVolumes.GetNumEntries(); i++)
+    {
+        EFF_PackedAppVolume theAppVolume = inAppVolumes.GetEntry<EFF_PackedAppVolume>(i);
+        theAppVolumes.push_back(ParseAppVolume(theAppVolume, inAppVolumes.GetString(theAppVolume.bundleID)));
+    }
+    
+    return SetClientsRelativeVolumes(theAppVolumes);
+}
+
+bool    EFF_Clients::SetClientsRelativeVolumes(const std::vector<AppVolume>& inAppVolumes)
+{
+    // Gather the changes into one transaction, so the client map's shadow maps are only swapped in
+    // once however many apps are changed.
+    EFF_ClientMap::Transaction theTransaction(mClientMap);
+    
+    for(const AppVolume& theAppVolume : inAppVolumes)
+    {
+        if(theAppVolume.hasVolume)
         {
-            SInt32 theRawRelativeVolume;
-            didGetVolume = theAppVolume.GetSInt32(CFSTR(kEFFAppVolumesKey_RelativeVolume), theRawRelativeVolume);
-            
-            if (didGetVolume) {
-                ThrowIf(didGetVolume &&
-                        (theRawRelativeVolume < kAppRelativeVolumeMinRawValue ||
-                         theRawRelativeVolume > kAppRelativeVolumeMaxRawValue),
-                        EFF_InvalidClientRelativeVolumeException(),
-                        "EFF_Clients::SetClientsRelativeVolumes: Relative volume for app out of valid range");
-                
-                // Apply the volume curve to the raw volume
-                //
-                // mRelativeVolumeCurve uses the default kPow2Over1Curve transfer function, so we also multiply by 4 to
-                // keep the middle volume equal to 1 (meaning apps' volumes are unchanged by default).
-                Float32 theRelativeVolume = mRelativeVolumeCurve.ConvertRawToScalar(theRawRelativeVolume) * 4;
-
-                // Try to update the client's volume, first by PID and then by bundle ID. Always try
-                // both because apps can have multiple clients.
-                if(mClientMap.SetClientsRelativeVolume(theAppPID, theRelativeVolume))
-                {
-                    didChangeAppVolumes = true;
-                }
-
-                if(mClientMap.SetClientsRelativeVolume(theAppBundleID, theRelativeVolume))
-                {
-                    didChangeAppVolumes = true;
-                }
-
-                // TODO: If the app isn't currently a client, we should add it to the past clients
-                //       map, or update its past volume if it's already in there.
+            // Try to update the client's volume, first by PID and then by bundle ID. Always try
+            // both because apps can have multiple clients.
+            if(theAppVolume.hasProcessID)
+            {
+                theTransaction.SetClientsRelativeVolume(theAppVolume.processID, theAppVolume.relativeVolume);
+            }
+
+            if(theAppVolume.bundleID != EFF_BundleIDs::kNone)
+            {
+                theTransaction.SetClientsRelativeVolume(theAppVolume.bundleID, theAppVolume.relativeVolume);
             }
+
+            // TODO: If the app isn't currently a client, we should add it to the past clients
+            //       map, or update its past volume if it's already in there.
         }
         
-        bool didGetPanPosition;
+        if(theAppVolume.hasPanPosition)
         {
-            SInt32 thePanPosition;
-            didGetPanPosition = theAppVolume.GetSInt32(CFSTR(kEFFAppVolumesKey_PanPosition), thePanPosition);
-            if (didGetPanPosition) {
-                ThrowIf(didGetPanPosition && (thePanPosition < kAppPanLeftRawValue || thePanPosition > kAppPanRightRawValue),
-                                              EFF_InvalidClientPanPositionException(),
-                                              "EFF_Clients::SetClientsRelativeVolumes: Pan position for app out of valid range");
-                
-                if(mClientMap.SetClientsPanPosition(theAppPID, thePanPosition))
-                {
-                    didChangeAppVolumes = true;
-                }
-
-                if(mClientMap.SetClientsPanPosition(theAppBundleID, thePanPosition))
-                {
-                    didChangeAppVolumes = true;
-                }
-
-                // TODO: If the app isn't currently a client, we should add it to the past clients
-                //       map, or update its past pan position if it's already in there.
+            if(theAppVolume.hasProcessID)
+            {
+                theTransaction.SetClientsPanPosition(theAppVolume.processID, theAppVolume.panPosition);
             }
+
+            if(theAppVolume.bundleID != EFF_BundleIDs::kNone)
+            {
+                theTransaction.SetClientsPanPosition(theAppVolume.bundleID, theAppVolume.panPosition);
+            }
+
+            // TODO: If the app isn't currently a client, we should add it to the past clients
+            //       map, or update its past pan position if it's already in there.
         }
-        
-        ThrowIf(!didGetVolume && !didGetPanPosition,
+    }
+    
+    // True if any clients' relative volumes or pan positions were changed.
+    return theTransaction.Commit();
+}
+
+CFDataRef    EFF_Clients::CopyPackedAppVolumes()
+const
+{
+    std::vector<EFF_Client> theClients = mClientMap.CopyClientsWithNonDefaultSettings();
+
+    EFF_PackedProperties::Writer theWriter(kAudioDeviceCustomPropertyAppVolumes,
+                                           sizeof(EFF_PackedAppVolume),
+                                           theClients.size());
+
+    for(const EFF_Client& theClient : theClients)
+    {
+        EFF_PackedAppVolume theAppVolume;
+        theAppVolume.processID = theClient.mProcessID;
+        theAppVolume.bundleID = theWriter.AddBundleID(theClient.mBundleID);
+        // Reverse the volume conversion from ParseAppVolume
+        theAppVolume.relativeVolume = mRelativeVolumeTable.ConvertScalarToRaw(theClient.mRelativeVolume / 4);
+        theAppVolume.panPosition = theClient.mPanPosition;
+        theAppVolume.flags = kEFFPackedAppVolumeFlag_HasProcessID |
+                             kEFFPackedAppVolumeFlag_HasRelativeVolume |
+                             kEFFPackedAppVolumeFlag_HasPanPosition;
+
+        theWriter.AppendEntry(theAppVolume);
+    }
+
+    return theWriter.CopyCFData();
+}
+
+EFF_Clients::AppVolume    EFF_Clients::ParseAppVolume(const CACFDictionary& inAppVolume) const
+{
+    AppVolume theAppVolume;
+    
+    // Get the app's PID from the dict
+    theAppVolume.hasProcessID = inAppVolume.GetSInt32(CFSTR(kEFFAppVolumesKey_ProcessID),
+                                                      theAppVolume.processID);
+    
+    // Get the app's bundle ID from the dict
+    CFStringRef theBundleIDRef = nullptr;
+    if(inAppVolume.GetString(CFSTR(kEFFAppVolumesKey_BundleID), theBundleIDRef) &&
+       theBundleIDRef != nullptr)
+    {
+        theAppVolume.hasBundleID = true;
+        // The bundle ID is only used to find clients, so it doesn't need to be interned.
+        theAppVolume.bundleID = EFF_BundleIDs::Find(CACFString(theBundleIDRef, false));
+    }
+    
+    SInt32 theRawRelativeVolume = 0;
+    theAppVolume.hasVolume = inAppVolume.GetSInt32(CFSTR(kEFFAppVolumesKey_RelativeVolume),
+                                                   theRawRelativeVolume);
+    
+    theAppVolume.hasPanPosition = inAppVolume.GetSInt32(CFSTR(kEFFAppVolumesKey_PanPosition),
+                                                        theAppVolume.panPosition);
+    
+    FinishParsingAppVolume(theAppVolume, theRawRelativeVolume);
+    
+    return theAppVolume;
+}
+
+EFF_Clients::AppVolume    EFF_Clients::ParseAppVolume(const EFF_PackedAppVolume& inAppVolume,
+                                                      const char* __nullable inBundleID) const
+{
+    AppVolume theAppVolume;
+    
+    theAppVolume.hasProcessID = (inAppVolume.flags & kEFFPackedAppVolumeFlag_HasProcessID) != 0;
+    theAppVolume.processID = theAppVolume.hasProcessID ? inAppVolume.processID : 0;
+    
+    if(inBundleID != nullptr)
+    {
+        theAppVolume.hasBundleID = true;
+        theAppVolume.bundleID = EFF_BundleIDs::FindCString(inBundleID);
+    }
+    
+    theAppVolume.hasVolume = (inAppVolume.flags & kEFFPackedAppVolumeFlag_HasRelativeVolume) != 0;
+    theAppVolume.hasPanPosition = (inAppVolume.flags & kEFFPackedAppVolumeFlag_HasPanPosition) != 0;
+    theAppVolume.panPosition = theAppVolume.hasPanPosition ? inAppVolume.panPosition : 0;
+    
+    FinishParsingAppVolume(theAppVolume, inAppVolume.relativeVolume);
+    
+    return theAppVolume;
+}
+
+void    EFF_Clients::FinishParsingAppVolume(AppVolume& ioAppVolume, SInt32 inRawRelativeVolume) const
+{
+    ThrowIf(!ioAppVolume.hasProcessID && !ioAppVolume.hasBundleID,
+            EFF_InvalidClientRelativeVolumeException(),
+            "EFF_Clients::ParseAppVolume: App volume was sent without PID or bundle ID for app");
+    
+    if(ioAppVolume.hasVolume)
+    {
+        ThrowIf(inRawRelativeVolume < kAppRelativeVolumeMinRawValue ||
+                inRawRelativeVolume > kAppRelativeVolumeMaxRawValue,
                 EFF_InvalidClientRelativeVolumeException(),
-                "EFF_Clients::SetClientsRelativeVolumes: No volume or pan position in request");
+                "EFF_Clients::ParseAppVolume: Relative volume for app out of valid range");
+        
+        // Apply the volume curve to the raw volume
+        //
+        // mRelativeVolumeTable uses the default kPow2Over1Curve transfer function, so we also multiply by 4 to
+        // keep the middle volume equal to 1 (meaning apps' volumes are unchanged by default).
+        ioAppVolume.relativeVolume = mRelativeVolumeTable.ConvertRawToScalar(inRawRelativeVolume) * 4;
+    }
+    
+    ThrowIf(ioAppVolume.hasPanPosition &&
+            (ioAppVolume.panPosition < kAppPanLeftRawValue ||
+             ioAppVolume.panPosition > kAppPanRightRawValue),
+            EFF_InvalidClientPanPositionException(),
+            "EFF_Clients::ParseAppVolume: Pan position for app out of valid range");
+    
+    ThrowIf(!ioAppVolume.hasVolume && !ioAppVolume.hasPanPosition,
+            EFF_InvalidClientRelativeVolumeException(),
+            "EFF_Clients::ParseAppVolume: No volume or pan position in request");
+}
+
+std::vector<UInt32>    EFF_Clients::GetClientIDs(const AppVolume& inAppVolume) const
+{
+    std::vector<EFF_Client> theClients;
+    
+    if(inAppVolume.hasProcessID)
+    {
+        theClients = mClientMap.GetClientsByPID(inAppVolume.processID);
+    }
+    
+    if(inAppVolume.bundleID != EFF_BundleIDs::kNone)
+    {
+        std::vector<EFF_Client> theClientsByBundleID = mClientMap.GetClientsByBundleID(inAppVolume.bundleID);
+        theClients.insert(theClients.end(), theClientsByBundleID.begin(), theClientsByBundleID.end());
+    }
+    
+    std::vector<UInt32> theClientIDs;
+    
+    for(const EFF_Client& theClient : theClients)
+    {
+        // An app's clients can match by both PID and bundle ID.
+        if(std::find(theClientIDs.begin(), theClientIDs.end(), theClient.mClientID) == theClientIDs.end())
+        {
+            theClientIDs.push_back(theClient.mClientID);
+        }
     }
     
-    return didChangeAppVolumes;
+    return theClientIDs;
 }
 
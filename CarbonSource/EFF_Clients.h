@@ -11,21 +11,26 @@
 
 // Local Includes
 #include "EFF_Client.h"
+#include "EFF_ClientIOStates.h"
 #include "EFF_ClientMap.h"
+#include "EFF_ClientMeters.h"
+#include "EFF_ClientEQ.h"
+#include "EFF_DuckingRules.h"
+#include "EFF_PackedProperties.h"
+#include "EFF_VolumeCurveTable.h"
 
 // PublicUtility Includes
-#include "CAVolumeCurve.h"
 #include "CAMutex.h"
 #include "CACFArray.h"
+#include "CACFDictionary.h"
+
+// STL Includes
+#include <vector>
 
 // System Includes
 #include <CoreAudio/AudioServerPlugIn.h>
 
 
-// Forward Declations
-class EFF_ClientTasks;
-
-
 #pragma clang assume_nonnull begin
 
 //==================================================================================================
@@ -41,8 +46,6 @@ class EFF_ClientTasks;
 
 class EFF_Clients
 {
-    friend class EFF_ClientTasks;
-
 
 #pragma mark Construction/Destruction
 
@@ -54,15 +57,36 @@ public:
                                 EFF_Clients(const EFF_Clients&) = delete;
                                 EFF_Clients& operator=(const EFF_Clients&) = delete;
     
+    // Loads the settings of the device's past clients, which are saved in a file named after the
+    // device's UID. Should be called before any clients are added.
+    void                        OpenPastClients(CFStringRef inDeviceUID)
+                                    { mClientMap.OpenPastClients(inDeviceUID); }
+
     void                        AddClient(EFF_Client inClient);
     void                        RemoveClient(const UInt32 inClientID);
     
 
 #pragma mark API
+    // >>> IO state API <<<
+    // Marks the client as doing IO and sends notifications if that changes the value of
+    // kAudioDevicePropertyDeviceIsRunning or kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp.
+    // Returns true if no other clients were running IO before this one started, which means the
+    // device should start IO. Returns false if the client was never added or has been removed.
+    //
+    // StartIO, StopIO and their RT versions are applied in the order they're called, even from
+    // different threads, so there's no need to funnel them through a single thread.
+    bool                        StartIO(UInt32 inClientID);
+    // Returns true if this was the last client running IO, which means the device should stop IO.
+    bool                        StopIO(UInt32 inClientID);
+    // The same, but real-time safe. They don't tell the caller whether the device started or
+    // stopped.
+    void                        StartIORT(UInt32 inClientID);
+    void                        StopIORT(UInt32 inClientID);
+
     bool                        ClientsRunningIO() const
-                                    { return mStartCount > 0; }
+                                    { return mClientIOStates.IsRunning(); }
     bool                        ClientsOtherThanEFFAppRunningIO() const
-                                    { return mStartCountExcludingEFFApp > 0; }
+                                    { return mClientIOStates.IsRunningSomewhereOtherThanEFFApp(); }
     bool                        IsEFFApp(UInt32 inClientID) const
                                     { return inClientID == mEFFAppClientID; }
     bool                        EFFAppHasClientRegistered() const
@@ -73,6 +97,9 @@ public:
                                     { return mMusicPlayerProcessIDProperty; }
     inline CFStringRef          CopyMusicPlayerBundleIDProperty() const
                                     { return mMusicPlayerBundleIDProperty.CopyCFString(); }
+    // The music player's bundle ID, or EFF_BundleIDs::kNone if it's set by PID or unset.
+    inline EFF_BundleIDs::ID    GetMusicPlayerBundleID() const
+                                    { return mMusicPlayerBundleID; }
     bool                        IsMusicPlayerRT(const UInt32 inClientID) const;
     // Returns true if the PID was changed
     bool                        SetMusicPlayer(const pid_t inPID);
@@ -86,39 +113,126 @@ public:
     // kAudioDeviceCustomPropertyAppVolumes. (Except that CACFArray and CACFDictionary are used instead
     // of unwrapped CFArray and CFDictionary refs.)
     CACFArray                   CopyClientRelativeVolumesAsAppVolumes() const
-                                    { return mClientMap.CopyClientRelativeVolumesAsAppVolumes(mRelativeVolumeCurve); };
+                                    { return mClientMap.CopyClientRelativeVolumesAsAppVolumes(mRelativeVolumeTable); };
+    // The value of kAudioDeviceCustomPropertyAppVolumeChanges for the qualifier inSequence. The
+    // caller is responsible for releasing it.
+    CFDataRef                   CopyAppVolumeChanges(UInt64 inSequence) const
+                                    { return mClientMap.CopyAppVolumeChanges(inSequence, mRelativeVolumeTable); }
     // inAppVolumes is an array of dicts with the keys kEFFAppVolumesKey_ProcessID,
     // kEFFAppVolumesKey_BundleID and optionally kEFFAppVolumesKey_RelativeVolume and
     // kEFFAppVolumesKey_PanPosition. This method finds the client for
-    // each app by PID or bundle ID, sets the volume and applies mRelativeVolumeCurve to it.
+    // each app by PID or bundle ID, sets the volume and applies mRelativeVolumeTable to it.
     //
     // Returns true if any clients' relative volumes were changed.
     bool                        SetClientsRelativeVolumes(const CACFArray inAppVolumes);
+    // The same, for the value of kAudioDeviceCustomPropertyPacked for
+    // kAudioDeviceCustomPropertyAppVolumes.
+    bool                        SetClientsRelativeVolumes(const EFF_PackedProperties::Reader& inAppVolumes);
+    // Copies the same apps as CopyClientRelativeVolumesAsAppVolumes into the value of
+    // kAudioDeviceCustomPropertyPacked for kAudioDeviceCustomPropertyAppVolumes. The caller is
+    // responsible for releasing it.
+    CFDataRef                   CopyPackedAppVolumes() const;
+    
+    // An element of the kAudioDeviceCustomPropertyAppVolumes array, parsed and with mRelativeVolumeTable
+    // applied to the volume.
+    struct AppVolume
+    {
+        bool                    hasProcessID    = false;
+        pid_t                   processID       = 0;
+        bool                    hasBundleID     = false;
+        // EFF_BundleIDs::kNone if the bundle ID has never been interned, since then it can't be any
+        // client's.
+        EFF_BundleIDs::ID       bundleID        = EFF_BundleIDs::kNone;
+        bool                    hasVolume       = false;
+        Float32                 relativeVolume  = 1.0f;
+        bool                    hasPanPosition  = false;
+        SInt32                  panPosition     = 0;
+    };
+    // Throws EFF_InvalidClientRelativeVolumeException or EFF_InvalidClientPanPositionException if the
+    // dict is invalid, the same as SetClientsRelativeVolumes.
+    AppVolume                   ParseAppVolume(const CACFDictionary& inAppVolume) const;
+    // The same, for an entry of the packed value of kAudioDeviceCustomPropertyAppVolumes and the
+    // bundle ID it refers to.
+    AppVolume                   ParseAppVolume(const EFF_PackedAppVolume& inAppVolume,
+                                               const char* __nullable inBundleID) const;
+    // Returns the IDs of the app's current clients, found by PID and by bundle ID.
+    std::vector<UInt32>         GetClientIDs(const AppVolume& inAppVolume) const;
+    
+    // >>> Level meter API <<<
+    void                        UpdateClientLevelsRT(UInt32 inClientID,
+                                                     Float64 inSampleTime,
+                                                     const Float32 inPeak[2],
+                                                     const Float32 inRMS[2])
+                                    { mClientMeters.StoreLevelsRT(inClientID, inSampleTime, inPeak, inRMS); }
+    // Copies the clients' levels into an array in the format expected for
+    // kAudioDeviceCustomPropertyClientLevels. Doesn't lock, so it can be called from any thread.
+    CACFArray                   CopyClientLevels() const
+                                    { return mClientMeters.CopyLevels(); }
+    
+    // >>> EQ API <<<
+    void                        ApplyClientEQRT(UInt32 inClientID, UInt32 inFrameCount, Float32* ioBuffer)
+                                    { mClientEQ.ApplyEQRT(inClientID, inFrameCount, ioBuffer); }
+    // See EFF_ClientEQ::SetAppEQs. Returns true if any apps' EQs were changed.
+    bool                        SetAppEQs(const CACFArray inAppEQs)
+                                    { return mClientEQ.SetAppEQs(inAppEQs); }
+    // Copies the apps' EQs into an array in the format expected for kAudioDeviceCustomPropertyAppEQ.
+    CACFArray                   CopyAppEQs() const
+                                    { return mClientEQ.CopyAppEQs(); }
+    // The EQs' coefficients depend on the sample rate. Shouldn't be called while IO is running.
+    void                        SetEQSampleRate(Float64 inSampleRate)
+                                    { mClientEQ.SetSampleRate(inSampleRate); }
+    
+    // >>> Ducking rules API <<<
+    // Must be called with the device's IO mutex held.
+    void                        ApplyDuckingRulesRT(UInt32 inClientID,
+                                                    UInt32 inFrameCount,
+                                                    Float64 inSampleTime,
+                                                    Float32* ioBuffer)
+                                    { mDuckingRules.ApplyRulesRT(inClientID, inFrameCount, inSampleTime, ioBuffer); }
+    // See EFF_DuckingRules::SetRules. Returns true if the rules were changed.
+    bool                        SetDuckingRules(const CACFArray inRules)
+                                    { return mDuckingRules.SetRules(inRules); }
+    // Copies the rules into an array in the format expected for kAudioDeviceCustomPropertyDuckingRules.
+    CACFArray                   CopyDuckingRules() const
+                                    { return mDuckingRules.CopyRules(); }
+    // The rules' times are converted to frames. Shouldn't be called while IO is running.
+    void                        SetDuckingRulesSampleRate(Float64 inSampleRate)
+                                    { mDuckingRules.SetSampleRate(inSampleRate); }
+    // See EFF_DuckingRules::Reset. Shouldn't be called while IO is running.
+    void                        ResetDucking()
+                                    { mDuckingRules.Reset(); }
     
     
 #pragma mark Implementation
 private:
-    // Only EFF_TaskQueue is allowed to call these (through the EFF_ClientTasks interface). We get notifications
-    // from the HAL when clients start/stop IO and they have to be processed in the order we receive them to
-    // avoid race conditions. If these methods could be called directly those calls would skip any queued calls.
-    bool                        StartIONonRT(UInt32 inClientID);
-    bool                        StopIONonRT(UInt32 inClientID);
-    
-    void                        SendIORunningNotifications(bool sendIsRunningNotification,
-                                                           bool sendIsRunningSomewhereOtherThanEFFAppNotification) const;
+    // Queues notifications for the properties the transition changed. Real-time safe.
+    void                        SendIORunningNotifications(const EFF_ClientIOStates::Transition& inTransition) const;
+
+    // Checks the fields ParseAppVolume has filled in and applies mRelativeVolumeTable to the volume.
+    void                        FinishParsingAppVolume(AppVolume& ioAppVolume, SInt32 inRawRelativeVolume) const;
+    // Makes the changes in the app volumes in one transaction.
+    bool                        SetClientsRelativeVolumes(const std::vector<AppVolume>& inAppVolumes);
     
 #pragma mark Members
     AudioObjectID               mOwnerDeviceID;
+    // Sends the IO running notifications, since they can be sent from the IO thread.
+    EFF_TaskQueue*              mTaskQueue;
     EFF_ClientMap               mClientMap;
+    // The levels of each client's last IO cycle. Slots are claimed and released while holding mMutex.
+    EFF_ClientMeters            mClientMeters;
+    // The clients' EQ filters. Slots are claimed and released while holding mMutex.
+    EFF_ClientEQ                mClientEQ;
+    // Which ducking rules each client triggers and is ducked by. Slots are claimed and released
+    // while holding mMutex.
+    EFF_DuckingRules            mDuckingRules;
 
-    // Counters for the number of clients that are doing IO. These are used to tell whether any clients
-    // are currently doing IO without having to check every client's mDoingIO.
+    // Which clients are doing IO and how many are. Slots are claimed and released while holding
+    // mMutex, but starting and stopping IO doesn't lock.
     //
-    // We need to reference count this rather than just using a bool because the HAL might (but usually
+    // We need to count the clients rather than just using a bool because the HAL might (but usually
     // doesn't) call our StartIO/StopIO functions for clients other than the first to start and last to
     // stop.
-    UInt64                      mStartCount = 0;
-    UInt64                      mStartCountExcludingEFFApp = 0;
+    EFF_ClientIOStates          mClientIOStates;
     
     CAMutex                     mMutex { "Clients" };
     
@@ -136,9 +250,16 @@ private:
     // because there might be no client with that bundle ID. In that case we need to be able to give the
     // property's value if the HAL asks for it, and to recognise the music player if it's added a client.
     CACFString                  mMusicPlayerBundleIDProperty { "" };
+    // mMusicPlayerBundleIDProperty interned, or EFF_BundleIDs::kNone if it's the empty string, so
+    // adding a client doesn't have to compare strings.
+    EFF_BundleIDs::ID           mMusicPlayerBundleID = EFF_BundleIDs::kNone;
     
-    // The volume curve we apply to raw client volumes before they're used
-    CAVolumeCurve               mRelativeVolumeCurve;
+    // The volume curve we apply to raw client volumes before they're used, precomputed so setting or
+    // copying every app's volume doesn't call pow and log for each one
+    const EFF_VolumeCurveTable  mRelativeVolumeTable;
+
+    // EFFApp's bundle ID, interned.
+    const EFF_BundleIDs::ID     mEFFAppBundleID;
     
 };
 
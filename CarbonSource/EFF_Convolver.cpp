@@ -0,0 +1,895 @@
+//
+//  EFF_Convolver.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_Convolver.h"
+
+// Local Includes
+#include "EFF_Utils.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CAException.h"
+#include "CAHostTimeBase.h"
+#include "CAPThread.h"
+
+// STL Includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+// System Includes
+#include <Accelerate/Accelerate.h>
+#include <AudioToolbox/ExtendedAudioFile.h>
+#include <mach/mach_init.h>
+#include <mach/semaphore.h>
+#include <mach/task.h>
+
+
+#pragma clang assume_nonnull begin
+
+// The weight of each new measurement in the average costs.
+static const Float64 kAverageWeight = 1.0 / 64.0;
+
+static UInt32 Log2(UInt32 inPowerOfTwo)
+{
+    UInt32 theLog2 = 0;
+
+    while((1U << theLog2) < inPowerOfTwo)
+    {
+        theLog2++;
+    }
+
+    return theLog2;
+}
+
+static bool IsPowerOfTwo(UInt32 inValue)
+{
+    return (inValue != 0) && ((inValue & (inValue - 1)) == 0);
+}
+
+#pragma mark Stage
+
+//==================================================================================================
+//    EFF_Convolver::Stage
+//
+//  Convolves a segment of the IR by uniformly partitioned overlap-save. The segment is cut into
+//  partitions of mBlockFrames frames, which are transformed once, up front. Each block of input is
+//  transformed along with the block before it and added to a ring of the transforms of the last
+//  few blocks, called the frequency-domain delay line. The output is the inverse transform of the
+//  sum of each partition multiplied by the block in the delay line that's as many blocks old.
+//
+//  The transforms are in vDSP's packed format for real FFTs, so the real and imaginary parts of
+//  each are stored one after the other, and the first imaginary value is really the real part of
+//  the Nyquist bin.
+//==================================================================================================
+
+class EFF_Convolver::Stage
+{
+
+public:
+    Stage(const std::vector<Float32> inIR[kChannels],
+          UInt32 inIROffset,
+          UInt32 inBlockFrames,
+          UInt32 inNumPartitions,
+          FFTSetup inFFTSetup)
+    :
+        mBlockFrames(inBlockFrames),
+        mLog2FFTSize(Log2(inBlockFrames * 2)),
+        mNumPartitions(inNumPartitions),
+        mFFTSetup(inFFTSetup),
+        mAccumulator(inBlockFrames * 2, 0.0f),
+        mOutput(inBlockFrames * 2, 0.0f)
+    {
+        // The forward FFTs are scaled up by 2 and the inverse one by the FFT size, so scale the IR
+        // down by all three up front.
+        Float32 theScale = 1.0f / (4.0f * inBlockFrames * 2);
+
+        for(UInt32 theChannel = 0; theChannel < kChannels; theChannel++)
+        {
+            mPartitions[theChannel].assign(mNumPartitions * mBlockFrames * 2, 0.0f);
+            mDelayLine[theChannel].assign(mNumPartitions * mBlockFrames * 2, 0.0f);
+            mInput[theChannel].assign(mBlockFrames * 2, 0.0f);
+
+            for(UInt32 thePartition = 0; thePartition < mNumPartitions; thePartition++)
+            {
+                // Zero-pad the partition to the FFT size.
+                UInt32 theStart = inIROffset + (thePartition * mBlockFrames);
+                UInt32 theEnd = std::min<UInt32>(theStart + mBlockFrames,
+                                                 static_cast<UInt32>(inIR[theChannel].size()));
+
+                std::fill(mOutput.begin(), mOutput.end(), 0.0f);
+
+                if(theStart < theEnd)
+                {
+                    std::copy(&inIR[theChannel][theStart],
+                              &inIR[theChannel][0] + theEnd,
+                              mOutput.begin());
+                }
+
+                DSPSplitComplex thePartitionSpectrum = GetSpectrum(mPartitions[theChannel], thePartition);
+                vDSP_ctoz(reinterpret_cast<const DSPComplex*>(mOutput.data()),
+                          2,
+                          &thePartitionSpectrum,
+                          1,
+                          mBlockFrames);
+                vDSP_fft_zrip(mFFTSetup, &thePartitionSpectrum, 1, mLog2FFTSize, kFFTDirection_Forward);
+                vDSP_vsmul(thePartitionSpectrum.realp, 1, &theScale, thePartitionSpectrum.realp, 1, mBlockFrames);
+                vDSP_vsmul(thePartitionSpectrum.imagp, 1, &theScale, thePartitionSpectrum.imagp, 1, mBlockFrames);
+            }
+        }
+    }
+
+    // Convolves a block of mBlockFrames frames of each channel, writing a block of output for each.
+    // Real-time safe.
+    void Process(const Float32* const inInput[kChannels], Float32* const outOutput[kChannels])
+    {
+        // Reuse the slot of the oldest block in the delay line for the new one.
+        mDelayLineHead = (mDelayLineHead + 1) % mNumPartitions;
+
+        for(UInt32 theChannel = 0; theChannel < kChannels; theChannel++)
+        {
+            // Slide the new block in after the last one.
+            Float32* theInput = mInput[theChannel].data();
+
+            memmove(theInput, theInput + mBlockFrames, mBlockFrames * sizeof(Float32));
+            memcpy(theInput + mBlockFrames, inInput[theChannel], mBlockFrames * sizeof(Float32));
+
+            DSPSplitComplex theNewest = GetSpectrum(mDelayLine[theChannel], mDelayLineHead);
+            vDSP_ctoz(reinterpret_cast<const DSPComplex*>(theInput), 2, &theNewest, 1, mBlockFrames);
+            vDSP_fft_zrip(mFFTSetup, &theNewest, 1, mLog2FFTSize, kFFTDirection_Forward);
+
+            // Multiply and accumulate. vDSP_zvma would treat the packed DC and Nyquist values as one
+            // complex number, so those are accumulated separately and put back afterwards.
+            DSPSplitComplex theSum = { mAccumulator.data(), mAccumulator.data() + mBlockFrames };
+            Float32 theDC = 0.0f;
+            Float32 theNyquist = 0.0f;
+
+            vDSP_vclr(mAccumulator.data(), 1, mBlockFrames * 2);
+
+            for(UInt32 thePartition = 0; thePartition < mNumPartitions; thePartition++)
+            {
+                UInt32 theSlot = (mDelayLineHead + mNumPartitions - thePartition) % mNumPartitions;
+                DSPSplitComplex theBlock = GetSpectrum(mDelayLine[theChannel], theSlot);
+                DSPSplitComplex thePartitionSpectrum = GetSpectrum(mPartitions[theChannel], thePartition);
+
+                theDC += theBlock.realp[0] * thePartitionSpectrum.realp[0];
+                theNyquist += theBlock.imagp[0] * thePartitionSpectrum.imagp[0];
+
+                vDSP_zvma(&theBlock, 1, &thePartitionSpectrum, 1, &theSum, 1, &theSum, 1, mBlockFrames);
+            }
+
+            theSum.realp[0] = theDC;
+            theSum.imagp[0] = theNyquist;
+
+            // Only the second half of the inverse is valid. The first half has wrapped around.
+            vDSP_fft_zrip(mFFTSetup, &theSum, 1, mLog2FFTSize, kFFTDirection_Inverse);
+            vDSP_ztoc(&theSum, 1, reinterpret_cast<DSPComplex*>(mOutput.data()), 2, mBlockFrames);
+
+            memcpy(outOutput[theChannel], mOutput.data() + mBlockFrames, mBlockFrames * sizeof(Float32));
+        }
+    }
+
+private:
+    DSPSplitComplex GetSpectrum(std::vector<Float32>& inSpectra, UInt32 inIndex)
+    {
+        Float32* theStart = inSpectra.data() + (inIndex * mBlockFrames * 2);
+        return { theStart, theStart + mBlockFrames };
+    }
+
+    const UInt32                mBlockFrames;
+    const UInt32                mLog2FFTSize;
+    const UInt32                mNumPartitions;
+    FFTSetup                    mFFTSetup;
+
+    // The transforms of the IR's partitions, one after the other.
+    std::vector<Float32>        mPartitions[kChannels];
+    // The transforms of the last mNumPartitions blocks of input, as a ring.
+    std::vector<Float32>        mDelayLine[kChannels];
+    UInt32                      mDelayLineHead = 0;
+    // The last two blocks of input.
+    std::vector<Float32>        mInput[kChannels];
+    std::vector<Float32>        mAccumulator;
+    std::vector<Float32>        mOutput;
+
+};
+
+#pragma mark Engine
+
+//==================================================================================================
+//    EFF_Convolver::Engine
+//
+//  The head and tail stages for an IR and IO buffer size, and the helper thread that runs the tail
+//  stage. An Engine built for an empty IR has neither and doesn't change the audio.
+//
+//  The IO thread copies each block of input for the tail stage into one of two input buffers,
+//  alternating between them, and signals the helper thread once the block is full. The helper
+//  thread convolves it while the IO thread fills the other buffer. Its output is for the block after
+//  next, which it writes to one of two output buffers and tags with that block's number. The IO
+//  thread only mixes an output buffer in if it's tagged with the number of the block it's playing.
+//==================================================================================================
+
+class EFF_Convolver::Engine
+{
+
+public:
+    Engine(const std::vector<Float32> inIR[kChannels],
+           UInt32 inBlockFrames,
+           Float64 inSampleRate,
+           Stats& ioStats)
+    :
+        mBlockFrames(inBlockFrames),
+        mTailBlockFrames(std::max<UInt32>(inBlockFrames * kMinTailBlockRatio, kMinTailBlockFrames)),
+        mBlockNanos(inBlockFrames * 1000000000.0 / inSampleRate),
+        mStats(ioStats)
+    {
+        UInt32 theIRFrames = static_cast<UInt32>(inIR[0].size());
+
+        if(theIRFrames == 0)
+        {
+            return;
+        }
+
+        ThrowIf(!IsPowerOfTwo(mBlockFrames),
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_Convolver::Engine::Engine: The block size must be a power of two");
+
+        // One setup for the largest FFT can also be used for the smaller ones.
+        mFFTSetup = vDSP_create_fftsetup(Log2(mTailBlockFrames * 2), kFFTRadix2);
+        ThrowIfNULL(mFFTSetup,
+                    CAException(kAudioHardwareUnspecifiedError),
+                    "EFF_Convolver::Engine::Engine: Could not create the FFT setup");
+
+        // The head stage covers the frames before the tail stage starts.
+        UInt32 theHeadFrames = std::min<UInt32>(theIRFrames, mTailBlockFrames * 2);
+
+        mHead.reset(new Stage(inIR,
+                              0,
+                              mBlockFrames,
+                              (theHeadFrames + mBlockFrames - 1) / mBlockFrames,
+                              mFFTSetup));
+        mNumHeadPartitions = (theHeadFrames + mBlockFrames - 1) / mBlockFrames;
+
+        for(UInt32 theChannel = 0; theChannel < kChannels; theChannel++)
+        {
+            mDry[theChannel].assign(mBlockFrames, 0.0f);
+            mWet[theChannel].assign(mBlockFrames, 0.0f);
+        }
+
+        if(theIRFrames > theHeadFrames)
+        {
+            mNumTailPartitions = (theIRFrames - theHeadFrames + mTailBlockFrames - 1) / mTailBlockFrames;
+            mTail.reset(new Stage(inIR, theHeadFrames, mTailBlockFrames, mNumTailPartitions, mFFTSetup));
+
+            for(UInt32 theBuffer = 0; theBuffer < 2; theBuffer++)
+            {
+                for(UInt32 theChannel = 0; theChannel < kChannels; theChannel++)
+                {
+                    mTailInput[theBuffer][theChannel].assign(mTailBlockFrames, 0.0f);
+                    mTailOutput[theBuffer][theChannel].assign(mTailBlockFrames, 0.0f);
+                }
+
+                // The first two blocks come before the tail starts, so they're silent.
+                mTailOutputBlock[theBuffer].store(theBuffer, std::memory_order_relaxed);
+            }
+
+            kern_return_t theError = semaphore_create(mach_task_self(),
+                                                      &mTailWorkQueuedSemaphore,
+                                                      SYNC_POLICY_FIFO,
+                                                      0);
+            EFF_Utils::ThrowIfMachError("EFF_Convolver::Engine::Engine", "semaphore_create", theError);
+
+            theError = semaphore_create(mach_task_self(), &mTailThreadStoppedSemaphore, SYNC_POLICY_FIFO, 0);
+            EFF_Utils::ThrowIfMachError("EFF_Convolver::Engine::Engine", "semaphore_create", theError);
+
+            // Ask to be scheduled like the IO thread, with a period of a tail block.
+            UInt32 thePeriod = static_cast<UInt32>(
+                    CAHostTimeBase::ConvertFromNanos(static_cast<UInt64>(mBlockNanos * (mTailBlockFrames / mBlockFrames))));
+
+            std::unique_ptr<CAPThread> theTailThread(
+                    new CAPThread(/* inThreadRoutine = */ &Engine::TailThreadProc,
+                                  /* inParameter */       this,
+                                  /* inPeriod = */        thePeriod,
+                                  /* inComputation */     thePeriod / 4,
+                                  /* inConstraint */      thePeriod / 2,
+                                  /* inIsPreemptible = */ true,
+                                  /* inAutoDelete = */    true));
+            theTailThread->Start();
+
+            // The thread deletes its CAPThread itself once TailThreadProc returns. It can't return
+            // before the destructor tells it to stop.
+            theTailThread.release();
+            mTailThreadStarted = true;
+        }
+    }
+
+    ~Engine()
+    {
+        if(mTailThreadStarted)
+        {
+            mStopTailThread.store(true, std::memory_order_release);
+
+            kern_return_t theError = semaphore_signal(mTailWorkQueuedSemaphore);
+            EFF_Utils::LogIfMachError("EFF_Convolver::Engine::~Engine", "semaphore_signal", theError);
+
+            // CAPThread's threads are detached, so they can't be joined. Instead, the thread signals
+            // this once it's done with the engine. It only has to finish the block it's on, if any.
+            do
+            {
+                theError = semaphore_wait(mTailThreadStoppedSemaphore);
+            }
+            while(theError == KERN_ABORTED);
+
+            EFF_Utils::LogIfMachError("EFF_Convolver::Engine::~Engine", "semaphore_wait", theError);
+        }
+
+        if(mTailWorkQueuedSemaphore != SEMAPHORE_NULL)
+        {
+            kern_return_t theError = semaphore_destroy(mach_task_self(), mTailWorkQueuedSemaphore);
+            EFF_Utils::LogIfMachError("EFF_Convolver::Engine::~Engine", "semaphore_destroy", theError);
+        }
+
+        if(mTailThreadStoppedSemaphore != SEMAPHORE_NULL)
+        {
+            kern_return_t theError = semaphore_destroy(mach_task_self(), mTailThreadStoppedSemaphore);
+            EFF_Utils::LogIfMachError("EFF_Convolver::Engine::~Engine", "semaphore_destroy", theError);
+        }
+
+        // Delete the stages before the setup they use.
+        mHead.reset();
+        mTail.reset();
+
+        if(mFFTSetup != nullptr)
+        {
+            vDSP_destroy_fftsetup(mFFTSetup);
+        }
+    }
+
+    bool                        HasIR() const { return mHead != nullptr; }
+    UInt32                      GetBlockFrames() const { return mBlockFrames; }
+    UInt32                      GetTailBlockFrames() const { return mTail ? mTailBlockFrames : 0; }
+    UInt32                      GetNumHeadPartitions() const { return mNumHeadPartitions; }
+    UInt32                      GetNumTailPartitions() const { return mNumTailPartitions; }
+    Float64                     GetBlockNanos() const { return mBlockNanos; }
+
+    // Convolves a buffer of mBlockFrames frames of interleaved stereo, in place.
+    void ProcessRT(Float32* ioBuffer)
+    {
+        // Deinterleave the input.
+        DSPSplitComplex theDry = { mDry[0].data(), mDry[1].data() };
+        vDSP_ctoz(reinterpret_cast<const DSPComplex*>(ioBuffer), 2, &theDry, 1, mBlockFrames);
+
+        const Float32* const theInput[kChannels] = { mDry[0].data(), mDry[1].data() };
+        Float32* const theOutput[kChannels] = { mWet[0].data(), mWet[1].data() };
+
+        mHead->Process(theInput, theOutput);
+
+        if(mTail)
+        {
+            MixTailRT();
+        }
+
+        // Interleave the output back into the buffer.
+        DSPSplitComplex theWet = { mWet[0].data(), mWet[1].data() };
+        vDSP_ztoc(&theWet, 1, reinterpret_cast<DSPComplex*>(ioBuffer), 2, mBlockFrames);
+    }
+
+private:
+    // Passes the input to the tail stage and mixes its output into mWet.
+    void MixTailRT()
+    {
+        UInt32 theBlocksPerTailBlock = mTailBlockFrames / mBlockFrames;
+        UInt64 theTailBlock = mCycleRT / theBlocksPerTailBlock;
+        UInt32 theBuffer = static_cast<UInt32>(theTailBlock & 1);
+        UInt32 theOffset = static_cast<UInt32>(mCycleRT % theBlocksPerTailBlock) * mBlockFrames;
+
+        // Check whether the helper thread finished this tail block's output in time. Only check at
+        // the start of the block so we never play part of one.
+        if(theOffset == 0)
+        {
+            mTailOutputReadyRT =
+                    (mTailOutputBlock[theBuffer].load(std::memory_order_acquire) == theTailBlock);
+
+            if(!mTailOutputReadyRT)
+            {
+                mStats.lateTailBlocks.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        for(UInt32 theChannel = 0; theChannel < kChannels; theChannel++)
+        {
+            memcpy(mTailInput[theBuffer][theChannel].data() + theOffset,
+                   mDry[theChannel].data(),
+                   mBlockFrames * sizeof(Float32));
+
+            if(mTailOutputReadyRT)
+            {
+                vDSP_vadd(mWet[theChannel].data(),
+                          1,
+                          mTailOutput[theBuffer][theChannel].data() + theOffset,
+                          1,
+                          mWet[theChannel].data(),
+                          1,
+                          mBlockFrames);
+            }
+        }
+
+        mCycleRT++;
+
+        // If that filled the tail block, hand it to the helper thread.
+        if(theOffset + mBlockFrames == mTailBlockFrames)
+        {
+            mTailBlocksQueued.store(theTailBlock + 1, std::memory_order_release);
+
+            // Note that semaphore_signal has an implicit barrier.
+            kern_return_t theError = semaphore_signal(mTailWorkQueuedSemaphore);
+            EFF_Utils::LogIfMachError("EFF_Convolver::Engine::MixTailRT", "semaphore_signal", theError);
+        }
+    }
+
+    static void* __nullable TailThreadProc(void* inRefCon)
+    {
+        Engine* theEngine = static_cast<Engine*>(inRefCon);
+        theEngine->TailThreadLoop();
+
+        // Tell the destructor we're done. The engine can be freed as soon as this is signalled, so
+        // it has to be the last time we use it.
+        kern_return_t theError = semaphore_signal(theEngine->mTailThreadStoppedSemaphore);
+        EFF_Utils::LogIfMachError("EFF_Convolver::Engine::TailThreadProc", "semaphore_signal", theError);
+
+        return NULL;
+    }
+
+    void TailThreadLoop()
+    {
+        UInt64 theNextTailBlock = 0;
+
+        while(!mStopTailThread.load(std::memory_order_acquire))
+        {
+            kern_return_t theError = semaphore_wait(mTailWorkQueuedSemaphore);
+
+            // Nothing would catch an exception thrown from this thread, so it would take down
+            // coreaudiod. Stop instead. The IO thread will find the tail blocks late and leave
+            // them out.
+            if(theError != KERN_SUCCESS && theError != KERN_ABORTED)
+            {
+                EFF_Utils::LogIfMachError("EFF_Convolver::Engine::TailThreadLoop", "semaphore_wait", theError);
+                break;
+            }
+
+            UInt64 theTailBlocksQueued = mTailBlocksQueued.load(std::memory_order_acquire);
+
+            // If we've fallen more than a block behind, the IO thread has already started
+            // overwriting the older blocks, so skip to the newest one.
+            if(theTailBlocksQueued > theNextTailBlock + 1)
+            {
+                theNextTailBlock = theTailBlocksQueued - 1;
+            }
+
+            while(theNextTailBlock < theTailBlocksQueued && !mStopTailThread.load(std::memory_order_acquire))
+            {
+                UInt64 theStartTime = CAHostTimeBase::GetTheCurrentTime();
+                UInt32 theBuffer = static_cast<UInt32>(theNextTailBlock & 1);
+
+                const Float32* const theInput[kChannels] = {
+                    mTailInput[theBuffer][0].data(), mTailInput[theBuffer][1].data()
+                };
+                // This block's output is for the block after next, which uses the same buffer.
+                Float32* const theOutput[kChannels] = {
+                    mTailOutput[theBuffer][0].data(), mTailOutput[theBuffer][1].data()
+                };
+
+                mTail->Process(theInput, theOutput);
+
+                // Only publish the output if the IO thread didn't start overwriting the input while
+                // we were reading it.
+                if(mTailBlocksQueued.load(std::memory_order_acquire) <= theNextTailBlock + 1)
+                {
+                    mTailOutputBlock[theBuffer].store(theNextTailBlock + 2, std::memory_order_release);
+                }
+
+                UInt64 theNanos =
+                        CAHostTimeBase::ConvertToNanos(CAHostTimeBase::GetTheCurrentTime() - theStartTime);
+                Float64 theAverage = mStats.averageTailNanos.load(std::memory_order_relaxed);
+                mStats.averageTailNanos.store(theAverage + ((theNanos - theAverage) * kAverageWeight),
+                                              std::memory_order_relaxed);
+
+                theNextTailBlock++;
+            }
+        }
+    }
+
+    const UInt32                mBlockFrames;
+    const UInt32                mTailBlockFrames;
+    const Float64               mBlockNanos;
+    Stats&                      mStats;
+
+    FFTSetup __nullable         mFFTSetup           = nullptr;
+    std::unique_ptr<Stage>      mHead;
+    std::unique_ptr<Stage>      mTail;
+    UInt32                      mNumHeadPartitions  = 0;
+    UInt32                      mNumTailPartitions  = 0;
+
+    // Only accessed by the IO thread.
+    std::vector<Float32>        mDry[kChannels];
+    std::vector<Float32>        mWet[kChannels];
+    // The number of buffers convolved.
+    UInt64                      mCycleRT            = 0;
+    bool                        mTailOutputReadyRT  = true;
+
+    // Each tail block of input is written by the IO thread and then read by the helper thread.
+    std::vector<Float32>        mTailInput[2][kChannels];
+    // The number of tail blocks of input the IO thread has finished writing.
+    std::atomic<UInt64>         mTailBlocksQueued   { 0 };
+    // Each tail block of output is written by the helper thread and then read by the IO thread.
+    std::vector<Float32>        mTailOutput[2][kChannels];
+    // The number of the tail block each output buffer holds.
+    std::atomic<UInt64>         mTailOutputBlock[2];
+
+    bool                        mTailThreadStarted  = false;
+    semaphore_t                 mTailWorkQueuedSemaphore = SEMAPHORE_NULL;
+    // Signalled by the helper thread once it has finished using the engine.
+    semaphore_t                 mTailThreadStoppedSemaphore = SEMAPHORE_NULL;
+    std::atomic<bool>           mStopTailThread     { false };
+
+};
+
+#pragma mark Construction/Destruction
+
+EFF_Convolver::EFF_Convolver()
+:
+    mMutex("Convolver"),
+    mSampleRate(44100.0),
+    mIRPath(CFSTR(""), false)
+{
+}
+
+EFF_Convolver::~EFF_Convolver()
+{
+    delete mPendingEngine.exchange(nullptr);
+    delete mRetiredEngine.exchange(nullptr);
+    delete mActiveEngineRT;
+}
+
+void    EFF_Convolver::SetSampleRate(Float64 inSampleRate)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    if(mSampleRate == inSampleRate)
+    {
+        return;
+    }
+
+    mSampleRate = inSampleRate;
+
+    if(!mIR[0].empty())
+    {
+        try
+        {
+            LoadImpulseResponse(mIRPath);
+        }
+        catch(const CAException& e)
+        {
+            // The IR would be at the wrong sample rate, so remove it.
+            LogError("EFF_Convolver::SetSampleRate: Could not reload the IR (%d)", e.GetError());
+            LoadImpulseResponse(CACFString(CFSTR(""), false));
+        }
+    }
+
+    RebuildEngine();
+}
+
+#pragma mark IO Operations
+
+bool    EFF_Convolver::ProcessRT(Float32* ioBuffer, UInt32 inFrameCount)
+{
+    bool theCallerShouldUpdate = false;
+
+    mIOBufferFrameSize.store(inFrameCount, std::memory_order_relaxed);
+
+    // Take the new Engine, if there is one, unless the last one we swapped out hasn't been deleted
+    // yet.
+    if(mPendingEngine.load(std::memory_order_relaxed) != nullptr &&
+       mRetiredEngine.load(std::memory_order_acquire) == nullptr)
+    {
+        Engine* theNewEngine = mPendingEngine.exchange(nullptr, std::memory_order_acq_rel);
+
+        if(theNewEngine != nullptr)
+        {
+            if(mActiveEngineRT != nullptr)
+            {
+                mRetiredEngine.store(mActiveEngineRT, std::memory_order_release);
+                theCallerShouldUpdate = true;
+            }
+
+            mActiveEngineRT = theNewEngine;
+        }
+    }
+
+    Engine* theEngine = mActiveEngineRT;
+    bool theIsConvolving = (theEngine != nullptr) &&
+                           theEngine->HasIR() &&
+                           (theEngine->GetBlockFrames() == inFrameCount);
+
+    // Ask for an Engine for this buffer size if we don't have one and can use one.
+    if(theEngine != nullptr &&
+       theEngine->HasIR() &&
+       !theIsConvolving &&
+       IsPowerOfTwo(inFrameCount) &&
+       inFrameCount >= kMinBlockFrames &&
+       inFrameCount <= kMaxBlockFrames &&
+       !mRebuildRequested.exchange(true, std::memory_order_acq_rel))
+    {
+        theCallerShouldUpdate = true;
+    }
+
+    mIsConvolving.store(theIsConvolving, std::memory_order_relaxed);
+
+    if(theIsConvolving)
+    {
+        UInt64 theStartTime = CAHostTimeBase::GetTheCurrentTime();
+
+        theEngine->ProcessRT(ioBuffer);
+
+        UInt64 theNanos = CAHostTimeBase::ConvertToNanos(CAHostTimeBase::GetTheCurrentTime() - theStartTime);
+
+        // We're the only writer of the averages, so they don't need to be read-modify-writes.
+        Float64 theAverage = mStats.averageCycleNanos.load(std::memory_order_relaxed);
+        mStats.averageCycleNanos.store(theAverage + ((theNanos - theAverage) * kAverageWeight),
+                                       std::memory_order_relaxed);
+
+        Float64 theLoad = theNanos / theEngine->GetBlockNanos();
+        Float64 theAverageLoad = mStats.averageLoad.load(std::memory_order_relaxed);
+        mStats.averageLoad.store(theAverageLoad + ((theLoad - theAverageLoad) * kAverageWeight),
+                                 std::memory_order_relaxed);
+
+        // CopyStats resets the peak, so this has to be a compare-and-swap.
+        UInt64 thePeak = mStats.peakCycleNanos.load(std::memory_order_relaxed);
+        while(theNanos > thePeak &&
+              !mStats.peakCycleNanos.compare_exchange_weak(thePeak, theNanos, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    return theCallerShouldUpdate;
+}
+
+void    EFF_Convolver::UpdateNonRT()
+{
+    delete mRetiredEngine.exchange(nullptr, std::memory_order_acq_rel);
+
+    if(mRebuildRequested.load(std::memory_order_acquire))
+    {
+        EFFLogAndSwallowExceptions("EFF_Convolver::UpdateNonRT", [&] {
+            CAMutex::Locker theLocker(mMutex);
+            RebuildEngine();
+        });
+
+        mRebuildRequested.store(false, std::memory_order_release);
+    }
+}
+
+#pragma mark Accessors
+
+void    EFF_Convolver::SetImpulseResponse(const CACFString& inPath)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    LoadImpulseResponse(inPath);
+    RebuildEngine();
+}
+
+CACFString    EFF_Convolver::CopyImpulseResponsePath()
+const
+{
+    CAMutex::Locker theLocker(mMutex);
+    return mIRPath;
+}
+
+CACFDictionary    EFF_Convolver::CopyStats()
+const
+{
+    CACFDictionary theStats(false);
+    CAMutex::Locker theLocker(mMutex);
+
+    // The head stage's partitions are the size of the IO buffer, so the convolution is done within
+    // each IO cycle.
+    theStats.AddBool(CFSTR(kEFFConvolutionStatsKey_Active), mIsConvolving.load(std::memory_order_relaxed));
+    theStats.AddUInt32(CFSTR(kEFFConvolutionStatsKey_LatencyFrames), 0);
+    theStats.AddUInt32(CFSTR(kEFFConvolutionStatsKey_IRFrames), static_cast<UInt32>(mIR[0].size()));
+    theStats.AddUInt32(CFSTR(kEFFConvolutionStatsKey_BlockFrames), mBuiltBlockFrames);
+    theStats.AddUInt32(CFSTR(kEFFConvolutionStatsKey_HeadPartitions), mBuiltHeadPartitions);
+    theStats.AddUInt32(CFSTR(kEFFConvolutionStatsKey_TailBlockFrames), mBuiltTailBlockFrames);
+    theStats.AddUInt32(CFSTR(kEFFConvolutionStatsKey_TailPartitions), mBuiltTailPartitions);
+    theStats.AddFloat64(CFSTR(kEFFConvolutionStatsKey_CycleMicros),
+                        mStats.averageCycleNanos.load(std::memory_order_relaxed) / 1000.0);
+    theStats.AddFloat64(CFSTR(kEFFConvolutionStatsKey_PeakCycleMicros),
+                        mStats.peakCycleNanos.exchange(0, std::memory_order_relaxed) / 1000.0);
+    theStats.AddFloat64(CFSTR(kEFFConvolutionStatsKey_Load),
+                        mStats.averageLoad.load(std::memory_order_relaxed));
+    theStats.AddFloat64(CFSTR(kEFFConvolutionStatsKey_TailMicros),
+                        mStats.averageTailNanos.load(std::memory_order_relaxed) / 1000.0);
+    theStats.AddUInt64(CFSTR(kEFFConvolutionStatsKey_LateTailBlocks),
+                       mStats.lateTailBlocks.load(std::memory_order_relaxed));
+
+    return theStats;
+}
+
+#pragma mark Implementation
+
+void    EFF_Convolver::LoadImpulseResponse(const CACFString& inPath)
+{
+    std::vector<Float32> theIR[kChannels];
+
+    if(inPath.GetLength() > 0)
+    {
+        CFURLRef theURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault,
+                                                        inPath.GetCFString(),
+                                                        kCFURLPOSIXPathStyle,
+                                                        false);
+        ThrowIfNULL(theURL,
+                    CAException(kAudioHardwareIllegalOperationError),
+                    "EFF_Convolver::LoadImpulseResponse: Invalid path");
+
+        ExtAudioFileRef theFile = nullptr;
+        OSStatus theError = ExtAudioFileOpenURL(theURL, &theFile);
+        CFRelease(theURL);
+
+        ThrowIf(theError != noErr || theFile == nullptr,
+                CAException(theError),
+                "EFF_Convolver::LoadImpulseResponse: Could not open the file");
+
+        try
+        {
+            AudioStreamBasicDescription theFileFormat;
+            UInt32 theSize = sizeof(AudioStreamBasicDescription);
+            theError = ExtAudioFileGetProperty(theFile,
+                                               kExtAudioFileProperty_FileDataFormat,
+                                               &theSize,
+                                               &theFileFormat);
+            ThrowIf(theError != noErr,
+                    CAException(theError),
+                    "EFF_Convolver::LoadImpulseResponse: Could not get the file's format");
+            ThrowIf(theFileFormat.mChannelsPerFrame < 1 || theFileFormat.mChannelsPerFrame > kChannels,
+                    CAException(kAudioHardwareIllegalOperationError),
+                    "EFF_Convolver::LoadImpulseResponse: The IR must be mono or stereo");
+
+            // Have ExtAudioFile convert the IR to deinterleaved floats at our sample rate.
+            AudioStreamBasicDescription theClientFormat = {};
+            theClientFormat.mSampleRate = mSampleRate;
+            theClientFormat.mFormatID = kAudioFormatLinearPCM;
+            theClientFormat.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+            theClientFormat.mBytesPerPacket = sizeof(Float32);
+            theClientFormat.mFramesPerPacket = 1;
+            theClientFormat.mBytesPerFrame = sizeof(Float32);
+            theClientFormat.mChannelsPerFrame = theFileFormat.mChannelsPerFrame;
+            theClientFormat.mBitsPerChannel = 32;
+
+            theError = ExtAudioFileSetProperty(theFile,
+                                               kExtAudioFileProperty_ClientDataFormat,
+                                               sizeof(AudioStreamBasicDescription),
+                                               &theClientFormat);
+            ThrowIf(theError != noErr,
+                    CAException(theError),
+                    "EFF_Convolver::LoadImpulseResponse: Could not set the client format");
+
+            SInt64 theFileFrames = 0;
+            theSize = sizeof(SInt64);
+            theError = ExtAudioFileGetProperty(theFile,
+                                               kExtAudioFileProperty_FileLengthFrames,
+                                               &theSize,
+                                               &theFileFrames);
+            ThrowIf(theError != noErr,
+                    CAException(theError),
+                    "EFF_Convolver::LoadImpulseResponse: Could not get the file's length");
+
+            Float64 theFrames = std::ceil(theFileFrames * mSampleRate / theFileFormat.mSampleRate);
+
+            if(theFrames > kEFFConvolutionMaxIRFrames)
+            {
+                LogWarning("EFF_Convolver::LoadImpulseResponse: Truncating the IR from %.0f frames", theFrames);
+                theFrames = kEFFConvolutionMaxIRFrames;
+            }
+
+            for(UInt32 theChannel = 0; theChannel < kChannels; theChannel++)
+            {
+                theIR[theChannel].assign(static_cast<size_t>(theFrames), 0.0f);
+            }
+
+            UInt32 theFramesRead = 0;
+
+            while(theFramesRead < theIR[0].size())
+            {
+                struct
+                {
+                    UInt32      mNumberBuffers;
+                    AudioBuffer mBuffers[kChannels];
+                } theBufferList;
+
+                UInt32 theFramesToRead = static_cast<UInt32>(theIR[0].size()) - theFramesRead;
+
+                theBufferList.mNumberBuffers = theFileFormat.mChannelsPerFrame;
+
+                for(UInt32 theChannel = 0; theChannel < theFileFormat.mChannelsPerFrame; theChannel++)
+                {
+                    theBufferList.mBuffers[theChannel].mNumberChannels = 1;
+                    theBufferList.mBuffers[theChannel].mDataByteSize = theFramesToRead * sizeof(Float32);
+                    theBufferList.mBuffers[theChannel].mData = &theIR[theChannel][theFramesRead];
+                }
+
+                theError = ExtAudioFileRead(theFile,
+                                            &theFramesToRead,
+                                            reinterpret_cast<AudioBufferList*>(&theBufferList));
+                ThrowIf(theError != noErr,
+                        CAException(theError),
+                        "EFF_Convolver::LoadImpulseResponse: Could not read the file");
+
+                if(theFramesToRead == 0)
+                {
+                    break;
+                }
+
+                theFramesRead += theFramesToRead;
+            }
+
+            ThrowIf(theFramesRead == 0,
+                    CAException(kAudioHardwareIllegalOperationError),
+                    "EFF_Convolver::LoadImpulseResponse: The file is empty");
+
+            for(UInt32 theChannel = 0; theChannel < kChannels; theChannel++)
+            {
+                theIR[theChannel].resize(theFramesRead);
+            }
+
+            if(theFileFormat.mChannelsPerFrame == 1)
+            {
+                theIR[1] = theIR[0];
+            }
+        }
+        catch(...)
+        {
+            ExtAudioFileDispose(theFile);
+            throw;
+        }
+
+        ExtAudioFileDispose(theFile);
+    }
+
+    for(UInt32 theChannel = 0; theChannel < kChannels; theChannel++)
+    {
+        mIR[theChannel].swap(theIR[theChannel]);
+    }
+
+    mIRPath = inPath;
+    mHasImpulseResponse.store(!mIR[0].empty(), std::memory_order_relaxed);
+}
+
+void    EFF_Convolver::RebuildEngine()
+{
+    // Build the Engine for the IO thread's buffer size, or a guess at it if IO hasn't started yet.
+    UInt32 theBlockFrames = mIOBufferFrameSize.load(std::memory_order_relaxed);
+
+    if(!IsPowerOfTwo(theBlockFrames) || theBlockFrames < kMinBlockFrames || theBlockFrames > kMaxBlockFrames)
+    {
+        theBlockFrames = kDefaultBlockFrames;
+    }
+
+    Engine* theEngine = new Engine(mIR, theBlockFrames, mSampleRate, mStats);
+
+    mBuiltBlockFrames = theEngine->HasIR() ? theBlockFrames : 0;
+    mBuiltTailBlockFrames = theEngine->GetTailBlockFrames();
+    mBuiltHeadPartitions = theEngine->GetNumHeadPartitions();
+    mBuiltTailPartitions = theEngine->GetNumTailPartitions();
+
+    // Hand it to the IO thread. If it hasn't taken the last one we built, it never will now, so we
+    // can delete that one.
+    delete mPendingEngine.exchange(theEngine, std::memory_order_acq_rel);
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,184 @@
+//
+//  EFF_Convolver.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_Convolver_h
+#define EFF_Convolver_h
+
+// Local Includes
+#include "EFF_CustomProperties.h"
+
+// PublicUtility Includes
+#include "CAMutex.h"
+#include "CACFDictionary.h"
+#include "CACFString.h"
+
+// STL Includes
+#include <atomic>
+#include <vector>
+
+// System Includes
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_Convolver
+//
+//  Convolves a device's mix with the impulse response set with
+//  kAudioDeviceCustomPropertyConvolutionIR, during ProcessMix.
+//
+//  The IR is split into two stages, both convolved by uniformly partitioned overlap-save. The head
+//  stage covers the start of the IR with partitions the size of the IO buffer and runs on the IO
+//  thread, so the convolution adds no latency. The tail stage covers the rest of the IR with
+//  partitions at least kMinTailBlockRatio times as large, which are much cheaper per frame, and
+//  runs on a real-time helper thread. The IO thread hands the helper thread each block of input and
+//  takes back each block of output through double buffers, so neither thread ever waits for the
+//  other. The tail stage starts two of its blocks into the IR, which gives the helper thread a
+//  whole block to compute each one before the IO thread needs it. If it's late anyway, that block
+//  of output is played without the tail.
+//
+//  The stages and their buffers are held in an Engine, which is built on a non-real-time thread for
+//  a particular IO buffer size and handed to the IO thread through an atomic pointer. If the IO
+//  buffer size changes, the IO thread passes the audio through unchanged and asks for a new Engine
+//  to be built. Engines the IO thread has finished with are handed back the same way to be deleted.
+//  vDSP's FFTs only come in powers of two, so IO buffer sizes that aren't one are passed through.
+//
+//  Methods whose names end with "RT" can only safely be called from real-time threads. The others
+//  aren't real-time safe.
+//==================================================================================================
+
+class EFF_Convolver
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_Convolver();
+                                ~EFF_Convolver();
+                                EFF_Convolver(const EFF_Convolver&) = delete;
+                                EFF_Convolver& operator=(const EFF_Convolver&) = delete;
+
+    /*!
+     Set the sample rate of the audio being convolved. Reloads the IR, if one is set, to resample it
+     to the new rate. Shouldn't be called while IO is running.
+     */
+    void                        SetSampleRate(Float64 inSampleRate);
+
+#pragma mark IO Operations
+
+    /*!
+     Convolve a buffer of audio with the IR, in place.
+
+     @param ioBuffer The audio, as interleaved stereo.
+     @param inFrameCount The number of frames in ioBuffer.
+     @return True if the caller should arrange for UpdateNonRT to be called.
+     */
+    bool                        ProcessRT(Float32* ioBuffer, UInt32 inFrameCount);
+
+    /*!
+     Delete the Engine the IO thread has finished with and build a new one if the IO buffer size has
+     changed. Must only be called after ProcessRT returns true, and only once each time it does.
+     */
+    void                        UpdateNonRT();
+
+#pragma mark Accessors
+
+    /*!
+     Load an IR from an audio file. Passing an empty path removes the IR.
+
+     @param inPath The absolute path of a mono or stereo audio file in any format Core Audio can
+                   read. It's resampled to the device's sample rate and truncated to
+                   kEFFConvolutionMaxIRFrames frames.
+     @throws CAException if the file can't be read.
+     */
+    void                        SetImpulseResponse(const CACFString& inPath);
+    CACFString                  CopyImpulseResponsePath() const;
+    // Real-time safe. The HAL only asks whether we'll do ProcessMix when IO starts, so the IR only
+    // starts being convolved once IO restarts if it was set while IO was running with no IR.
+    bool                        HasImpulseResponse() const
+                                    { return mHasImpulseResponse.load(std::memory_order_relaxed); }
+
+    /*!
+     @return The convolver's latency and CPU cost in the format of
+             kAudioDeviceCustomPropertyConvolutionStats. Also resets the peak cost.
+     */
+    CACFDictionary              CopyStats() const;
+
+#pragma mark Implementation
+
+private:
+    class Stage;
+    class Engine;
+
+    // Reads the IR from the file at inPath, resampled to mSampleRate, into mIR. mMutex must be held.
+    void                        LoadImpulseResponse(const CACFString& inPath);
+    // Builds a new Engine for mIR and the last IO buffer size and hands it to the IO thread. mMutex
+    // must be held.
+    void                        RebuildEngine();
+
+    enum : UInt32
+    {
+        kChannels               = 2,
+        // The size of the tail stage's partitions as a multiple of the head stage's, and the
+        // smallest size they can be, which keeps the number of them down for small IO buffers.
+        kMinTailBlockRatio      = 4,
+        kMinTailBlockFrames     = 1024,
+        // The IO buffer size to build the Engine for until the IO thread has told us the real one.
+        kDefaultBlockFrames     = 512,
+        // The largest and smallest IO buffer sizes we'll convolve. Others are passed through.
+        kMinBlockFrames         = 16,
+        kMaxBlockFrames         = 4096
+    };
+
+    // The costs measured on the IO thread and the helper thread. Written by those threads and read
+    // by CopyStats.
+    struct Stats
+    {
+        std::atomic<Float64>    averageCycleNanos   { 0.0 };
+        mutable std::atomic<UInt64> peakCycleNanos  { 0 };
+        std::atomic<Float64>    averageLoad         { 0.0 };
+        std::atomic<Float64>    averageTailNanos    { 0.0 };
+        std::atomic<UInt64>     lateTailBlocks      { 0 };
+    };
+
+    // An Engine built by RebuildEngine that the IO thread hasn't taken yet.
+    std::atomic<Engine*>        mPendingEngine      { nullptr };
+    // An Engine the IO thread has finished with, waiting for UpdateNonRT to delete it.
+    std::atomic<Engine*>        mRetiredEngine      { nullptr };
+    // Set by the IO thread when it needs an Engine for a different IO buffer size.
+    std::atomic<bool>           mRebuildRequested   { false };
+    // The size of the IO thread's last buffer, or 0 before it's had one.
+    std::atomic<UInt32>         mIOBufferFrameSize  { 0 };
+    // True if an IR is set.
+    std::atomic<bool>           mHasImpulseResponse { false };
+    // True while the IO thread is convolving, rather than passing the audio through.
+    std::atomic<bool>           mIsConvolving       { false };
+
+    // Only accessed by ProcessRT, except for the destructor.
+    Engine* __nullable          mActiveEngineRT     = nullptr;
+
+    Stats                       mStats;
+
+    // Guards the IR and building Engines.
+    mutable CAMutex             mMutex;
+    Float64                     mSampleRate;
+    CACFString                  mIRPath;
+    // The IR, one vector per channel. A mono IR is copied to both. Empty if no IR is set.
+    std::vector<Float32>        mIR[kChannels];
+    // The layout of the last Engine built, for CopyStats.
+    UInt32                      mBuiltBlockFrames       = 0;
+    UInt32                      mBuiltTailBlockFrames   = 0;
+    UInt32                      mBuiltHeadPartitions    = 0;
+    UInt32                      mBuiltTailPartitions    = 0;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_Convolver_h */
@@ -0,0 +1,235 @@
+//
+//  EFF_CustomProperties.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+//  Custom properties that only EFFDriver uses so far. The ones EFFApp also needs are in EFF_Types.h.
+//
+
+#ifndef EFF_CustomProperties_h
+#define EFF_CustomProperties_h
+
+// System Includes
+#include <CoreAudio/AudioHardwareBase.h>
+
+
+#pragma mark EFFDevice Custom Properties
+
+enum
+{
+    // A CFArray of CFDictionaries, one for each client of EFFDevice that has played audio, holding
+    // the levels of the last buffer the client played. The levels are measured after the client's
+    // relative volume and pan position have been applied, as linear amplitudes in [0, 1]. See the
+    // kEFFClientLevelsKey_ keys. Read-only and not notified, so it should be polled.
+    kAudioDeviceCustomPropertyClientLevels = 'clvl',
+    // A CFArray of kEFFSpectrumNumBands CFNumbers, the spectrum of the device's mix as the levels of
+    // bands log-spaced from 20 Hz to 20 kHz, lowest first, in dBFS. A sine wave at full scale in
+    // both channels reads as 0 dBFS in its band. Updated about every 1024 frames while something is
+    // reading it, but read-only and not notified, so it should be polled.
+    kAudioDeviceCustomPropertySpectrum = 'spec',
+    // A CFArray of CFDictionaries, one for each app with a parametric EQ, with the keys
+    // kEFFAppEQKey_ProcessID and/or kEFFAppEQKey_BundleID and kEFFAppEQKey_Bands. Setting it only
+    // changes the EQs of the apps in the array. An empty bands array removes an app's EQ.
+    kAudioDeviceCustomPropertyAppEQ = 'apeq',
+    // A CFString, the absolute path of an audio file holding an impulse response to convolve the
+    // device's mix with, or an empty string for none. The IR can be mono or stereo, is resampled to
+    // the device's sample rate and is truncated to kEFFConvolutionMaxIRFrames frames.
+    kAudioDeviceCustomPropertyConvolutionIR = 'cvir',
+    // A CFDictionary with the kEFFConvolutionStatsKey_ keys, describing how the IR is being
+    // convolved and what it costs. Read-only and not notified, so it should be polled.
+    kAudioDeviceCustomPropertyConvolutionStats = 'cvst',
+    // A CFDictionary with the kEFFMusicDuckingKey_ keys, the settings for ducking the music player
+    // while other clients are playing audio. Setting it only changes the settings it has keys for.
+    kAudioDeviceCustomPropertyMusicDucking = 'mdck',
+    // A CFArray of up to kEFFDuckingMaxRules CFDictionaries with the kEFFDuckingRuleKey_ keys. Each
+    // one is a rule that ducks the apps with its target bundle IDs while any of the apps with its
+    // trigger bundle IDs is audible. A client ducked by more than one rule is ducked by the deepest.
+    // An app that's a trigger of a rule isn't ducked by it. Setting it replaces all of the rules.
+    kAudioDeviceCustomPropertyDuckingRules = 'drul',
+    // A CFArray of CFDictionaries with the kEFFAutomationKey_ keys, each of which is a change to an
+    // app's volume or pan, or to the device's volume or mute, that starts on the first frame at or
+    // after a given output sample time. Setting it schedules the changes in addition to any already
+    // scheduled, and setting an empty array cancels them. Getting it returns the changes that
+    // haven't started yet. The events are dropped if IO stops before they start.
+    kAudioDeviceCustomPropertyAutomation = 'atmn',
+    // A CFData holding the changes to kAudioDeviceCustomPropertyAppVolumes since an earlier read, as
+    // an EFF_AppVolumeChangesHeader followed by its EFF_AppVolumeChanges. The qualifier is a
+    // CFNumber, the sequence number from the header of the last read, or 0 or no qualifier for all
+    // of the apps. If the driver no longer has every change since that read, or coreaudiod has
+    // restarted since, the data has kEFFAppVolumeChangesFlag_Snapshot set and holds every app with a
+    // non-default volume or pan instead. Each change is the latest volume and pan of one client,
+    // which can be the default. Clients being removed aren't changes. Read-only and not notified, so
+    // it should be read when kAudioDeviceCustomPropertyAppVolumes changes or polled.
+    kAudioDeviceCustomPropertyAppVolumeChanges = 'avch',
+    // A CFData holding the value of another custom property in a fixed binary layout instead of CF
+    // objects, so it can be read and written without building and parsing arrays and dictionaries.
+    // The qualifier is a CFNumber, the selector of the property, which can be
+    // kAudioDeviceCustomPropertyAppVolumes, kAudioDeviceCustomPropertyMusicPlayerProcessID,
+    // kAudioDeviceCustomPropertyMusicPlayerBundleID or kAudioDeviceCustomPropertyEnabledOutputControls.
+    // The data is an EFF_PackedPropertyHeader, then its entries, then its strings. Getting and
+    // setting it work the same way as for the property itself, and changes are notified for the
+    // property itself, not this one.
+    kAudioDeviceCustomPropertyPacked = 'pckd'
+};
+
+// kAudioDeviceCustomPropertyClientLevels keys
+#define kEFFClientLevelsKey_ClientID        "cid"   // SInt32, the HAL's ID for the client
+#define kEFFClientLevelsKey_ProcessID       "pid"   // SInt32, the client's PID
+#define kEFFClientLevelsKey_SampleTime      "st"    // Float64, the output sample time of the buffer
+#define kEFFClientLevelsKey_PeakLeft        "pkl"   // Float32
+#define kEFFClientLevelsKey_PeakRight       "pkr"   // Float32
+#define kEFFClientLevelsKey_RMSLeft         "rmsl"  // Float32
+#define kEFFClientLevelsKey_RMSRight        "rmsr"  // Float32
+
+// The number of bands in kAudioDeviceCustomPropertySpectrum
+#define kEFFSpectrumNumBands                64
+
+// kAudioDeviceCustomPropertyAppEQ keys
+#define kEFFAppEQKey_ProcessID              "pid"   // SInt32
+#define kEFFAppEQKey_BundleID               "bid"   // CFString
+#define kEFFAppEQKey_Bands                  "bands" // CFArray of CFDictionaries with the kEFFEQBandKey_
+                                                    // keys, at most kEFFAppEQMaxBands, applied in order
+#define kEFFAppEQMaxBands                   8
+
+// The keys of the bands in kAudioDeviceCustomPropertyAppEQ
+#define kEFFEQBandKey_Type                  "type"  // SInt32, an EFF_EQBandType
+#define kEFFEQBandKey_Frequency             "freq"  // Float32, the centre or corner frequency in Hz
+#define kEFFEQBandKey_Gain                  "gain"  // Float32, in dB, in [-24, 24]. Ignored by the
+                                                    // pass filters. Optional, defaults to 0.
+#define kEFFEQBandKey_Q                     "q"     // Float32, greater than 0. Optional, defaults to
+                                                    // 0.7071 (Butterworth).
+
+// The longest IR kAudioDeviceCustomPropertyConvolutionIR will convolve, about 2.7 s at 48 kHz
+#define kEFFConvolutionMaxIRFrames          131072
+
+// kAudioDeviceCustomPropertyConvolutionStats keys
+#define kEFFConvolutionStatsKey_Active          "act"   // CFBoolean, false if the IO buffer size
+                                                        // isn't supported or there's no IR
+#define kEFFConvolutionStatsKey_LatencyFrames   "lat"   // SInt32, the latency the convolution adds
+#define kEFFConvolutionStatsKey_IRFrames        "irl"   // SInt32, the length of the IR
+#define kEFFConvolutionStatsKey_BlockFrames     "blk"   // SInt32, the size of the partitions
+                                                        // convolved on the IO thread
+#define kEFFConvolutionStatsKey_HeadPartitions  "hpn"   // SInt32
+#define kEFFConvolutionStatsKey_TailBlockFrames "tblk"  // SInt32, the size of the partitions
+                                                        // convolved on the helper thread
+#define kEFFConvolutionStatsKey_TailPartitions  "tpn"   // SInt32
+#define kEFFConvolutionStatsKey_CycleMicros     "cyc"   // Float64, the average time spent convolving
+                                                        // on the IO thread per IO cycle
+#define kEFFConvolutionStatsKey_PeakCycleMicros "cycpk" // Float64, the longest since the last read
+#define kEFFConvolutionStatsKey_Load            "load"  // Float64, the average time spent on the IO
+                                                        // thread as a fraction of the IO cycle
+#define kEFFConvolutionStatsKey_TailMicros      "tail"  // Float64, the average time the helper
+                                                        // thread spends on each of its blocks
+#define kEFFConvolutionStatsKey_LateTailBlocks  "late"  // SInt64, the number of the helper thread's
+                                                        // blocks that weren't ready in time
+
+// kAudioDeviceCustomPropertyMusicDucking keys
+#define kEFFMusicDuckingKey_Enabled         "on"    // CFBoolean, defaults to false
+#define kEFFMusicDuckingKey_Depth           "db"    // Float32, the attenuation in dB, in [0, 96]
+#define kEFFMusicDuckingKey_Attack          "atk"   // Float32, in ms, in [0, 10000]
+#define kEFFMusicDuckingKey_Release         "rel"   // Float32, in ms, in [0, 10000]
+#define kEFFMusicDuckingKey_Hold            "hold"  // Float32, how long after the other audio stops
+                                                    // to start releasing, in ms, in [0, 10000]
+
+// kAudioDeviceCustomPropertyDuckingRules keys
+#define kEFFDuckingRuleKey_Triggers         "trig"  // CFArray of CFStrings, bundle IDs. Not empty.
+#define kEFFDuckingRuleKey_Targets          "tgt"   // CFArray of CFStrings, bundle IDs. Not empty.
+#define kEFFDuckingRuleKey_Depth            "db"    // Float32, the attenuation in dB, in [0, 96]
+#define kEFFDuckingRuleKey_Attack           "atk"   // Float32, in ms, in [0, 10000]. Optional,
+                                                    // defaults to 10.
+#define kEFFDuckingRuleKey_Release          "rel"   // Float32, in ms, in [0, 10000]. Optional,
+                                                    // defaults to 500.
+#define kEFFDuckingRuleKey_Hold             "hold"  // Float32, in ms, in [0, 10000]. Optional,
+                                                    // defaults to 250.
+#define kEFFDuckingMaxRules                 32
+
+// kAudioDeviceCustomPropertyAutomation keys. Each event has exactly one of an app volume, a device
+// volume or a device mute.
+#define kEFFAutomationKey_SampleTime        "st"    // Float64, the output sample time, at least 0
+#define kEFFAutomationKey_AppVolume         "app"   // CFDictionary, in the format of the elements of
+                                                    // kAudioDeviceCustomPropertyAppVolumes
+#define kEFFAutomationKey_DeviceVolume      "dvol"  // Float32, the volume control's scalar value
+#define kEFFAutomationKey_DeviceMute        "dmut"  // CFBoolean, the mute control's value
+
+// The layout of kAudioDeviceCustomPropertyAppVolumeChanges, in native byte order.
+struct EFF_AppVolumeChangesHeader
+{
+    UInt64  sequence;           // The qualifier to use for the next read
+    UInt32  numChanges;
+    UInt32  flags;              // kEFFAppVolumeChangesFlag_ bits
+};
+
+#define kEFFAppVolumeChangesFlag_Snapshot   (1u << 0)   // The changes are every app, not just the ones
+                                                        // that changed since the last read
+
+struct EFF_AppVolumeChange
+{
+    SInt32  processID;
+    SInt32  relativeVolume;     // As in kEFFAppVolumesKey_RelativeVolume
+    SInt32  panPosition;        // As in kEFFAppVolumesKey_PanPosition
+    UInt32  bundleIDLength;     // The length in bytes of the UTF-8 bundle ID that follows this struct,
+                                // or 0 if the client has none. The bundle ID isn't NUL-terminated
+                                // and is padded with zeros to a multiple of 4 bytes, after which
+                                // the next change starts.
+};
+
+// The layout of kAudioDeviceCustomPropertyPacked, in native byte order. The entries are each
+// entrySize bytes, which is at least the size of the struct for the property, so fields can be added
+// to the ends of the structs. The strings are NUL-terminated UTF-8, and the last byte of the strings
+// is always a NUL. Each distinct string is only included once.
+struct EFF_PackedPropertyHeader
+{
+    UInt32  selector;           // The property, the same as the qualifier
+    UInt32  numEntries;
+    UInt32  entrySize;
+    UInt32  stringsSize;        // In bytes
+};
+
+#define kEFFPackedNoString                  0xFFFFFFFFu // A string offset for no string
+
+// An entry of kAudioDeviceCustomPropertyAppVolumes, in the same format as its dictionaries.
+struct EFF_PackedAppVolume
+{
+    SInt32  processID;          // Ignored without kEFFPackedAppVolumeFlag_HasProcessID
+    UInt32  bundleID;           // The offset of the bundle ID in the strings, or kEFFPackedNoString
+    SInt32  relativeVolume;     // Ignored without kEFFPackedAppVolumeFlag_HasRelativeVolume
+    SInt32  panPosition;        // Ignored without kEFFPackedAppVolumeFlag_HasPanPosition
+    UInt32  flags;              // kEFFPackedAppVolumeFlag_ bits
+};
+
+#define kEFFPackedAppVolumeFlag_HasProcessID        (1u << 0)
+#define kEFFPackedAppVolumeFlag_HasRelativeVolume   (1u << 1)
+#define kEFFPackedAppVolumeFlag_HasPanPosition      (1u << 2)
+
+// The only entry of kAudioDeviceCustomPropertyMusicPlayerProcessID.
+struct EFF_PackedMusicPlayerProcessID
+{
+    SInt32  processID;
+};
+
+// The only entry of kAudioDeviceCustomPropertyMusicPlayerBundleID.
+struct EFF_PackedMusicPlayerBundleID
+{
+    UInt32  bundleID;           // The offset of the bundle ID in the strings, or kEFFPackedNoString
+                                // to unset it
+};
+
+// The only entry of kAudioDeviceCustomPropertyEnabledOutputControls.
+struct EFF_PackedEnabledOutputControls
+{
+    UInt32  volumeEnabled;      // 0 or 1
+    UInt32  muteEnabled;        // 0 or 1
+};
+
+enum EFF_EQBandType : SInt32
+{
+    kEFFEQBandType_Peak         = 0,
+    kEFFEQBandType_LowShelf     = 1,
+    kEFFEQBandType_HighShelf    = 2,
+    kEFFEQBandType_LowPass      = 3,
+    kEFFEQBandType_HighPass     = 4
+};
+
+#endif /* EFF_CustomProperties_h */
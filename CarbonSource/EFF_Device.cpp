@@ -15,6 +15,8 @@
 
 // Local Includes
 #include "EFF_PlugIn.h"
+#include "EFF_ObjectRegistry.h"
+#include "EFF_PropertyTable.h"
 // #include "EFF_XPCHelper.h"
 #include "EFF_Utils.h"
 
@@ -22,22 +24,103 @@
 #include "CADispatchQueue.h"
 #include "CAException.h"
 #include "CACFArray.h"
+#include "CACFDictionary.h"
 #include "CACFString.h"
 #include "CADebugMacros.h"
 #include "CAHostTimeBase.h"
 
 // STL Includes
+#include <algorithm>
 #include <stdexcept>
+#include <cmath>
+#include <cstring>
 
 // System Includes
+#include <Accelerate/Accelerate.h>
 #include <CoreAudio/AudioHardwareBase.h>
 
 
+#pragma mark Property Table
+
+namespace
+{
+    // The properties EFF_Device adds to EFF_AbstractDevice's or answers differently for. Custom
+    // properties are listed in kAudioObjectPropertyCustomPropertyInfoList in this order.
+    constexpr EFF_PropertyInfo kDevicePropertyList[] =
+    {
+        EFF_Property(kAudioObjectPropertyOwnedObjects,                  EFF_PropertyInfo::kComputedSize),
+        EFF_Property(kAudioDevicePropertyStreams,                       EFF_PropertyInfo::kComputedSize),
+        EFF_Property(kAudioObjectPropertyControlList,                   EFF_PropertyInfo::kComputedSize),
+        EFF_Property(kAudioDevicePropertyNominalSampleRate,             sizeof(Float64), EFF_PropertyInfo::kSettable),
+        EFF_Property(kAudioDevicePropertyAvailableNominalSampleRates,   1 * sizeof(AudioValueRange)),
+        EFF_Property(kAudioDevicePropertyLatency,                       sizeof(UInt32), EFF_PropertyInfo::kInputOutputOnly),
+        EFF_Property(kAudioDevicePropertySafetyOffset,                  sizeof(UInt32), EFF_PropertyInfo::kInputOutputOnly),
+        EFF_Property(kAudioDevicePropertyPreferredChannelsForStereo,    2 * sizeof(UInt32), EFF_PropertyInfo::kInputOutputOnly),
+        EFF_Property(kAudioDevicePropertyPreferredChannelLayout,
+                     offsetof(AudioChannelLayout, mChannelDescriptions) + (2 * sizeof(AudioChannelDescription)),
+                     EFF_PropertyInfo::kInputOutputOnly),
+        EFF_Property(kAudioDevicePropertyDeviceCanBeDefaultDevice,      sizeof(UInt32), EFF_PropertyInfo::kInputOutputOnly),
+        EFF_Property(kAudioDevicePropertyDeviceCanBeDefaultSystemDevice, sizeof(UInt32), EFF_PropertyInfo::kInputOutputOnly),
+        EFF_Property(kAudioDevicePropertyIcon,                          sizeof(CFURLRef)),
+        EFF_Property(kAudioObjectPropertyCustomPropertyInfoList,        EFF_PropertyInfo::kComputedSize),
+
+        EFF_CustomProperty(kAudioDeviceCustomPropertyAppVolumes,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyMusicPlayerProcessID,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyMusicPlayerBundleID,
+                           kAudioServerPlugInCustomPropertyDataTypeCFString,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyDeviceAudibleState,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyEnabledOutputControls,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyClientLevels,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList),
+        EFF_CustomProperty(kAudioDeviceCustomPropertySpectrum,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyAppEQ,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyConvolutionIR,
+                           kAudioServerPlugInCustomPropertyDataTypeCFString,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyConvolutionStats,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyMusicDucking,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyDuckingRules,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyAutomation,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyAppVolumeChanges,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           0,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList),
+        EFF_CustomProperty(kAudioDeviceCustomPropertyPacked,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList)
+    };
+
+    constexpr auto kDeviceProperties = EFF_MakePropertyTable(kDevicePropertyList);
+
+}
+
 #pragma mark Construction/Destruction
 
 pthread_once_t              EFF_Device::sStaticInitializer  = PTHREAD_ONCE_INIT;
 EFF_Device*                 EFF_Device::sInstance           = nullptr;
 EFF_Device*                 EFF_Device::sUISoundsInstance   = nullptr;
+std::vector<EFF_Device*>    EFF_Device::sAdditionalInstances;
 
 EFF_Device&    EFF_Device::GetInstance()
 {
@@ -51,6 +134,12 @@ EFF_Device&    EFF_Device::GetUISoundsInstance()
     return *sUISoundsInstance;
 }
 
+const std::vector<EFF_Device*>&    EFF_Device::GetAdditionalInstances()
+{
+    pthread_once(&sStaticInitializer, StaticInitializer);
+    return sAdditionalInstances;
+}
+
 void    EFF_Device::StaticInitializer()
 {
     try
@@ -65,6 +154,9 @@ void    EFF_Device::StaticInitializer()
                                    kObjectID_Stream_Output,
                                    kObjectID_Volume_Output_Master,
                                    kObjectID_Mute_Output_Master);
+        // Mute the device's output stream when its mute control is set, so muting doesn't depend on
+        // EFFApp muting the real output device.
+        sInstance->mMuteControl.SetWillApplyMuteToAudio(true);
         sInstance->Activate();
         
         // The instance for system (UI) sounds.
@@ -82,7 +174,7 @@ void    EFF_Device::StaticInitializer()
         // Default to full volume.
         theUISoundsVolumeControl.SetVolumeScalar(1.0f);
         // Make the volume curve a bit steeper than the default.
-        theUISoundsVolumeControl.GetVolumeCurve().SetTransferFunction(CAVolumeCurve::kPow4Over1Curve);
+        theUISoundsVolumeControl.SetVolumeCurveTransferFunction(CAVolumeCurve::kPow4Over1Curve);
         // Apply the volume to the device's output stream. The main instance of EFF_Device doesn't
         // apply volume to its audio because EFFApp changes the real output device's volume directly instead.
         theUISoundsVolumeControl.SetWillApplyVolumeToAudio(true);
@@ -96,6 +188,140 @@ void    EFF_Device::StaticInitializer()
         sInstance = nullptr;
         delete sUISoundsInstance;
         sUISoundsInstance = nullptr;
+        return;
+    }
+
+    CreateAdditionalInstances();
+}
+
+void    EFF_Device::CreateAdditionalInstances()
+{
+    // Read the config file, if there is one.
+    CFURLRef theURL =
+        CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault,
+                                                reinterpret_cast<const UInt8*>(kEFFDeviceConfigPath),
+                                                strlen(kEFFDeviceConfigPath),
+                                                false);
+    CFReadStreamRef theStream = theURL ? CFReadStreamCreateWithFile(kCFAllocatorDefault, theURL) : nullptr;
+    CFPropertyListRef theConfig = nullptr;
+
+    if(theStream != nullptr && CFReadStreamOpen(theStream))
+    {
+        theConfig = CFPropertyListCreateWithStream(kCFAllocatorDefault,
+                                                   theStream,
+                                                   0,
+                                                   kCFPropertyListImmutable,
+                                                   nullptr,
+                                                   nullptr);
+        CFReadStreamClose(theStream);
+    }
+
+    if(theStream != nullptr)
+    {
+        CFRelease(theStream);
+    }
+    if(theURL != nullptr)
+    {
+        CFRelease(theURL);
+    }
+
+    if(theConfig == nullptr)
+    {
+        DebugMsg("EFF_Device::CreateAdditionalInstances: No config file at " kEFFDeviceConfigPath);
+        return;
+    }
+
+    if(CFGetTypeID(theConfig) != CFArrayGetTypeID())
+    {
+        LogWarning("EFF_Device::CreateAdditionalInstances: Config file isn't an array");
+        CFRelease(theConfig);
+        return;
+    }
+
+    // Takes ownership of theConfig.
+    CACFArray theDevices(static_cast<CFArrayRef>(theConfig), true);
+    UInt32 theNumDevices = std::min(theDevices.GetNumberItems(), UInt32(kEFFDeviceConfigMaxDevices));
+
+    if(theDevices.GetNumberItems() > theNumDevices)
+    {
+        LogWarning("EFF_Device::CreateAdditionalInstances: Only creating the first %u devices",
+                   theNumDevices);
+    }
+
+    for(UInt32 i = 0; i < theNumDevices; i++)
+    {
+        CACFDictionary theDeviceConfig(false);
+        CFStringRef theName = nullptr;
+        CFStringRef theUID = nullptr;
+
+        if(!theDevices.GetCACFDictionary(i, theDeviceConfig) ||
+           !theDeviceConfig.GetString(CFSTR(kEFFDeviceConfigKey_Name), theName) ||
+           !theDeviceConfig.GetString(CFSTR(kEFFDeviceConfigKey_UID), theUID) ||
+           theName == nullptr ||
+           theUID == nullptr)
+        {
+            LogWarning("EFF_Device::CreateAdditionalInstances: Device %u needs a name and a UID", i);
+            continue;
+        }
+
+        // The UID is part of the name of the device's past clients file. See EFF_PastClients::Open.
+        if(CFStringFind(theUID, CFSTR("/"), 0).location != kCFNotFound ||
+           CFStringFind(theUID, CFSTR(".."), 0).location != kCFNotFound)
+        {
+            LogWarning("EFF_Device::CreateAdditionalInstances: Device %u's UID can't contain / or ..", i);
+            continue;
+        }
+
+        // EFF_PlugIn checks these devices before the null device when it translates a UID, so one
+        // with the null device's UID would hide it.
+        bool theUIDIsTaken = CFEqual(theUID, sInstance->mDeviceUID) ||
+                             CFEqual(theUID, sUISoundsInstance->mDeviceUID) ||
+                             CFEqual(theUID, CFSTR(kEFFNullDeviceUID));
+
+        for(EFF_Device* theDevice : sAdditionalInstances)
+        {
+            theUIDIsTaken = theUIDIsTaken || CFEqual(theUID, theDevice->mDeviceUID);
+        }
+
+        if(theUIDIsTaken)
+        {
+            LogWarning("EFF_Device::CreateAdditionalInstances: Device %u's UID is already taken", i);
+            continue;
+        }
+
+        EFF_Device* theDevice = nullptr;
+
+        try
+        {
+            // The devices are never destroyed, so they keep this reference to their strings for the
+            // life of the driver. Device_GetPropertyData retains the strings again for the HAL,
+            // which releases the strings it gets.
+            CFRetain(theName);
+            CFRetain(theUID);
+
+            theDevice = new EFF_Device(EFF_ObjectRegistry::AllocateObjectID(),
+                                       theName,
+                                       theUID,
+                                       CFSTR(kEFFDeviceModelUID),
+                                       EFF_ObjectRegistry::AllocateObjectID(),
+                                       EFF_ObjectRegistry::AllocateObjectID(),
+                                       EFF_ObjectRegistry::AllocateObjectID(),
+                                       EFF_ObjectRegistry::AllocateObjectID());
+
+            // EFFApp doesn't manage these devices, so they apply their own volume and mute.
+            theDevice->mVolumeControl.SetWillApplyVolumeToAudio(true);
+            theDevice->mMuteControl.SetWillApplyMuteToAudio(true);
+            theDevice->Activate();
+
+            sAdditionalInstances.push_back(theDevice);
+        }
+        catch(...)
+        {
+            LogWarning("EFF_Device::CreateAdditionalInstances: Failed to create device %u", i);
+            delete theDevice;
+            CFRelease(theName);
+            CFRelease(theUID);
+        }
     }
 }
 
@@ -115,6 +341,7 @@ EFF_Device::EFF_Device(AudioObjectID inObjectID,
     mDeviceUID(inDeviceUID),
     mDeviceModelUID(inDeviceModelUID),
     mWrappedAudioEngine(nullptr),
+    mAutomation(inObjectID, mClients, mVolumeControl, mMuteControl),
     mClients(inObjectID, &mTaskQueue),
     mInputStream(inInputStreamID, inObjectID, false, kSampleRateDefault),
     mOutputStream(inOutputStreamID, inObjectID, false, kSampleRateDefault),
@@ -125,10 +352,29 @@ EFF_Device::EFF_Device(AudioObjectID inObjectID,
     // Initialises the loopback clock with the default sample rate and, if there is one,
     // sets the wrapped device to the same sample rate
     SetSampleRate(kSampleRateDefault, true);
+
+    // The device handles the HAL's calls for its streams and controls as well as its own.
+    EFF_ObjectRegistry::Register(inObjectID, *this, this);
+    EFF_ObjectRegistry::Register(inInputStreamID, *this);
+    EFF_ObjectRegistry::Register(inOutputStreamID, *this);
+
+    if(inOutputVolumeControlID != kAudioObjectUnknown)
+    {
+        EFF_ObjectRegistry::Register(inOutputVolumeControlID, *this);
+    }
+    if(inOutputMuteControlID != kAudioObjectUnknown)
+    {
+        EFF_ObjectRegistry::Register(inOutputMuteControlID, *this);
+    }
 }
 
 EFF_Device::~EFF_Device()
 {
+    EFF_ObjectRegistry::Unregister(GetObjectID());
+    EFF_ObjectRegistry::Unregister(mInputStream.GetObjectID());
+    EFF_ObjectRegistry::Unregister(mOutputStream.GetObjectID());
+    EFF_ObjectRegistry::Unregister(mVolumeControl.GetObjectID());
+    EFF_ObjectRegistry::Unregister(mMuteControl.GetObjectID());
 }
 
 void    EFF_Device::Activate()
@@ -138,6 +384,10 @@ void    EFF_Device::Activate()
     // Open the connection to the driver and initialize things.
     //_HW_Open();
 
+    // Map the file the device's past clients' settings are saved in, so they're restored when the
+    // apps are added again.
+    mClients.OpenPastClients(mDeviceUID);
+
     mInputStream.Activate();
     mOutputStream.Activate();
 
@@ -312,6 +562,14 @@ void    EFF_Device::SetPropertyData(AudioObjectID inObjectID,
                     reinterpret_cast<const AudioStreamBasicDescription*>(inData);
                 RequestSampleRate(theNewFormat->mSampleRate);
             }
+            else if(inAddress.mSelector == kAudioStreamPropertyIsActive &&
+                    inObjectID == mInputStream.GetObjectID() &&
+                    !mInputStream.IsStreamActive())
+            {
+                // Nothing can read the input stream now, so stop storing the mix in the loopback
+                // ring buffer without waiting for WriteMix to notice ReadInput has stopped.
+                ResetLoopbackReaders();
+            }
         }
     }
 }
@@ -328,36 +586,14 @@ const
     //    are useful but not required. There is more detailed commentary about each property in the
     //    Device_GetPropertyData() method.
 
-    bool theAnswer = false;
-    switch(inAddress.mSelector)
+    const EFF_PropertyInfo* theInfo = kDeviceProperties.Find(inAddress.mSelector);
+
+    if(theInfo != nullptr)
     {
-        case kAudioDevicePropertyStreams:
-        case kAudioDevicePropertyIcon:
-        case kAudioObjectPropertyCustomPropertyInfoList:
-        case kAudioDeviceCustomPropertyDeviceAudibleState:
-        case kAudioDeviceCustomPropertyMusicPlayerProcessID:
-        case kAudioDeviceCustomPropertyMusicPlayerBundleID:
-        case kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp:
-        case kAudioDeviceCustomPropertyAppVolumes:
-        case kAudioDeviceCustomPropertyEnabledOutputControls:
-            theAnswer = true;
-            break;
-            
-        case kAudioDevicePropertyLatency:
-        case kAudioDevicePropertySafetyOffset:
-        case kAudioDevicePropertyPreferredChannelsForStereo:
-        case kAudioDevicePropertyPreferredChannelLayout:
-        case kAudioDevicePropertyDeviceCanBeDefaultDevice:
-        case kAudioDevicePropertyDeviceCanBeDefaultSystemDevice:
-            theAnswer = (inAddress.mScope == kAudioObjectPropertyScopeInput) ||
-                        (inAddress.mScope == kAudioObjectPropertyScopeOutput);
-            break;
-            
-        default:
-            theAnswer = EFF_AbstractDevice::HasProperty(inObjectID, inClientPID, inAddress);
-            break;
-    };
-    return theAnswer;
+        return kDeviceProperties.HasProperty(*theInfo, inAddress);
+    }
+
+    return EFF_AbstractDevice::HasProperty(inObjectID, inClientPID, inAddress);
 }
 
 bool    EFF_Device::Device_IsPropertySettable(AudioObjectID inObjectID,
@@ -369,36 +605,14 @@ const
     //    are useful but not required. There is more detailed commentary about each property in the
     //    Device_GetPropertyData() method.
     
-    bool theAnswer = false;
-    switch(inAddress.mSelector)
+    const EFF_PropertyInfo* theInfo = kDeviceProperties.Find(inAddress.mSelector);
+
+    if(theInfo != nullptr)
     {
-        case kAudioDevicePropertyStreams:
-        case kAudioDevicePropertyLatency:
-        case kAudioDevicePropertySafetyOffset:
-        case kAudioDevicePropertyPreferredChannelsForStereo:
-        case kAudioDevicePropertyPreferredChannelLayout:
-        case kAudioDevicePropertyDeviceCanBeDefaultDevice:
-        case kAudioDevicePropertyDeviceCanBeDefaultSystemDevice:
-        case kAudioDevicePropertyIcon:
-        case kAudioObjectPropertyCustomPropertyInfoList:
-        case kAudioDeviceCustomPropertyDeviceAudibleState:
-        case kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp:
-            theAnswer = false;
-            break;
-            
-        case kAudioDevicePropertyNominalSampleRate:
-        case kAudioDeviceCustomPropertyMusicPlayerProcessID:
-        case kAudioDeviceCustomPropertyMusicPlayerBundleID:
-        case kAudioDeviceCustomPropertyAppVolumes:
-        case kAudioDeviceCustomPropertyEnabledOutputControls:
-            theAnswer = true;
-            break;
-        
-        default:
-            theAnswer = EFF_AbstractDevice::IsPropertySettable(inObjectID, inClientPID, inAddress);
-            break;
-    };
-    return theAnswer;
+        return kDeviceProperties.IsPropertySettable(*theInfo);
+    }
+
+    return EFF_AbstractDevice::IsPropertySettable(inObjectID, inClientPID, inAddress);
 }
 
 UInt32    EFF_Device::Device_GetPropertyDataSize(AudioObjectID inObjectID,
@@ -412,6 +626,23 @@ const
     //    are useful but not required. There is more detailed commentary about each property in the
     //    Device_GetPropertyData() method.
 
+    const EFF_PropertyInfo* theInfo = kDeviceProperties.Find(inAddress.mSelector);
+
+    if(theInfo == nullptr)
+    {
+        return EFF_AbstractDevice::GetPropertyDataSize(inObjectID,
+                                                       inClientPID,
+                                                       inAddress,
+                                                       inQualifierDataSize,
+                                                       inQualifierData);
+    }
+
+    if(theInfo->dataSize != EFF_PropertyInfo::kComputedSize)
+    {
+        return theInfo->dataSize;
+    }
+
+    // The properties whose sizes depend on the device's state.
     UInt32 theAnswer = 0;
 
     switch(inAddress.mSelector)
@@ -465,56 +696,11 @@ const
             theAnswer = GetNumberOfOutputControls() * sizeof(AudioObjectID);
             break;
 
-        case kAudioDevicePropertyAvailableNominalSampleRates:
-            theAnswer = 1 * sizeof(AudioValueRange);
-            break;
-
-        case kAudioDevicePropertyPreferredChannelsForStereo:
-            theAnswer = 2 * sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyPreferredChannelLayout:
-            theAnswer = offsetof(AudioChannelLayout, mChannelDescriptions) + (2 * sizeof(AudioChannelDescription));
-            break;
-
-        case kAudioDevicePropertyIcon:
-            theAnswer = sizeof(CFURLRef);
-            break;
-            
         case kAudioObjectPropertyCustomPropertyInfoList:
-            theAnswer = sizeof(AudioServerPlugInCustomPropertyInfo) * 6;
-            break;
-            
-        case kAudioDeviceCustomPropertyDeviceAudibleState:
-            theAnswer = sizeof(CFNumberRef);
-            break;
-
-        case kAudioDeviceCustomPropertyMusicPlayerProcessID:
-            theAnswer = sizeof(CFPropertyListRef);
-            break;
-            
-        case kAudioDeviceCustomPropertyMusicPlayerBundleID:
-            theAnswer = sizeof(CFStringRef);
-            break;
-            
-        case kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp:
-            theAnswer = sizeof(CFBooleanRef);
-            break;
-            
-        case kAudioDeviceCustomPropertyAppVolumes:
-            theAnswer = sizeof(CFPropertyListRef);
+            theAnswer = kDeviceProperties.GetNumberOfCustomProperties() * sizeof(AudioServerPlugInCustomPropertyInfo);
             break;
 
-        case kAudioDeviceCustomPropertyEnabledOutputControls:
-            theAnswer = sizeof(CFArrayRef);
-            break;
-        
         default:
-            theAnswer = EFF_AbstractDevice::GetPropertyDataSize(inObjectID,
-                                                                inClientPID,
-                                                                inAddress,
-                                                                inQualifierDataSize,
-                                                                inQualifierData);
             break;
     };
 
@@ -548,6 +734,9 @@ const
             ThrowIf(inDataSize < sizeof(AudioObjectID),
                     CAException(kAudioHardwareBadPropertySizeError),
                     "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioObjectPropertyName for the device");
+            // The caller releases the string. The additional devices' names came from the config
+            // file, so unlike CFSTR constants they'd be freed.
+            CFRetain(mDeviceName);
             *reinterpret_cast<CFStringRef*>(outData) = mDeviceName;
             outDataSize = sizeof(CFStringRef);
             break;
@@ -678,6 +867,8 @@ const
             ThrowIf(inDataSize < sizeof(AudioObjectID),
                     CAException(kAudioHardwareBadPropertySizeError),
                     "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDevicePropertyDeviceUID for the device");
+            // Retained for the caller, like the name.
+            CFRetain(mDeviceUID);
             *reinterpret_cast<CFStringRef*>(outData) = mDeviceUID;
             outDataSize = sizeof(CFStringRef);
             break;
@@ -689,6 +880,7 @@ const
             ThrowIf(inDataSize < sizeof(AudioObjectID),
                     CAException(kAudioHardwareBadPropertySizeError),
                     "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDevicePropertyModelUID for the device");
+            CFRetain(mDeviceModelUID);
             *reinterpret_cast<CFStringRef*>(outData) = mDeviceModelUID;
             outDataSize = sizeof(CFStringRef);
             break;
@@ -942,57 +1134,8 @@ const
             break;
             
         case kAudioObjectPropertyCustomPropertyInfoList:
-            theNumberItemsToFetch = inDataSize / sizeof(AudioServerPlugInCustomPropertyInfo);
-            
-            //    clamp it to the number of items we have
-            if(theNumberItemsToFetch > 6)
-            {
-                theNumberItemsToFetch = 6;
-            }
-            
-            if(theNumberItemsToFetch > 0)
-            {
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[0].mSelector =
-                    kAudioDeviceCustomPropertyAppVolumes;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[0].mPropertyDataType =
-                    kAudioServerPlugInCustomPropertyDataTypeCFPropertyList;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[0].mQualifierDataType =
-                    kAudioServerPlugInCustomPropertyDataTypeNone;
-            }
-            if(theNumberItemsToFetch > 1)
-            {
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[1].mSelector = kAudioDeviceCustomPropertyMusicPlayerProcessID;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[1].mPropertyDataType = kAudioServerPlugInCustomPropertyDataTypeCFPropertyList;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[1].mQualifierDataType = kAudioServerPlugInCustomPropertyDataTypeNone;
-            }
-            if(theNumberItemsToFetch > 2)
-            {
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[2].mSelector =
-                    kAudioDeviceCustomPropertyMusicPlayerBundleID;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[2].mPropertyDataType = kAudioServerPlugInCustomPropertyDataTypeCFString;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[2].mQualifierDataType = kAudioServerPlugInCustomPropertyDataTypeNone;
-            }
-            if(theNumberItemsToFetch > 3)
-            {
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[3].mSelector = kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[3].mPropertyDataType = kAudioServerPlugInCustomPropertyDataTypeCFPropertyList;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[3].mQualifierDataType = kAudioServerPlugInCustomPropertyDataTypeNone;
-            }
-            if(theNumberItemsToFetch > 4)
-            {
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[4].mSelector =
-                    kAudioDeviceCustomPropertyDeviceAudibleState;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[4].mPropertyDataType = kAudioServerPlugInCustomPropertyDataTypeCFPropertyList;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[4].mQualifierDataType = kAudioServerPlugInCustomPropertyDataTypeNone;
-            }
-            if(theNumberItemsToFetch > 5)
-            {
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[5].mSelector = kAudioDeviceCustomPropertyEnabledOutputControls;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[5].mPropertyDataType = kAudioServerPlugInCustomPropertyDataTypeCFPropertyList;
-                ((AudioServerPlugInCustomPropertyInfo*)outData)[5].mQualifierDataType = kAudioServerPlugInCustomPropertyDataTypeNone;
-            }
-
-            outDataSize = theNumberItemsToFetch * sizeof(AudioServerPlugInCustomPropertyInfo);
+            //    the table copies as many of the custom properties as fit, in the order it lists them
+            outDataSize = kDeviceProperties.CopyCustomPropertyInfoList(inDataSize, outData);
             break;
             
         case kAudioDeviceCustomPropertyDeviceAudibleState:
@@ -1070,6 +1213,113 @@ const
             }
             break;
 
+        case kAudioDeviceCustomPropertyClientLevels:
+            // The levels are read without locking so refreshing the meters never blocks the IO
+            // thread. See EFF_ClientMeters.
+            ThrowIf(inDataSize < sizeof(CFArrayRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyClientLevels for the device");
+            *reinterpret_cast<CFArrayRef*>(outData) = mClients.CopyClientLevels().GetCFArray();
+            outDataSize = sizeof(CFArrayRef);
+            break;
+
+        case kAudioDeviceCustomPropertySpectrum:
+            // Doesn't take the IO mutex. The spectrum is computed on EFF_TaskQueue's non-real-time
+            // thread, so EFF_SpectrumAnalyzer has its own.
+            ThrowIf(inDataSize < sizeof(CFArrayRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertySpectrum for the device");
+            *reinterpret_cast<CFArrayRef*>(outData) = mSpectrumAnalyzer.CopySpectrum().GetCFArray();
+            outDataSize = sizeof(CFArrayRef);
+            break;
+
+        case kAudioDeviceCustomPropertyAppEQ:
+            ThrowIf(inDataSize < sizeof(CFArrayRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyAppEQ for the device");
+            *reinterpret_cast<CFArrayRef*>(outData) = mClients.CopyAppEQs().GetCFArray();
+            outDataSize = sizeof(CFArrayRef);
+            break;
+
+        case kAudioDeviceCustomPropertyConvolutionIR:
+            ThrowIf(inDataSize < sizeof(CFStringRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyConvolutionIR for the device");
+            *reinterpret_cast<CFStringRef*>(outData) = mConvolver.CopyImpulseResponsePath().CopyCFString();
+            outDataSize = sizeof(CFStringRef);
+            break;
+
+        case kAudioDeviceCustomPropertyConvolutionStats:
+            // Doesn't take the IO mutex. The costs are measured with atomics. See EFF_Convolver.
+            ThrowIf(inDataSize < sizeof(CFDictionaryRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyConvolutionStats for the device");
+            *reinterpret_cast<CFDictionaryRef*>(outData) = mConvolver.CopyStats().GetDict();
+            outDataSize = sizeof(CFDictionaryRef);
+            break;
+
+        case kAudioDeviceCustomPropertyMusicDucking:
+            ThrowIf(inDataSize < sizeof(CFDictionaryRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyMusicDucking for the device");
+            *reinterpret_cast<CFDictionaryRef*>(outData) = mDucker.CopyMusicDucking().GetDict();
+            outDataSize = sizeof(CFDictionaryRef);
+            break;
+
+        case kAudioDeviceCustomPropertyDuckingRules:
+            ThrowIf(inDataSize < sizeof(CFArrayRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyDuckingRules for the device");
+            *reinterpret_cast<CFArrayRef*>(outData) = mClients.CopyDuckingRules().GetCFArray();
+            outDataSize = sizeof(CFArrayRef);
+            break;
+
+        case kAudioDeviceCustomPropertyAutomation:
+            ThrowIf(inDataSize < sizeof(CFArrayRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyAutomation for the device");
+            *reinterpret_cast<CFArrayRef*>(outData) = mAutomation.CopyScheduledEvents().GetCFArray();
+            outDataSize = sizeof(CFArrayRef);
+            break;
+
+        case kAudioDeviceCustomPropertyAppVolumeChanges:
+            {
+                ThrowIf(inDataSize < sizeof(CFDataRef),
+                        CAException(kAudioHardwareBadPropertySizeError),
+                        "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyAppVolumeChanges for the device");
+
+                // The qualifier is the sequence number from the last value the caller read. Without
+                // one, the caller gets a snapshot.
+                UInt64 theSequence = 0;
+
+                if(inQualifierDataSize >= sizeof(CFNumberRef) && inQualifierData != nullptr)
+                {
+                    CFNumberRef theSequenceRef = *reinterpret_cast<const CFNumberRef*>(inQualifierData);
+
+                    ThrowIf(theSequenceRef == nullptr || CFGetTypeID(theSequenceRef) != CFNumberGetTypeID(),
+                            CAException(kAudioHardwareIllegalOperationError),
+                            "EFF_Device::Device_GetPropertyData: the qualifier for kAudioDeviceCustomPropertyAppVolumeChanges was not a CFNumber");
+
+                    SInt64 theSequenceValue = 0;
+                    CFNumberGetValue(theSequenceRef, kCFNumberSInt64Type, &theSequenceValue);
+                    theSequence = static_cast<UInt64>(theSequenceValue);
+                }
+
+                CAMutex::Locker theStateLocker(mStateMutex);
+                *reinterpret_cast<CFDataRef*>(outData) = mClients.CopyAppVolumeChanges(theSequence);
+                outDataSize = sizeof(CFDataRef);
+            }
+            break;
+
+        case kAudioDeviceCustomPropertyPacked:
+            ThrowIf(inDataSize < sizeof(CFDataRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_GetPropertyData: not enough space for the return value of kAudioDeviceCustomPropertyPacked for the device");
+            *reinterpret_cast<CFDataRef*>(outData) =
+                CopyPackedProperty(GetPackedPropertySelector(inQualifierDataSize, inQualifierData));
+            outDataSize = sizeof(CFDataRef);
+            break;
+
         default:
             EFF_AbstractDevice::GetPropertyData(inObjectID,
                                                 inClientPID,
@@ -1219,6 +1469,10 @@ void    EFF_Device::Device_SetPropertyData(AudioObjectID inObjectID,
                 {
                     Throw(CAException(kAudioHardwareIllegalOperationError));
                 }
+                catch(EFF_InvalidClientPanPositionException)
+                {
+                    Throw(CAException(kAudioHardwareIllegalOperationError));
+                }
                 
                 if(propertyWasChanged)
                 {
@@ -1231,33 +1485,222 @@ void    EFF_Device::Device_SetPropertyData(AudioObjectID inObjectID,
             }
             break;
 
-        case kAudioDeviceCustomPropertyEnabledOutputControls:
+        case kAudioDeviceCustomPropertyAppEQ:
             {
                 ThrowIf(inDataSize < sizeof(CFArrayRef),
                         CAException(kAudioHardwareBadPropertySizeError),
-                        "EFF_Device::Device_SetPropertyData: wrong size for the data for "
-                        "kAudioDeviceCustomPropertyEnabledOutputControls");
-
-                CFArrayRef theEnabledControlsRef = *reinterpret_cast<const CFArrayRef*>(inData);
+                        "EFF_Device::Device_SetPropertyData: wrong size for the data for kAudioDeviceCustomPropertyAppEQ");
+                
+                CFArrayRef arrayRef = *reinterpret_cast<const CFArrayRef*>(inData);
 
-                ThrowIfNULL(theEnabledControlsRef,
+                ThrowIfNULL(arrayRef,
                             CAException(kAudioHardwareIllegalOperationError),
-                            "EFF_Device::Device_SetPropertyData: null reference given for "
-                            "kAudioDeviceCustomPropertyEnabledOutputControls");
-                ThrowIf(CFGetTypeID(theEnabledControlsRef) != CFArrayGetTypeID(),
+                            "EFF_Device::Device_SetPropertyData: kAudioDeviceCustomPropertyAppEQ cannot be set to NULL");
+                ThrowIf(CFGetTypeID(arrayRef) != CFArrayGetTypeID(),
                         CAException(kAudioHardwareIllegalOperationError),
-                        "EFF_Device::Device_SetPropertyData: CFType given for "
-                        "kAudioDeviceCustomPropertyEnabledOutputControls was not a CFArray");
+                        "EFF_Device::Device_SetPropertyData: CFType given for kAudioDeviceCustomPropertyAppEQ was not a CFArray");
+                
+                CACFArray array(arrayRef, false);
 
-                CACFArray theEnabledControls(theEnabledControlsRef, false);
+                CAMutex::Locker theStateLocker(mStateMutex);
 
-                ThrowIf(theEnabledControls.GetNumberItems() != 2,
-                        CAException(kAudioHardwareIllegalOperationError),
-                        "EFF_Device::Device_SetPropertyData: Expected the CFArray given for "
-                        "kAudioDeviceCustomPropertyEnabledOutputControls to have exactly 2 elements");
+                // The coefficients are computed here, on the HAL's thread, and swapped into the
+                // clients' filters without blocking IO. See EFF_ClientEQ.
+                bool propertyWasChanged = mClients.SetAppEQs(array);
+                
+                if(propertyWasChanged)
+                {
+                    // Send notification
+                    CADispatchQueue::GetGlobalSerialQueue().Dispatch(false,    ^{
+                        AudioObjectPropertyAddress theChangedProperties[] = {
+                            { kAudioDeviceCustomPropertyAppEQ,
+                              kAudioObjectPropertyScopeGlobal,
+                              kAudioObjectPropertyElementMaster }
+                        };
+                        EFF_PlugIn::Host_PropertiesChanged(inObjectID, 1, theChangedProperties);
+                    });
+                }
+            }
+            break;
 
-                bool theVolumeControlEnabled;
-                bool didGetBool = theEnabledControls.GetBool(kEFFEnabledOutputControlsIndex_Volume,
+        case kAudioDeviceCustomPropertyConvolutionIR:
+            {
+                ThrowIf(inDataSize < sizeof(CFStringRef),
+                        CAException(kAudioHardwareBadPropertySizeError),
+                        "EFF_Device::Device_SetPropertyData: wrong size for the data for kAudioDeviceCustomPropertyConvolutionIR");
+
+                CFStringRef thePathRef = *reinterpret_cast<const CFStringRef*>(inData);
+
+                ThrowIfNULL(thePathRef,
+                            CAException(kAudioHardwareIllegalOperationError),
+                            "EFF_Device::Device_SetPropertyData: kAudioDeviceCustomPropertyConvolutionIR cannot be set to NULL");
+                ThrowIf(CFGetTypeID(thePathRef) != CFStringGetTypeID(),
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::Device_SetPropertyData: CFType given for kAudioDeviceCustomPropertyConvolutionIR was not a CFString");
+
+                CFRetain(thePathRef);
+                CACFString thePath(thePathRef);
+
+                // The IR is read and transformed here, on the HAL's thread, and handed to the IO
+                // thread without blocking it. See EFF_Convolver.
+                mConvolver.SetImpulseResponse(thePath);
+
+                // Send notification
+                CADispatchQueue::GetGlobalSerialQueue().Dispatch(false,    ^{
+                    AudioObjectPropertyAddress theChangedProperties[] = {
+                        { kAudioDeviceCustomPropertyConvolutionIR,
+                          kAudioObjectPropertyScopeGlobal,
+                          kAudioObjectPropertyElementMaster }
+                    };
+                    EFF_PlugIn::Host_PropertiesChanged(inObjectID, 1, theChangedProperties);
+                });
+            }
+            break;
+
+        case kAudioDeviceCustomPropertyMusicDucking:
+            {
+                ThrowIf(inDataSize < sizeof(CFDictionaryRef),
+                        CAException(kAudioHardwareBadPropertySizeError),
+                        "EFF_Device::Device_SetPropertyData: wrong size for the data for kAudioDeviceCustomPropertyMusicDucking");
+
+                CFDictionaryRef theSettingsRef = *reinterpret_cast<const CFDictionaryRef*>(inData);
+
+                ThrowIfNULL(theSettingsRef,
+                            CAException(kAudioHardwareIllegalOperationError),
+                            "EFF_Device::Device_SetPropertyData: kAudioDeviceCustomPropertyMusicDucking cannot be set to NULL");
+                ThrowIf(CFGetTypeID(theSettingsRef) != CFDictionaryGetTypeID(),
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::Device_SetPropertyData: CFType given for kAudioDeviceCustomPropertyMusicDucking was not a CFDictionary");
+
+                CACFDictionary theSettings(theSettingsRef, false);
+
+                // The IO thread reads the new settings without locking. See EFF_Ducker.
+                bool propertyWasChanged = mDucker.SetMusicDucking(theSettings);
+
+                if(propertyWasChanged)
+                {
+                    // Send notification
+                    CADispatchQueue::GetGlobalSerialQueue().Dispatch(false,    ^{
+                        AudioObjectPropertyAddress theChangedProperties[] = {
+                            { kAudioDeviceCustomPropertyMusicDucking,
+                              kAudioObjectPropertyScopeGlobal,
+                              kAudioObjectPropertyElementMaster }
+                        };
+                        EFF_PlugIn::Host_PropertiesChanged(inObjectID, 1, theChangedProperties);
+                    });
+                }
+            }
+            break;
+
+        case kAudioDeviceCustomPropertyDuckingRules:
+            {
+                ThrowIf(inDataSize < sizeof(CFArrayRef),
+                        CAException(kAudioHardwareBadPropertySizeError),
+                        "EFF_Device::Device_SetPropertyData: wrong size for the data for kAudioDeviceCustomPropertyDuckingRules");
+
+                CFArrayRef theRulesRef = *reinterpret_cast<const CFArrayRef*>(inData);
+
+                ThrowIfNULL(theRulesRef,
+                            CAException(kAudioHardwareIllegalOperationError),
+                            "EFF_Device::Device_SetPropertyData: kAudioDeviceCustomPropertyDuckingRules cannot be set to NULL");
+                ThrowIf(CFGetTypeID(theRulesRef) != CFArrayGetTypeID(),
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::Device_SetPropertyData: CFType given for kAudioDeviceCustomPropertyDuckingRules was not a CFArray");
+
+                CACFArray theRules(theRulesRef, false);
+
+                // The rules are matched against the clients' bundle IDs here, on the HAL's thread, and
+                // swapped in without blocking IO. See EFF_DuckingRules.
+                bool propertyWasChanged = mClients.SetDuckingRules(theRules);
+
+                if(propertyWasChanged)
+                {
+                    // Send notification
+                    CADispatchQueue::GetGlobalSerialQueue().Dispatch(false,    ^{
+                        AudioObjectPropertyAddress theChangedProperties[] = {
+                            { kAudioDeviceCustomPropertyDuckingRules,
+                              kAudioObjectPropertyScopeGlobal,
+                              kAudioObjectPropertyElementMaster }
+                        };
+                        EFF_PlugIn::Host_PropertiesChanged(inObjectID, 1, theChangedProperties);
+                    });
+                }
+            }
+            break;
+
+        case kAudioDeviceCustomPropertyAutomation:
+            {
+                ThrowIf(inDataSize < sizeof(CFArrayRef),
+                        CAException(kAudioHardwareBadPropertySizeError),
+                        "EFF_Device::Device_SetPropertyData: wrong size for the data for kAudioDeviceCustomPropertyAutomation");
+
+                CFArrayRef theEventsRef = *reinterpret_cast<const CFArrayRef*>(inData);
+
+                ThrowIfNULL(theEventsRef,
+                            CAException(kAudioHardwareIllegalOperationError),
+                            "EFF_Device::Device_SetPropertyData: kAudioDeviceCustomPropertyAutomation cannot be set to NULL");
+                ThrowIf(CFGetTypeID(theEventsRef) != CFArrayGetTypeID(),
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::Device_SetPropertyData: CFType given for kAudioDeviceCustomPropertyAutomation was not a CFArray");
+
+                CACFArray theEvents(theEventsRef, false);
+
+                // Hold the state mutex so the apps' clients can't be added or removed while their
+                // events are queued.
+                CAMutex::Locker theStateLocker(mStateMutex);
+
+                try
+                {
+                    mAutomation.ScheduleEvents(theEvents);
+                }
+                catch(EFF_InvalidClientRelativeVolumeException)
+                {
+                    Throw(CAException(kAudioHardwareIllegalOperationError));
+                }
+                catch(EFF_InvalidClientPanPositionException)
+                {
+                    Throw(CAException(kAudioHardwareIllegalOperationError));
+                }
+
+                // Send notification
+                CADispatchQueue::GetGlobalSerialQueue().Dispatch(false,    ^{
+                    AudioObjectPropertyAddress theChangedProperties[] = {
+                        { kAudioDeviceCustomPropertyAutomation,
+                          kAudioObjectPropertyScopeGlobal,
+                          kAudioObjectPropertyElementMaster }
+                    };
+                    EFF_PlugIn::Host_PropertiesChanged(inObjectID, 1, theChangedProperties);
+                });
+            }
+            break;
+
+        case kAudioDeviceCustomPropertyEnabledOutputControls:
+            {
+                ThrowIf(inDataSize < sizeof(CFArrayRef),
+                        CAException(kAudioHardwareBadPropertySizeError),
+                        "EFF_Device::Device_SetPropertyData: wrong size for the data for "
+                        "kAudioDeviceCustomPropertyEnabledOutputControls");
+
+                CFArrayRef theEnabledControlsRef = *reinterpret_cast<const CFArrayRef*>(inData);
+
+                ThrowIfNULL(theEnabledControlsRef,
+                            CAException(kAudioHardwareIllegalOperationError),
+                            "EFF_Device::Device_SetPropertyData: null reference given for "
+                            "kAudioDeviceCustomPropertyEnabledOutputControls");
+                ThrowIf(CFGetTypeID(theEnabledControlsRef) != CFArrayGetTypeID(),
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::Device_SetPropertyData: CFType given for "
+                        "kAudioDeviceCustomPropertyEnabledOutputControls was not a CFArray");
+
+                CACFArray theEnabledControls(theEnabledControlsRef, false);
+
+                ThrowIf(theEnabledControls.GetNumberItems() != 2,
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::Device_SetPropertyData: Expected the CFArray given for "
+                        "kAudioDeviceCustomPropertyEnabledOutputControls to have exactly 2 elements");
+
+                bool theVolumeControlEnabled;
+                bool didGetBool = theEnabledControls.GetBool(kEFFEnabledOutputControlsIndex_Volume,
                                                              theVolumeControlEnabled);
                 ThrowIf(!didGetBool,
                         CAException(kAudioHardwareIllegalOperationError),
@@ -1276,6 +1719,15 @@ void    EFF_Device::Device_SetPropertyData(AudioObjectID inObjectID,
             }
             break;
 
+        case kAudioDeviceCustomPropertyPacked:
+            ThrowIf(inDataSize < sizeof(CFDataRef),
+                    CAException(kAudioHardwareBadPropertySizeError),
+                    "EFF_Device::Device_SetPropertyData: wrong size for the data for kAudioDeviceCustomPropertyPacked");
+            SetPackedProperty(inObjectID,
+                              GetPackedPropertySelector(inQualifierDataSize, inQualifierData),
+                              *reinterpret_cast<const CFTypeRef*>(inData));
+            break;
+
         default:
             EFF_AbstractDevice::SetPropertyData(inObjectID,
                                                 inClientPID,
@@ -1289,6 +1741,222 @@ void    EFF_Device::Device_SetPropertyData(AudioObjectID inObjectID,
 }
 
 
+#pragma mark Packed Properties
+
+//static
+AudioObjectPropertySelector    EFF_Device::GetPackedPropertySelector(UInt32 inQualifierDataSize,
+                                                                     const void* __nullable inQualifierData)
+{
+    ThrowIf(inQualifierDataSize < sizeof(CFNumberRef) || inQualifierData == nullptr,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_Device::GetPackedPropertySelector: kAudioDeviceCustomPropertyPacked needs a qualifier");
+
+    CFNumberRef theSelectorRef = *reinterpret_cast<const CFNumberRef*>(inQualifierData);
+
+    ThrowIf(theSelectorRef == nullptr || CFGetTypeID(theSelectorRef) != CFNumberGetTypeID(),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_Device::GetPackedPropertySelector: the qualifier for kAudioDeviceCustomPropertyPacked was not a CFNumber");
+
+    // Selectors are four-char codes, so read it as 64 bits in case the high bit is set.
+    SInt64 theSelector = 0;
+    CFNumberGetValue(theSelectorRef, kCFNumberSInt64Type, &theSelector);
+
+    return static_cast<AudioObjectPropertySelector>(theSelector);
+}
+
+CFDataRef    EFF_Device::CopyPackedProperty(AudioObjectPropertySelector inSelector) const
+{
+    switch(inSelector)
+    {
+        case kAudioDeviceCustomPropertyAppVolumes:
+            {
+                CAMutex::Locker theStateLocker(mStateMutex);
+                return mClients.CopyPackedAppVolumes();
+            }
+
+        case kAudioDeviceCustomPropertyMusicPlayerProcessID:
+            {
+                EFF_PackedProperties::Writer theWriter(inSelector, sizeof(EFF_PackedMusicPlayerProcessID));
+                EFF_PackedMusicPlayerProcessID theEntry;
+
+                {
+                    CAMutex::Locker theStateLocker(mStateMutex);
+                    theEntry.processID = mClients.GetMusicPlayerProcessIDProperty();
+                }
+
+                theWriter.AppendEntry(theEntry);
+                return theWriter.CopyCFData();
+            }
+
+        case kAudioDeviceCustomPropertyMusicPlayerBundleID:
+            {
+                EFF_PackedProperties::Writer theWriter(inSelector, sizeof(EFF_PackedMusicPlayerBundleID));
+                EFF_PackedMusicPlayerBundleID theEntry;
+
+                {
+                    CAMutex::Locker theStateLocker(mStateMutex);
+                    theEntry.bundleID = theWriter.AddBundleID(mClients.GetMusicPlayerBundleID());
+                }
+
+                theWriter.AppendEntry(theEntry);
+                return theWriter.CopyCFData();
+            }
+
+        case kAudioDeviceCustomPropertyEnabledOutputControls:
+            {
+                EFF_PackedProperties::Writer theWriter(inSelector, sizeof(EFF_PackedEnabledOutputControls));
+                EFF_PackedEnabledOutputControls theEntry;
+
+                {
+                    CAMutex::Locker theStateLocker(mStateMutex);
+                    theEntry.volumeEnabled = mVolumeControl.IsActive() ? 1 : 0;
+                    theEntry.muteEnabled = mMuteControl.IsActive() ? 1 : 0;
+                }
+
+                theWriter.AppendEntry(theEntry);
+                return theWriter.CopyCFData();
+            }
+
+        default:
+            Throw(CAException(kAudioHardwareUnknownPropertyError));
+    };
+}
+
+void    EFF_Device::SetPackedProperty(AudioObjectID inObjectID,
+                                      AudioObjectPropertySelector inSelector,
+                                      CFTypeRef __nullable inData)
+{
+    switch(inSelector)
+    {
+        case kAudioDeviceCustomPropertyAppVolumes:
+            {
+                EFF_PackedProperties::Reader theReader(inData, inSelector, sizeof(EFF_PackedAppVolume));
+
+                bool propertyWasChanged = false;
+
+                CAMutex::Locker theStateLocker(mStateMutex);
+
+                try
+                {
+                    propertyWasChanged = mClients.SetClientsRelativeVolumes(theReader);
+                }
+                catch(EFF_InvalidClientRelativeVolumeException)
+                {
+                    Throw(CAException(kAudioHardwareIllegalOperationError));
+                }
+                catch(EFF_InvalidClientPanPositionException)
+                {
+                    Throw(CAException(kAudioHardwareIllegalOperationError));
+                }
+
+                if(propertyWasChanged)
+                {
+                    // Send notification
+                    CADispatchQueue::GetGlobalSerialQueue().Dispatch(false,    ^{
+                        AudioObjectPropertyAddress theChangedProperties[] = { kEFFAppVolumesAddress };
+                        EFF_PlugIn::Host_PropertiesChanged(inObjectID, 1, theChangedProperties);
+                    });
+                }
+            }
+            break;
+
+        case kAudioDeviceCustomPropertyMusicPlayerProcessID:
+            {
+                EFF_PackedProperties::Reader theReader(inData, inSelector, sizeof(EFF_PackedMusicPlayerProcessID));
+
+                ThrowIf(theReader.GetNumEntries() != 1,
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::SetPackedProperty: Expected one entry for kAudioDeviceCustomPropertyMusicPlayerProcessID");
+
+                pid_t pid = theReader.GetEntry<EFF_PackedMusicPlayerProcessID>(0).processID;
+
+                CAMutex::Locker theStateLocker(mStateMutex);
+
+                bool propertyWasChanged = false;
+
+                try
+                {
+                    propertyWasChanged = mClients.SetMusicPlayer(pid);
+                }
+                catch(EFF_InvalidClientPIDException)
+                {
+                    Throw(CAException(kAudioHardwareIllegalOperationError));
+                }
+
+                if(propertyWasChanged)
+                {
+                    // Send notification
+                    CADispatchQueue::GetGlobalSerialQueue().Dispatch(false,    ^{
+                        AudioObjectPropertyAddress theChangedProperties[] = {
+                            kEFFMusicPlayerProcessIDAddress,
+                            kEFFMusicPlayerBundleIDAddress
+                        };
+                        EFF_PlugIn::Host_PropertiesChanged(inObjectID, 2, theChangedProperties);
+                    });
+                }
+            }
+            break;
+
+        case kAudioDeviceCustomPropertyMusicPlayerBundleID:
+            {
+                EFF_PackedProperties::Reader theReader(inData, inSelector, sizeof(EFF_PackedMusicPlayerBundleID));
+
+                ThrowIf(theReader.GetNumEntries() != 1,
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::SetPackedProperty: Expected one entry for kAudioDeviceCustomPropertyMusicPlayerBundleID");
+
+                const char* theBundleIDCString =
+                    theReader.GetString(theReader.GetEntry<EFF_PackedMusicPlayerBundleID>(0).bundleID);
+
+                // The music player's bundle ID is kept, so it's worth making a CFString of it.
+                CFStringRef theBundleIDRef = CFStringCreateWithCString(kCFAllocatorDefault,
+                                                                       theBundleIDCString ? theBundleIDCString : "",
+                                                                       kCFStringEncodingUTF8);
+
+                ThrowIfNULL(theBundleIDRef,
+                            CAException(kAudioHardwareIllegalOperationError),
+                            "EFF_Device::SetPackedProperty: bundle ID for kAudioDeviceCustomPropertyMusicPlayerBundleID was not UTF-8");
+
+                CACFString bundleID(theBundleIDRef);
+
+                CAMutex::Locker theStateLocker(mStateMutex);
+
+                bool propertyWasChanged = mClients.SetMusicPlayer(bundleID);
+
+                if(propertyWasChanged)
+                {
+                    // Send notification
+                    CADispatchQueue::GetGlobalSerialQueue().Dispatch(false,    ^{
+                        AudioObjectPropertyAddress theChangedProperties[] = {
+                            kEFFMusicPlayerBundleIDAddress,
+                            kEFFMusicPlayerProcessIDAddress
+                        };
+                        EFF_PlugIn::Host_PropertiesChanged(inObjectID, 2, theChangedProperties);
+                    });
+                }
+            }
+            break;
+
+        case kAudioDeviceCustomPropertyEnabledOutputControls:
+            {
+                EFF_PackedProperties::Reader theReader(inData, inSelector, sizeof(EFF_PackedEnabledOutputControls));
+
+                ThrowIf(theReader.GetNumEntries() != 1,
+                        CAException(kAudioHardwareIllegalOperationError),
+                        "EFF_Device::SetPackedProperty: Expected one entry for kAudioDeviceCustomPropertyEnabledOutputControls");
+
+                EFF_PackedEnabledOutputControls theEntry =
+                    theReader.GetEntry<EFF_PackedEnabledOutputControls>(0);
+
+                RequestEnabledControls(theEntry.volumeEnabled != 0, theEntry.muteEnabled != 0);
+            }
+            break;
+
+        default:
+            Throw(CAException(kAudioHardwareUnknownPropertyError));
+    };
+}
+
 #pragma mark IO Operations
 
 void    EFF_Device::StartIO(UInt32 inClientID)
@@ -1307,14 +1975,11 @@ void    EFF_Device::StartIO(UInt32 inClientID)
         //   - EFFDriver lets the host know that it's ready to do IO by ret///////////////////'urning from StartIO.
 
         
-        // Update our client data.
+        // Update our client data. This doesn't queue a task or wait for one, so it's ordered with the updates
+        // BeginIOOperation and EndIOOperation make on the IO thread by when they're called.
         //
-        // We add the work to the task queue, rather than doing it here, because BeginIOOperation and EndIOOperation
-        // also add this task to the queue and the updates should be done in order.
-        //
-        // didStartIO ultimately gets returned from EFF_Clients::StartIONonRT. It will be true if
-        // no other clients were running IO before this one started
-        bool didStartIO = mTaskQueue.QueueSync_StartClientIO(&mClients, inClientID);
+        // didStartIO will be true if no other clients were running IO before this one started.
+        bool didStartIO = mClients.StartIO(inClientID);
 
         // We only tell the hardware to start if this is the first time IO has been started.
         if(didStartIO)
@@ -1367,18 +2032,21 @@ void    EFF_Device::StopIO(UInt32 inClientID)
 {
     CAMutex::Locker theStateLocker(mStateMutex);
     
-    // Update our client data.
-    //
-    // We add the work to the task queue, rather than doing it here, because BeginIOOperation and EndIOOperation also
-    // add this task to the queue and the updates should be done in order.
-    //
-    // The task ultimately calls EFF_Clients::StopIONonRT
-    bool didStopIO = mTaskQueue.QueueSync_StopClientIO(&mClients, inClientID);
+    // Update our client data. See StartIO.
+    bool didStopIO = mClients.StopIO(inClientID);
 
     // we tell the hardware to stop if this is the last stop call
     if(didStopIO)
     {
         _HW_StopIO();
+
+        // The output timeline restarts with IO, so drop the scheduled changes that haven't started.
+        {
+            CAMutex::Locker theIOLocker(mIOMutex);
+            mAutomation.StopIO();
+        }
+
+        mAutomation.CommitNonRT();
     }
 }
 
@@ -1441,7 +2109,9 @@ const
             break;
 
         case kAudioServerPlugInIOOperationProcessMix:
-            outWillDo = mVolumeControl.WillApplyVolumeToAudioRT();
+            outWillDo = mVolumeControl.WillApplyVolumeToAudioRT() ||
+                        mMuteControl.WillApplyMuteToAudioRT() ||
+                        mConvolver.HasImpulseResponse();
             outWillDoInPlace = true;
             break;
 
@@ -1471,13 +2141,13 @@ void    EFF_Device::BeginIOOperation(UInt32 inOperationID,
         // kAudioDeviceCustomPropertyDeviceIsRunningSomewhereOtherThanEFFApp. We have to do this here
         // as well as in StartIO because the HAL only calls StartIO/StopIO with the first/last clients.
         //
-        // We perform the update async because it isn't real-time safe, but we can't just dispatch it with
-        // dispatch_async because that isn't real-time safe either. (Apparently even constructing a block
-        // isn't.)
+        // The update itself is lock-free. Only the notifications are deferred, to mTaskQueue, because
+        // sending them isn't real-time safe. (We can't just dispatch them with dispatch_async because
+        // that isn't real-time safe either. Apparently even constructing a block isn't.)
         //
         // We don't have to hold the IO mutex here because mTaskQueue and mClients don't change and
-        // adding a task to mTaskQueue is thread safe.
-        mTaskQueue.QueueAsync_StartClientIO(&mClients, inClientID);
+        // updating a client's IO state is thread safe.
+        mClients.StartIORT(inClientID);
     }
 }
 
@@ -1506,6 +2176,13 @@ void    EFF_Device::DoIOOperation(AudioObjectID inStreamObjectID,
                 // If an IO operation misses its deadline, the host will log this message:
                 //     Audio IO Overload inputs: '<private>' outputs: '<private>' cause: 'Unknown'
                 //     prewarming: no recovering: no
+                //
+                // Also note that something is reading the input stream, so WriteMix knows it still has
+                // to store the mix in the ring buffer.
+                mLoopbackReaders.hasRead = true;
+                mLoopbackReaders.lastReadSampleTime =
+                    inIOCycleInfo.mInputTime.mSampleTime + inIOBufferFrameSize;
+
                 ReadInputData(inIOBufferFrameSize,
                               inIOCycleInfo.mInputTime.mSampleTime,
                               ioMainBuffer);
@@ -1515,16 +2192,58 @@ void    EFF_Device::DoIOOperation(AudioObjectID inStreamObjectID,
         case kAudioServerPlugInIOOperationProcessOutput:
             // From docs: This operation is about the buffer for one particular client.
             {
-                bool theClientIsMusicPlayer = mClients.IsMusicPlayerRT(inClientID);
+                // The parts of the buffer to apply each of the client's scheduled volume and pan
+                // changes to.
+                EFF_Automation::ClientSegment theSegments[EFF_Automation::kMaxSegments];
+                UInt32 theNumSegments = 0;
 
-                CAMutex::Locker theIOLocker(mIOMutex);
-                // Called in this IO operation so we can get the music player client's data separately
-                mAudibleState.UpdateWithClientIO(theClientIsMusicPlayer,
+                {
+                    bool theClientIsMusicPlayer = mClients.IsMusicPlayerRT(inClientID);
+
+                    CAMutex::Locker theIOLocker(mIOMutex);
+                    // Called in this IO operation so we can get the music player client's data separately
+                    mAudibleState.UpdateWithClientIO(theClientIsMusicPlayer,
+                                                     inIOBufferFrameSize,
+                                                     inIOCycleInfo.mOutputTime.mSampleTime,
+                                                     reinterpret_cast<const Float32*>(ioMainBuffer));
+
+                    // Duck the music player while other clients are audible. This uses the audible
+                    // state from before the music player's own audio is ducked.
+                    if(theClientIsMusicPlayer)
+                    {
+                        mDucker.ApplyMusicDuckingRT(mAudibleState.GetLatestAudibleNonMusicSampleTime(),
+                                                    inIOBufferFrameSize,
+                                                    inIOCycleInfo.mOutputTime.mSampleTime,
+                                                    reinterpret_cast<Float32*>(ioMainBuffer));
+                    }
+
+                    // Apply the ducking rules. Like the music player, a client can be ducked up to a
+                    // buffer late if the client that triggers the rule is processed after it.
+                    mClients.ApplyDuckingRulesRT(inClientID,
                                                  inIOBufferFrameSize,
                                                  inIOCycleInfo.mOutputTime.mSampleTime,
-                                                 reinterpret_cast<const Float32*>(ioMainBuffer));
+                                                 reinterpret_cast<Float32*>(ioMainBuffer));
+
+                    theNumSegments =
+                        mAutomation.GetClientSegmentsRT(inClientID,
+                                                        inIOCycleInfo.mOutputTime.mSampleTime,
+                                                        inIOBufferFrameSize,
+                                                        mClients.GetClientRelativeVolumeRT(inClientID),
+                                                        mClients.GetClientPanPositionRT(inClientID),
+                                                        theSegments);
+                }
+
+                // Apply the client's EQ first so the meters measure the audio as it'll be heard.
+                mClients.ApplyClientEQRT(inClientID,
+                                         inIOBufferFrameSize,
+                                         reinterpret_cast<Float32*>(ioMainBuffer));
+                ApplyClientRelativeVolume(inClientID,
+                                          inIOBufferFrameSize,
+                                          inIOCycleInfo.mOutputTime.mSampleTime,
+                                          theSegments,
+                                          theNumSegments,
+                                          ioMainBuffer);
             }
-            ApplyClientRelativeVolume(inClientID, inIOBufferFrameSize, ioMainBuffer);
             break;
 
         case kAudioServerPlugInIOOperationProcessMix:
@@ -1538,10 +2257,61 @@ void    EFF_Device::DoIOOperation(AudioObjectID inStreamObjectID,
 
                 CAMutex::Locker theIOLocker(mIOMutex);
 
+                // Convolve the mix with the IR, if one is set. The heavy part of the convolution
+                // runs on EFF_Convolver's own real-time thread, but building and deleting its
+                // buffers happens on the non-real-time worker thread.
+                if(mConvolver.ProcessRT(reinterpret_cast<Float32*>(ioMainBuffer), inIOBufferFrameSize))
+                {
+                    mTaskQueue.QueueAsync_UpdateConvolver(&mConvolver);
+                }
+
                 // We ask to do this IO operation so this device can apply its own volume to the
-                // stream. Currently, only the UI sounds device does.
-                mVolumeControl.ApplyVolumeToAudioRT(reinterpret_cast<Float32*>(ioMainBuffer),
-                                                    inIOBufferFrameSize);
+                // stream. Currently, only the UI sounds device does. Split the buffer at any
+                // scheduled changes to the volume so each starts on the right frame.
+                if(mVolumeControl.WillApplyVolumeToAudioRT())
+                {
+                    Float32* theBuffer = reinterpret_cast<Float32*>(ioMainBuffer);
+                    UInt32 theFrame = 0;
+
+                    while(theFrame < inIOBufferFrameSize)
+                    {
+                        Float32 theAmplitudeGain = mVolumeControl.GetAmplitudeGainRT();
+                        UInt32 theNumFrames =
+                            mAutomation.GetDeviceVolumeRT(inIOCycleInfo.mOutputTime.mSampleTime + theFrame,
+                                                          inIOBufferFrameSize - theFrame,
+                                                          theAmplitudeGain);
+
+                        // Two samples per frame.
+                        mVolumeControl.ApplyVolumeToAudioRT(theBuffer + theFrame * 2,
+                                                            theNumFrames,
+                                                            theAmplitudeGain);
+                        theFrame += theNumFrames;
+                    }
+                }
+
+                // Mute the mix last, so muting doesn't leave the convolver's tail ringing. Split the
+                // buffer at scheduled mute changes the same way.
+                if(mMuteControl.WillApplyMuteToAudioRT())
+                {
+                    Float32* theBuffer = reinterpret_cast<Float32*>(ioMainBuffer);
+                    UInt32 theFrame = 0;
+
+                    while(theFrame < inIOBufferFrameSize)
+                    {
+                        bool theMuted = mMuteControl.IsMutedRT();
+                        UInt32 theNumFrames =
+                            mAutomation.GetDeviceMuteRT(inIOCycleInfo.mOutputTime.mSampleTime + theFrame,
+                                                        inIOBufferFrameSize - theFrame,
+                                                        theMuted);
+
+                        // Two samples per frame.
+                        mMuteControl.ApplyMuteToAudioRT(theBuffer + theFrame * 2,
+                                                        theNumFrames,
+                                                        inIOCycleInfo.mOutputTime.mSampleTime + theFrame,
+                                                        theMuted);
+                        theFrame += theNumFrames;
+                    }
+                }
             }
             break;
 
@@ -1561,10 +2331,41 @@ void    EFF_Device::DoIOOperation(AudioObjectID inStreamObjectID,
                                                                    GetObjectID());
                 }
 
-                // Copy the audio data into our ring buffer.
-                WriteOutputData(inIOBufferFrameSize,
-                                inIOCycleInfo.mOutputTime.mSampleTime,
-                                ioMainBuffer);
+                // Copy the audio data into our ring buffer, but only if something will read it back
+                // out. Otherwise it's just a wasted copy every cycle.
+                if(LoopbackHasReadersRT(inIOCycleInfo.mOutputTime.mSampleTime))
+                {
+                    if(!mLoopbackReaders.isStoring)
+                    {
+                        // The ring buffer hasn't been written to for a while, so everything before
+                        // this sample time is stale. ReadInputData will return silence for it.
+                        mLoopbackReaders.isStoring = true;
+                        mLoopbackReaders.resyncSampleTime = inIOCycleInfo.mOutputTime.mSampleTime;
+                    }
+
+                    WriteOutputData(inIOBufferFrameSize,
+                                    inIOCycleInfo.mOutputTime.mSampleTime,
+                                    ioMainBuffer);
+                }
+                else
+                {
+                    mLoopbackReaders.isStoring = false;
+                }
+
+                // Copy the mix to the spectrum analyzer's tap. The FFT runs on the non-real-time
+                // worker thread.
+                if(mSpectrumAnalyzer.PushFramesRT(reinterpret_cast<const Float32*>(ioMainBuffer),
+                                                  inIOBufferFrameSize))
+                {
+                    mTaskQueue.QueueAsync_ComputeSpectrum(&mSpectrumAnalyzer);
+                }
+
+                // Start any scheduled changes due this cycle that the clients' buffers didn't, then
+                // have the ones that have started committed.
+                if(mAutomation.EndCycleRT(inIOCycleInfo.mOutputTime.mSampleTime + inIOBufferFrameSize))
+                {
+                    mTaskQueue.QueueAsync_CommitAutomation(&mAutomation);
+                }
             }
             break;
 
@@ -1584,11 +2385,8 @@ void    EFF_Device::EndIOOperation(UInt32 inOperationID,
 
     if(inOperationID == kAudioServerPlugInIOOperationThread)
     {
-        // Tell EFF_Clients that this client has stopped IO. Queued async because we have to be real-time safe here.
-        //
-        // We don't have to hold the IO mutex here because mTaskQueue and mClients don't change and adding a task to
-        // mTaskQueue is thread safe.
-        mTaskQueue.QueueAsync_StopClientIO(&mClients, inClientID);
+        // Tell EFF_Clients that this client has stopped IO. See BeginIOOperation.
+        mClients.StopIORT(inClientID);
     }
 }
 
@@ -1606,11 +2404,33 @@ void    EFF_Device::ReadInputData(UInt32 inIOBufferFrameSize, Float64 inSampleTi
         }
     };
 
+    // The frames in the ring buffer from before WriteMix last started storing to it again are
+    // stale (or were never written at all), so we return silence for them instead.
+    Float64 theStaleFrames = inIOBufferFrameSize;
+
+    if(mLoopbackReaders.isStoring)
+    {
+        theStaleFrames = mLoopbackReaders.resyncSampleTime - inSampleTime;
+        theStaleFrames = theStaleFrames < 0.0 ? 0.0 : theStaleFrames;
+    }
+
+    if(theStaleFrames >= inIOBufferFrameSize)
+    {
+        memset(outBuffer, 0, abl.mBuffers[0].mDataByteSize);
+        return;
+    }
+
     // Copy the audio data from our ring buffer into the provided buffer.
     CARingBufferError err = mLoopbackRingBuffer.Fetch(&abl,
                                                       inIOBufferFrameSize,
                                                       static_cast<CARingBuffer::SampleTime>(inSampleTime));
 
+    if(err == kCARingBufferError_OK && theStaleFrames > 0.0)
+    {
+        // Silence the start of the buffer, up to the first frame WriteMix stored after resuming.
+        memset(outBuffer, 0, static_cast<size_t>(theStaleFrames) * sizeof(Float32) * 2);
+    }
+
     // Handle errors.
     switch (err)
     {
@@ -1659,53 +2479,103 @@ void    EFF_Device::WriteOutputData(UInt32 inIOBufferFrameSize,
     }
 }
 
+bool    EFF_Device::LoopbackHasReadersRT(Float64 inOutputSampleTime)
+const
+{
+    // Input sample times trail output sample times by about the IO buffer size plus the safety
+    // offsets, so allow for up to a full ring buffer between the last read and this write. Any
+    // longer and the reader couldn't fetch the frames we'd store anyway.
+    return mLoopbackReaders.hasRead &&
+           (inOutputSampleTime - mLoopbackReaders.lastReadSampleTime) < kLoopbackRingBufferFrameSize;
+}
+
+void    EFF_Device::ResetLoopbackReaders()
+{
+    CAMutex::Locker theIOLocker(mIOMutex);
+
+    mLoopbackReaders.hasRead = false;
+    mLoopbackReaders.isStoring = false;
+}
+
 void    EFF_Device::ApplyClientRelativeVolume(UInt32 inClientID,
                                               UInt32 inIOBufferFrameSize,
+                                              Float64 inSampleTime,
+                                              const EFF_Automation::ClientSegment* inSegments,
+                                              UInt32 inNumSegments,
                                               void* ioBuffer)
-const
 {
-    Float32* theBuffer = reinterpret_cast<Float32*>(ioBuffer);
-    Float32 theRelativeVolume = mClients.GetClientRelativeVolumeRT(inClientID);
-    
-    auto thePanPositionInt = mClients.GetClientPanPositionRT(inClientID);
-    Float32 thePanPosition = static_cast<Float32>(thePanPositionInt) / 100.0f;
-    
     // TODO When we get around to supporting devices with more than two channels it would be worth looking into
     //      kAudioFormatProperty_PanningMatrix and kAudioFormatProperty_BalanceFade in AudioFormat.h.
     
     // TODO precompute matrix coefficients w/ volume and do everything in one pass
-    
-    // Apply balance w/ crossfeed to the frames in the buffer.
-    // Expect samples interleaved, starting with left
-    if (thePanPosition > 0.0f) {
-        for (UInt32 i = 0; i < inIOBufferFrameSize * 2; i += 2) {
-            auto L = i;
-            auto R = i + 1;
-            
-            theBuffer[R] = theBuffer[R] + theBuffer[L] * thePanPosition;
-            theBuffer[L] = theBuffer[L] * (1 - thePanPosition);
+
+    for(UInt32 theSegmentIndex = 0; theSegmentIndex < inNumSegments; theSegmentIndex++)
+    {
+        const EFF_Automation::ClientSegment& theSegment = inSegments[theSegmentIndex];
+        const UInt32 theEndFrame =
+            (theSegmentIndex + 1 < inNumSegments) ? inSegments[theSegmentIndex + 1].startFrame : inIOBufferFrameSize;
+
+        // Two samples per frame.
+        Float32* theBuffer = reinterpret_cast<Float32*>(ioBuffer) + theSegment.startFrame * 2;
+        const UInt32 theNumSamples = (theEndFrame - theSegment.startFrame) * 2;
+
+        Float32 theRelativeVolume = theSegment.relativeVolume;
+        Float32 thePanPosition = static_cast<Float32>(theSegment.panPosition) / 100.0f;
+        
+        // Apply balance w/ crossfeed to the frames in the segment.
+        // Expect samples interleaved, starting with left
+        if (thePanPosition > 0.0f) {
+            for (UInt32 i = 0; i < theNumSamples; i += 2) {
+                auto L = i;
+                auto R = i + 1;
+                
+                theBuffer[R] = theBuffer[R] + theBuffer[L] * thePanPosition;
+                theBuffer[L] = theBuffer[L] * (1 - thePanPosition);
+            }
+        } else if (thePanPosition < 0.0f) {
+            for (UInt32 i = 0; i < theNumSamples; i += 2) {
+                auto L = i;
+                auto R = i + 1;
+                
+                theBuffer[L] = theBuffer[L] + theBuffer[R] * (-thePanPosition);
+                theBuffer[R] = theBuffer[R] * (1 + thePanPosition);
+            }
         }
-    } else if (thePanPosition < 0.0f) {
-        for (UInt32 i = 0; i < inIOBufferFrameSize * 2; i += 2) {
-            auto L = i;
-            auto R = i + 1;
-            
-            theBuffer[L] = theBuffer[L] + theBuffer[R] * (-thePanPosition);
-            theBuffer[R] = theBuffer[R] * (1 + thePanPosition);
+
+        if(theRelativeVolume != 1.0f)
+        {
+            for(UInt32 i = 0; i < theNumSamples; i++)
+            {
+                Float32 theAdjustedSample = theBuffer[i] * theRelativeVolume;
+
+                // Clamp to [-1, 1].
+                // (This way is roughly 6 times faster than using std::min and std::max because the compiler can vectorize the loop.)
+                const Float32 theAdjustedSampleClippedBelow = theAdjustedSample < -1.0f ? -1.0f : theAdjustedSample;
+                theBuffer[i] = theAdjustedSampleClippedBelow > 1.0f ? 1.0f : theAdjustedSampleClippedBelow;
+            }
         }
     }
 
-    if(theRelativeVolume != 1.0f)
+    if(inIOBufferFrameSize > 0)
     {
-        for(UInt32 i = 0; i < inIOBufferFrameSize * 2; i++)
-        {
-            Float32 theAdjustedSample = theBuffer[i] * theRelativeVolume;
+        // Measure the levels in a separate pass, one channel at a time, so the loop above stays
+        // simple enough to vectorize. Index 0 is the left channel and 1 is the right.
+        const Float32* theSamples = reinterpret_cast<const Float32*>(ioBuffer);
+        Float32 thePeak[2];
+        Float32 theSumOfSquares[2];
 
-            // Clamp to [-1, 1].
-            // (This way is roughly 6 times faster than using std::min and std::max because the compiler can vectorize the loop.)
-            const Float32 theAdjustedSampleClippedBelow = theAdjustedSample < -1.0f ? -1.0f : theAdjustedSample;
-            theBuffer[i] = theAdjustedSampleClippedBelow > 1.0f ? 1.0f : theAdjustedSampleClippedBelow;
+        for(UInt32 theChannel = 0; theChannel < 2; theChannel++)
+        {
+            vDSP_maxmgv(theSamples + theChannel, 2, &thePeak[theChannel], inIOBufferFrameSize);
+            vDSP_svesq(theSamples + theChannel, 2, &theSumOfSquares[theChannel], inIOBufferFrameSize);
         }
+
+        Float32 theRMS[2] = {
+            std::sqrt(theSumOfSquares[0] / inIOBufferFrameSize),
+            std::sqrt(theSumOfSquares[1] / inIOBufferFrameSize)
+        };
+
+        mClients.UpdateClientLevelsRT(inClientID, inSampleTime, thePeak, theRMS);
     }
 }
 
@@ -1926,6 +2796,12 @@ void EFF_Device::SetSampleRate(Float64 inSampleRate, bool force)
         mLoopbackSampleRate = inSampleRate;
         InitLoopback();
 
+        mSpectrumAnalyzer.SetSampleRate(inSampleRate);
+        mConvolver.SetSampleRate(inSampleRate);
+        mDucker.SetSampleRate(inSampleRate);
+        mClients.SetEQSampleRate(inSampleRate);
+        mClients.SetDuckingRulesSampleRate(inSampleRate);
+
         // Update the streams.
         mInputStream.SetSampleRate(inSampleRate);
         mOutputStream.SetSampleRate(inSampleRate);
@@ -1972,6 +2848,12 @@ kern_return_t    EFF_Device::_HW_StartIO()
     // at a time).
     EFFAssert(mIOMutex.IsFree(), "EFF_Device::_HW_StartIO: IO mutex taken before starting IO");
     mAudibleState.Reset();
+    // The ducking rules' trigger times are sample times too.
+    mClients.ResetDucking();
+    // Sample times restart from zero, so any earlier reads of the input stream can't tell us
+    // whether the next cycles will need the loopback ring buffer.
+    mLoopbackReaders.hasRead = false;
+    mLoopbackReaders.isStoring = false;
     
     return KERN_SUCCESS;
 }
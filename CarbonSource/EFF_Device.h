@@ -17,6 +17,7 @@
 
 // Local Includes
 #include "EFF_Types.h"
+#include "EFF_CustomProperties.h"
 #include "EFF_WrappedAudioEngine.h"
 #include "EFF_Clients.h"
 #include "EFF_TaskQueue.h"
@@ -24,12 +25,19 @@
 #include "EFF_Stream.h"
 #include "EFF_VolumeControl.h"
 #include "EFF_MuteControl.h"
+#include "EFF_SpectrumAnalyzer.h"
+#include "EFF_Convolver.h"
+#include "EFF_Ducker.h"
+#include "EFF_Automation.h"
 
 // PublicUtility Includes
 #include "CAMutex.h"
 #include "CAVolumeCurve.h"
 #include "CARingBuffer.h"
 
+// STL Includes
+#include <vector>
+
 // System Includes
 #include <CoreFoundation/CoreFoundation.h>
 #include <pthread.h>
@@ -45,6 +53,11 @@ class EFF_Device
 public:
     static EFF_Device&          GetInstance();
     static EFF_Device&          GetUISoundsInstance();
+    /*!
+     @return The devices listed in the config file at kEFFDeviceConfigPath, in the file's order.
+             Empty if there's no config file.
+     */
+    static const std::vector<EFF_Device*>& GetAdditionalInstances();
 
 protected:
                                 EFF_Device(AudioObjectID inObjectID,
@@ -63,6 +76,11 @@ protected:
 private:
     void                        InitLoopback();
     static void                 StaticInitializer();
+    /*!
+     Creates the devices listed in the config file, with dynamically allocated object IDs. Logs and
+     skips any that can't be created, so a bad entry doesn't stop the driver from loading.
+     */
+    static void                 CreateAdditionalInstances();
     
     
 #pragma mark Property Operations
@@ -127,6 +145,15 @@ private:
                                                        UInt32 inDataSize,
                                                        const void* __nonnull inData);
 
+    // For kAudioDeviceCustomPropertyPacked. Reads the selector of the property to pack from the
+    // qualifier, throwing if it isn't a CFNumber.
+    static AudioObjectPropertySelector GetPackedPropertySelector(UInt32 inQualifierDataSize,
+                                                                 const void* __nullable inQualifierData);
+    CFDataRef __nonnull         CopyPackedProperty(AudioObjectPropertySelector inSelector) const;
+    void                        SetPackedProperty(AudioObjectID inObjectID,
+                                                  AudioObjectPropertySelector inSelector,
+                                                  CFTypeRef __nullable inData);
+
     
 #pragma mark IO Operations
     
@@ -149,9 +176,14 @@ public:
      @discussion All operations take IO lock.
         For each type of kAudioServerPlugInIOOperation{...}, we do:
         ReadInput: Call ReadInputData() to copy from mLoopbackRingBuffer to ioMainBuffer
-        ProcessOutput: For inClientID, update audible state for that client and apply relative volume
-        ProcessMix: The device applies its own volume
+        ProcessOutput: For inClientID, update audible state for that client, duck it if it's the
+            music player and other audio is playing, apply the ducking rules, its EQ and its
+            relative volume, starting its scheduled changes on the right frames, and meter the result
+        ProcessMix: Convolve the mix with mConvolver's IR, if one is set, then the device applies
+            its own volume and mute
         WriteMix: Update audible state for the mix; copy data from ioMainBuffer to mLoopbackRingBuffer
+            if anything is reading the input stream; copy it to mSpectrumAnalyzer's tap; have the
+            scheduled changes that started this cycle committed
      */
     void                        DoIOOperation(AudioObjectID inStreamObjectID,
                                               UInt32 inClientID,
@@ -181,12 +213,28 @@ private:
     void                        WriteOutputData(UInt32 inIOBufferFrameSize,
                                                 Float64 inSampleTime,
                                                 const void* __nonnull inBuffer);
+    /*!
+     @abstract True if something has read from the input stream recently enough that WriteMix should
+               keep filling mLoopbackRingBuffer. The caller must hold the IO mutex.
+     */
+    bool                        LoopbackHasReadersRT(Float64 inOutputSampleTime) const;
+    /*!
+     @abstract Forget the input stream's readers so WriteMix stops storing to mLoopbackRingBuffer
+               until the next ReadInput. Takes the IO mutex.
+     */
+    void                        ResetLoopbackReaders();
     /*!
      @abstract Applies volume and panning settings to a buffer with two channels.
+     @discussion Each segment from EFF_Automation::GetClientSegmentsRT has its own volume and pan
+        position. Then measures the peak and RMS levels of the result and publishes them for
+        kAudioDeviceCustomPropertyClientLevels.
      */
     void                        ApplyClientRelativeVolume(UInt32 inClientID,
                                                           UInt32 inIOBufferFrameSize,
-                                                          void* __nonnull inBuffer) const;
+                                                          Float64 inSampleTime,
+                                                          const EFF_Automation::ClientSegment* __nonnull inSegments,
+                                                          UInt32 inNumSegments,
+                                                          void* __nonnull ioBuffer);
     
 
 #pragma mark Accessors
@@ -282,11 +330,20 @@ private:
     static pthread_once_t               sStaticInitializer;
     static EFF_Device* __nonnull        sInstance;
     static EFF_Device* __nonnull        sUISoundsInstance;
+    static std::vector<EFF_Device*>     sAdditionalInstances;
     
     #define kDeviceName                 "Effervescence Device"
     #define kDeviceName_UISounds        "Effervescence Device (UI Sounds)"
     #define kDeviceManufacturerName     "Effervescence contributors"
 
+    // A plist with an array of dictionaries, one for each additional loopback device to create,
+    // e.g. one per team or per stream destination.
+    #define kEFFDeviceConfigPath        "/Library/Application Support/Effervescence/Devices.plist"
+    #define kEFFDeviceConfigKey_Name    "name"  // CFString, required
+    #define kEFFDeviceConfigKey_UID     "uid"   // CFString, required, unique
+    // The limit keeps the devices' object IDs within EFF_ObjectRegistry's.
+    #define kEFFDeviceConfigMaxDevices  16
+
     const CFStringRef __nonnull         mDeviceName;
     const CFStringRef __nonnull         mDeviceUID;
     const CFStringRef __nonnull         mDeviceModelUID;
@@ -311,6 +368,12 @@ private:
     
     EFF_WrappedAudioEngine* __nullable  mWrappedAudioEngine;
     
+    // Declared before mTaskQueue so they're destroyed after mTaskQueue has waited for its queued
+    // tasks to finish, since they run their NonRT methods.
+    EFF_SpectrumAnalyzer                mSpectrumAnalyzer;
+    EFF_Convolver                       mConvolver;
+    EFF_Automation                      mAutomation;
+    
     EFF_TaskQueue                       mTaskQueue;
     
     EFF_Clients                         mClients;
@@ -330,11 +393,29 @@ private:
         UInt64                          numberTimeStamps  = 0;      // # of sample times passed since _HW_StartIO
         UInt64                          anchorHostTime    = 0;      // The host time when IO started in hardware
     }                                   mLoopbackTime;
+
+    // Storing the mix in mLoopbackRingBuffer is skipped while nothing is reading the input stream.
+    // The HAL only asks us to do ReadInput while a client is using the input stream, so ReadInput
+    // records when it last happened and WriteMix stops storing once that's over a ring buffer ago.
+    // When storing resumes, ReadInput returns silence for any sample time before the first new
+    // store, since the frames in the ring buffer from before that are stale.
+    //
+    // Guarded by the IO mutex.
+    struct {
+        bool                            hasRead            = false;    // ReadInput has happened since the reset
+        Float64                         lastReadSampleTime = 0.0;      // The end sample time of the last ReadInput
+        bool                            isStoring          = false;    // WriteMix stored the last cycle
+        Float64                         resyncSampleTime   = 0.0;      // The sample time of the first store since
+                                                                       // isStoring was last false
+    }                                   mLoopbackReaders;
     
     EFF_Stream                          mInputStream;
     EFF_Stream                          mOutputStream;
 
     EFF_AudibleState                    mAudibleState;
+    // Ducks the music player using mAudibleState as the sidechain. Its RT state is guarded by
+    // mIOMutex, like mAudibleState.
+    EFF_Ducker                          mDucker;
     
     enum class ChangeAction : UInt64
     {
@@ -0,0 +1,175 @@
+//
+//  EFF_Ducker.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_Ducker.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CAException.h"
+
+// STL Includes
+#include <cmath>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+EFF_Ducker::EFF_Ducker()
+:
+    mMutex("Ducker"),
+    mSampleRate(44100.0)
+{
+    CAMutex::Locker theLocker(mMutex);
+    PublishSettings();
+}
+
+void    EFF_Ducker::SetSampleRate(Float64 inSampleRate)
+{
+    CAMutex::Locker theLocker(mMutex);
+    mSampleRate = inSampleRate;
+    PublishSettings();
+}
+
+#pragma mark IO Operations
+
+void    EFF_Ducker::ApplyMusicDuckingRT(Float64 inLatestAudibleNonMusic,
+                                        UInt32 inFrameCount,
+                                        Float64 inSampleTime,
+                                        Float32* ioBuffer)
+{
+    // Start from the gain at this sample time, which is the start of the last buffer if another of
+    // the music player's clients has already played it.
+    Float32 theGain = (inSampleTime == mLastStartSampleTime) ? mGainAtLastStart : mGainAtLastEnd;
+
+    mLastStartSampleTime = inSampleTime;
+    mGainAtLastStart = theGain;
+
+    // Frames up to this sample time are ducked.
+    Float64 theDuckedUntil = -1.0;
+
+    if(mEnabled.load(std::memory_order_relaxed) && inLatestAudibleNonMusic > 0)
+    {
+        theDuckedUntil = inLatestAudibleNonMusic + mHoldFrames.load(std::memory_order_relaxed);
+    }
+
+    // Nothing to do if the music player isn't ducked and won't be during this buffer.
+    if(theGain == 1.0f && theDuckedUntil < inSampleTime)
+    {
+        mGainAtLastEnd = 1.0f;
+        return;
+    }
+
+    Float32 theDuckedGain = mDuckedGain.load(std::memory_order_relaxed);
+    Float32 theAttackCoefficient = mAttackCoefficient.load(std::memory_order_relaxed);
+    Float32 theReleaseCoefficient = mReleaseCoefficient.load(std::memory_order_relaxed);
+
+    for(UInt32 i = 0; i < inFrameCount; i++)
+    {
+        Float32 theTarget = ((inSampleTime + i) <= theDuckedUntil) ? theDuckedGain : 1.0f;
+        Float32 theCoefficient = (theTarget < theGain) ? theAttackCoefficient : theReleaseCoefficient;
+
+        theGain += (theTarget - theGain) * theCoefficient;
+
+        ioBuffer[i * 2] *= theGain;
+        ioBuffer[(i * 2) + 1] *= theGain;
+    }
+
+    // Snap to fully released so the next buffer can take the fast path.
+    if(std::fabs(1.0f - theGain) < kGainEpsilon)
+    {
+        theGain = 1.0f;
+    }
+
+    mGainAtLastEnd = theGain;
+}
+
+#pragma mark Accessors
+
+bool    EFF_Ducker::SetMusicDucking(const CACFDictionary& inSettings)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    // Read and check all the values before changing any of them.
+    bool theEnabled = mSettingEnabled;
+    Float32 theDepthDB = mSettingDepthDB;
+    Float32 theAttackMs = mSettingAttackMs;
+    Float32 theReleaseMs = mSettingReleaseMs;
+    Float32 theHoldMs = mSettingHoldMs;
+
+    inSettings.GetBool(CFSTR(kEFFMusicDuckingKey_Enabled), theEnabled);
+    inSettings.GetFloat32(CFSTR(kEFFMusicDuckingKey_Depth), theDepthDB);
+    inSettings.GetFloat32(CFSTR(kEFFMusicDuckingKey_Attack), theAttackMs);
+    inSettings.GetFloat32(CFSTR(kEFFMusicDuckingKey_Release), theReleaseMs);
+    inSettings.GetFloat32(CFSTR(kEFFMusicDuckingKey_Hold), theHoldMs);
+
+    ThrowIf(!(theDepthDB >= 0.0f && theDepthDB <= kMaxDepthDB),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_Ducker::SetMusicDucking: Invalid depth");
+    ThrowIf(!(theAttackMs >= 0.0f && theAttackMs <= kMaxTimeMs) ||
+                !(theReleaseMs >= 0.0f && theReleaseMs <= kMaxTimeMs) ||
+                !(theHoldMs >= 0.0f && theHoldMs <= kMaxTimeMs),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_Ducker::SetMusicDucking: Invalid time");
+
+    bool theSettingsChanged = (theEnabled != mSettingEnabled) ||
+                              (theDepthDB != mSettingDepthDB) ||
+                              (theAttackMs != mSettingAttackMs) ||
+                              (theReleaseMs != mSettingReleaseMs) ||
+                              (theHoldMs != mSettingHoldMs);
+
+    if(theSettingsChanged)
+    {
+        mSettingEnabled = theEnabled;
+        mSettingDepthDB = theDepthDB;
+        mSettingAttackMs = theAttackMs;
+        mSettingReleaseMs = theReleaseMs;
+        mSettingHoldMs = theHoldMs;
+
+        PublishSettings();
+    }
+
+    return theSettingsChanged;
+}
+
+CACFDictionary    EFF_Ducker::CopyMusicDucking()
+const
+{
+    CACFDictionary theSettings(false);
+    CAMutex::Locker theLocker(mMutex);
+
+    theSettings.AddBool(CFSTR(kEFFMusicDuckingKey_Enabled), mSettingEnabled);
+    theSettings.AddFloat32(CFSTR(kEFFMusicDuckingKey_Depth), mSettingDepthDB);
+    theSettings.AddFloat32(CFSTR(kEFFMusicDuckingKey_Attack), mSettingAttackMs);
+    theSettings.AddFloat32(CFSTR(kEFFMusicDuckingKey_Release), mSettingReleaseMs);
+    theSettings.AddFloat32(CFSTR(kEFFMusicDuckingKey_Hold), mSettingHoldMs);
+
+    return theSettings;
+}
+
+#pragma mark Utility
+
+Float32 EFF_Ducker::OnePoleCoefficient(Float32 inTimeMs, Float64 inSampleRate)
+{
+    Float64 theFrames = inTimeMs * inSampleRate / 1000.0;
+    return (theFrames < 1.0) ? 1.0f : static_cast<Float32>(1.0 - std::exp(-1.0 / theFrames));
+}
+
+#pragma mark Implementation
+
+void    EFF_Ducker::PublishSettings()
+{
+    mDuckedGain.store(std::pow(10.0f, -mSettingDepthDB / 20.0f), std::memory_order_relaxed);
+    mAttackCoefficient.store(OnePoleCoefficient(mSettingAttackMs, mSampleRate), std::memory_order_relaxed);
+    mReleaseCoefficient.store(OnePoleCoefficient(mSettingReleaseMs, mSampleRate), std::memory_order_relaxed);
+    mHoldFrames.store(mSettingHoldMs * mSampleRate / 1000.0, std::memory_order_relaxed);
+    mEnabled.store(mSettingEnabled, std::memory_order_relaxed);
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,141 @@
+//
+//  EFF_Ducker.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_Ducker_h
+#define EFF_Ducker_h
+
+// Local Includes
+#include "EFF_CustomProperties.h"
+
+// PublicUtility Includes
+#include "CAMutex.h"
+#include "CACFDictionary.h"
+
+// STL Includes
+#include <atomic>
+
+// System Includes
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_Ducker
+//
+//  Ducks the music player while other audio is playing, as configured by
+//  kAudioDeviceCustomPropertyMusicDucking.
+//
+//  This is done in the driver, during ProcessOutput, rather than by EFFApp pausing the music player
+//  when kAudioDeviceCustomPropertyDeviceAudibleState changes, so it starts within a buffer instead
+//  of after a round trip to EFFApp. The sidechain is the sample time of the latest audible non-music
+//  frame, which EFF_AudibleState already tracks. Each frame of the music player's audio is ducked if
+//  it's within the hold time of that, and the gain moves towards its target with one-pole attack and
+//  release curves, so it changes at the exact frame the hold time runs out.
+//
+//  The music player can have more than one client, which all play the same frames each IO cycle.
+//  The gain is kept for the start of the last buffer as well as the end, so the music player's
+//  clients all get the same gain curve.
+//
+//  Methods whose names end with "RT" can only safely be called from real-time threads and must be
+//  called with the device's IO mutex held. The others aren't real-time safe.
+//==================================================================================================
+
+class EFF_Ducker
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_Ducker();
+                                EFF_Ducker(const EFF_Ducker&) = delete;
+                                EFF_Ducker& operator=(const EFF_Ducker&) = delete;
+
+    /*!
+     Set the sample rate of the audio being ducked, which the attack, release and hold times are
+     converted to frames for.
+     */
+    void                        SetSampleRate(Float64 inSampleRate);
+
+#pragma mark IO Operations
+
+    /*!
+     Duck a buffer of the music player's audio.
+
+     @param inLatestAudibleNonMusic The sample time of the latest audible frame any other client
+                                    has played, or 0 if none has. Other clients' buffers for the
+                                    same IO cycle might not have been checked yet, so ducking can
+                                    start up to a buffer late.
+     @param inFrameCount The number of frames in ioBuffer.
+     @param inSampleTime The output sample time of the first frame in ioBuffer.
+     @param ioBuffer The audio, as interleaved stereo.
+     */
+    void                        ApplyMusicDuckingRT(Float64 inLatestAudibleNonMusic,
+                                                    UInt32 inFrameCount,
+                                                    Float64 inSampleTime,
+                                                    Float32* ioBuffer);
+
+#pragma mark Accessors
+
+    /*!
+     @param inSettings A dictionary in the format of kAudioDeviceCustomPropertyMusicDucking. Keys
+                       it doesn't have are left unchanged.
+     @return True if the settings changed.
+     @throws CAException(kAudioHardwareIllegalOperationError) if any of the values are invalid, in
+             which case none of them are changed.
+     */
+    bool                        SetMusicDucking(const CACFDictionary& inSettings);
+    CACFDictionary              CopyMusicDucking() const;
+
+#pragma mark Utility
+
+    /*!
+     @return The coefficient of a one-pole smoother that gets about 63% of the way to its target in
+             inTimeMs. Also used by EFF_DuckingRules.
+     */
+    static Float32              OnePoleCoefficient(Float32 inTimeMs, Float64 inSampleRate);
+
+#pragma mark Implementation
+
+private:
+    // Converts the settings to the values ApplyMusicDuckingRT uses and publishes them. mMutex must
+    // be held.
+    void                        PublishSettings();
+
+    static constexpr Float32    kMaxDepthDB         = 96.0f;
+    static constexpr Float32    kMaxTimeMs          = 10000.0f;
+    // The gain is snapped to its target once it's this close.
+    static constexpr Float32    kGainEpsilon        = 1.0e-5f;
+
+    // Written by PublishSettings, read by the IO thread. They're independent, so it doesn't matter
+    // if the IO thread reads them while they're being changed.
+    std::atomic<bool>           mEnabled            { false };
+    std::atomic<Float32>        mDuckedGain         { 1.0f };
+    std::atomic<Float32>        mAttackCoefficient  { 1.0f };
+    std::atomic<Float32>        mReleaseCoefficient { 1.0f };
+    std::atomic<Float64>        mHoldFrames         { 0.0 };
+
+    // Only accessed by the IO thread.
+    Float64                     mLastStartSampleTime    = -1.0;
+    Float32                     mGainAtLastStart        = 1.0f;
+    Float32                     mGainAtLastEnd          = 1.0f;
+
+    // Guards the settings.
+    mutable CAMutex             mMutex;
+    Float64                     mSampleRate;
+    bool                        mSettingEnabled     = false;
+    Float32                     mSettingDepthDB     = 12.0f;
+    Float32                     mSettingAttackMs    = 10.0f;
+    Float32                     mSettingReleaseMs   = 500.0f;
+    Float32                     mSettingHoldMs      = 250.0f;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_Ducker_h */
@@ -0,0 +1,422 @@
+//
+//  EFF_DuckingRules.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_DuckingRules.h"
+
+// Local Includes
+#include "EFF_AudibleState.h"
+#include "EFF_Ducker.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CAException.h"
+
+// STL Includes
+#include <algorithm>
+#include <cmath>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+EFF_DuckingRules::EFF_DuckingRules()
+:
+    mMutex("Ducking Rules"),
+    mSampleRate(44100.0)
+{
+    for(UInt32 i = 0; i < kEFFDuckingMaxRules; i++)
+    {
+        mDuckedGain[i].store(1.0f, std::memory_order_relaxed);
+        mAttackCoefficient[i].store(1.0f, std::memory_order_relaxed);
+        mReleaseCoefficient[i].store(1.0f, std::memory_order_relaxed);
+        mHoldFrames[i].store(0.0, std::memory_order_relaxed);
+        mLatestTriggerRT[i] = -1.0;
+    }
+}
+
+void    EFF_DuckingRules::AddClient(UInt32 inClientID, EFF_BundleIDs::ID inBundleID)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    mSlots.Claim(inClientID, [&] (Slot& theSlot) {
+        theSlot.gainRT = 1.0f;
+        theSlot.releaseCoefficientRT = 1.0f;
+        theSlot.bundleID = inBundleID;
+
+        PublishMasks(theSlot);
+    });
+}
+
+void    EFF_DuckingRules::RemoveClient(UInt32 inClientID)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    Slot* theRemovedSlot = mSlots.Release(inClientID);
+
+    if(theRemovedSlot != nullptr)
+    {
+        theRemovedSlot->bundleID = EFF_BundleIDs::kNone;
+    }
+}
+
+void    EFF_DuckingRules::SetSampleRate(Float64 inSampleRate)
+{
+    CAMutex::Locker theLocker(mMutex);
+    mSampleRate = inSampleRate;
+    PublishParams();
+}
+
+void    EFF_DuckingRules::Reset()
+{
+    for(UInt32 i = 0; i < kEFFDuckingMaxRules; i++)
+    {
+        mLatestTriggerRT[i] = -1.0;
+    }
+
+    mSlots.ForEach([] (UInt32, Slot& theSlot) {
+        theSlot.gainRT = 1.0f;
+        theSlot.releaseCoefficientRT = 1.0f;
+    });
+}
+
+#pragma mark IO Operations
+
+void    EFF_DuckingRules::ApplyRulesRT(UInt32 inClientID,
+                                       UInt32 inFrameCount,
+                                       Float64 inSampleTime,
+                                       Float32* ioBuffer)
+{
+    Slot* theSlotPtr = mSlots.Find(inClientID);
+
+    if(theSlotPtr == nullptr)
+    {
+        return;
+    }
+
+    Slot& theSlot = *theSlotPtr;
+
+    RefreshParamsRT();
+
+    // Ignore bits for rules we don't have parameters for yet.
+    const UInt32 theRulesMask =
+        (mNumRulesRT >= 32) ? UINT32_MAX : ((UInt32(1) << mNumRulesRT) - 1);
+    UInt32 theTriggerMask = theSlot.triggerMask.load(std::memory_order_relaxed) & theRulesMask;
+    UInt32 theTargetMask = theSlot.targetMask.load(std::memory_order_relaxed) & theRulesMask;
+
+    // Trigger the client's rules if this buffer is audible. This is checked before the buffer is
+    // ducked, so a client that's ducked by one rule still triggers the others.
+    if(theTriggerMask != 0 && EFF_AudibleState::BufferIsAudible(inFrameCount, ioBuffer))
+    {
+        Float64 theLastFrame = inSampleTime + inFrameCount - 1;
+
+        for(UInt32 theMask = theTriggerMask; theMask != 0; theMask &= (theMask - 1))
+        {
+            UInt32 theRule = static_cast<UInt32>(__builtin_ctz(theMask));
+            mLatestTriggerRT[theRule] = std::max(mLatestTriggerRT[theRule], theLastFrame);
+        }
+    }
+
+    // Find the client's rules that duck any of this buffer, and the last frame each one ducks.
+    UInt32 theActiveRules[kEFFDuckingMaxRules];
+    Float64 theDuckedUntil[kEFFDuckingMaxRules];
+    UInt32 theNumActiveRules = 0;
+
+    for(UInt32 theMask = theTargetMask; theMask != 0; theMask &= (theMask - 1))
+    {
+        UInt32 theRule = static_cast<UInt32>(__builtin_ctz(theMask));
+
+        if(mLatestTriggerRT[theRule] >= 0.0)
+        {
+            Float64 theUntil = mLatestTriggerRT[theRule] + mParamsRT[theRule].holdFrames;
+
+            if(theUntil >= inSampleTime)
+            {
+                theActiveRules[theNumActiveRules] = theRule;
+                theDuckedUntil[theNumActiveRules] = theUntil;
+                theNumActiveRules++;
+            }
+        }
+    }
+
+    Float32 theGain = theSlot.gainRT;
+
+    // Nothing to do if the client isn't ducked and won't be during this buffer.
+    if(theGain == 1.0f && theNumActiveRules == 0)
+    {
+        return;
+    }
+
+    for(UInt32 theFrame = 0; theFrame < inFrameCount; theFrame++)
+    {
+        // The deepest of the rules ducking this frame wins.
+        Float32 theTarget = 1.0f;
+        Float32 theAttackCoefficient = 1.0f;
+
+        for(UInt32 i = 0; i < theNumActiveRules; i++)
+        {
+            const Params& theParams = mParamsRT[theActiveRules[i]];
+
+            if((inSampleTime + theFrame) <= theDuckedUntil[i] && theParams.duckedGain < theTarget)
+            {
+                theTarget = theParams.duckedGain;
+                theAttackCoefficient = theParams.attackCoefficient;
+                theSlot.releaseCoefficientRT = theParams.releaseCoefficient;
+            }
+        }
+
+        Float32 theCoefficient =
+            (theTarget < theGain) ? theAttackCoefficient : theSlot.releaseCoefficientRT;
+
+        theGain += (theTarget - theGain) * theCoefficient;
+
+        ioBuffer[theFrame * 2] *= theGain;
+        ioBuffer[(theFrame * 2) + 1] *= theGain;
+    }
+
+    // Snap to fully released so the next buffer can take the fast path.
+    if(std::fabs(1.0f - theGain) < kGainEpsilon)
+    {
+        theGain = 1.0f;
+    }
+
+    theSlot.gainRT = theGain;
+}
+
+#pragma mark Accessors
+
+bool    EFF_DuckingRules::SetRules(const CACFArray& inRules)
+{
+    ThrowIf(inRules.GetNumberItems() > kEFFDuckingMaxRules,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_DuckingRules::SetRules: Too many rules");
+
+    // Parse all of the rules before changing anything, so an invalid one doesn't leave us with only
+    // some of them.
+    std::vector<Rule> theRules;
+
+    for(UInt32 i = 0; i < inRules.GetNumberItems(); i++)
+    {
+        CACFDictionary theRuleDict(false);
+        ThrowIf(!inRules.GetCACFDictionary(i, theRuleDict),
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_DuckingRules::SetRules: Expected a CFDictionary for each rule");
+
+        theRules.push_back(ParseRule(theRuleDict));
+    }
+
+    CAMutex::Locker theLocker(mMutex);
+
+    if(theRules == mRules)
+    {
+        return false;
+    }
+
+    mRules = theRules;
+
+    // Publish the parameters before the masks so the IO thread never sees a mask bit for a rule it
+    // doesn't have parameters for.
+    PublishParams();
+
+    mSlots.ForEach([&] (UInt32, Slot& theSlot) {
+        PublishMasks(theSlot);
+    });
+
+    return true;
+}
+
+CACFArray    EFF_DuckingRules::CopyRules()
+const
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    CACFArray theRules(false);
+
+    auto theCopyBundleIDs = [] (const std::vector<EFF_BundleIDs::ID>& inBundleIDs) {
+        CACFArray theBundleIDs(false);
+
+        for(EFF_BundleIDs::ID theBundleID : inBundleIDs)
+        {
+            theBundleIDs.AppendString(EFF_BundleIDs::GetBundleID(theBundleID).GetCFString());
+        }
+
+        return theBundleIDs;
+    };
+
+    for(const Rule& theRule : mRules)
+    {
+        CACFDictionary theRuleDict(false);
+        theRuleDict.AddArray(CFSTR(kEFFDuckingRuleKey_Triggers),
+                             theCopyBundleIDs(theRule.triggers).GetCFArray());
+        theRuleDict.AddArray(CFSTR(kEFFDuckingRuleKey_Targets),
+                             theCopyBundleIDs(theRule.targets).GetCFArray());
+        theRuleDict.AddFloat32(CFSTR(kEFFDuckingRuleKey_Depth), theRule.depthDB);
+        theRuleDict.AddFloat32(CFSTR(kEFFDuckingRuleKey_Attack), theRule.attackMs);
+        theRuleDict.AddFloat32(CFSTR(kEFFDuckingRuleKey_Release), theRule.releaseMs);
+        theRuleDict.AddFloat32(CFSTR(kEFFDuckingRuleKey_Hold), theRule.holdMs);
+        theRules.AppendDictionary(theRuleDict.GetDict());
+    }
+
+    return theRules;
+}
+
+#pragma mark Implementation
+
+bool    EFF_DuckingRules::Rule::operator==(const Rule& inOther)
+const
+{
+    return triggers == inOther.triggers &&
+           targets == inOther.targets &&
+           depthDB == inOther.depthDB &&
+           attackMs == inOther.attackMs &&
+           releaseMs == inOther.releaseMs &&
+           holdMs == inOther.holdMs;
+}
+
+//static
+EFF_DuckingRules::Rule    EFF_DuckingRules::ParseRule(const CACFDictionary& inRule)
+{
+    // The same defaults as music ducking.
+    Rule theRule = { {}, {}, 12.0f, 10.0f, 500.0f, 250.0f };
+
+    auto theParseBundleIDs = [&] (CFStringRef inKey, std::vector<EFF_BundleIDs::ID>& outBundleIDs) {
+        CACFArray theBundleIDs(false);
+        ThrowIf(!inRule.GetCACFArray(inKey, theBundleIDs) || theBundleIDs.GetNumberItems() == 0,
+                CAException(kAudioHardwareIllegalOperationError),
+                "EFF_DuckingRules::ParseRule: Missing or empty bundle ID array");
+
+        for(UInt32 i = 0; i < theBundleIDs.GetNumberItems(); i++)
+        {
+            CACFString theBundleID;
+            ThrowIf(!theBundleIDs.GetCACFString(i, theBundleID) || !theBundleID.IsValid(),
+                    CAException(kAudioHardwareIllegalOperationError),
+                    "EFF_DuckingRules::ParseRule: Expected a CFString for each bundle ID");
+
+            outBundleIDs.push_back(EFF_BundleIDs::Intern(theBundleID));
+        }
+    };
+
+    theParseBundleIDs(CFSTR(kEFFDuckingRuleKey_Triggers), theRule.triggers);
+    theParseBundleIDs(CFSTR(kEFFDuckingRuleKey_Targets), theRule.targets);
+
+    ThrowIf(!inRule.GetFloat32(CFSTR(kEFFDuckingRuleKey_Depth), theRule.depthDB) ||
+                !(theRule.depthDB >= 0.0f && theRule.depthDB <= kMaxDepthDB),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_DuckingRules::ParseRule: Missing or invalid depth");
+
+    // The times are optional.
+    inRule.GetFloat32(CFSTR(kEFFDuckingRuleKey_Attack), theRule.attackMs);
+    inRule.GetFloat32(CFSTR(kEFFDuckingRuleKey_Release), theRule.releaseMs);
+    inRule.GetFloat32(CFSTR(kEFFDuckingRuleKey_Hold), theRule.holdMs);
+
+    ThrowIf(!(theRule.attackMs >= 0.0f && theRule.attackMs <= kMaxTimeMs) ||
+                !(theRule.releaseMs >= 0.0f && theRule.releaseMs <= kMaxTimeMs) ||
+                !(theRule.holdMs >= 0.0f && theRule.holdMs <= kMaxTimeMs),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_DuckingRules::ParseRule: Invalid time");
+
+    return theRule;
+}
+
+void    EFF_DuckingRules::PublishParams()
+{
+    // Make the sequence number odd while we write so the IO thread won't use half-written
+    // parameters, then even again once they're all written.
+    UInt32 theSequence = mParamsSequence.load(std::memory_order_relaxed);
+    mParamsSequence.store(theSequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    mNumRules.store(static_cast<UInt32>(mRules.size()), std::memory_order_relaxed);
+
+    for(UInt32 i = 0; i < mRules.size(); i++)
+    {
+        const Rule& theRule = mRules[i];
+
+        mDuckedGain[i].store(std::pow(10.0f, -theRule.depthDB / 20.0f), std::memory_order_relaxed);
+        mAttackCoefficient[i].store(EFF_Ducker::OnePoleCoefficient(theRule.attackMs, mSampleRate),
+                                    std::memory_order_relaxed);
+        mReleaseCoefficient[i].store(EFF_Ducker::OnePoleCoefficient(theRule.releaseMs, mSampleRate),
+                                     std::memory_order_relaxed);
+        mHoldFrames[i].store(theRule.holdMs * mSampleRate / 1000.0, std::memory_order_relaxed);
+    }
+
+    mParamsSequence.store(theSequence + 2, std::memory_order_release);
+}
+
+void    EFF_DuckingRules::PublishMasks(Slot& ioSlot)
+const
+{
+    UInt32 theTriggerMask = 0;
+    UInt32 theTargetMask = 0;
+
+    if(ioSlot.bundleID != EFF_BundleIDs::kNone)
+    {
+        auto theContains = [&] (const std::vector<EFF_BundleIDs::ID>& inBundleIDs) {
+            return std::find(inBundleIDs.begin(), inBundleIDs.end(), ioSlot.bundleID) !=
+                   inBundleIDs.end();
+        };
+
+        for(UInt32 i = 0; i < mRules.size(); i++)
+        {
+            if(theContains(mRules[i].triggers))
+            {
+                theTriggerMask |= (UInt32(1) << i);
+            }
+            // An app is never ducked by a rule it triggers, or it would duck itself.
+            else if(theContains(mRules[i].targets))
+            {
+                theTargetMask |= (UInt32(1) << i);
+            }
+        }
+    }
+
+    ioSlot.triggerMask.store(theTriggerMask, std::memory_order_relaxed);
+    ioSlot.targetMask.store(theTargetMask, std::memory_order_relaxed);
+}
+
+void    EFF_DuckingRules::RefreshParamsRT()
+{
+    UInt32 theSequence = mParamsSequence.load(std::memory_order_acquire);
+
+    if(theSequence == mParamsSequenceRT || (theSequence & 1) != 0)
+    {
+        return;
+    }
+
+    UInt32 theNumRules = std::min(mNumRules.load(std::memory_order_relaxed),
+                                  static_cast<UInt32>(kEFFDuckingMaxRules));
+    Params theParams[kEFFDuckingMaxRules];
+
+    for(UInt32 i = 0; i < theNumRules; i++)
+    {
+        theParams[i].duckedGain = mDuckedGain[i].load(std::memory_order_relaxed);
+        theParams[i].attackCoefficient = mAttackCoefficient[i].load(std::memory_order_relaxed);
+        theParams[i].releaseCoefficient = mReleaseCoefficient[i].load(std::memory_order_relaxed);
+        theParams[i].holdFrames = mHoldFrames[i].load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // If the parameters were changed while we copied them, keep the old ones for now.
+    if(mParamsSequence.load(std::memory_order_relaxed) == theSequence)
+    {
+        std::copy(theParams, theParams + theNumRules, mParamsRT);
+        mNumRulesRT = theNumRules;
+        mParamsSequenceRT = theSequence;
+
+        // The rules might not be the same ones anymore, so forget when they were triggered. The
+        // clients that are ducked release from their current gain.
+        for(UInt32 i = 0; i < kEFFDuckingMaxRules; i++)
+        {
+            mLatestTriggerRT[i] = -1.0;
+        }
+    }
+}
+
+#pragma clang assume_nonnull end
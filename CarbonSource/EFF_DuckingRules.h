@@ -0,0 +1,197 @@
+//
+//  EFF_DuckingRules.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_DuckingRules_h
+#define EFF_DuckingRules_h
+
+// Local Includes
+#include "EFF_BundleIDs.h"
+#include "EFF_ClientSlots.h"
+#include "EFF_CustomProperties.h"
+
+// PublicUtility Includes
+#include "CAMutex.h"
+#include "CACFArray.h"
+#include "CACFDictionary.h"
+
+// STL Includes
+#include <atomic>
+#include <vector>
+
+// System Includes
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_DuckingRules
+//
+//  The rules set with kAudioDeviceCustomPropertyDuckingRules, each of which ducks a set of apps
+//  while any of another set of apps is audible, and the envelopes that apply them to each client's
+//  audio during ProcessOutput.
+//
+//  Rules name apps by bundle ID, but the IO thread never compares strings. The rules' bundle IDs are
+//  interned in EFF_BundleIDs when they're parsed. When a client is added, or the rules are changed,
+//  each client's bundle ID is matched against the rules once and the result stored in its slot as
+//  two bitmasks: the rules it triggers and the rules it's ducked by.
+//  That's why there can be at most kEFFDuckingMaxRules rules. The slots are in an EFF_ClientSlots,
+//  as in EFF_ClientEQ.
+//
+//  On the IO thread, a client's audible buffers update the sample time of the latest audible frame
+//  for each rule in its trigger mask, and a client with a target mask is ducked by the deepest of
+//  its rules that has been triggered within its hold time. That makes the cost of each client's
+//  buffer independent of the number of clients, so evaluating the rules is O(clients) per IO
+//  cycle. As with music ducking, a trigger client processed after a target client in the same IO
+//  cycle starts the ducking a buffer late.
+//
+//  The rules' parameters are published to the IO thread through a seqlock and are replaced all at
+//  once when the property is set. The IO thread keeps using the old ones if it sees them being
+//  written. The masks are published after the parameters, so for a buffer or so after a change a
+//  client can be ducked by a new rule that hasn't been triggered yet, which does nothing.
+//
+//  Methods whose names end with "RT" can only safely be called from real-time threads and must be
+//  called with the device's IO mutex held. The others aren't real-time safe.
+//==================================================================================================
+
+class EFF_DuckingRules
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_DuckingRules();
+                                EFF_DuckingRules(const EFF_DuckingRules&) = delete;
+                                EFF_DuckingRules& operator=(const EFF_DuckingRules&) = delete;
+
+    // Claims a slot for the client and matches its bundle ID against the rules.
+    void                        AddClient(UInt32 inClientID, EFF_BundleIDs::ID inBundleID);
+    void                        RemoveClient(UInt32 inClientID);
+
+    // Converts the rules' times to frames at the new sample rate. Shouldn't be called while IO is
+    // running.
+    void                        SetSampleRate(Float64 inSampleRate);
+
+    // Forgets when the rules were last triggered and un-ducks every client. Sample times restart
+    // from zero when IO starts, so the old trigger times would keep clients ducked until the new
+    // timeline caught up with them. Real-time safe, but shouldn't be called while IO is running.
+    void                        Reset();
+
+#pragma mark IO Operations
+
+    /*!
+     Update the rules the client triggers from a buffer of its audio, then duck the buffer if the
+     client is the target of any triggered rules.
+
+     @param inClientID The client the buffer is from.
+     @param inFrameCount The number of frames in ioBuffer.
+     @param inSampleTime The output sample time of the first frame in ioBuffer.
+     @param ioBuffer The audio, as interleaved stereo.
+     */
+    void                        ApplyRulesRT(UInt32 inClientID,
+                                             UInt32 inFrameCount,
+                                             Float64 inSampleTime,
+                                             Float32* ioBuffer);
+
+#pragma mark Accessors
+
+    /*!
+     Replace all of the rules.
+
+     @param inRules An array in the format of kAudioDeviceCustomPropertyDuckingRules.
+     @return True if the rules changed.
+     @throws CAException(kAudioHardwareIllegalOperationError) if any of the rules are invalid, in
+             which case none of them are changed.
+     */
+    bool                        SetRules(const CACFArray& inRules);
+    CACFArray                   CopyRules() const;
+
+#pragma mark Implementation
+
+private:
+    struct Rule
+    {
+        std::vector<EFF_BundleIDs::ID> triggers;
+        std::vector<EFF_BundleIDs::ID> targets;
+        Float32                 depthDB;
+        Float32                 attackMs;
+        Float32                 releaseMs;
+        Float32                 holdMs;
+
+        bool                    operator==(const Rule& inOther) const;
+    };
+
+    // A rule converted to the values the IO thread uses.
+    struct Params
+    {
+        Float32                 duckedGain;
+        Float32                 attackCoefficient;
+        Float32                 releaseCoefficient;
+        Float64                 holdFrames;
+    };
+
+    static_assert(kEFFDuckingMaxRules <= 32, "The rules must fit in a UInt32 mask");
+
+    struct Slot
+    {
+        // Bit i is set if the client triggers, or is ducked by, rule i. Written with mMutex held and
+        // read by the IO thread.
+        std::atomic<UInt32>     triggerMask    { 0 };
+        std::atomic<UInt32>     targetMask     { 0 };
+
+        // Only accessed by the IO thread, except that AddClient resets them before claiming the slot.
+        Float32                 gainRT         = 1.0f;
+        // The release coefficient of the last rule that ducked the client.
+        Float32                 releaseCoefficientRT = 1.0f;
+
+        // Guarded by mMutex.
+        EFF_BundleIDs::ID       bundleID       = EFF_BundleIDs::kNone;
+    };
+
+    // Parses an element of kAudioDeviceCustomPropertyDuckingRules.
+    static Rule                 ParseRule(const CACFDictionary& inRule);
+    // Converts mRules to Params and publishes them to the IO thread. mMutex must be held.
+    void                        PublishParams();
+    // Matches the slot's bundle ID against mRules and publishes its masks. mMutex must be held.
+    void                        PublishMasks(Slot& ioSlot) const;
+    // Copies the published Params to mParamsRT if they've changed. Only called by the IO thread.
+    void                        RefreshParamsRT();
+
+    static constexpr Float32    kMaxDepthDB         = 96.0f;
+    static constexpr Float32    kMaxTimeMs          = 10000.0f;
+    // The gain is snapped to 1 once it's this close.
+    static constexpr Float32    kGainEpsilon        = 1.0e-5f;
+
+    EFF_ClientSlots<Slot>       mSlots;
+
+    // Written by PublishParams and read by the IO thread. Guarded by mParamsSequence.
+    std::atomic<UInt32>         mParamsSequence     { 0 };
+    std::atomic<UInt32>         mNumRules           { 0 };
+    std::atomic<Float32>        mDuckedGain[kEFFDuckingMaxRules];
+    std::atomic<Float32>        mAttackCoefficient[kEFFDuckingMaxRules];
+    std::atomic<Float32>        mReleaseCoefficient[kEFFDuckingMaxRules];
+    std::atomic<Float64>        mHoldFrames[kEFFDuckingMaxRules];
+
+    // Only accessed by the IO thread.
+    UInt32                      mParamsSequenceRT   = 0;
+    UInt32                      mNumRulesRT         = 0;
+    Params                      mParamsRT[kEFFDuckingMaxRules];
+    // The sample time of the latest audible frame from any of each rule's trigger clients, or -1 if
+    // there hasn't been one.
+    Float64                     mLatestTriggerRT[kEFFDuckingMaxRules];
+
+    // Guards the rules and the slots' bundle IDs.
+    mutable CAMutex             mMutex;
+    Float64                     mSampleRate;
+    std::vector<Rule>           mRules;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_DuckingRules_h */
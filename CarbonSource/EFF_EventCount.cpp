@@ -0,0 +1,180 @@
+//
+//  EFF_EventCount.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_EventCount.h"
+
+#if defined(__APPLE__)
+// Local Includes
+#include "EFF_Types.h"
+#include "EFF_Utils.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CAException.h"
+#endif
+
+// STL Includes
+#if defined(__linux__)
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <system_error>
+#endif
+
+// System Includes
+#if defined(__APPLE__)
+#include <mach/mach_init.h>
+#include <mach/task.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#error "EFF_EventCount has no backend for this platform"
+#endif
+
+
+#if defined(__linux__)
+
+namespace
+{
+    // The kernel reads and writes the futex word as an int.
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(int) && std::atomic<uint32_t>::is_always_lock_free,
+                  "EFF_EventCount's count can't be used as a futex word");
+
+    // Outside the assume_nonnull region because inTimeout can be null.
+    long    Futex(std::atomic<uint32_t>& inWord, int inOperation, uint32_t inValue, const timespec* inTimeout)
+    {
+        return syscall(SYS_futex, reinterpret_cast<int*>(&inWord), inOperation, inValue, inTimeout, nullptr, 0);
+    }
+}
+
+#endif
+
+#if defined(__clang__)
+#pragma clang assume_nonnull begin
+#endif
+
+// MARK: Construction/Destruction
+
+EFF_EventCount::EFF_EventCount()
+:
+    mCount(0),
+    mNumWaiters(0)
+{
+#if defined(__APPLE__)
+    kern_return_t theError = semaphore_create(mach_task_self(), &mSemaphore, SYNC_POLICY_FIFO, 0);
+    EFF_Utils::ThrowIfMachError("EFF_EventCount::EFF_EventCount", "semaphore_create", theError);
+    ThrowIf(mSemaphore == SEMAPHORE_NULL,
+            CAException(kAudioHardwareUnspecifiedError),
+            "EFF_EventCount::EFF_EventCount: Could not create semaphore");
+#endif
+}
+
+EFF_EventCount::~EFF_EventCount()
+{
+#if defined(__APPLE__)
+    kern_return_t theError = semaphore_destroy(mach_task_self(), mSemaphore);
+    EFF_Utils::LogIfMachError("EFF_EventCount::~EFF_EventCount", "semaphore_destroy", theError);
+#endif
+}
+
+// MARK: Waiting
+
+bool    EFF_EventCount::TimedWait(uint32_t inKey, uint64_t inTimeoutNs)
+{
+    // Count ourselves as a waiter before checking the count. Increment changes the count before
+    // checking for waiters, so either we see the new count or it sees us and wakes us. Both sides
+    // are sequentially consistent so the two can't be reordered.
+    mNumWaiters.fetch_add(1, std::memory_order_seq_cst);
+
+    bool didTimeOut = false;
+
+#if defined(__APPLE__)
+    if(mCount.load(std::memory_order_seq_cst) == inKey)
+    {
+        kern_return_t theError;
+
+        if(inTimeoutNs == 0)
+        {
+            theError = semaphore_wait(mSemaphore);
+        }
+        else
+        {
+            theError = semaphore_timedwait(mSemaphore,
+                                           (mach_timespec_t){ static_cast<unsigned int>(inTimeoutNs / NSEC_PER_SEC),
+                                                              static_cast<clock_res_t>(inTimeoutNs % NSEC_PER_SEC) });
+        }
+
+        didTimeOut = (theError == KERN_OPERATION_TIMED_OUT);
+
+        if(!didTimeOut && theError != KERN_ABORTED)
+        {
+            EFF_Utils::ThrowIfMachError("EFF_EventCount::TimedWait", "semaphore_wait", theError);
+        }
+    }
+#elif defined(__linux__)
+    // The kernel checks the count is still inKey before sleeping, atomically with respect to
+    // FUTEX_WAKE, so this can't miss a notification.
+    timespec theTimeout = { static_cast<time_t>(inTimeoutNs / 1000000000), static_cast<long>(inTimeoutNs % 1000000000) };
+
+    if(Futex(mCount, FUTEX_WAIT_PRIVATE, inKey, (inTimeoutNs == 0) ? nullptr : &theTimeout) != 0)
+    {
+        int theError = errno;
+        didTimeOut = (theError == ETIMEDOUT);
+
+        // EAGAIN means the count had already changed.
+        if(!didTimeOut && theError != EAGAIN && theError != EINTR)
+        {
+            mNumWaiters.fetch_sub(1, std::memory_order_seq_cst);
+            throw std::system_error(theError, std::generic_category(), "EFF_EventCount::TimedWait: futex wait failed");
+        }
+    }
+#endif
+
+    mNumWaiters.fetch_sub(1, std::memory_order_seq_cst);
+
+    return !didTimeOut;
+}
+
+// MARK: Notifying
+
+void    EFF_EventCount::Increment(bool inWakeAll)
+{
+    mCount.fetch_add(1, std::memory_order_seq_cst);
+
+    uint32_t theNumWaiters = mNumWaiters.load(std::memory_order_seq_cst);
+
+    if(theNumWaiters == 0)
+    {
+        // The fast path. Any thread that starts waiting from now will see the new count.
+        return;
+    }
+
+#if defined(__APPLE__)
+    // Mach's semaphore_signal_all only wakes the threads already blocked on the semaphore, so a
+    // waiter that has counted itself but hasn't blocked yet would miss it. Signalling once per
+    // waiter leaves a signal for that thread instead.
+    for(uint32_t i = 0; i < (inWakeAll ? theNumWaiters : 1); i++)
+    {
+        kern_return_t theError = semaphore_signal(mSemaphore);
+        EFF_Utils::ThrowIfMachError("EFF_EventCount::Increment", "semaphore_signal", theError);
+    }
+#elif defined(__linux__)
+    if(Futex(mCount, FUTEX_WAKE_PRIVATE, inWakeAll ? INT_MAX : 1, nullptr) < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "EFF_EventCount::Increment: futex wake failed");
+    }
+#endif
+}
+
+#if defined(__clang__)
+#pragma clang assume_nonnull end
+#endif
+
@@ -0,0 +1,96 @@
+//
+//  EFF_EventCount.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_EventCount_h
+#define EFF_EventCount_h
+
+// STL Includes
+#include <atomic>
+#include <cstdint>
+
+// System Includes
+#if defined(__APPLE__)
+#include <mach/semaphore.h>
+#endif
+
+
+#if defined(__clang__)
+#pragma clang assume_nonnull begin
+#endif
+
+//==================================================================================================
+//    EFF_EventCount
+//
+//  Lets threads wait for a condition that another thread makes true, without locks and without
+//  missing wake-ups. A waiter takes a key with PrepareWait, checks its condition and, if it's still
+//  false, passes the key to Wait. Wait returns immediately if Notify or NotifyAll has been called
+//  since PrepareWait, so a notification sent between checking the condition and waiting isn't lost.
+//
+//      while(true)
+//      {
+//          uint32_t theKey = theEventCount.PrepareWait();
+//          if(condition) break;
+//          theEventCount.Wait(theKey);
+//      }
+//
+//  Wait can return spuriously, so callers always check their condition in a loop like that.
+//
+//  Notify and NotifyAll are real-time safe, and don't make any system calls when no thread is
+//  waiting. On Linux, threads wait on a futex on the count itself. On macOS, which has no public
+//  futex API, they wait on a Mach semaphore.
+//
+//  This class only uses standard types, rather than CoreAudio's, so it can be built and tested on
+//  Linux. Errors are thrown as CAExceptions on macOS and std::system_errors elsewhere.
+//==================================================================================================
+
+class EFF_EventCount
+{
+
+public:
+    // Throws if the semaphore can't be created.
+                                EFF_EventCount();
+                                ~EFF_EventCount();
+    // Disallow copying
+                                EFF_EventCount(const EFF_EventCount&)               = delete;
+    EFF_EventCount&             operator=(const EFF_EventCount&)                    = delete;
+
+    uint32_t                    PrepareWait() const { return mCount.load(std::memory_order_acquire); }
+
+    // Blocks until the count differs from inKey. Throws if waiting fails.
+    void                        Wait(uint32_t inKey) { TimedWait(inKey, 0); }
+    // The same, but gives up after inTimeoutNs nanoseconds, if it isn't 0. Returns false if it
+    // timed out.
+    bool                        TimedWait(uint32_t inKey, uint64_t inTimeoutNs);
+
+    // Wakes one waiting thread. Throws if signalling fails.
+    void                        Notify()            { Increment(false); }
+    // Wakes every waiting thread.
+    void                        NotifyAll()         { Increment(true); }
+
+private:
+    void                        Increment(bool inWakeAll);
+
+    // The futex word on Linux.
+    std::atomic<uint32_t>       mCount;
+    // The threads in TimedWait. Notify and NotifyAll only make a system call if this isn't 0.
+    std::atomic<uint32_t>       mNumWaiters;
+
+#if defined(__APPLE__)
+    // Signalled once for each thread to wake. A signal that arrives after the thread it was for has
+    // stopped waiting just causes a spurious wake-up later.
+    semaphore_t                 mSemaphore;
+#endif
+
+};
+
+#if defined(__clang__)
+#pragma clang assume_nonnull end
+#endif
+
+#endif /* EFF_EventCount_h */
+
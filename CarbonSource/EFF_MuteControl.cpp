@@ -12,15 +12,35 @@
 
 // Local Includes
 #include "EFF_PlugIn.h"
+#include "EFF_PropertyTable.h"
 
 // PublicUtility Includes
 #include "CADebugMacros.h"
 #include "CAException.h"
 #include "CADispatchQueue.h"
 
+// STL Includes
+#include <algorithm>
+#include <cmath>
+
+// System Includes
+#include <Accelerate/Accelerate.h>
+
 
 #pragma clang assume_nonnull begin
 
+#pragma mark Property Table
+
+namespace
+{
+    constexpr EFF_PropertyInfo kMuteControlPropertyList[] =
+    {
+        EFF_Property(kAudioBooleanControlPropertyValue, sizeof(UInt32), EFF_PropertyInfo::kSettable)
+    };
+
+    constexpr auto kMuteControlProperties = EFF_MakePropertyTable(kMuteControlPropertyList);
+}
+
 #pragma mark Construction/Destruction
 
 EFF_MuteControl::EFF_MuteControl(AudioObjectID inObjectID,
@@ -35,7 +55,10 @@ EFF_MuteControl::EFF_MuteControl(AudioObjectID inObjectID,
                 inScope,
                 inElement),
     mMutex("Mute Control"),
-    mMuted(false)
+    mMuted(false),
+    mWillApplyMuteToAudio(false),
+    mGainRT(1.0f),
+    mNextSampleTimeRT(-1.0)
 {
 }
 
@@ -47,20 +70,14 @@ bool    EFF_MuteControl::HasProperty(AudioObjectID inObjectID,
 {
     CheckObjectID(inObjectID);
 
-    bool theAnswer = false;
+    const EFF_PropertyInfo* theInfo = kMuteControlProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioBooleanControlPropertyValue:
-            theAnswer = true;
-            break;
-
-        default:
-            theAnswer = EFF_Control::HasProperty(inObjectID, inClientPID, inAddress);
-            break;
-    };
+        return kMuteControlProperties.HasProperty(*theInfo, inAddress);
+    }
 
-    return theAnswer;
+    return EFF_Control::HasProperty(inObjectID, inClientPID, inAddress);
 }
 
 bool    EFF_MuteControl::IsPropertySettable(AudioObjectID inObjectID,
@@ -69,20 +86,14 @@ bool    EFF_MuteControl::IsPropertySettable(AudioObjectID inObjectID,
 {
     CheckObjectID(inObjectID);
 
-    bool theAnswer = false;
+    const EFF_PropertyInfo* theInfo = kMuteControlProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioBooleanControlPropertyValue:
-            theAnswer = true;
-            break;
-
-        default:
-            theAnswer = EFF_Control::IsPropertySettable(inObjectID, inClientPID, inAddress);
-            break;
-    };
+        return kMuteControlProperties.IsPropertySettable(*theInfo);
+    }
 
-    return theAnswer;
+    return EFF_Control::IsPropertySettable(inObjectID, inClientPID, inAddress);
 }
 
 UInt32  EFF_MuteControl::GetPropertyDataSize(AudioObjectID inObjectID,
@@ -93,24 +104,18 @@ UInt32  EFF_MuteControl::GetPropertyDataSize(AudioObjectID inObjectID,
 {
     CheckObjectID(inObjectID);
 
-    UInt32 theAnswer = 0;
+    const EFF_PropertyInfo* theInfo = kMuteControlProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioBooleanControlPropertyValue:
-            theAnswer = sizeof(UInt32);
-            break;
-
-        default:
-            theAnswer = EFF_Control::GetPropertyDataSize(inObjectID,
-                                                         inClientPID,
-                                                         inAddress,
-                                                         inQualifierDataSize,
-                                                         inQualifierData);
-            break;
-    };
-
-    return theAnswer;
+        return theInfo->dataSize;
+    }
+
+    return EFF_Control::GetPropertyDataSize(inObjectID,
+                                            inClientPID,
+                                            inAddress,
+                                            inQualifierDataSize,
+                                            inQualifierData);
 }
 
 void    EFF_MuteControl::GetPropertyData(AudioObjectID inObjectID,
@@ -137,7 +142,7 @@ void    EFF_MuteControl::GetPropertyData(AudioObjectID inObjectID,
                 CAMutex::Locker theLocker(mMutex);
 
                 // Non-zero for true, which means audio is being muted.
-                *reinterpret_cast<UInt32*>(outData) = mMuted ? 1 : 0;
+                *reinterpret_cast<UInt32*>(outData) = mMuted.load() ? 1 : 0;
                 outDataSize = sizeof(UInt32);
             }
             break;
@@ -174,25 +179,8 @@ void    EFF_MuteControl::SetPropertyData(AudioObjectID inObjectID,
                         "EFF_MuteControl::SetPropertyData: wrong size for the data for "
                         "kAudioBooleanControlPropertyValue");
 
-                CAMutex::Locker theLocker(mMutex);
-
                 // Non-zero for true, meaning audio will be muted.
-                bool theNewMuted = (*reinterpret_cast<const UInt32*>(inData) != 0);
-
-                if(mMuted != theNewMuted)
-                {
-                    mMuted = theNewMuted;
-
-                    // Send notifications.
-                    CADispatchQueue::GetGlobalSerialQueue().Dispatch(false, ^{
-                        AudioObjectPropertyAddress theChangedProperty[1];
-                        theChangedProperty[0] = {
-                                kAudioBooleanControlPropertyValue, mScope, mElement
-                        };
-
-                        EFF_PlugIn::Host_PropertiesChanged(inObjectID, 1, theChangedProperty);
-                    });
-                }
+                SetMuted(*reinterpret_cast<const UInt32*>(inData) != 0);
             }
             break;
 
@@ -208,4 +196,112 @@ void    EFF_MuteControl::SetPropertyData(AudioObjectID inObjectID,
     };
 }
 
+#pragma mark Accessors
+
+void    EFF_MuteControl::SetWillApplyMuteToAudio(bool inWillApplyMuteToAudio)
+{
+    mWillApplyMuteToAudio = inWillApplyMuteToAudio;
+}
+
+void    EFF_MuteControl::SetMuted(bool inMuted)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    if(mMuted.load() != inMuted)
+    {
+        // If we're applying the mute to audio, this takes effect from the next buffer.
+        mMuted = inMuted;
+
+        // Send notifications.
+        AudioObjectID theObjectID = GetObjectID();
+
+        CADispatchQueue::GetGlobalSerialQueue().Dispatch(false, ^{
+            AudioObjectPropertyAddress theChangedProperty[1];
+            theChangedProperty[0] = {
+                    kAudioBooleanControlPropertyValue, mScope, mElement
+            };
+
+            EFF_PlugIn::Host_PropertiesChanged(theObjectID, 1, theChangedProperty);
+        });
+    }
+}
+
+#pragma mark IO Operations
+
+bool    EFF_MuteControl::WillApplyMuteToAudioRT() const
+{
+    // The control is only deactivated while IO is stopped, so this can't change during IO. See
+    // EFF_Device::SetEnabledControls.
+    return mWillApplyMuteToAudio && IsActive();
+}
+
+void    EFF_MuteControl::ApplyMuteToAudioRT(Float32* ioBuffer,
+                                            UInt32 inBufferFrameSize,
+                                            Float64 inSampleTime)
+{
+    ApplyMuteToAudioRT(ioBuffer, inBufferFrameSize, inSampleTime, IsMutedRT());
+}
+
+void    EFF_MuteControl::ApplyMuteToAudioRT(Float32* ioBuffer,
+                                            UInt32 inBufferFrameSize,
+                                            Float64 inSampleTime,
+                                            bool inMuted)
+{
+    ThrowIf(!mWillApplyMuteToAudio,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_MuteControl::ApplyMuteToAudioRT: This control doesn't process audio data");
+
+    const Float32 theTargetGain = inMuted ? 0.0f : 1.0f;
+
+    // Skip the fade if this buffer doesn't follow on from the last one, e.g. because IO has just
+    // started.
+    if(inSampleTime != mNextSampleTimeRT)
+    {
+        mGainRT = theTargetGain;
+    }
+
+    mNextSampleTimeRT = inSampleTime + inBufferFrameSize;
+
+    UInt32 theFrame = 0;
+
+    if(mGainRT != theTargetGain)
+    {
+        // Fade linearly towards the target gain, one step per frame.
+        const Float32 theStep = (theTargetGain > mGainRT ? 1.0f : -1.0f) / kRampFrames;
+        const Float32 theRemainingFrames = std::abs(theTargetGain - mGainRT) * kRampFrames;
+        const UInt32 theRampFrames =
+            std::min(inBufferFrameSize, static_cast<UInt32>(std::ceil(theRemainingFrames)));
+
+        // vDSP_vrampmul is equivalent to
+        //
+        // for(UInt32 i = 0; i < theRampFrames; i++)
+        // {
+        //     ioBuffer[i * 2] *= theGain;
+        //     theGain += theStep;
+        // }
+        //
+        // and advances its start value, so run it on a copy for the left channel and let the
+        // right channel's call leave the gain where the fade got to.
+        Float32 theLeftGain = mGainRT;
+        vDSP_vrampmul(ioBuffer, 2, &theLeftGain, &theStep, ioBuffer, 2, theRampFrames);
+        vDSP_vrampmul(ioBuffer + 1, 2, &mGainRT, &theStep, ioBuffer + 1, 2, theRampFrames);
+
+        // Land exactly on the target at the end of the fade, so the paths below are taken.
+        if(theRampFrames < inBufferFrameSize ||
+           (theStep > 0.0f ? mGainRT >= theTargetGain : mGainRT <= theTargetGain))
+        {
+            mGainRT = theTargetGain;
+        }
+
+        theFrame = theRampFrames;
+    }
+
+    // Clear the rest of the buffer if the fade has finished and we're muted. Otherwise, we're
+    // unmuted and there's nothing to do.
+    if(mGainRT == 0.0f && theFrame < inBufferFrameSize)
+    {
+        vDSP_vclr(ioBuffer + theFrame * 2, 1, (inBufferFrameSize - theFrame) * 2);
+    }
+}
+
 #pragma clang assume_nonnull end
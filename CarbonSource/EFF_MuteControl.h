@@ -17,6 +17,9 @@
 // PublicUtility Includes
 #include "CAMutex.h"
 
+// STL Includes
+#include <atomic>
+
 // System Includes
 #include <MacTypes.h>
 #include <CoreAudio/CoreAudio.h>
@@ -72,11 +75,74 @@ public:
                                               UInt32 inDataSize,
                                               const void* inData);
 
+#pragma mark Accessors
+
+    /*!
+     Set this mute control to mute the audio data passed to ApplyMuteToAudioRT, rather than only
+     reporting its value. When this is set true, WillApplyMuteToAudioRT will return true while the
+     control is active. Set to false initially.
+     */
+    void                      SetWillApplyMuteToAudio(bool inWillApplyMuteToAudio);
+
+    /*!
+     Mute or unmute this control and send the property notification if its value changes, the same
+     as setting kAudioBooleanControlPropertyValue.
+     */
+    void                      SetMuted(bool inMuted);
+
+#pragma mark IO Operations
+
+    /*!
+     @return True if clients should use ApplyMuteToAudioRT to apply this mute control to their audio
+             data while doing IO.
+     */
+    bool                      WillApplyMuteToAudioRT() const;
+    /*!
+     Mute the samples in ioBuffer if this control is muted. Changes to the control fade the audio
+     out or in over kRampFrames frames, starting with the next buffer, so they don't click. Once
+     the fade has finished, buffers are just cleared while muted and left alone while unmuted.
+
+     Must only be called from one real-time thread at a time, e.g. with the device's IO mutex held.
+
+     @param ioBuffer The audio sample buffer to process, in stereo.
+     @param inBufferFrameSize The number of sample frames in ioBuffer.
+     @param inSampleTime The sample time of the first frame in ioBuffer. If it doesn't follow on from
+                         the last buffer, the fade is skipped, since there's no audio to fade from.
+     @throws CAException If SetWillApplyMuteToAudio hasn't been used to set this control to apply
+                         its value to audio data.
+     */
+    void                      ApplyMuteToAudioRT(Float32* ioBuffer,
+                                                 UInt32 inBufferFrameSize,
+                                                 Float64 inSampleTime);
+    /*!
+     Mute the samples in ioBuffer if inMuted is true instead of if the control is muted, e.g. to
+     apply a mute change from part way through the buffer. A buffer that follows on from the last
+     one fades from where the last one ended, so the frames after a change fade the same way they
+     would at the start of a buffer.
+     */
+    void                      ApplyMuteToAudioRT(Float32* ioBuffer,
+                                                 UInt32 inBufferFrameSize,
+                                                 Float64 inSampleTime,
+                                                 bool inMuted);
+    /*! @return The value ApplyMuteToAudioRT mutes for. */
+    bool                      IsMutedRT() const { return mMuted.load(std::memory_order_relaxed); }
+
 #pragma mark Implementation
 
 private:
+    // The length of the fade, about 5 ms at 48 kHz.
+    static constexpr UInt32   kRampFrames = 256;
+
     CAMutex                   mMutex;
-    bool                      mMuted;
+    // Written with mMutex held. Atomic so the IO thread can read it without taking mMutex.
+    std::atomic<bool>         mMuted;
+
+    bool                      mWillApplyMuteToAudio;
+
+    // Only accessed by the IO thread. The gain at the end of the last buffer, from 1 when unmuted
+    // to 0 when muted, and the sample time of the frame after it.
+    Float32                   mGainRT;
+    Float64                   mNextSampleTimeRT;
 
 };
 
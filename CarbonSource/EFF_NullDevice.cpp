@@ -10,7 +10,9 @@
 #include "EFF_NullDevice.h"
 
 // Local Includes
+#include "EFF_ObjectRegistry.h"
 #include "EFF_PlugIn.h"
+#include "EFF_PropertyTable.h"
 
 // PublicUtility Includes
 #include "CADebugMacros.h"
@@ -24,6 +26,20 @@
 static const Float64 kSampleRate = 44100.0;
 static const UInt32 kZeroTimeStampPeriod = 10000;  // Arbitrary.
 
+namespace
+{
+    // The null device can be the default device in any scope, unlike EFF_Device.
+    constexpr EFF_PropertyInfo kNullDevicePropertyList[] =
+    {
+        EFF_Property(kAudioDevicePropertyStreams,                       1 * sizeof(AudioObjectID)),
+        EFF_Property(kAudioDevicePropertyAvailableNominalSampleRates,   1 * sizeof(AudioValueRange)),
+        EFF_Property(kAudioDevicePropertyDeviceCanBeDefaultDevice,      sizeof(UInt32)),
+        EFF_Property(kAudioDevicePropertyDeviceCanBeDefaultSystemDevice, sizeof(UInt32))
+    };
+
+    constexpr auto kNullDeviceProperties = EFF_MakePropertyTable(kNullDevicePropertyList);
+}
+
 
 #pragma mark Construction/Destruction
 
@@ -58,10 +74,14 @@ EFF_NullDevice::EFF_NullDevice()
     mIOMutex("Null Device IO"),
     mStream(kObjectID_Stream_Null, kObjectID_Device_Null, false, kSampleRate)
 {
+    EFF_ObjectRegistry::Register(kObjectID_Device_Null, *this, this);
+    EFF_ObjectRegistry::Register(kObjectID_Stream_Null, *this);
 }
 
 EFF_NullDevice::~EFF_NullDevice()
 {
+    EFF_ObjectRegistry::Unregister(kObjectID_Device_Null);
+    EFF_ObjectRegistry::Unregister(kObjectID_Stream_Null);
 }
 
 void    EFF_NullDevice::Activate()
@@ -119,19 +139,14 @@ const
         return mStream.HasProperty(inObjectID, inClientPID, inAddress);
     }
 
-    bool theAnswer = false;
-    switch(inAddress.mSelector)
+    const EFF_PropertyInfo* theInfo = kNullDeviceProperties.Find(inAddress.mSelector);
+
+    if(theInfo != nullptr)
     {
-        case kAudioDevicePropertyDeviceCanBeDefaultDevice:
-        case kAudioDevicePropertyDeviceCanBeDefaultSystemDevice:
-            theAnswer = true;
-            break;
+        return kNullDeviceProperties.HasProperty(*theInfo, inAddress);
+    }
 
-        default:
-            theAnswer = EFF_AbstractDevice::HasProperty(inObjectID, inClientPID, inAddress);
-            break;
-    };
-    return theAnswer;
+    return EFF_AbstractDevice::HasProperty(inObjectID, inClientPID, inAddress);
 }
 
 bool    EFF_NullDevice::IsPropertySettable(AudioObjectID inObjectID,
@@ -145,16 +160,14 @@ const
         return mStream.IsPropertySettable(inObjectID, inClientPID, inAddress);
     }
 
-    bool theAnswer = false;
+    const EFF_PropertyInfo* theInfo = kNullDeviceProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        default:
-            theAnswer = EFF_AbstractDevice::IsPropertySettable(inObjectID, inClientPID, inAddress);
-            break;
-    };
+        return kNullDeviceProperties.IsPropertySettable(*theInfo);
+    }
 
-    return theAnswer;
+    return EFF_AbstractDevice::IsPropertySettable(inObjectID, inClientPID, inAddress);
 }
 
 UInt32    EFF_NullDevice::GetPropertyDataSize(AudioObjectID inObjectID,
@@ -174,28 +187,18 @@ const
                                            inQualifierData);
     }
 
-    UInt32 theAnswer = 0;
+    const EFF_PropertyInfo* theInfo = kNullDeviceProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioDevicePropertyStreams:
-            theAnswer = 1 * sizeof(AudioObjectID);
-            break;
-
-        case kAudioDevicePropertyAvailableNominalSampleRates:
-            theAnswer = 1 * sizeof(AudioValueRange);
-            break;
-
-        default:
-            theAnswer = EFF_AbstractDevice::GetPropertyDataSize(inObjectID,
-                                                                inClientPID,
-                                                                inAddress,
-                                                                inQualifierDataSize,
-                                                                inQualifierData);
-            break;
-    };
+        return theInfo->dataSize;
+    }
 
-    return theAnswer;
+    return EFF_AbstractDevice::GetPropertyDataSize(inObjectID,
+                                                   inClientPID,
+                                                   inAddress,
+                                                   inQualifierDataSize,
+                                                   inQualifierData);
 }
 
 void    EFF_NullDevice::GetPropertyData(AudioObjectID inObjectID,
@@ -0,0 +1,99 @@
+//
+//  EFF_ObjectRegistry.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_ObjectRegistry.h"
+
+// Local Includes
+#include "EFF_Object.h"
+#include "EFF_AbstractDevice.h"
+#include "EFF_PropertyCache.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CAException.h"
+
+
+#pragma clang assume_nonnull begin
+
+std::array<EFF_ObjectRegistry::Entry, EFF_ObjectRegistry::kMaxObjectIDs> EFF_ObjectRegistry::sEntries;
+std::atomic<AudioObjectID> EFF_ObjectRegistry::sNextDynamicObjectID { EFF_ObjectRegistry::kFirstDynamicObjectID };
+
+AudioObjectID    EFF_ObjectRegistry::AllocateObjectID()
+{
+    AudioObjectID theObjectID = sNextDynamicObjectID.fetch_add(1, std::memory_order_relaxed);
+
+    ThrowIf(theObjectID >= kMaxObjectIDs,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_ObjectRegistry::AllocateObjectID: Out of object IDs");
+
+    return theObjectID;
+}
+
+void    EFF_ObjectRegistry::Register(AudioObjectID inObjectID,
+                                     EFF_Object& inOwner,
+                                     EFF_AbstractDevice* __nullable inDevice)
+{
+    ThrowIf(inObjectID == kAudioObjectUnknown || inObjectID >= kMaxObjectIDs,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_ObjectRegistry::Register: Object ID out of range");
+
+    Entry& theEntry = sEntries[inObjectID];
+    EFF_Object* theOwner = theEntry.owner.load(std::memory_order_acquire);
+
+    ThrowIf(theOwner != nullptr && theOwner != &inOwner,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_ObjectRegistry::Register: Object ID already registered");
+
+    // Store the device first, so a reader that sees the owner also sees the device.
+    theEntry.device.store(inDevice, std::memory_order_release);
+    theEntry.owner.store(&inOwner, std::memory_order_release);
+
+    // In case the ID was used by an object that has since been destroyed.
+    EFF_PropertyCache::Invalidate();
+}
+
+void    EFF_ObjectRegistry::Unregister(AudioObjectID inObjectID)
+{
+    if(inObjectID != kAudioObjectUnknown && inObjectID < kMaxObjectIDs)
+    {
+        sEntries[inObjectID].owner.store(nullptr, std::memory_order_release);
+        sEntries[inObjectID].device.store(nullptr, std::memory_order_release);
+        EFF_PropertyCache::Invalidate();
+    }
+}
+
+EFF_Object&    EFF_ObjectRegistry::LookUpOwnerObject(AudioObjectID inObjectID)
+{
+    EFF_Object* theOwner =
+        (inObjectID < kMaxObjectIDs) ? sEntries[inObjectID].owner.load(std::memory_order_acquire) : nullptr;
+
+    if(theOwner == nullptr)
+    {
+        DebugMsg("EFF_ObjectRegistry::LookUpOwnerObject: unknown object %u", inObjectID);
+        Throw(CAException(kAudioHardwareBadObjectError));
+    }
+
+    return *theOwner;
+}
+
+EFF_AbstractDevice&    EFF_ObjectRegistry::LookUpDevice(AudioObjectID inObjectID)
+{
+    EFF_AbstractDevice* theDevice =
+        (inObjectID < kMaxObjectIDs) ? sEntries[inObjectID].device.load(std::memory_order_acquire) : nullptr;
+
+    if(theDevice == nullptr)
+    {
+        DebugMsg("EFF_ObjectRegistry::LookUpDevice: unknown device %u", inObjectID);
+        Throw(CAException(kAudioHardwareBadDeviceError));
+    }
+
+    return *theDevice;
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,86 @@
+//
+//  EFF_ObjectRegistry.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_ObjectRegistry_h
+#define EFF_ObjectRegistry_h
+
+// STL Includes
+#include <array>
+#include <atomic>
+
+// System Includes
+#include <CoreAudio/AudioServerPlugIn.h>
+
+
+// Forward Declarations
+class EFF_Object;
+class EFF_AbstractDevice;
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_ObjectRegistry
+//
+//  Maps the driver's object IDs to the objects the HAL's calls for them should go to, so the entry
+//  points in EFF_PlugInInterface.cpp can find them with a single indexed load instead of comparing
+//  the ID against every known object and calling the singletons' accessors.
+//
+//  Each object ID has an owner, the object whose HasProperty, GetPropertyData, etc. handle the ID
+//  (e.g. a device, for its streams and controls), and, for device IDs, the device to send the IO
+//  calls to. Objects register their IDs when they're constructed and unregister them when they're
+//  destroyed.
+//
+//  Lookups are lock-free and real-time safe. Registering and unregistering aren't synchronised with
+//  each other, which is fine as long as each ID is only registered by the object that has it.
+//==================================================================================================
+
+class EFF_ObjectRegistry
+{
+
+public:
+    // Object IDs have to be less than this to be registered.
+    static constexpr AudioObjectID  kMaxObjectIDs = 256;
+    // The fixed object IDs in EFF_Types.h are all less than this. The ones from here to
+    // kMaxObjectIDs are given to objects created at runtime, like the devices in the config file.
+    static constexpr AudioObjectID  kFirstDynamicObjectID = 128;
+
+    // Returns an object ID no other object has been given. IDs aren't reused, even if their
+    // objects are destroyed. Throws CAException(kAudioHardwareIllegalOperationError) if they've
+    // run out. Thread safe.
+    static AudioObjectID        AllocateObjectID();
+
+    // Throws CAException(kAudioHardwareIllegalOperationError) if the ID is kAudioObjectUnknown or too
+    // large, or is already registered to a different owner.
+    static void                 Register(AudioObjectID inObjectID,
+                                         EFF_Object& inOwner,
+                                         EFF_AbstractDevice* __nullable inDevice = nullptr);
+    // Does nothing if the ID isn't registered.
+    static void                 Unregister(AudioObjectID inObjectID);
+
+    // Throw CAException(kAudioHardwareBadObjectError) or CAException(kAudioHardwareBadDeviceError)
+    // if the ID isn't registered. Real-time safe, except when they throw.
+    static EFF_Object&          LookUpOwnerObject(AudioObjectID inObjectID);
+    static EFF_AbstractDevice&  LookUpDevice(AudioObjectID inObjectID);
+
+private:
+    struct Entry
+    {
+        std::atomic<EFF_Object*>            owner;
+        std::atomic<EFF_AbstractDevice*>    device;
+    };
+
+    // Zero-initialised, since it has static storage duration, so every ID starts unregistered.
+    static std::array<Entry, kMaxObjectIDs> sEntries;
+    static std::atomic<AudioObjectID>       sNextDynamicObjectID;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_ObjectRegistry_h */
@@ -0,0 +1,134 @@
+//
+//  EFF_PackedProperties.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_PackedProperties.h"
+
+// PublicUtility Includes
+#include "CAException.h"
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Writer
+
+EFF_PackedProperties::Writer::Writer(UInt32 inSelector, UInt32 inEntrySize, size_t inNumEntries)
+:
+    mSelector(inSelector),
+    mEntrySize(inEntrySize)
+{
+    mEntries.reserve(inNumEntries * inEntrySize);
+}
+
+UInt32    EFF_PackedProperties::Writer::AddBundleID(EFF_BundleIDs::ID inBundleID)
+{
+    if(inBundleID == EFF_BundleIDs::kNone)
+    {
+        return kEFFPackedNoString;
+    }
+
+    auto theItr = mBundleIDOffsets.find(inBundleID);
+
+    if(theItr != mBundleIDOffsets.end())
+    {
+        return theItr->second;
+    }
+
+    const char* theBundleID = EFF_BundleIDs::GetCString(inBundleID);
+    UInt32 theOffset = static_cast<UInt32>(mStrings.size());
+
+    // Including the NUL.
+    mStrings.insert(mStrings.end(), theBundleID, theBundleID + std::strlen(theBundleID) + 1);
+    mBundleIDOffsets[inBundleID] = theOffset;
+
+    return theOffset;
+}
+
+CFDataRef    EFF_PackedProperties::Writer::CopyCFData() const
+{
+    EFF_PackedPropertyHeader theHeader;
+    theHeader.selector = mSelector;
+    theHeader.numEntries = static_cast<UInt32>(mEntries.size() / mEntrySize);
+    theHeader.entrySize = mEntrySize;
+    theHeader.stringsSize = static_cast<UInt32>(mStrings.size());
+
+    std::vector<UInt8> theBytes(sizeof(theHeader) + mEntries.size() + mStrings.size());
+
+    std::memcpy(theBytes.data(), &theHeader, sizeof(theHeader));
+
+    if(!mEntries.empty())
+    {
+        std::memcpy(&theBytes[sizeof(theHeader)], mEntries.data(), mEntries.size());
+    }
+
+    if(!mStrings.empty())
+    {
+        std::memcpy(&theBytes[sizeof(theHeader) + mEntries.size()], mStrings.data(), mStrings.size());
+    }
+
+    return CFDataCreate(kCFAllocatorDefault, theBytes.data(), static_cast<CFIndex>(theBytes.size()));
+}
+
+#pragma mark Reader
+
+EFF_PackedProperties::Reader::Reader(CFTypeRef __nullable inData, UInt32 inSelector, UInt32 inMinEntrySize)
+{
+    ThrowIf(inData == nullptr || CFGetTypeID(inData) != CFDataGetTypeID(),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_PackedProperties::Reader::Reader: Packed property data was not a CFData");
+
+    CFDataRef theData = static_cast<CFDataRef>(inData);
+    const UInt8* theBytes = CFDataGetBytePtr(theData);
+    UInt64 theLength = static_cast<UInt64>(CFDataGetLength(theData));
+
+    ThrowIf(theLength < sizeof(EFF_PackedPropertyHeader),
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_PackedProperties::Reader::Reader: Packed property data too short for its header");
+
+    std::memcpy(&mHeader, theBytes, sizeof(mHeader));
+
+    ThrowIf(mHeader.selector != inSelector,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_PackedProperties::Reader::Reader: Packed property data is for a different property");
+    ThrowIf(mHeader.entrySize < inMinEntrySize,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_PackedProperties::Reader::Reader: Packed property entries too small");
+
+    // In 64 bits so a bad header can't overflow the sum.
+    UInt64 theExpectedLength = sizeof(mHeader) +
+                               static_cast<UInt64>(mHeader.numEntries) * mHeader.entrySize +
+                               mHeader.stringsSize;
+
+    ThrowIf(theLength != theExpectedLength,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_PackedProperties::Reader::Reader: Packed property data is the wrong length for its header");
+
+    mEntries = theBytes + sizeof(mHeader);
+    mStrings = reinterpret_cast<const char*>(mEntries + static_cast<size_t>(mHeader.numEntries) * mHeader.entrySize);
+
+    // With the last byte a NUL, every offset in range is the start of a terminated string.
+    ThrowIf(mHeader.stringsSize > 0 && mStrings[mHeader.stringsSize - 1] != '\0',
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_PackedProperties::Reader::Reader: Packed property strings not NUL-terminated");
+}
+
+const char* __nullable    EFF_PackedProperties::Reader::GetString(UInt32 inOffset) const
+{
+    if(inOffset == kEFFPackedNoString)
+    {
+        return nullptr;
+    }
+
+    ThrowIf(inOffset >= mHeader.stringsSize,
+            CAException(kAudioHardwareIllegalOperationError),
+            "EFF_PackedProperties::Reader::GetString: String offset out of range");
+
+    return mStrings + inOffset;
+}
+
+#pragma clang assume_nonnull end
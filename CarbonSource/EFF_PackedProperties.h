@@ -0,0 +1,121 @@
+//
+//  EFF_PackedProperties.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_PackedProperties_h
+#define EFF_PackedProperties_h
+
+// Local Includes
+#include "EFF_BundleIDs.h"
+#include "EFF_CustomProperties.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+
+// STL Includes
+#include <cstring>
+#include <map>
+#include <type_traits>
+#include <vector>
+
+// System Includes
+#include <CoreFoundation/CoreFoundation.h>
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_PackedProperties
+//
+//  Builds and reads the values of kAudioDeviceCustomPropertyPacked. See EFF_CustomProperties.h for
+//  the layout.
+//
+//  A Writer collects the entries and strings in vectors and copies them into a single CFData at the
+//  end, so building a value only makes one CF object however many entries it has. A Reader checks
+//  the layout once, when it's constructed, and then reads the entries and strings straight out of
+//  the CFData's bytes.
+//
+//  Neither is thread safe or real-time safe.
+//==================================================================================================
+
+class EFF_PackedProperties
+{
+
+public:
+    class Writer
+    {
+
+    public:
+                                Writer(UInt32 inSelector, UInt32 inEntrySize, size_t inNumEntries = 0);
+
+        template <typename T>
+        void                    AppendEntry(const T& inEntry)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "Packed entries are copied as bytes");
+            Assert(sizeof(T) == mEntrySize, "EFF_PackedProperties::Writer::AppendEntry: Wrong entry size");
+
+            size_t theOffset = mEntries.size();
+            mEntries.resize(theOffset + sizeof(T));
+            std::memcpy(&mEntries[theOffset], &inEntry, sizeof(T));
+        }
+
+        // Adds the bundle ID to the strings, if it isn't already, and returns its offset. Returns
+        // kEFFPackedNoString for EFF_BundleIDs::kNone.
+        UInt32                  AddBundleID(EFF_BundleIDs::ID inBundleID);
+
+        // The caller is responsible for releasing the returned CFData.
+        CFDataRef               CopyCFData() const;
+
+    private:
+        UInt32                  mSelector;
+        UInt32                  mEntrySize;
+        std::vector<UInt8>      mEntries;
+        std::vector<char>       mStrings;
+        std::map<EFF_BundleIDs::ID, UInt32> mBundleIDOffsets;
+
+    };
+
+    class Reader
+    {
+
+    public:
+        // Throws CAException(kAudioHardwareIllegalOperationError) if inData isn't a CFData holding
+        // a value for inSelector with entries of at least inMinEntrySize bytes. Doesn't retain
+        // inData, so it has to outlive the Reader.
+                                Reader(CFTypeRef __nullable inData, UInt32 inSelector, UInt32 inMinEntrySize);
+
+        UInt32                  GetNumEntries() const { return mHeader.numEntries; }
+
+        template <typename T>
+        T                       GetEntry(UInt32 inIndex) const
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "Packed entries are copied as bytes");
+            Assert(inIndex < mHeader.numEntries, "EFF_PackedProperties::Reader::GetEntry: Index out of range");
+            Assert(sizeof(T) <= mHeader.entrySize, "EFF_PackedProperties::Reader::GetEntry: Entry too small");
+
+            T theEntry;
+            std::memcpy(&theEntry, mEntries + static_cast<size_t>(inIndex) * mHeader.entrySize, sizeof(T));
+            return theEntry;
+        }
+
+        // Returns the string at the offset, or nullptr for kEFFPackedNoString. Throws
+        // CAException(kAudioHardwareIllegalOperationError) if the offset is out of range.
+        const char* __nullable  GetString(UInt32 inOffset) const;
+
+    private:
+        EFF_PackedPropertyHeader mHeader;
+        const UInt8*            mEntries;
+        const char*             mStrings;
+
+    };
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_PackedProperties_h */
@@ -0,0 +1,379 @@
+//
+//  EFF_PastClients.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_PastClients.h"
+
+// Local Includes
+#include "EFF_Types.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+
+// STL Includes
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// System Includes
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+EFF_PastClients::EFF_PastClients()
+:
+    mMemory(kStorageSize, 0)
+{
+    mStorage = mMemory.data();
+    Reset();
+}
+
+EFF_PastClients::~EFF_PastClients()
+{
+    Unmap();
+}
+
+void    EFF_PastClients::Open(CFStringRef inDeviceUID)
+{
+    Unmap();
+
+    mStorage = mMemory.data();
+    Reset();
+
+    // The cache directory of the user coreaudiod runs as. It's always writable, even when
+    // coreaudiod is sandboxed.
+    char theCacheDir[PATH_MAX];
+    size_t theCacheDirLength = confstr(_CS_DARWIN_USER_CACHE_DIR, theCacheDir, sizeof(theCacheDir));
+
+    char theDeviceUID[128];
+
+    if(theCacheDirLength == 0 || theCacheDirLength > sizeof(theCacheDir) ||
+       !CFStringGetCString(inDeviceUID, theDeviceUID, sizeof(theDeviceUID), kCFStringEncodingUTF8))
+    {
+        LogWarning("EFF_PastClients::Open: Couldn't get the file's path. Settings won't be saved.");
+        return;
+    }
+
+    std::string thePath = std::string(theCacheDir) + kEFFDriverBundleID "." + theDeviceUID + ".pastclients";
+
+    int theFile = open(thePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+    if(theFile == -1)
+    {
+        LogWarning("EFF_PastClients::Open: Couldn't open %s (errno %d). Settings won't be saved.",
+                   thePath.c_str(),
+                   errno);
+        return;
+    }
+
+    struct stat theFileInfo;
+    bool theFileIsNew = (fstat(theFile, &theFileInfo) != 0 ||
+                         theFileInfo.st_size != static_cast<off_t>(kStorageSize));
+
+    // Truncating to 0 first so the resized file is all zeros.
+    if(theFileIsNew && (ftruncate(theFile, 0) != 0 ||
+                        ftruncate(theFile, static_cast<off_t>(kStorageSize)) != 0))
+    {
+        LogWarning("EFF_PastClients::Open: Couldn't resize %s (errno %d). Settings won't be saved.",
+                   thePath.c_str(),
+                   errno);
+        close(theFile);
+        return;
+    }
+
+    void* theMapping = mmap(nullptr, kStorageSize, PROT_READ | PROT_WRITE, MAP_SHARED, theFile, 0);
+
+    // The mapping keeps its own reference to the file.
+    close(theFile);
+
+    if(theMapping == MAP_FAILED)
+    {
+        LogWarning("EFF_PastClients::Open: Couldn't map %s (errno %d). Settings won't be saved.",
+                   thePath.c_str(),
+                   errno);
+        return;
+    }
+
+    mStorage = static_cast<UInt8*>(theMapping);
+    mIsMapped = true;
+
+    const Header* theHeader = reinterpret_cast<const Header*>(mStorage);
+
+    if(theFileIsNew ||
+       theHeader->magic != kMagic ||
+       theHeader->version != kVersion ||
+       theHeader->numRecords != kNumRecords ||
+       theHeader->recordSize != kRecordSize)
+    {
+        DebugMsg("EFF_PastClients::Open: Initializing %s", thePath.c_str());
+        Reset();
+        msync(mStorage, kStorageSize, MS_ASYNC);
+    }
+
+    // The records are read by LoadIndex when they're first needed.
+}
+
+#pragma mark Accessors
+
+bool    EFF_PastClients::Find(EFF_Client& ioClient)
+{
+    if(ioClient.mBundleID == EFF_BundleIDs::kNone)
+    {
+        return false;
+    }
+
+    LoadIndex();
+
+    auto theItr = mIndex.find(ioClient.mBundleID);
+
+    if(theItr == mIndex.end())
+    {
+        return false;
+    }
+
+    Record& theRecord = GetRecord(theItr->second);
+    theRecord.lastUsed = ++mClock;
+
+    ioClient.mRelativeVolume = theRecord.relativeVolume;
+    ioClient.mPanPosition = theRecord.panPosition;
+
+    return true;
+}
+
+void    EFF_PastClients::Store(const EFF_Client& inClient)
+{
+    if(inClient.mBundleID == EFF_BundleIDs::kNone)
+    {
+        return;
+    }
+
+    const char* theBundleID = EFF_BundleIDs::GetCString(inClient.mBundleID);
+
+    if(std::strlen(theBundleID) >= kMaxBundleIDLength)
+    {
+        DebugMsg("EFF_PastClients::Store: Bundle ID too long to store: %s", theBundleID);
+        return;
+    }
+
+    LoadIndex();
+
+    UInt32 theIndex;
+    auto theItr = mIndex.find(inClient.mBundleID);
+
+    if(theItr != mIndex.end())
+    {
+        theIndex = theItr->second;
+    }
+    else
+    {
+        // Use an unused record if there is one, or the least recently used one otherwise.
+        theIndex = 0;
+
+        for(UInt32 i = 0; i < kNumRecords; i++)
+        {
+            if(mRecordBundleIDs[i] == EFF_BundleIDs::kNone)
+            {
+                theIndex = i;
+                break;
+            }
+            else if(GetRecord(i).lastUsed < GetRecord(theIndex).lastUsed)
+            {
+                theIndex = i;
+            }
+        }
+
+        if(mRecordBundleIDs[theIndex] != EFF_BundleIDs::kNone)
+        {
+            DebugMsg("EFF_PastClients::Store: Replacing the settings for %s",
+                     EFF_BundleIDs::GetCString(mRecordBundleIDs[theIndex]));
+            mIndex.erase(mRecordBundleIDs[theIndex]);
+        }
+
+        mIndex[inClient.mBundleID] = theIndex;
+        mRecordBundleIDs[theIndex] = inClient.mBundleID;
+    }
+
+    Record& theRecord = GetRecord(theIndex);
+
+    // Copy the whole field so the rest of it is zeroed.
+    std::strncpy(theRecord.bundleID, theBundleID, sizeof(theRecord.bundleID));
+    theRecord.relativeVolume = inClient.mRelativeVolume;
+    theRecord.panPosition = inClient.mPanPosition;
+    theRecord.processID = inClient.mProcessID;
+    // Written last, so the record is only valid once the rest of it has been written.
+    theRecord.checksum = Checksum(theRecord);
+    theRecord.lastUsed = ++mClock;
+
+    Flush(theIndex);
+}
+
+void    EFF_PastClients::ForEach(const std::function<void(const EFF_Client&)>& inFunction)
+const
+{
+    LoadIndex();
+
+    for(auto& theEntry : mIndex)
+    {
+        const Record& theRecord = GetRecord(theEntry.second);
+
+        EFF_Client theClient;
+        theClient.mClientID = 0;
+        theClient.mProcessID = theRecord.processID;
+        theClient.mBundleID = theEntry.first;
+        theClient.mRelativeVolume = theRecord.relativeVolume;
+        theClient.mPanPosition = theRecord.panPosition;
+
+        inFunction(theClient);
+    }
+}
+
+#pragma mark Implementation
+
+//static
+UInt32    EFF_PastClients::Checksum(const Record& inRecord)
+{
+    // FNV-1a over the fields before the checksum.
+    const UInt8* theBytes = reinterpret_cast<const UInt8*>(&inRecord);
+    UInt32 theChecksum = 2166136261u;
+
+    for(size_t i = 0; i < offsetof(Record, checksum); i++)
+    {
+        theChecksum = (theChecksum ^ theBytes[i]) * 16777619u;
+    }
+
+    return theChecksum;
+}
+
+EFF_PastClients::Record&    EFF_PastClients::GetRecord(UInt32 inIndex)
+const
+{
+    return reinterpret_cast<Record*>(mStorage + kRecordSize)[inIndex];
+}
+
+void    EFF_PastClients::LoadIndex()
+const
+{
+    if(mIsIndexLoaded)
+    {
+        return;
+    }
+
+    mIsIndexLoaded = true;
+    mIndex.clear();
+    mRecordBundleIDs.assign(kNumRecords, EFF_BundleIDs::kNone);
+    mClock = 0;
+
+    for(UInt32 i = 0; i < kNumRecords; i++)
+    {
+        Record& theRecord = GetRecord(i);
+
+        bool theRecordIsValid = theRecord.bundleID[0] != '\0' &&
+                                theRecord.bundleID[kMaxBundleIDLength - 1] == '\0' &&
+                                theRecord.checksum == Checksum(theRecord);
+
+        if(!theRecordIsValid)
+        {
+            if(theRecord.bundleID[0] != '\0')
+            {
+                DebugMsg("EFF_PastClients::LoadIndex: Ignoring invalid record %u", i);
+                theRecord.bundleID[0] = '\0';
+            }
+
+            continue;
+        }
+
+        CACFString theBundleIDString(CFStringCreateWithCString(kCFAllocatorDefault,
+                                                               theRecord.bundleID,
+                                                               kCFStringEncodingUTF8));
+        EFF_BundleIDs::ID theBundleID = EFF_BundleIDs::Intern(theBundleIDString);
+
+        if(theBundleID == EFF_BundleIDs::kNone)
+        {
+            theRecord.bundleID[0] = '\0';
+            continue;
+        }
+
+        // If a bundle ID somehow has two records, keep the more recent one.
+        auto theItr = mIndex.find(theBundleID);
+
+        if(theItr != mIndex.end())
+        {
+            Record& theOtherRecord = GetRecord(theItr->second);
+
+            if(theOtherRecord.lastUsed >= theRecord.lastUsed)
+            {
+                theRecord.bundleID[0] = '\0';
+                continue;
+            }
+
+            theOtherRecord.bundleID[0] = '\0';
+            mRecordBundleIDs[theItr->second] = EFF_BundleIDs::kNone;
+        }
+
+        mIndex[theBundleID] = i;
+        mRecordBundleIDs[i] = theBundleID;
+        mClock = std::max(mClock, theRecord.lastUsed);
+    }
+
+    DebugMsg("EFF_PastClients::LoadIndex: Loaded %lu past clients", mIndex.size());
+}
+
+void    EFF_PastClients::Reset()
+{
+    std::memset(mStorage, 0, kStorageSize);
+
+    Header* theHeader = reinterpret_cast<Header*>(mStorage);
+    theHeader->magic = kMagic;
+    theHeader->version = kVersion;
+    theHeader->numRecords = kNumRecords;
+    theHeader->recordSize = kRecordSize;
+
+    mIsIndexLoaded = false;
+}
+
+void    EFF_PastClients::Flush(UInt32 inIndex)
+{
+    if(!mIsMapped)
+    {
+        return;
+    }
+
+    // msync needs a page-aligned address.
+    uintptr_t thePageSize = static_cast<uintptr_t>(getpagesize());
+    uintptr_t theRecordAddress = reinterpret_cast<uintptr_t>(&GetRecord(inIndex));
+    uintptr_t thePageAddress = theRecordAddress & ~(thePageSize - 1);
+
+    if(msync(reinterpret_cast<void*>(thePageAddress),
+             theRecordAddress + kRecordSize - thePageAddress,
+             MS_ASYNC) != 0)
+    {
+        DebugMsg("EFF_PastClients::Flush: msync failed (errno %d)", errno);
+    }
+}
+
+void    EFF_PastClients::Unmap()
+{
+    if(mIsMapped)
+    {
+        msync(mStorage, kStorageSize, MS_ASYNC);
+        munmap(mStorage, kStorageSize);
+        mStorage = mMemory.data();
+        mIsMapped = false;
+    }
+}
+
+#pragma clang assume_nonnull end
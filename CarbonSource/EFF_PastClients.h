@@ -0,0 +1,149 @@
+//
+//  EFF_PastClients.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_PastClients_h
+#define EFF_PastClients_h
+
+// Local Includes
+#include "EFF_Client.h"
+#include "EFF_BundleIDs.h"
+
+// STL Includes
+#include <functional>
+#include <map>
+#include <vector>
+
+// System Includes
+#include <CoreFoundation/CoreFoundation.h>
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_PastClients
+//
+//  The settings (volume, pan) of apps that have been clients, keyed by bundle ID, so they can be
+//  given back to the app's clients if it comes back. EFF_ClientMap stores a client's settings when
+//  it's added, when a transaction changes them and when it's removed.
+//
+//  The settings are kept in a fixed number of fixed-size records, so the store never grows. When
+//  every record is in use, storing a new app's settings replaces the least recently used app's.
+//  The records are memory-mapped from a small file in coreaudiod's cache directory, one file per
+//  device, so the settings survive coreaudiod restarts without EFFApp having to send them all
+//  again. Each store writes only the one record, straight into the mapping, and the file is opened
+//  when the device is activated. Its records are only read, and their bundle IDs interned, the
+//  first time the store is used. If the file can't be opened, the records are kept in memory
+//  instead.
+//
+//  Each record has a checksum, so a record that was only partly written when coreaudiod stopped is
+//  ignored rather than giving an app the wrong settings. A file with a different layout is cleared.
+//
+//  None of the methods are real-time safe or thread safe. EFF_ClientMap only calls them with its
+//  shadow maps mutex held.
+//==================================================================================================
+
+class EFF_PastClients
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_PastClients();
+                                ~EFF_PastClients();
+                                EFF_PastClients(const EFF_PastClients&) = delete;
+                                EFF_PastClients& operator=(const EFF_PastClients&) = delete;
+
+    // Maps the store's file for the device with the given UID, creating it if it doesn't exist.
+    // Any settings stored before this is called are discarded. Logs and keeps the store in memory
+    // if the file can't be mapped.
+    void                        Open(CFStringRef inDeviceUID);
+
+#pragma mark Accessors
+
+    // If settings have been stored for the client's bundle ID, copies them into ioClient and
+    // returns true.
+    bool                        Find(EFF_Client& ioClient);
+
+    // Stores the client's settings for its bundle ID. Does nothing if the client has no bundle ID.
+    void                        Store(const EFF_Client& inClient);
+
+    // Calls inFunction with a client for each stored bundle ID, with the settings stored for it and
+    // the process ID of the last client stored for it. The clients' IDs are 0.
+    void                        ForEach(const std::function<void(const EFF_Client&)>& inFunction) const;
+
+#pragma mark Implementation
+
+private:
+    enum : UInt32
+    {
+        kMagic = 'EFpc',
+        kVersion = 1,
+        kNumRecords = 256,
+        kRecordSize = 256,
+        // Including the terminating NUL. Longer bundle IDs aren't stored.
+        kMaxBundleIDLength = kRecordSize - 24
+    };
+
+    // The header, then the records.
+    static constexpr size_t     kStorageSize = (1 + kNumRecords) * kRecordSize;
+
+    // The file starts with one of these, padded to kRecordSize bytes.
+    struct Header
+    {
+        UInt32                  magic;
+        UInt32                  version;
+        UInt32                  numRecords;
+        UInt32                  recordSize;
+    };
+
+    struct Record
+    {
+        // NUL-terminated UTF-8. Empty if the record isn't in use.
+        char                    bundleID[kMaxBundleIDLength];
+        Float32                 relativeVolume;
+        SInt32                  panPosition;
+        pid_t                   processID;
+        // Of the fields above.
+        UInt32                  checksum;
+        // The value of mClock when the record was last stored or found. Not covered by the
+        // checksum, so finding a record only writes this.
+        UInt64                  lastUsed;
+    };
+
+    static_assert(sizeof(Header) <= kRecordSize, "EFF_PastClients::Header doesn't fit in a record");
+    static_assert(sizeof(Record) == kRecordSize, "EFF_PastClients::Record should be kRecordSize bytes");
+
+    static UInt32               Checksum(const Record& inRecord);
+
+    Record&                     GetRecord(UInt32 inIndex) const;
+    // Reads the records into mIndex the first time it's called.
+    void                        LoadIndex() const;
+    // Clears the records and writes the header.
+    void                        Reset();
+    // Asks the kernel to write the record back to the file soon. Doesn't wait for it.
+    void                        Flush(UInt32 inIndex);
+    void                        Unmap();
+
+    // The header followed by the records. Either mapped from the file or in mMemory.
+    UInt8*                      mStorage = nullptr;
+    bool                        mIsMapped = false;
+    std::vector<UInt8>          mMemory;
+
+    // Filled in by LoadIndex.
+    mutable bool                mIsIndexLoaded = false;
+    mutable std::map<EFF_BundleIDs::ID, UInt32> mIndex;
+    // The interned bundle ID of each record, or EFF_BundleIDs::kNone if it isn't in use.
+    mutable std::vector<EFF_BundleIDs::ID> mRecordBundleIDs;
+    mutable UInt64              mClock = 0;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_PastClients_h */
@@ -17,6 +17,8 @@
 // Local Includes
 #include "EFF_Device.h"
 #include "EFF_NullDevice.h"
+#include "EFF_ObjectRegistry.h"
+#include "EFF_PropertyTable.h"
 
 // PublicUtility Includes
 #include "CAException.h"
@@ -25,6 +27,27 @@
 #include "CADispatchQueue.h"
 
 
+#pragma mark Property Table
+
+namespace
+{
+    constexpr EFF_PropertyInfo kPlugInPropertyList[] =
+    {
+        EFF_Property(kAudioObjectPropertyManufacturer,              sizeof(CFStringRef)),
+        EFF_Property(kAudioObjectPropertyOwnedObjects,              EFF_PropertyInfo::kComputedSize),
+        EFF_Property(kAudioPlugInPropertyDeviceList,                EFF_PropertyInfo::kComputedSize),
+        EFF_Property(kAudioPlugInPropertyTranslateUIDToDevice,      sizeof(AudioObjectID)),
+        EFF_Property(kAudioPlugInPropertyResourceBundle,            sizeof(CFStringRef)),
+        EFF_Property(kAudioObjectPropertyCustomPropertyInfoList,    EFF_PropertyInfo::kComputedSize),
+
+        EFF_CustomProperty(kAudioPlugInCustomPropertyNullDeviceActive,
+                           kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+                           EFF_PropertyInfo::kSettable)
+    };
+
+    constexpr auto kPlugInProperties = EFF_MakePropertyTable(kPlugInPropertyList);
+}
+
 #pragma mark Construction/Destruction
 
 pthread_once_t              EFF_PlugIn::sStaticInitializer = PTHREAD_ONCE_INIT;
@@ -60,10 +83,12 @@ EFF_PlugIn::EFF_PlugIn()
                0),
     mMutex("EFF_PlugIn")
 {
+    EFF_ObjectRegistry::Register(GetObjectID(), *this);
 }
 
 EFF_PlugIn::~EFF_PlugIn()
 {
+    EFF_ObjectRegistry::Unregister(GetObjectID());
 }
 
 void    EFF_PlugIn::Deactivate()
@@ -82,22 +107,14 @@ bool    EFF_PlugIn::HasProperty(AudioObjectID inObjectID,
                                 const AudioObjectPropertyAddress& inAddress)
 const
 {
-    bool theAnswer = false;
-    switch(inAddress.mSelector)
+    const EFF_PropertyInfo* theInfo = kPlugInProperties.Find(inAddress.mSelector);
+
+    if(theInfo != NULL)
     {
-        case kAudioObjectPropertyManufacturer:
-        case kAudioPlugInPropertyDeviceList:
-        case kAudioPlugInPropertyTranslateUIDToDevice:
-        case kAudioPlugInPropertyResourceBundle:
-        case kAudioObjectPropertyCustomPropertyInfoList:
-        case kAudioPlugInCustomPropertyNullDeviceActive:
-            theAnswer = true;
-            break;
-        
-        default:
-            theAnswer = EFF_Object::HasProperty(inObjectID, inClientPID, inAddress);
-    };
-    return theAnswer;
+        return kPlugInProperties.HasProperty(*theInfo, inAddress);
+    }
+
+    return EFF_Object::HasProperty(inObjectID, inClientPID, inAddress);
 }
 
 bool    EFF_PlugIn::IsPropertySettable(AudioObjectID inObjectID,
@@ -105,25 +122,14 @@ bool    EFF_PlugIn::IsPropertySettable(AudioObjectID inObjectID,
                                        const AudioObjectPropertyAddress& inAddress)
 const
 {
-    bool theAnswer = false;
-    switch(inAddress.mSelector)
+    const EFF_PropertyInfo* theInfo = kPlugInProperties.Find(inAddress.mSelector);
+
+    if(theInfo != NULL)
     {
-        case kAudioObjectPropertyManufacturer:
-        case kAudioPlugInPropertyDeviceList:
-        case kAudioPlugInPropertyTranslateUIDToDevice:
-        case kAudioPlugInPropertyResourceBundle:
-        case kAudioObjectPropertyCustomPropertyInfoList:
-            theAnswer = false;
-            break;
+        return kPlugInProperties.IsPropertySettable(*theInfo);
+    }
 
-        case kAudioPlugInCustomPropertyNullDeviceActive:
-            theAnswer = true;
-            break;
-        
-        default:
-            theAnswer = EFF_Object::IsPropertySettable(inObjectID, inClientPID, inAddress);
-    };
-    return theAnswer;
+    return EFF_Object::IsPropertySettable(inObjectID, inClientPID, inAddress);
 }
 
 UInt32    EFF_PlugIn::GetPropertyDataSize(AudioObjectID inObjectID,
@@ -133,38 +139,30 @@ UInt32    EFF_PlugIn::GetPropertyDataSize(AudioObjectID inObjectID,
                                           const void* inQualifierData)
 const
 {
-    UInt32 theAnswer = 0;
+    const EFF_PropertyInfo* theInfo = kPlugInProperties.Find(inAddress.mSelector);
+
+    if(theInfo == NULL)
+    {
+        return EFF_Object::GetPropertyDataSize(inObjectID, inClientPID, inAddress, inQualifierDataSize, inQualifierData);
+    }
+
+    UInt32 theAnswer = theInfo->dataSize;
     switch(inAddress.mSelector)
     {
-        case kAudioObjectPropertyManufacturer:
-            theAnswer = sizeof(CFStringRef);
-            break;
-            
         case kAudioObjectPropertyOwnedObjects:
         case kAudioPlugInPropertyDeviceList:
             // The plug-in owns the main EFF_Device, the instance of EFF_Device that handles UI
-            // sounds and, if it's enabled, the null device.
-            theAnswer = (EFF_NullDevice::GetInstance().IsActive() ? 3 : 2) * sizeof(AudioObjectID);
-            break;
-            
-        case kAudioPlugInPropertyTranslateUIDToDevice:
-            theAnswer = sizeof(AudioObjectID);
-            break;
-            
-        case kAudioPlugInPropertyResourceBundle:
-            theAnswer = sizeof(CFStringRef);
+            // sounds, the devices from the config file and, if it's enabled, the null device.
+            theAnswer = (2 + static_cast<UInt32>(EFF_Device::GetAdditionalInstances().size()) +
+                         (EFF_NullDevice::GetInstance().IsActive() ? 1 : 0)) * sizeof(AudioObjectID);
             break;
 
         case kAudioObjectPropertyCustomPropertyInfoList:
-            theAnswer = sizeof(AudioServerPlugInCustomPropertyInfo);
+            theAnswer = kPlugInProperties.GetNumberOfCustomProperties() * sizeof(AudioServerPlugInCustomPropertyInfo);
             break;
 
-        case kAudioPlugInCustomPropertyNullDeviceActive:
-            theAnswer = sizeof(CFBooleanRef);
-            break;
-        
         default:
-            theAnswer = EFF_Object::GetPropertyDataSize(inObjectID, inClientPID, inAddress, inQualifierDataSize, inQualifierData);
+            break;
     };
     return theAnswer;
 }
@@ -194,44 +192,33 @@ const
             // Fall through because this plug-in object only owns the devices.
         case kAudioPlugInPropertyDeviceList:
             {
+                // Return as many of the devices as fit, in the order GetPropertyDataSize counts them.
                 AudioObjectID* theReturnedDeviceList = reinterpret_cast<AudioObjectID*>(outData);
-                if(inDataSize >= 3 * sizeof(AudioObjectID))
-                {
-                    if(EFF_NullDevice::GetInstance().IsActive())
+                UInt32 theMaxItems = inDataSize / sizeof(AudioObjectID);
+                UInt32 theNumItems = 0;
+
+                auto theAddDevice = [&](AudioObjectID inDeviceID) {
+                    if(theNumItems < theMaxItems)
                     {
-                        theReturnedDeviceList[0] = kObjectID_Device;
-                        theReturnedDeviceList[1] = kObjectID_Device_UI_Sounds;
-                        theReturnedDeviceList[2] = kObjectID_Device_Null;
-                        
-                        // say how much we returned
-                        outDataSize = 3 * sizeof(AudioObjectID);
+                        theReturnedDeviceList[theNumItems++] = inDeviceID;
                     }
-                    else
-                    {
-                        theReturnedDeviceList[0] = kObjectID_Device;
-                        theReturnedDeviceList[1] = kObjectID_Device_UI_Sounds;
+                };
 
-                        // say how much we returned
-                        outDataSize = 2 * sizeof(AudioObjectID);
-                    }
-                }
-                else if(inDataSize >= 2 * sizeof(AudioObjectID))
-                {
-                    theReturnedDeviceList[0] = kObjectID_Device;
-                    theReturnedDeviceList[1] = kObjectID_Device_UI_Sounds;
+                theAddDevice(kObjectID_Device);
+                theAddDevice(kObjectID_Device_UI_Sounds);
 
-                    // say how much we returned
-                    outDataSize = 2 * sizeof(AudioObjectID);
-                }
-                else if(inDataSize >= sizeof(AudioObjectID))
+                for(EFF_Device* theDevice : EFF_Device::GetAdditionalInstances())
                 {
-                    theReturnedDeviceList[0] = kObjectID_Device;
-                    outDataSize = sizeof(AudioObjectID);
+                    theAddDevice(theDevice->GetObjectID());
                 }
-                else
+
+                if(EFF_NullDevice::GetInstance().IsActive())
                 {
-                    outDataSize = 0;
+                    theAddDevice(kObjectID_Device_Null);
                 }
+
+                // say how much we returned
+                outDataSize = theNumItems * sizeof(AudioObjectID);
             }
             break;
             
@@ -250,6 +237,18 @@ const
                 CFStringRef theUID = *reinterpret_cast<const CFStringRef*>(inQualifierData);
                 AudioObjectID* outID = reinterpret_cast<AudioObjectID*>(outData);
 
+                // The devices from the config file, or kAudioObjectUnknown if none of them has the UID.
+                AudioObjectID theAdditionalDeviceID = kAudioObjectUnknown;
+
+                for(EFF_Device* theDevice : EFF_Device::GetAdditionalInstances())
+                {
+                    if(CFEqual(theUID, theDevice->CopyDeviceUID()))
+                    {
+                        theAdditionalDeviceID = theDevice->GetObjectID();
+                        break;
+                    }
+                }
+
                 if(CFEqual(theUID, EFF_Device::GetInstance().CopyDeviceUID()))
                 {
                     DebugMsg("EFF_PlugIn::GetPropertyData: Returning EFFDevice for "
@@ -262,6 +261,12 @@ const
                              "kAudioPlugInPropertyTranslateUIDToDevice");
                     *outID = kObjectID_Device_UI_Sounds;
                 }
+                else if(theAdditionalDeviceID != kAudioObjectUnknown)
+                {
+                    DebugMsg("EFF_PlugIn::GetPropertyData: Returning device %u for "
+                             "kAudioPlugInPropertyTranslateUIDToDevice", theAdditionalDeviceID);
+                    *outID = theAdditionalDeviceID;
+                }
                 else if(EFF_NullDevice::GetInstance().IsActive() &&
                         CFEqual(theUID, EFF_NullDevice::GetInstance().CopyDeviceUID()))
                 {
@@ -292,24 +297,7 @@ const
             break;
 
         case kAudioObjectPropertyCustomPropertyInfoList:
-            if(inDataSize >= sizeof(AudioServerPlugInCustomPropertyInfo))
-            {
-                AudioServerPlugInCustomPropertyInfo* outCustomProperties =
-                    reinterpret_cast<AudioServerPlugInCustomPropertyInfo*>(outData);
-
-                outCustomProperties[0].mSelector =
-                    kAudioPlugInCustomPropertyNullDeviceActive;
-                outCustomProperties[0].mPropertyDataType =
-                    kAudioServerPlugInCustomPropertyDataTypeCFPropertyList;
-                outCustomProperties[0].mQualifierDataType =
-                    kAudioServerPlugInCustomPropertyDataTypeNone;
-
-                outDataSize = sizeof(AudioServerPlugInCustomPropertyInfo);
-            }
-            else
-            {
-                outDataSize = 0;
-            }
+            outDataSize = kPlugInProperties.CopyCustomPropertyInfoList(inDataSize, outData);
             break;
 
         case kAudioPlugInCustomPropertyNullDeviceActive:
@@ -19,6 +19,8 @@
 #include "EFF_PlugIn.h"
 #include "EFF_Device.h"
 #include "EFF_NullDevice.h"
+#include "EFF_ObjectRegistry.h"
+#include "EFF_PropertyCache.h"
 
 
 #pragma mark COM Prototypes
@@ -159,54 +161,6 @@ static AudioServerPlugInDriverInterface*    gAudioServerPlugInDriverInterfacePtr
 static AudioServerPlugInDriverRef           gAudioServerPlugInDriverRef             = &gAudioServerPlugInDriverInterfacePtr;
 static UInt32                               gAudioServerPlugInDriverRefCount        = 1;
 
-static EFF_Object& EFF_LookUpOwnerObject(AudioObjectID inObjectID)
-{
-    switch(inObjectID)
-    {
-        case kObjectID_PlugIn:
-            return EFF_PlugIn::GetInstance();
-            
-        case kObjectID_Device:
-        case kObjectID_Stream_Input:
-        case kObjectID_Stream_Output:
-        case kObjectID_Volume_Output_Master:
-        case kObjectID_Mute_Output_Master:
-            return EFF_Device::GetInstance();
-
-        case kObjectID_Device_UI_Sounds:
-        case kObjectID_Stream_Input_UI_Sounds:
-        case kObjectID_Stream_Output_UI_Sounds:
-        case kObjectID_Volume_Output_Master_UI_Sounds:
-            return EFF_Device::GetUISoundsInstance();
-
-        case kObjectID_Device_Null:
-        case kObjectID_Stream_Null:
-            return EFF_NullDevice::GetInstance();
-    }
-    
-    DebugMsg("EFF_LookUpOwnerObject: unknown object");
-    Throw(CAException(kAudioHardwareBadObjectError));
-}
-
-static EFF_AbstractDevice& EFF_LookUpDevice(AudioObjectID inObjectID)
-{
-    switch(inObjectID)
-    {
-        case kObjectID_Device:
-            return EFF_Device::GetInstance();
-
-        case kObjectID_Device_UI_Sounds:
-            return EFF_Device::GetUISoundsInstance();
-
-        case kObjectID_Device_Null:
-            return EFF_NullDevice::GetInstance();
-    }
-
-    DebugMsg("EFF_LookUpDevice: unknown device");
-    Throw(CAException(kAudioHardwareBadDeviceError));
-}
-
-
 #pragma mark Factory
 
 extern "C"
@@ -427,14 +381,9 @@ static OSStatus    EFF_AddDeviceClient(AudioServerPlugInDriverRef inDriver,
         ThrowIf(inDriver != gAudioServerPlugInDriverRef,
                 CAException(kAudioHardwareBadObjectError),
                 "EFF_AddDeviceClient: bad driver reference");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadObjectError),
-                "EFF_AddDeviceClient: unknown device");
         
         // Inform the device.
-        EFF_LookUpDevice(inDeviceObjectID).AddClient(inClientInfo);
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).AddClient(inClientInfo);
     }
     catch(const CAException& inException)
     {
@@ -467,14 +416,9 @@ static OSStatus    EFF_RemoveDeviceClient(AudioServerPlugInDriverRef inDriver,
         ThrowIf(inDriver != gAudioServerPlugInDriverRef,
                 CAException(kAudioHardwareBadObjectError),
                 "EFF_RemoveDeviceClient: bad driver reference");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadObjectError),
-                "EFF_RemoveDeviceClient: unknown device");
 
         // Inform the device.
-        EFF_LookUpDevice(inDeviceObjectID).RemoveClient(inClientInfo);
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).RemoveClient(inClientInfo);
     }
     catch(const CAException& inException)
     {
@@ -515,14 +459,13 @@ static OSStatus    EFF_PerformDeviceConfigurationChange(AudioServerPlugInDriverR
         ThrowIf(inDriver != gAudioServerPlugInDriverRef,
                 CAException(kAudioHardwareBadObjectError),
                 "EFF_PerformDeviceConfigurationChange: bad driver reference");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_PerformDeviceConfigurationChange: unknown device");
 
         // tell the device to do the work
-        EFF_LookUpDevice(inDeviceObjectID).PerformConfigChange(inChangeAction, inChangeInfo);
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).PerformConfigChange(inChangeAction, inChangeInfo);
+
+        // the change can change the values of properties that are otherwise immutable, e.g. the
+        // streams' formats, so stop answering from the values cached before it
+        EFF_PropertyCache::Invalidate();
     }
     catch(const CAException& inException)
     {
@@ -552,14 +495,9 @@ static OSStatus    EFF_AbortDeviceConfigurationChange(AudioServerPlugInDriverRef
         ThrowIf(inDriver != gAudioServerPlugInDriverRef,
                 CAException(kAudioHardwareBadObjectError),
                 "EFF_PerformDeviceConfigurationChange: bad driver reference");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_PerformDeviceConfigurationChange: unknown device");
 
         //    tell the device to do the work
-        EFF_LookUpDevice(inDeviceObjectID).AbortConfigChange(inChangeAction, inChangeInfo);
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).AbortConfigChange(inChangeAction, inChangeInfo);
     }
     catch(const CAException& inException)
     {
@@ -595,7 +533,7 @@ static Boolean    EFF_HasProperty(AudioServerPlugInDriverRef inDriver,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_HasProperty: no address");
 
-        theAnswer = EFF_LookUpOwnerObject(inObjectID).HasProperty(inObjectID, inClientProcessID, *inAddress);
+        theAnswer = EFF_ObjectRegistry::LookUpOwnerObject(inObjectID).HasProperty(inObjectID, inClientProcessID, *inAddress);
     }
     catch(const CAException& inException)
     {
@@ -636,7 +574,7 @@ static OSStatus    EFF_IsPropertySettable(AudioServerPlugInDriverRef inDriver,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_IsPropertySettable: no place to put the return value");
 
-        EFF_Object& theAudioObject = EFF_LookUpOwnerObject(inObjectID);
+        EFF_Object& theAudioObject = EFF_ObjectRegistry::LookUpOwnerObject(inObjectID);
         if(theAudioObject.HasProperty(inObjectID, inClientProcessID, *inAddress))
         {
             *outIsSettable = theAudioObject.IsPropertySettable(inObjectID, inClientProcessID, *inAddress);
@@ -686,7 +624,7 @@ static OSStatus    EFF_GetPropertyDataSize(AudioServerPlugInDriverRef inDriver,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_GetPropertyDataSize: no place to put the return value");
 
-        EFF_Object& theAudioObject = EFF_LookUpOwnerObject(inObjectID);
+        EFF_Object& theAudioObject = EFF_ObjectRegistry::LookUpOwnerObject(inObjectID);
         if(theAudioObject.HasProperty(inObjectID, inClientProcessID, *inAddress))
         {
             *outDataSize = theAudioObject.GetPropertyDataSize(inObjectID,
@@ -745,7 +683,16 @@ static OSStatus    EFF_GetPropertyData(AudioServerPlugInDriverRef inDriver,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_GetPropertyData: no place to put the return value");
 
-        EFF_Object& theAudioObject = EFF_LookUpOwnerObject(inObjectID);
+        //    answer the requests for properties that don't change from the cache
+        if(EFF_PropertyCache::Get(inObjectID, *inAddress, inQualifierDataSize, inDataSize, *outDataSize, outData))
+        {
+            return theAnswer;
+        }
+
+        //    read the generation first so a value read before an invalidation isn't cached
+        UInt64 theCacheGeneration = EFF_PropertyCache::GetGeneration();
+
+        EFF_Object& theAudioObject = EFF_ObjectRegistry::LookUpOwnerObject(inObjectID);
         if(theAudioObject.HasProperty(inObjectID, inClientProcessID, *inAddress))
         {
             theAudioObject.GetPropertyData(inObjectID,
@@ -756,6 +703,13 @@ static OSStatus    EFF_GetPropertyData(AudioServerPlugInDriverRef inDriver,
                                            inDataSize,
                                            *outDataSize,
                                            outData);
+
+            EFF_PropertyCache::Store(inObjectID,
+                                     *inAddress,
+                                     inQualifierDataSize,
+                                     *outDataSize,
+                                     outData,
+                                     theCacheGeneration);
         }
         else
         {
@@ -803,7 +757,7 @@ static OSStatus    EFF_SetPropertyData(AudioServerPlugInDriverRef inDriver,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_SetPropertyData: no data");
 
-        EFF_Object& theAudioObject = EFF_LookUpOwnerObject(inObjectID);
+        EFF_Object& theAudioObject = EFF_ObjectRegistry::LookUpOwnerObject(inObjectID);
         if(theAudioObject.HasProperty(inObjectID, inClientProcessID, *inAddress))
         {
             if(theAudioObject.IsPropertySettable(inObjectID, inClientProcessID, *inAddress))
@@ -862,14 +816,9 @@ static OSStatus    EFF_StartIO(AudioServerPlugInDriverRef inDriver,
         ThrowIf(inDriver != gAudioServerPlugInDriverRef,
                 CAException(kAudioHardwareBadObjectError),
                 "EFF_StartIO: bad driver reference");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_StartIO: unknown device");
 
         // tell the device to do the work
-        EFF_LookUpDevice(inDeviceObjectID).StartIO(inClientID);
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).StartIO(inClientID);
     }
     catch(const CAException& inException)
     {
@@ -898,14 +847,9 @@ static OSStatus    EFF_StopIO(AudioServerPlugInDriverRef inDriver,
         ThrowIf(inDriver != gAudioServerPlugInDriverRef,
                 CAException(kAudioHardwareBadObjectError),
                 "EFF_StopIO: bad driver reference");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_StopIO: unknown device");
         
         // tell the device to do the work
-        EFF_LookUpDevice(inDeviceObjectID).StopIO(inClientID);
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).StopIO(inClientID);
     }
     catch(const CAException& inException)
     {
@@ -950,14 +894,9 @@ static OSStatus    EFF_GetZeroTimeStamp(AudioServerPlugInDriverRef inDriver,
         ThrowIfNULL(outSeed,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_GetZeroTimeStamp: no place to put the seed");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_GetZeroTimeStamp: unknown device");
 
         // tell the device to do the work
-        EFF_LookUpDevice(inDeviceObjectID).GetZeroTimeStamp(*outSampleTime, *outHostTime, *outSeed);
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).GetZeroTimeStamp(*outSampleTime, *outHostTime, *outSeed);
     }
     catch(const CAException& inException)
     {
@@ -995,16 +934,11 @@ static OSStatus    EFF_WillDoIOOperation(AudioServerPlugInDriverRef inDriver,
         ThrowIfNULL(outWillDoInPlace,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_WillDoIOOperation: no place to put the in-place return value");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_WillDoIOOperation: unknown device");
 
         // tell the device to do the work
         bool willDo = false;
         bool willDoInPlace = false;
-        EFF_LookUpDevice(inDeviceObjectID).WillDoIOOperation(inOperationID, willDo, willDoInPlace);
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).WillDoIOOperation(inOperationID, willDo, willDoInPlace);
         
         // set the return values
         *outWillDo = willDo;
@@ -1042,14 +976,9 @@ static OSStatus    EFF_BeginIOOperation(AudioServerPlugInDriverRef inDriver,
         ThrowIfNULL(inIOCycleInfo,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_BeginIOOperation: no cycle info");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_BeginIOOperation: unknown device");
 
         // tell the device to do the work
-        EFF_LookUpDevice(inDeviceObjectID).BeginIOOperation(inOperationID,
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).BeginIOOperation(inOperationID,
                                                             inIOBufferFrameSize,
                                                             *inIOCycleInfo,
                                                             inClientID);
@@ -1092,14 +1021,9 @@ static OSStatus    EFF_DoIOOperation(AudioServerPlugInDriverRef inDriver,
         ThrowIfNULL(inIOCycleInfo,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_EndIOOperation: no cycle info");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_EndIOOperation: unknown device");
 
         // Tell the device to do the work
-        EFF_LookUpDevice(inDeviceObjectID).DoIOOperation(inStreamObjectID,
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).DoIOOperation(inStreamObjectID,
                                                          inClientID,
                                                          inOperationID,
                                                          inIOBufferFrameSize,
@@ -1142,14 +1066,9 @@ static OSStatus    EFF_EndIOOperation(AudioServerPlugInDriverRef inDriver,
         ThrowIfNULL(inIOCycleInfo,
                     CAException(kAudioHardwareIllegalOperationError),
                     "EFF_EndIOOperation: no cycle info");
-        ThrowIf(inDeviceObjectID != kObjectID_Device &&
-                inDeviceObjectID != kObjectID_Device_UI_Sounds &&
-                inDeviceObjectID != kObjectID_Device_Null,
-                CAException(kAudioHardwareBadDeviceError),
-                "EFF_EndIOOperation: unknown device");
 
         // tell the device to do the work
-        EFF_LookUpDevice(inDeviceObjectID).EndIOOperation(inOperationID,
+        EFF_ObjectRegistry::LookUpDevice(inDeviceObjectID).EndIOOperation(inOperationID,
                                                           inIOBufferFrameSize,
                                                           *inIOCycleInfo,
                                                           inClientID);
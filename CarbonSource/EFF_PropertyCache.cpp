@@ -0,0 +1,207 @@
+//
+//  EFF_PropertyCache.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_PropertyCache.h"
+
+// Local Includes
+#include "EFF_ObjectRegistry.h"
+#include "EFF_PropertyTable.h"
+
+// STL Includes
+#include <atomic>
+#include <cstring>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Cached Properties
+
+namespace
+{
+    // The properties whose values are cached and their sizes. Values of any other size aren't
+    // cached, so a property that's truncated to fit the caller's buffer never is.
+    constexpr EFF_PropertyInfo kCacheablePropertyList[] =
+    {
+        EFF_Property(kAudioObjectPropertyClass,                     sizeof(AudioClassID)),
+        EFF_Property(kAudioObjectPropertyBaseClass,                 sizeof(AudioClassID)),
+        EFF_Property(kAudioObjectPropertyOwner,                     sizeof(AudioObjectID)),
+        EFF_Property(kAudioObjectPropertyName,                      sizeof(CFStringRef)),
+        EFF_Property(kAudioObjectPropertyManufacturer,              sizeof(CFStringRef)),
+        EFF_Property(kAudioDevicePropertyDeviceUID,                 sizeof(CFStringRef)),
+        EFF_Property(kAudioDevicePropertyModelUID,                  sizeof(CFStringRef)),
+        EFF_Property(kAudioDevicePropertyTransportType,             sizeof(UInt32)),
+        EFF_Property(kAudioStreamPropertyDirection,                 sizeof(UInt32)),
+        EFF_Property(kAudioStreamPropertyTerminalType,              sizeof(UInt32)),
+        EFF_Property(kAudioStreamPropertyStartingChannel,           sizeof(UInt32)),
+        // The formats only change with the sample rate, which changes in a configuration change.
+        EFF_Property(kAudioStreamPropertyVirtualFormat,             sizeof(AudioStreamBasicDescription)),
+        EFF_Property(kAudioStreamPropertyPhysicalFormat,            sizeof(AudioStreamBasicDescription)),
+        EFF_Property(kAudioStreamPropertyAvailableVirtualFormats,   sizeof(AudioStreamRangedDescription)),
+        EFF_Property(kAudioStreamPropertyAvailablePhysicalFormats,  sizeof(AudioStreamRangedDescription)),
+        EFF_Property(kAudioControlPropertyScope,                    sizeof(AudioObjectPropertyScope)),
+        EFF_Property(kAudioControlPropertyElement,                  sizeof(AudioObjectPropertyElement))
+    };
+
+    constexpr auto kCacheableProperties = EFF_MakePropertyTable(kCacheablePropertyList);
+
+    constexpr size_t kMaxDataWords = (sizeof(AudioStreamRangedDescription) + sizeof(UInt64) - 1) / sizeof(UInt64);
+
+    // A seqlock, so the value can be read without locking while another thread might be storing
+    // it. The fields are atomics only so the racing reads are defined; they're all accessed relaxed
+    // and ordered by the fences around sequence.
+    struct Entry
+    {
+        // Odd while a value is being stored.
+        std::atomic<UInt32>     sequence;
+        std::atomic<UInt32>     dataSize;
+        // 0, which is never a generation, until the first value is stored.
+        std::atomic<UInt64>     generation;
+        std::atomic<UInt64>     data[kMaxDataWords];
+    };
+
+    // Zero-initialised, since they have static storage duration.
+    Entry                   sEntries[EFF_ObjectRegistry::kMaxObjectIDs][kCacheableProperties.GetNumberOfProperties()];
+    std::atomic<UInt64>     sGeneration { 1 };
+
+    // Returns the property's cache entry, or nullptr if its values aren't cached.
+    Entry* __nullable    FindEntry(AudioObjectID inObjectID,
+                                   const AudioObjectPropertyAddress& inAddress,
+                                   UInt32 inQualifierDataSize,
+                                   UInt32& outMaxDataSize)
+    {
+        if(inObjectID >= EFF_ObjectRegistry::kMaxObjectIDs ||
+           inQualifierDataSize != 0 ||
+           inAddress.mScope != kAudioObjectPropertyScopeGlobal ||
+           inAddress.mElement != kAudioObjectPropertyElementMaster)
+        {
+            return nullptr;
+        }
+
+        const EFF_PropertyInfo* theInfo = kCacheableProperties.Find(inAddress.mSelector);
+
+        if(theInfo == nullptr)
+        {
+            return nullptr;
+        }
+
+        outMaxDataSize = theInfo->dataSize;
+        return &sEntries[inObjectID][kCacheableProperties.GetIndex(*theInfo)];
+    }
+}
+
+#pragma mark Cache Operations
+
+bool    EFF_PropertyCache::Get(AudioObjectID inObjectID,
+                               const AudioObjectPropertyAddress& inAddress,
+                               UInt32 inQualifierDataSize,
+                               UInt32 inDataSize,
+                               UInt32& outDataSize,
+                               void* outData)
+{
+    UInt32 theMaxDataSize = 0;
+    Entry* theEntry = FindEntry(inObjectID, inAddress, inQualifierDataSize, theMaxDataSize);
+
+    if(theEntry == nullptr)
+    {
+        return false;
+    }
+
+    UInt32 theSequence = theEntry->sequence.load(std::memory_order_acquire);
+
+    if(theSequence & 1)
+    {
+        // Being stored.
+        return false;
+    }
+
+    UInt64 theGeneration = theEntry->generation.load(std::memory_order_relaxed);
+    UInt32 theDataSize = theEntry->dataSize.load(std::memory_order_relaxed);
+    UInt64 theData[kMaxDataWords];
+
+    for(size_t i = 0; i < kMaxDataWords; i++)
+    {
+        theData[i] = theEntry->data[i].load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if(theEntry->sequence.load(std::memory_order_relaxed) != theSequence ||
+       theGeneration != sGeneration.load(std::memory_order_acquire) ||
+       theDataSize == 0 ||
+       theDataSize > theMaxDataSize ||
+       theDataSize > inDataSize)
+    {
+        // Stale, torn by a store or too big for the caller's buffer. The property's object will
+        // handle the request, including throwing if the buffer is too small.
+        return false;
+    }
+
+    std::memcpy(outData, theData, theDataSize);
+    outDataSize = theDataSize;
+
+    return true;
+}
+
+UInt64    EFF_PropertyCache::GetGeneration()
+{
+    return sGeneration.load(std::memory_order_acquire);
+}
+
+void    EFF_PropertyCache::Store(AudioObjectID inObjectID,
+                                 const AudioObjectPropertyAddress& inAddress,
+                                 UInt32 inQualifierDataSize,
+                                 UInt32 inDataSize,
+                                 const void* inData,
+                                 UInt64 inGeneration)
+{
+    UInt32 theMaxDataSize = 0;
+    Entry* theEntry = FindEntry(inObjectID, inAddress, inQualifierDataSize, theMaxDataSize);
+
+    if(theEntry == nullptr ||
+       inDataSize != theMaxDataSize ||
+       inGeneration != sGeneration.load(std::memory_order_acquire) ||
+       theEntry->generation.load(std::memory_order_relaxed) == inGeneration)
+    {
+        // Not cacheable, possibly out of date or already cached.
+        return;
+    }
+
+    UInt32 theSequence = theEntry->sequence.load(std::memory_order_relaxed);
+
+    if((theSequence & 1) ||
+       !theEntry->sequence.compare_exchange_strong(theSequence,
+                                                   theSequence + 1,
+                                                   std::memory_order_relaxed))
+    {
+        // Another thread is storing it.
+        return;
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    UInt64 theData[kMaxDataWords] = {};
+    std::memcpy(theData, inData, inDataSize);
+
+    theEntry->generation.store(inGeneration, std::memory_order_relaxed);
+    theEntry->dataSize.store(inDataSize, std::memory_order_relaxed);
+
+    for(size_t i = 0; i < kMaxDataWords; i++)
+    {
+        theEntry->data[i].store(theData[i], std::memory_order_relaxed);
+    }
+
+    theEntry->sequence.store(theSequence + 2, std::memory_order_release);
+}
+
+void    EFF_PropertyCache::Invalidate()
+{
+    sGeneration.fetch_add(1, std::memory_order_acq_rel);
+}
+
+#pragma clang assume_nonnull end
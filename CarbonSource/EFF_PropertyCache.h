@@ -0,0 +1,69 @@
+//
+//  EFF_PropertyCache.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_PropertyCache_h
+#define EFF_PropertyCache_h
+
+// System Includes
+#include <CoreAudio/AudioServerPlugIn.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_PropertyCache
+//
+//  Keeps copies of the values of the properties that never change while the driver's objects keep
+//  their configuration, e.g. their classes, owners, names, UIDs and stream formats, so
+//  EFF_GetPropertyData can answer the bursts of requests for them the HAL makes when clients attach
+//  with a copy instead of going through the objects' property dispatch.
+//
+//  Only fixed-size values of properties in the global scope and master element, without
+//  qualifiers, are cached. Values are copied as bytes, which works for the CFString properties
+//  because the objects return CFStrings they keep for their whole lifetimes without retaining them.
+//
+//  Each cached value is tagged with the cache's generation when it was read from its object.
+//  Invalidate starts a new generation, which makes every cached value stale, and values read before
+//  it can't be stored after it. The driver calls it after each configuration change and whenever an
+//  object ID is registered or unregistered.
+//
+//  Get, Store and Invalidate are thread safe, lock-free and real-time safe. Writers that race to
+//  store the same value just skip storing it.
+//==================================================================================================
+
+class EFF_PropertyCache
+{
+
+public:
+    // Copies the property's cached value into outData and returns true, or returns false if it isn't
+    // cached or doesn't fit in inDataSize bytes.
+    static bool                 Get(AudioObjectID inObjectID,
+                                    const AudioObjectPropertyAddress& inAddress,
+                                    UInt32 inQualifierDataSize,
+                                    UInt32 inDataSize,
+                                    UInt32& outDataSize,
+                                    void* outData);
+
+    // Read this before getting the property's value from its object, and pass it to Store.
+    static UInt64               GetGeneration();
+
+    // Caches the value the property's object returned, if it's a property that can be cached.
+    static void                 Store(AudioObjectID inObjectID,
+                                      const AudioObjectPropertyAddress& inAddress,
+                                      UInt32 inQualifierDataSize,
+                                      UInt32 inDataSize,
+                                      const void* inData,
+                                      UInt64 inGeneration);
+
+    static void                 Invalidate();
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_PropertyCache_h */
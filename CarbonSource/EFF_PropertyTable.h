@@ -0,0 +1,266 @@
+//
+//  EFF_PropertyTable.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_PropertyTable_h
+#define EFF_PropertyTable_h
+
+// STL Includes
+#include <array>
+#include <cstddef>
+
+// System Includes
+#include <CoreAudio/AudioServerPlugIn.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_PropertyInfo
+//
+//  What an object's HasProperty, IsPropertySettable and GetPropertyDataSize say about one of its
+//  properties, and, for custom properties, its entry in kAudioObjectPropertyCustomPropertyInfoList.
+//  Use the functions below to make them.
+//==================================================================================================
+
+struct EFF_PropertyInfo
+{
+    enum : UInt32
+    {
+        kSettable           = (1u << 0),
+        // The object only has the property in the input and output scopes.
+        kInputOutputOnly    = (1u << 1),
+        kCustom             = (1u << 2)
+    };
+
+    // The size of the property's data when it depends on the object's state, so the object works it
+    // out in GetPropertyDataSize instead.
+    static constexpr UInt32 kComputedSize = 0;
+
+    AudioObjectPropertySelector             selector;
+    UInt32                                  flags;
+    UInt32                                  dataSize;
+    AudioServerPlugInCustomPropertyDataType dataType;
+    AudioServerPlugInCustomPropertyDataType qualifierDataType;
+};
+
+constexpr EFF_PropertyInfo    EFF_Property(AudioObjectPropertySelector inSelector,
+                                           UInt32 inDataSize,
+                                           UInt32 inFlags = 0)
+{
+    return { inSelector,
+             inFlags,
+             inDataSize,
+             kAudioServerPlugInCustomPropertyDataTypeNone,
+             kAudioServerPlugInCustomPropertyDataTypeNone };
+}
+
+// Custom properties' data is always a CF object, so their data sizes are the size of a pointer.
+constexpr EFF_PropertyInfo    EFF_CustomProperty(AudioObjectPropertySelector inSelector,
+                                                 AudioServerPlugInCustomPropertyDataType inDataType,
+                                                 UInt32 inFlags = 0,
+                                                 AudioServerPlugInCustomPropertyDataType inQualifierDataType =
+                                                     kAudioServerPlugInCustomPropertyDataTypeNone)
+{
+    return { inSelector,
+             inFlags | EFF_PropertyInfo::kCustom,
+             sizeof(CFTypeRef),
+             inDataType,
+             inQualifierDataType };
+}
+
+//==================================================================================================
+//    EFF_PropertyTable
+//
+//  A class's properties, so the answers its HasProperty, IsPropertySettable and GetPropertyDataSize
+//  give for each property come from one list and can't disagree. GetPropertyData and
+//  SetPropertyData still switch on the selector.
+//
+//  The tables are built at compile time. Find looks selectors up with a perfect hash, also found at
+//  compile time: a multiplier for which (selector * multiplier) >> shift puts every selector in the
+//  table in a different slot. So a lookup is a multiply, a shift and one comparison, however many
+//  properties the class has. A table with duplicate selectors fails to compile.
+//
+//  Declare a table with EFF_MakePropertyTable, e.g.
+//
+//      constexpr EFF_PropertyInfo kPropertyList[] = { EFF_Property(...), ... };
+//      constexpr auto kProperties = EFF_MakePropertyTable(kPropertyList);
+//
+//  All of the methods are real-time safe.
+//==================================================================================================
+
+// The number of bits a table of inNumProperties properties hashes selectors to, for at least four
+// slots per property.
+constexpr UInt32    EFF_PropertyTableSlotBits(size_t inNumProperties)
+{
+    UInt32 theBits = 1;
+
+    while((size_t(1) << theBits) < 4 * inNumProperties)
+    {
+        theBits++;
+    }
+
+    return theBits;
+}
+
+template <size_t N>
+class EFF_PropertyTable
+{
+
+public:
+    constexpr                   EFF_PropertyTable(const EFF_PropertyInfo (&inProperties)[N])
+    :
+        mProperties(),
+        mSlots(),
+        mMultiplier(0)
+    {
+        for(size_t i = 0; i < N; i++)
+        {
+            mProperties[i] = inProperties[i];
+
+            for(size_t j = 0; j < i; j++)
+            {
+                if(inProperties[i].selector == inProperties[j].selector)
+                {
+                    // Not a constant expression, so a duplicate is a compile error.
+                    throw "EFF_PropertyTable: duplicate selector";
+                }
+            }
+        }
+
+        // Try odd multipliers until one gives every selector its own slot. With at least four
+        // slots per property, one is almost always found within a few tries.
+        for(UInt32 theMultiplier = 2654435769u; ; theMultiplier += 2)
+        {
+            if(TryMultiplier(theMultiplier))
+            {
+                mMultiplier = theMultiplier;
+                break;
+            }
+        }
+    }
+
+    // Returns the property's info, or nullptr if it isn't in the table.
+    constexpr const EFF_PropertyInfo* __nullable Find(AudioObjectPropertySelector inSelector) const
+    {
+        UInt8 theIndex = mSlots[Slot(inSelector, mMultiplier)];
+        return (theIndex != 0 && mProperties[theIndex - 1].selector == inSelector) ?
+                &mProperties[theIndex - 1] : nullptr;
+    }
+
+    // The position of the property in the table, given the info Find returned, so callers can keep
+    // per-property data in arrays of GetNumberOfProperties() elements.
+    constexpr size_t            GetIndex(const EFF_PropertyInfo& inInfo) const
+    {
+        return static_cast<size_t>(&inInfo - mProperties.data());
+    }
+
+    static constexpr size_t     GetNumberOfProperties() { return N; }
+
+    // For HasProperty, given the info Find returned.
+    static bool                 HasProperty(const EFF_PropertyInfo& inInfo,
+                                            const AudioObjectPropertyAddress& inAddress)
+    {
+        return !(inInfo.flags & EFF_PropertyInfo::kInputOutputOnly) ||
+               (inAddress.mScope == kAudioObjectPropertyScopeInput) ||
+               (inAddress.mScope == kAudioObjectPropertyScopeOutput);
+    }
+
+    static bool                 IsPropertySettable(const EFF_PropertyInfo& inInfo)
+    {
+        return (inInfo.flags & EFF_PropertyInfo::kSettable) != 0;
+    }
+
+#pragma mark Custom Properties
+
+    constexpr UInt32            GetNumberOfCustomProperties() const
+    {
+        UInt32 theNumber = 0;
+
+        for(const EFF_PropertyInfo& theInfo : mProperties)
+        {
+            theNumber += (theInfo.flags & EFF_PropertyInfo::kCustom) ? 1 : 0;
+        }
+
+        return theNumber;
+    }
+
+    // Copies the value of kAudioObjectPropertyCustomPropertyInfoList into outData, in the order
+    // the custom properties are in the table, and returns its size. Copies as many of them as fit
+    // in inDataSize bytes.
+    UInt32                      CopyCustomPropertyInfoList(UInt32 inDataSize, void* outData) const
+    {
+        AudioServerPlugInCustomPropertyInfo* theInfoList =
+            reinterpret_cast<AudioServerPlugInCustomPropertyInfo*>(outData);
+        UInt32 theMaxItems = inDataSize / sizeof(AudioServerPlugInCustomPropertyInfo);
+        UInt32 theNumItems = 0;
+
+        for(const EFF_PropertyInfo& theInfo : mProperties)
+        {
+            if((theInfo.flags & EFF_PropertyInfo::kCustom) && theNumItems < theMaxItems)
+            {
+                theInfoList[theNumItems].mSelector = theInfo.selector;
+                theInfoList[theNumItems].mPropertyDataType = theInfo.dataType;
+                theInfoList[theNumItems].mQualifierDataType = theInfo.qualifierDataType;
+                theNumItems++;
+            }
+        }
+
+        return theNumItems * sizeof(AudioServerPlugInCustomPropertyInfo);
+    }
+
+private:
+    // At least four slots per property, as a power of two.
+    static constexpr UInt32     kNumSlotBits = EFF_PropertyTableSlotBits(N);
+    static constexpr size_t     kNumSlots = size_t(1) << kNumSlotBits;
+
+    static_assert(N < 255, "EFF_PropertyTable stores indexes in UInt8s");
+
+    static constexpr UInt32     Slot(AudioObjectPropertySelector inSelector, UInt32 inMultiplier)
+    {
+        return static_cast<UInt32>(inSelector * inMultiplier) >> (32 - kNumSlotBits);
+    }
+
+    constexpr bool              TryMultiplier(UInt32 inMultiplier)
+    {
+        for(UInt8& theSlot : mSlots)
+        {
+            theSlot = 0;
+        }
+
+        for(size_t i = 0; i < N; i++)
+        {
+            UInt8& theSlot = mSlots[Slot(mProperties[i].selector, inMultiplier)];
+
+            if(theSlot != 0)
+            {
+                return false;
+            }
+
+            // Plus one so 0 means the slot is empty.
+            theSlot = static_cast<UInt8>(i + 1);
+        }
+
+        return true;
+    }
+
+    std::array<EFF_PropertyInfo, N>     mProperties;
+    // The index plus one of the property in each slot, or 0.
+    std::array<UInt8, kNumSlots>        mSlots;
+    UInt32                              mMultiplier;
+
+};
+
+template <size_t N>
+constexpr EFF_PropertyTable<N>    EFF_MakePropertyTable(const EFF_PropertyInfo (&inProperties)[N])
+{
+    return EFF_PropertyTable<N>(inProperties);
+}
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_PropertyTable_h */
@@ -0,0 +1,235 @@
+//
+//  EFF_SpectrumAnalyzer.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_SpectrumAnalyzer.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+#include "CAException.h"
+
+// STL Includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Construction/Destruction
+
+EFF_SpectrumAnalyzer::EFF_SpectrumAnalyzer()
+:
+    mTap(kTapFrames * kChannels, 0.0f),
+    mFFTSetup(vDSP_create_fftsetup(kFFTLog2Size, kFFTRadix2)),
+    mWindow(kFFTSize),
+    mPowerScale(1.0f),
+    mFrames(kFFTSize * kChannels),
+    mSamples(kFFTSize),
+    mReal(kNumBins),
+    mImag(kNumBins),
+    mPower(kNumBins),
+    mSpectrumMutex("Spectrum"),
+    mBandEdges(kEFFSpectrumNumBands + 1, 1),
+    mSpectrum(kEFFSpectrumNumBands, kFloorDB)
+{
+    ThrowIfNULL(mFFTSetup,
+                CAException(kAudioHardwareUnspecifiedError),
+                "EFF_SpectrumAnalyzer::EFF_SpectrumAnalyzer: Could not create the FFT setup");
+
+    vDSP_hann_window(mWindow.data(), kFFTSize, vDSP_HANN_NORM);
+
+    // vDSP_fft_zrip's output is scaled up by 2, so a full-scale sine wave comes out with a magnitude
+    // of the window's sum.
+    Float32 theWindowSum = 0.0f;
+    vDSP_sve(mWindow.data(), 1, &theWindowSum, kFFTSize);
+    mPowerScale = 1.0f / (theWindowSum * theWindowSum);
+
+    // Scale the window by half so applying it also averages the two channels, which we add together.
+    Float32 theHalf = 0.5f;
+    vDSP_vsmul(mWindow.data(), 1, &theHalf, mWindow.data(), 1, kFFTSize);
+
+    SetSampleRate(44100.0);
+}
+
+EFF_SpectrumAnalyzer::~EFF_SpectrumAnalyzer()
+{
+    vDSP_destroy_fftsetup(mFFTSetup);
+}
+
+void    EFF_SpectrumAnalyzer::SetSampleRate(Float64 inSampleRate)
+{
+    CAMutex::Locker theLocker(mSpectrumMutex);
+
+    Float64 theBinsPerHz = kFFTSize / inSampleRate;
+
+    for(UInt32 i = 0; i <= kEFFSpectrumNumBands; i++)
+    {
+        Float64 theFrequency =
+            kMinFrequency * std::pow(kMaxFrequency / kMinFrequency,
+                                     static_cast<Float64>(i) / kEFFSpectrumNumBands);
+        UInt32 theBin = static_cast<UInt32>(std::lround(theFrequency * theBinsPerHz));
+
+        // Skip the DC bin, keep the bands in order and give each at least one bin, even if that
+        // means the low bands share a bin's width of frequencies or the high ones are past Nyquist.
+        theBin = std::max<UInt32>(theBin, 1);
+
+        if(i > 0)
+        {
+            theBin = std::max(theBin, mBandEdges[i - 1] + 1);
+        }
+
+        mBandEdges[i] = std::min<UInt32>(theBin, kNumBins);
+    }
+
+    // The bands' levels are for the old sample rate's frequencies, so clear them.
+    std::fill(mSpectrum.begin(), mSpectrum.end(), kFloorDB);
+}
+
+#pragma mark IO Operations
+
+bool    EFF_SpectrumAnalyzer::PushFramesRT(const Float32* inBuffer, UInt32 inFrameCount)
+{
+    // We're the only writer, so we can load the write position relaxed.
+    UInt64 theWriteFrame = mTapWriteFrame.load(std::memory_order_relaxed);
+
+    // Only keep as many frames as the tap can hold.
+    if(inFrameCount > kTapFrames)
+    {
+        inBuffer += (inFrameCount - kTapFrames) * kChannels;
+        theWriteFrame += inFrameCount - kTapFrames;
+        inFrameCount = kTapFrames;
+    }
+
+    // Copy the frames in, wrapping around the end of the tap if necessary.
+    UInt32 theStartFrame = static_cast<UInt32>(theWriteFrame & (kTapFrames - 1));
+    UInt32 theFramesBeforeEnd = std::min<UInt32>(inFrameCount, kTapFrames - theStartFrame);
+
+    memcpy(&mTap[theStartFrame * kChannels],
+           inBuffer,
+           theFramesBeforeEnd * kChannels * sizeof(Float32));
+    memcpy(&mTap[0],
+           inBuffer + (theFramesBeforeEnd * kChannels),
+           (inFrameCount - theFramesBeforeEnd) * kChannels * sizeof(Float32));
+
+    theWriteFrame += inFrameCount;
+    mTapWriteFrame.store(theWriteFrame, std::memory_order_release);
+
+    // Ask for a new spectrum every kHopFrames, but only if something wants it and the last one is
+    // finished.
+    if((theWriteFrame - mLastQueuedFrame) < kHopFrames || !IsBeingReadRT(theWriteFrame))
+    {
+        return false;
+    }
+
+    if(mComputeQueued.exchange(true, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+
+    mLastQueuedFrame = theWriteFrame;
+    return true;
+}
+
+void    EFF_SpectrumAnalyzer::ComputeSpectrumNonRT()
+{
+    UInt64 theEndFrame = mTapWriteFrame.load(std::memory_order_acquire);
+    bool didCopyFrames = false;
+
+    if(theEndFrame >= kFFTSize)
+    {
+        // Copy the newest frames out of the tap.
+        UInt32 theStartFrame = static_cast<UInt32>((theEndFrame - kFFTSize) & (kTapFrames - 1));
+        UInt32 theFramesBeforeEnd = std::min<UInt32>(kFFTSize, kTapFrames - theStartFrame);
+
+        memcpy(mFrames.data(),
+               &mTap[theStartFrame * kChannels],
+               theFramesBeforeEnd * kChannels * sizeof(Float32));
+        memcpy(&mFrames[theFramesBeforeEnd * kChannels],
+               &mTap[0],
+               (kFFTSize - theFramesBeforeEnd) * kChannels * sizeof(Float32));
+
+        // If the IO thread got far enough ahead while we were copying to overwrite some of the
+        // frames we copied, skip this spectrum. It'll have queued the next one by then anyway.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        UInt64 theFramesWrittenSince = mTapWriteFrame.load(std::memory_order_relaxed) - theEndFrame;
+        didCopyFrames = (theFramesWrittenSince <= (kTapFrames - kFFTSize));
+    }
+
+    if(didCopyFrames)
+    {
+        // Add the channels together and apply the window, which also halves them.
+        vDSP_vadd(&mFrames[0], kChannels, &mFrames[1], kChannels, mSamples.data(), 1, kFFTSize);
+        vDSP_vmul(mSamples.data(), 1, mWindow.data(), 1, mSamples.data(), 1, kFFTSize);
+
+        // Compute the FFT in place, in the packed format vDSP uses for real FFTs.
+        DSPSplitComplex theSplitComplex = { mReal.data(), mImag.data() };
+        vDSP_ctoz(reinterpret_cast<const DSPComplex*>(mSamples.data()),
+                  2,
+                  &theSplitComplex,
+                  1,
+                  kNumBins);
+        vDSP_fft_zrip(mFFTSetup, &theSplitComplex, 1, kFFTLog2Size, kFFTDirection_Forward);
+
+        // The first imaginary value is actually the real part of the Nyquist bin, which none of the
+        // bands include, so clear it to leave just the DC bin.
+        mImag[0] = 0.0f;
+
+        vDSP_zvmags(&theSplitComplex, 1, mPower.data(), 1, kNumBins);
+        vDSP_vsmul(mPower.data(), 1, &mPowerScale, mPower.data(), 1, kNumBins);
+
+        // Reduce the bins to bands and publish them. Each band gets the level of its loudest bin so
+        // narrow peaks don't get averaged away in the wider high bands.
+        CAMutex::Locker theLocker(mSpectrumMutex);
+
+        Float32 theFloorPower = std::pow(10.0f, kFloorDB / 10.0f);
+
+        for(UInt32 i = 0; i < kEFFSpectrumNumBands; i++)
+        {
+            UInt32 theFirstBin = std::min<UInt32>(mBandEdges[i], kNumBins - 1);
+            UInt32 theEndBin = std::max(mBandEdges[i + 1], theFirstBin + 1);
+            Float32 thePower = 0.0f;
+
+            vDSP_maxv(&mPower[theFirstBin], 1, &thePower, theEndBin - theFirstBin);
+
+            mSpectrum[i] = 10.0f * std::log10(std::max(thePower, theFloorPower));
+        }
+    }
+
+    mComputeQueued.store(false, std::memory_order_release);
+}
+
+#pragma mark Accessors
+
+CACFArray    EFF_SpectrumAnalyzer::CopySpectrum()
+const
+{
+    // Let PushFramesRT know the spectrum is being used.
+    mLastReadFrame.store(mTapWriteFrame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    CACFArray theSpectrum(false);
+    CAMutex::Locker theLocker(mSpectrumMutex);
+
+    for(Float32 theLevel : mSpectrum)
+    {
+        theSpectrum.AppendFloat32(theLevel);
+    }
+
+    return theSpectrum;
+}
+
+#pragma mark Implementation
+
+bool    EFF_SpectrumAnalyzer::IsBeingReadRT(UInt64 inTapWriteFrame)
+const
+{
+    UInt64 theLastReadFrame = mLastReadFrame.load(std::memory_order_relaxed);
+    return (theLastReadFrame != kNeverRead) && ((inTapWriteFrame - theLastReadFrame) < kIdleFrames);
+}
+
+#pragma clang assume_nonnull end
@@ -0,0 +1,145 @@
+//
+//  EFF_SpectrumAnalyzer.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_SpectrumAnalyzer_h
+#define EFF_SpectrumAnalyzer_h
+
+// Local Includes
+#include "EFF_CustomProperties.h"
+
+// PublicUtility Includes
+#include "CAMutex.h"
+#include "CACFArray.h"
+
+// STL Includes
+#include <atomic>
+#include <vector>
+
+// System Includes
+#include <Accelerate/Accelerate.h>
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_SpectrumAnalyzer
+//
+//  Computes the spectrum of a device's mix for kAudioDeviceCustomPropertySpectrum.
+//
+//  The IO thread only copies each mixed buffer into a tap, which is a ring of the most recent
+//  frames. Once enough new frames have been copied, PushFramesRT returns true and the caller queues
+//  ComputeSpectrumNonRT on a non-real-time thread, which windows the newest kFFTSize frames, runs
+//  a real FFT with vDSP and reduces the result to kEFFSpectrumNumBands log-spaced bands.
+//
+//  Only one spectrum is computed at a time, and none are computed while nothing is reading the
+//  property, so an idle analyzer costs a memcpy per IO cycle.
+//==================================================================================================
+
+class EFF_SpectrumAnalyzer
+{
+
+#pragma mark Construction/Destruction
+
+public:
+                                EFF_SpectrumAnalyzer();
+                                ~EFF_SpectrumAnalyzer();
+                                EFF_SpectrumAnalyzer(const EFF_SpectrumAnalyzer&) = delete;
+                                EFF_SpectrumAnalyzer& operator=(const EFF_SpectrumAnalyzer&) = delete;
+
+    /*!
+     Set the sample rate of the audio being analyzed, which the band edges depend on. Shouldn't be
+     called while IO is running.
+     */
+    void                        SetSampleRate(Float64 inSampleRate);
+
+#pragma mark IO Operations
+
+    /*!
+     Copy a buffer of mixed audio into the tap.
+
+     @param inBuffer The audio, as interleaved stereo.
+     @param inFrameCount The number of frames in inBuffer.
+     @return True if the caller should arrange for ComputeSpectrumNonRT to be called.
+     */
+    bool                        PushFramesRT(const Float32* inBuffer, UInt32 inFrameCount);
+
+    /*!
+     Compute the spectrum of the newest frames in the tap and publish it. Must only be called after
+     PushFramesRT returns true, and only once each time it does.
+     */
+    void                        ComputeSpectrumNonRT();
+
+#pragma mark Accessors
+
+    /*!
+     @return The latest spectrum in the format of kAudioDeviceCustomPropertySpectrum. Also keeps the
+             analyzer running for a while, if it's been idle.
+     */
+    CACFArray                   CopySpectrum() const;
+
+#pragma mark Implementation
+
+private:
+    bool                        IsBeingReadRT(UInt64 inTapWriteFrame) const;
+
+    enum : UInt32
+    {
+        kFFTLog2Size    = 11,
+        kFFTSize        = 1 << kFFTLog2Size,
+        kNumBins        = kFFTSize / 2,
+        // The number of frames between spectrums, so they overlap by half.
+        kHopFrames      = kFFTSize / 2,
+        // The number of frames the tap holds. Must be a power of two and comfortably more than
+        // kFFTSize, so the IO thread can keep writing while ComputeSpectrumNonRT reads.
+        kTapFrames      = kFFTSize * 4,
+        kChannels       = 2
+    };
+
+    // The analyzer stops computing spectrums once nobody has read one for this many frames.
+    static constexpr UInt64     kIdleFrames         = 1 << 18;
+    static constexpr UInt64     kNeverRead          = UINT64_MAX;
+    static constexpr Float64    kMinFrequency       = 20.0;
+    static constexpr Float64    kMaxFrequency       = 20000.0;
+    static constexpr Float32    kFloorDB            = -120.0f;
+
+    // Written by PushFramesRT, read by ComputeSpectrumNonRT. Only the IO thread writes to mTap, and
+    // it publishes the frames it's written by incrementing mTapWriteFrame.
+    std::vector<Float32>        mTap;
+    std::atomic<UInt64>         mTapWriteFrame      { 0 };
+    // Only accessed by PushFramesRT.
+    UInt64                      mLastQueuedFrame    = 0;
+    // True from when PushFramesRT asks for a spectrum until ComputeSpectrumNonRT finishes it.
+    std::atomic<bool>           mComputeQueued      { false };
+    // The value of mTapWriteFrame the last time CopySpectrum was called.
+    mutable std::atomic<UInt64> mLastReadFrame      { kNeverRead };
+
+    // Only accessed by ComputeSpectrumNonRT, except for the constructor and destructor.
+    FFTSetup __nullable         mFFTSetup;
+    // The Hann window, scaled by half so it also averages the two channels.
+    std::vector<Float32>        mWindow;
+    // Converts the FFT's squared magnitudes to squared amplitudes relative to full scale.
+    Float32                     mPowerScale;
+    std::vector<Float32>        mFrames;
+    std::vector<Float32>        mSamples;
+    std::vector<Float32>        mReal;
+    std::vector<Float32>        mImag;
+    std::vector<Float32>        mPower;
+
+    // Guards the band edges and the published spectrum.
+    CAMutex                     mSpectrumMutex;
+    // The first FFT bin of each band, followed by the end of the last band.
+    std::vector<UInt32>         mBandEdges;
+    // The level of each band in dBFS.
+    std::vector<Float32>        mSpectrum;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_SpectrumAnalyzer_h */
@@ -14,6 +14,7 @@
 #include "EFF_Utils.h"
 #include "EFF_Device.h"
 #include "EFF_PlugIn.h"
+#include "EFF_PropertyTable.h"
 
 // PublicUtility Includes
 #include "CADebugMacros.h"
@@ -23,6 +24,29 @@
 
 #pragma clang assume_nonnull begin
 
+#pragma mark Property Table
+
+namespace
+{
+    constexpr EFF_PropertyInfo kStreamPropertyList[] =
+    {
+        EFF_Property(kAudioStreamPropertyIsActive,                  sizeof(UInt32), EFF_PropertyInfo::kSettable),
+        EFF_Property(kAudioStreamPropertyDirection,                 sizeof(UInt32)),
+        EFF_Property(kAudioStreamPropertyTerminalType,              sizeof(UInt32)),
+        EFF_Property(kAudioStreamPropertyStartingChannel,           sizeof(UInt32)),
+        EFF_Property(kAudioStreamPropertyLatency,                   sizeof(UInt32)),
+        EFF_Property(kAudioStreamPropertyVirtualFormat,             sizeof(AudioStreamBasicDescription),
+                     EFF_PropertyInfo::kSettable),
+        EFF_Property(kAudioStreamPropertyPhysicalFormat,            sizeof(AudioStreamBasicDescription),
+                     EFF_PropertyInfo::kSettable),
+        EFF_Property(kAudioStreamPropertyAvailableVirtualFormats,   1 * sizeof(AudioStreamRangedDescription)),
+        EFF_Property(kAudioStreamPropertyAvailablePhysicalFormats,  1 * sizeof(AudioStreamRangedDescription))
+    };
+
+    constexpr auto kStreamProperties = EFF_MakePropertyTable(kStreamPropertyList);
+}
+
+#pragma mark Construction/Destruction
 
 EFF_Stream::EFF_Stream(AudioObjectID inObjectID,
                        AudioDeviceID inOwnerDeviceID,
@@ -58,28 +82,14 @@ const
     //    are useful but not required. There is more detailed commentary about each property in the
     //    GetPropertyData() method.
 
-    bool theAnswer = false;
+    const EFF_PropertyInfo* theInfo = kStreamProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioStreamPropertyIsActive:
-        case kAudioStreamPropertyDirection:
-        case kAudioStreamPropertyTerminalType:
-        case kAudioStreamPropertyStartingChannel:
-        case kAudioStreamPropertyLatency:
-        case kAudioStreamPropertyVirtualFormat:
-        case kAudioStreamPropertyPhysicalFormat:
-        case kAudioStreamPropertyAvailableVirtualFormats:
-        case kAudioStreamPropertyAvailablePhysicalFormats:
-            theAnswer = true;
-            break;
-
-        default:
-            theAnswer = EFF_Object::HasProperty(inObjectID, inClientPID, inAddress);
-            break;
-    };
+        return kStreamProperties.HasProperty(*theInfo, inAddress);
+    }
 
-    return theAnswer;
+    return EFF_Object::HasProperty(inObjectID, inClientPID, inAddress);
 }
 
 bool    EFF_Stream::IsPropertySettable(AudioObjectID inObjectID,
@@ -91,31 +101,14 @@ const
     // are useful but not required. There is more detailed commentary about each property in the
     // GetPropertyData() method.
 
-    bool theAnswer = false;
+    const EFF_PropertyInfo* theInfo = kStreamProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioStreamPropertyDirection:
-        case kAudioStreamPropertyTerminalType:
-        case kAudioStreamPropertyStartingChannel:
-        case kAudioStreamPropertyLatency:
-        case kAudioStreamPropertyAvailableVirtualFormats:
-        case kAudioStreamPropertyAvailablePhysicalFormats:
-            theAnswer = false;
-            break;
-
-        case kAudioStreamPropertyIsActive:
-        case kAudioStreamPropertyVirtualFormat:
-        case kAudioStreamPropertyPhysicalFormat:
-            theAnswer = true;
-            break;
-
-        default:
-            theAnswer = EFF_Object::IsPropertySettable(inObjectID, inClientPID, inAddress);
-            break;
-    };
+        return kStreamProperties.IsPropertySettable(*theInfo);
+    }
 
-    return theAnswer;
+    return EFF_Object::IsPropertySettable(inObjectID, inClientPID, inAddress);
 }
 
 UInt32    EFF_Stream::GetPropertyDataSize(AudioObjectID inObjectID,
@@ -129,38 +122,18 @@ const
     // are useful but not required. There is more detailed commentary about each property in the
     // GetPropertyData() method.
 
-    UInt32 theAnswer = 0;
+    const EFF_PropertyInfo* theInfo = kStreamProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioStreamPropertyIsActive:
-        case kAudioStreamPropertyDirection:
-        case kAudioStreamPropertyTerminalType:
-        case kAudioStreamPropertyStartingChannel:
-        case kAudioStreamPropertyLatency:
-            theAnswer = sizeof(UInt32);
-            break;
-
-        case kAudioStreamPropertyVirtualFormat:
-        case kAudioStreamPropertyPhysicalFormat:
-            theAnswer = sizeof(AudioStreamBasicDescription);
-            break;
-            
-        case kAudioStreamPropertyAvailableVirtualFormats:
-        case kAudioStreamPropertyAvailablePhysicalFormats:
-            theAnswer = 1 * sizeof(AudioStreamRangedDescription);
-            break;
-            
-        default:
-            theAnswer = EFF_Object::GetPropertyDataSize(inObjectID,
-                                                        inClientPID,
-                                                        inAddress,
-                                                        inQualifierDataSize,
-                                                        inQualifierData);
-            break;
-    };
-
-    return theAnswer;
+        return theInfo->dataSize;
+    }
+
+    return EFF_Object::GetPropertyDataSize(inObjectID,
+                                           inClientPID,
+                                           inAddress,
+                                           inQualifierDataSize,
+                                           inQualifierData);
 }
 
 void    EFF_Stream::GetPropertyData(AudioObjectID inObjectID,
@@ -466,4 +439,11 @@ void    EFF_Stream::SetSampleRate(Float64 inSampleRate)
     mSampleRate = inSampleRate;
 }
 
+bool    EFF_Stream::IsStreamActive()
+const
+{
+    CAMutex::Locker theStateLocker(mStateMutex);
+    return mIsStreamActive;
+}
+
 #pragma clang assume_nonnull end
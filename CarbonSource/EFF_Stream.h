@@ -73,6 +73,8 @@ public:
     // This is only called by EFFDevice and not by this stream itself, because the device will
     // make the decision to set the sample rates for both streams at once
     void                        SetSampleRate(Float64 inSampleRate);
+    /*! @return True if the stream is enabled. See kAudioStreamPropertyIsActive. */
+    bool                        IsStreamActive() const;
 
 private:
     CAMutex                     mStateMutex;
@@ -13,9 +13,11 @@
 #include "EFF_Types.h"
 #include "EFF_Utils.h"
 #include "EFF_PlugIn.h"
-#include "EFF_Clients.h"
 #include "EFF_ClientMap.h"
 #include "EFF_ClientTasks.h"
+#include "EFF_SpectrumAnalyzer.h"
+#include "EFF_Convolver.h"
+#include "EFF_Automation.h"
 
 // PublicUtility Includes
 #include "CAException.h"
@@ -25,114 +27,78 @@
 #include "CAAtomic.h"
 #pragma clang diagnostic pop
 
-// System Includes
-#include <mach/mach_init.h>
-#include <mach/mach_time.h>
-#include <mach/task.h>
-
 
 #pragma clang assume_nonnull begin
 
 
 #pragma mark Construction/destruction
 
-EFF_TaskQueue::EFF_TaskQueue()
+EFF_TaskQueue::EFF_Worker::EFF_Worker(UInt32 inComputation, UInt32 inConstraint)
 :
-    // The inline documentation for thread_time_constraint_policy.period says "A value of 0 indicates that there is no
-    // inherent periodicity in the computation". So I figure setting the period to 0 means the scheduler will take as long
-    // as it wants to wake our real-time thread, which is fine for us, but once it has only other real-time threads can
-    // preempt us. (And that's only if they won't make our computation take longer than kRealTimeThreadMaximumComputationNs).
-    mRealTimeThread(/* inThreadRoutine = */ &EFF_TaskQueue::RealTimeThreadProc,
-                    /* inParameter */       this,
-                    /* inPeriod = */        0,
-                    /* inComputation */     NanosToAbsoluteTime(kRealTimeThreadNominalComputationNs),
-                    /* inConstraint */      NanosToAbsoluteTime(kRealTimeThreadMaximumComputationNs),
-                    /* inIsPreemptible = */ true),
-    mNonRealTimeThread(&EFF_TaskQueue::NonRealTimeThreadProc, this)
+    mThread(&EFF_TaskQueue::RealTimeThreadProc, this, inComputation, inConstraint),
+    mFreeList(NULL)
 {
-    // Init the semaphores
-    auto createSemaphore = [] () {
-        semaphore_t theSemaphore;
-        kern_return_t theError = semaphore_create(mach_task_self(),
-                                                  &theSemaphore,
-                                                  SYNC_POLICY_FIFO, 0);
-        EFF_Utils::ThrowIfMachError("EFF_TaskQueue::EFF_TaskQueue",
-                                    "semaphore_create",
-                                    theError);
-        ThrowIf(theSemaphore == SEMAPHORE_NULL,
-                CAException(kAudioHardwareUnspecifiedError),
-                "EFF_TaskQueue::EFF_TaskQueue: Could not create semaphore");
-        
-        return theSemaphore;
-    };
-    mRealTimeThreadWorkQueuedSemaphore              = createSemaphore();
-    mNonRealTimeThreadWorkQueuedSemaphore           = createSemaphore();
-    mRealTimeThreadSyncTaskCompletedSemaphore       = createSemaphore();
-    mNonRealTimeThreadSyncTaskCompletedSemaphore    = createSemaphore();
-    
-    // Pre-allocate enough tasks in mNonRealTimeThreadTasksFreeList that the real-time threads should never have to
-    // allocate memory when adding a task to the non-realtime queue.
-    for(UInt32 i = 0; i < kNonRealTimeThreadTaskBufferSize; i++)
-    {
-        EFF_Task* theTask = new EFF_Task;
-        mNonRealTimeThreadTasksFreeList.push_NA(theTask);
-    }
-    
-    // Start the worker threads
-    mRealTimeThread.Start();
-    mNonRealTimeThread.Start();
 }
 
-EFF_TaskQueue::~EFF_TaskQueue()
+EFF_TaskQueue::EFF_Worker::EFF_Worker(TAtomicStack2<EFF_Task>& inFreeList)
+:
+    mThread(&EFF_TaskQueue::NonRealTimeThreadProc, this),
+    mFreeList(&inFreeList)
 {
-    // Join the worker threads
-    EFFLogAndSwallowExceptionsMsg("EFF_TaskQueue::~EFF_TaskQueue", "QueueSync", ([&] {
-        QueueSync(kEFFTaskStopWorkerThread, /* inRunOnRealtimeThread = */ true);
-        QueueSync(kEFFTaskStopWorkerThread, /* inRunOnRealtimeThread = */ false);
-    }));
+}
 
-    // Destroy the semaphores
-    auto destroySemaphore = [] (semaphore_t inSemaphore) {
-        kern_return_t theError = semaphore_destroy(mach_task_self(), inSemaphore);
-        EFF_Utils::LogIfMachError("EFF_TaskQueue::~EFF_TaskQueue",
-                                  "semaphore_destroy",
-                                  theError);
-    };
-    
-    destroySemaphore(mRealTimeThreadWorkQueuedSemaphore);
-    destroySemaphore(mNonRealTimeThreadWorkQueuedSemaphore);
-    destroySemaphore(mRealTimeThreadSyncTaskCompletedSemaphore);
-    destroySemaphore(mNonRealTimeThreadSyncTaskCompletedSemaphore);
-    
-    EFF_Task* theTask;
+EFF_TaskQueue::EFF_WorkerPool::EFF_WorkerPool()
+:
+    mRealTimeWorker(kRealTimeThreadNominalComputationNs, kRealTimeThreadMaximumComputationNs),
+    mNextNonRealTimeWorker(0)
+{
+    for(std::unique_ptr<EFF_Worker>& theWorker : mNonRealTimeWorkers)
+    {
+        theWorker.reset(new EFF_Worker(mNonRealTimeTasksFreeList));
+    }
     
-    // Delete the tasks in the non-realtime tasks free list
-    while((theTask = mNonRealTimeThreadTasksFreeList.pop_atomic()) != NULL)
+    // Pre-allocate enough tasks in the free list that the real-time threads should never have to
+    // allocate memory when adding a task to a non-realtime queue.
+    for(UInt32 i = 0; i < kNonRealTimeTaskBufferSize; i++)
     {
-        delete theTask;
+        EFF_Task* theTask = new EFF_Task;
+        mNonRealTimeTasksFreeList.push_NA(theTask);
     }
     
-    // Delete any tasks left on the non-realtime queue that need to be
-    while((theTask = mNonRealTimeThreadTasks.pop_atomic()) != NULL)
+    // Start the worker threads
+    mRealTimeWorker.mThread.Start();
+    
+    for(std::unique_ptr<EFF_Worker>& theWorker : mNonRealTimeWorkers)
     {
-        if(!theTask->IsSync())
-        {
-            delete theTask;
-        }
+        theWorker->mThread.Start();
     }
 }
 
 //static
-UInt32  EFF_TaskQueue::NanosToAbsoluteTime(UInt32 inNanos)
+EFF_TaskQueue::EFF_WorkerPool&    EFF_TaskQueue::GetWorkerPool()
 {
-    // Converts a duration from nanoseconds to absolute time (i.e. number of bus cycles). Used for calculating
-    // the real-time thread's time constraint policy.
-    
-    mach_timebase_info_data_t theTimebaseInfo;
-    mach_timebase_info(&theTimebaseInfo);
-    
-    Float64 theTicksPerNs = static_cast<Float64>(theTimebaseInfo.denom) / theTimebaseInfo.numer;
-    return static_cast<UInt32>(inNanos * theTicksPerNs);
+    // Never deleted, since the worker threads are never stopped. If creating it throws, the next
+    // call tries again.
+    static EFF_WorkerPool* sWorkerPool = new EFF_WorkerPool;
+    return *sWorkerPool;
+}
+
+EFF_TaskQueue::EFF_TaskQueue()
+:
+    mWorkerPool(GetWorkerPool()),
+    mNonRealTimeWorker(*mWorkerPool.mNonRealTimeWorkers[mWorkerPool.mNextNonRealTimeWorker++ %
+                                                        EFF_WorkerPool::kNumNonRealTimeWorkers])
+{
+}
+
+EFF_TaskQueue::~EFF_TaskQueue()
+{
+    // Wait for this queue's async tasks, since the worker thread would be using its owner's
+    // objects after they're destroyed otherwise. The real-time worker only runs sync tasks.
+    EFFLogAndSwallowExceptionsMsg("EFF_TaskQueue::~EFF_TaskQueue", "QueueSync", ([&] {
+        // The task doesn't need to do anything. The worker runs it after the tasks queued before it.
+        QueueSync("Flush", /* inRunOnRealtimeThread = */ false, [] { });
+    }));
 }
 
 
@@ -140,15 +106,12 @@ UInt32  EFF_TaskQueue::NanosToAbsoluteTime(UInt32 inNanos)
 
 void    EFF_TaskQueue::QueueSync_SwapClientShadowMaps(EFF_ClientMap* inClientMap)
 {
-    // TODO: Is there any reason to use uintptr_t when we pass pointers to tasks like this? I can't think of any
-    //       reason for a system to have (non-function) pointers larger than 64-bit, so I figure they should fit.
-    //
-    //       From http://en.cppreference.com/w/cpp/language/reinterpret_cast:
-    //       "A pointer converted to an integer of sufficient size and back to the same pointer type is guaranteed
-    //        to have its original value [...]"
-    QueueSync(kEFFTaskSwapClientShadowMaps,
+    QueueSync("SwapClientShadowMaps",
               /* inRunOnRealtimeThread = */ true,
-              reinterpret_cast<UInt64>(inClientMap));
+              [inClientMap] {
+                  DebugMsg("EFF_TaskQueue::QueueSync_SwapClientShadowMaps: Swapping the shadow maps in EFF_ClientMap");
+                  EFF_ClientTasks::SwapInShadowMapsRT(inClientMap);
+              });
 }
 
 void    EFF_TaskQueue::QueueAsync_SendPropertyNotification(AudioObjectPropertySelector inProperty,
@@ -157,119 +120,100 @@ void    EFF_TaskQueue::QueueAsync_SendPropertyNotification(AudioObjectPropertySe
     DebugMsg("EFF_TaskQueue::QueueAsync_SendPropertyNotification: Queueing property notification. inProperty=%u inDeviceID=%u",
              inProperty,
              inDeviceID);
-    EFF_Task theTask(kEFFTaskSendPropertyNotification,
+    EFF_Task theTask("SendPropertyNotification",
                      /* inIsSync = */ false,
-                     inProperty,
-                     inDeviceID);
+                     [inProperty, inDeviceID] {
+                         AudioObjectPropertyAddress thePropertyAddress[] = {
+                             { inProperty, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster } };
+                         EFF_PlugIn::Host_PropertiesChanged(inDeviceID, 1, thePropertyAddress);
+                     });
     QueueOnNonRealtimeThread(theTask);
 }
 
-bool    EFF_TaskQueue::Queue_UpdateClientIOState(bool inSync,
-                                                 EFF_Clients* inClients,
-                                                 UInt32 inClientID,
-                                                 bool inDoingIO)
+void    EFF_TaskQueue::QueueAsync_ComputeSpectrum(EFF_SpectrumAnalyzer* inSpectrumAnalyzer)
 {
-    DebugMsg("EFF_TaskQueue::Queue_UpdateClientIOState: Queueing %s %s",
-             (inDoingIO ? "kEFFTaskStartClientIO" : "kEFFTaskStopClientIO"),
-             (inSync ? "synchronously" : "asynchronously"));
-    
-    EFF_TaskID theTaskID = (inDoingIO ? kEFFTaskStartClientIO : kEFFTaskStopClientIO);
-    UInt64 theClientsPtrArg = reinterpret_cast<UInt64>(inClients);
-    UInt64 theClientIDTaskArg = static_cast<UInt64>(inClientID);
-    
-    if(inSync)
-    {
-        return QueueSync(theTaskID,
-                         false,
-                         theClientsPtrArg,
-                         theClientIDTaskArg);
-    }
-    else
-    {
-        EFF_Task theTask(theTaskID,
-                         /* inIsSync = */ false,
-                         theClientsPtrArg,
-                         theClientIDTaskArg);
-        QueueOnNonRealtimeThread(theTask);
-        
-        // This method's return value isn't used when queueing async, because we can't know what it should be yet.
-        return false;
-    }
+    // No DebugMsg here because this is queued every few IO cycles while the spectrum is being read.
+    EFF_Task theTask("ComputeSpectrum",
+                     /* inIsSync = */ false,
+                     [inSpectrumAnalyzer] { inSpectrumAnalyzer->ComputeSpectrumNonRT(); });
+    QueueOnNonRealtimeThread(theTask);
+}
+
+void    EFF_TaskQueue::QueueAsync_UpdateConvolver(EFF_Convolver* inConvolver)
+{
+    DebugMsg("EFF_TaskQueue::QueueAsync_UpdateConvolver: Queueing");
+    EFF_Task theTask("UpdateConvolver",
+                     /* inIsSync = */ false,
+                     [inConvolver] { inConvolver->UpdateNonRT(); });
+    QueueOnNonRealtimeThread(theTask);
+}
+
+void    EFF_TaskQueue::QueueAsync_CommitAutomation(EFF_Automation* inAutomation)
+{
+    DebugMsg("EFF_TaskQueue::QueueAsync_CommitAutomation: Queueing");
+    EFF_Task theTask("CommitAutomation",
+                     /* inIsSync = */ false,
+                     [inAutomation] { inAutomation->CommitNonRT(); });
+    QueueOnNonRealtimeThread(theTask);
 }
 
 // This function happens synchronously (i.e. it returns only after the work is done)
 // but it can add tasks to either RT or nonRT queues on respective threads
-UInt64    EFF_TaskQueue::QueueSync(EFF_TaskID inTaskID,
+template <typename Closure>
+UInt64    EFF_TaskQueue::QueueSync(const char* inTaskName,
                                    bool inRunOnRealtimeThread,
-                                   UInt64 inTaskArg1,
-                                   UInt64 inTaskArg2)
+                                   Closure inClosure)
 {
-    DebugMsg("EFF_TaskQueue::QueueSync: Queueing task synchronously to be processed on the %s thread. inTaskID=%d inTaskArg1=%llu inTaskArg2=%llu",
+    DebugMsg("EFF_TaskQueue::QueueSync: Queueing task synchronously to be processed on the %s thread. inTaskName=%s",
              (inRunOnRealtimeThread ? "realtime" : "non-realtime"),
-             inTaskID,
-             inTaskArg1,
-             inTaskArg2);
+             inTaskName);
     
     // Create the task
-    EFF_Task theTask(inTaskID,
+    EFF_Task theTask(inTaskName,
                      /* inIsSync = */ true,
-                     inTaskArg1,
-                     inTaskArg2);
+                     inClosure);
 
     // Add the task to the queue
-    TAtomicStack<EFF_Task>& theTasks = (inRunOnRealtimeThread
-                                        ? mRealTimeThreadTasks
-                                        : mNonRealTimeThreadTasks);
-    theTasks.push_atomic(&theTask);
-
-    // Wake the worker thread so it'll process the task. (Note that semaphore_signal has an implicit barrier.)
-    kern_return_t theError = semaphore_signal(inRunOnRealtimeThread
-                                              ? mRealTimeThreadWorkQueuedSemaphore
-                                              : mNonRealTimeThreadWorkQueuedSemaphore);
-    EFF_Utils::ThrowIfMachError("EFF_TaskQueue::QueueSync",
-                                "semaphore_signal",
-                                theError);
+    EFF_Worker& theWorker = (inRunOnRealtimeThread ? mWorkerPool.mRealTimeWorker : mNonRealTimeWorker);
+    theWorker.mTasks.push_atomic(&theTask);
+
+    // Wake the worker thread so it'll process the task. (Note that notifying has an implicit barrier.)
+    theWorker.mWorkQueued.Notify();
 
     // Wait until the task has been processed.
     //
-    // The worker thread signals all threads waiting on this semaphore when it finishes a task.
+    // The worker thread notifies every thread waiting on mSyncTaskCompleted when it finishes a task.
     // The comments in WorkerThreadProc explain why we have to check the condition in a loop here.
+    // Taking the key before checking means we can't miss the notification for our task.
     bool didLogTimeoutMessage = false;
-    while(!theTask.IsComplete())
+    while(true)
     {
-        semaphore_t theTaskCompletedSemaphore = inRunOnRealtimeThread
-                                                ? mRealTimeThreadSyncTaskCompletedSemaphore
-                                                : mNonRealTimeThreadSyncTaskCompletedSemaphore;
-        // TODO: Because the worker threads use semaphore_signal_all instead of semaphore_signal,
-        // a thread can miss the signal if it isn't waiting at the right time.
-        // Using a timeout for now as a temporary fix so threads don't get stuck here.
-        theError = semaphore_timedwait(theTaskCompletedSemaphore,
-                                       (mach_timespec_t){ 0, kRealTimeThreadMaximumComputationNs * 4 });
+        UInt32 theKey = theWorker.mSyncTaskCompleted.PrepareWait();
+        CAMemoryBarrier();
         
-        if(theError == KERN_OPERATION_TIMED_OUT)
+        if(theTask.IsComplete())
         {
-            if(!didLogTimeoutMessage && inRunOnRealtimeThread)
-            {
-                DebugMsg("EFF_TaskQueue::QueueSync: Task %d taking longer than expected.", theTask.GetTaskID());
-                didLogTimeoutMessage = true;
-            }
+            break;
         }
-        else
+        
+        // The timeout is only so we can log when a real-time task is late.
+        bool didTimeOut = !theWorker.mSyncTaskCompleted.TimedWait(theKey, kRealTimeThreadMaximumComputationNs * 4);
+        
+        if(didTimeOut && !didLogTimeoutMessage && inRunOnRealtimeThread)
         {
-            EFF_Utils::ThrowIfMachError("EFF_TaskQueue::QueueSync", "semaphore_timedwait", theError);
+            DebugMsg("EFF_TaskQueue::QueueSync: Task %s taking longer than expected.", theTask.GetName());
+            didLogTimeoutMessage = true;
         }
-        
-        CAMemoryBarrier();
     }
     
     if(didLogTimeoutMessage)
     {
-        DebugMsg("EFF_TaskQueue::QueueSync: Late task %d finished.", theTask.GetTaskID());
+        DebugMsg("EFF_TaskQueue::QueueSync: Late task %s finished.", theTask.GetName());
     }
     
     if(theTask.GetReturnValue() != INT64_MAX)
     {
-        DebugMsg("EFF_TaskQueue::QueueSync: Task %d returned %llu.", theTask.GetTaskID(), theTask.GetReturnValue());
+        DebugMsg("EFF_TaskQueue::QueueSync: Task %s returned %llu.", theTask.GetName(), theTask.GetReturnValue());
     }
     
     return theTask.GetReturnValue();
@@ -277,8 +221,8 @@ UInt64    EFF_TaskQueue::QueueSync(EFF_TaskID inTaskID,
 
 void   EFF_TaskQueue::QueueOnNonRealtimeThread(EFF_Task inTask)
 {
-    // Add the task to our task list
-    EFF_Task* freeTask = mNonRealTimeThreadTasksFreeList.pop_atomic();
+    // Add the task to our worker's task list
+    EFF_Task* freeTask = mWorkerPool.mNonRealTimeTasksFreeList.pop_atomic();
     
     if(freeTask == NULL)
     {
@@ -288,26 +232,29 @@ void   EFF_TaskQueue::QueueOnNonRealtimeThread(EFF_Task inTask)
     
     *freeTask = inTask;
     
-    mNonRealTimeThreadTasks.push_atomic(freeTask);
+    mNonRealTimeWorker.mTasks.push_atomic(freeTask);
     
-    // Signal the worker thread to process the task. (Note that semaphore_signal has an implicit barrier.)
-    kern_return_t theError = semaphore_signal(mNonRealTimeThreadWorkQueuedSemaphore);
-    EFF_Utils::ThrowIfMachError("EFF_TaskQueue::QueueOnNonRealtimeThread", "semaphore_signal", theError);
+    // Notify the worker thread to process the task. This doesn't make a system call if the worker
+    // is already busy. (Note that notifying has an implicit barrier.)
+    mNonRealTimeWorker.mWorkQueued.Notify();
 }
 
 
 #pragma mark Worker threads
 
+//static
 void    EFF_TaskQueue::AssertCurrentThreadIsRTWorkerThread(const char* inCallerMethodName)
 {
 #if DEBUG  // This Assert macro always checks the condition, even in release builds if the compiler doesn't optimise it away
-    if(!mRealTimeThread.IsCurrentThread())
+    const EFF_WorkerThread& theRealTimeThread = GetWorkerPool().mRealTimeWorker.mThread;
+    
+    if(!theRealTimeThread.IsCurrentThread())
     {
         DebugMsg("%s should only be called on the realtime worker thread.", inCallerMethodName);
         __ASSERT_STOP;  // TODO: Figure out a better way to assert with a formatted message
     }
     
-    Assert(mRealTimeThread.IsTimeConstraintThread(), "mRealTimeThread should be in a time-constraint priority band.");
+    Assert(theRealTimeThread.IsTimeConstraintThread(), "The realtime worker thread should be in a time-constraint priority band.");
 #else
     #pragma unused (inCallerMethodName)
 #endif
@@ -318,12 +265,8 @@ void* __nullable    EFF_TaskQueue::RealTimeThreadProc(void* inRefCon)
 {
     DebugMsg("EFF_TaskQueue::RealTimeThreadProc: The realtime worker thread has started");
     
-    EFF_TaskQueue* refCon = static_cast<EFF_TaskQueue*>(inRefCon);
-    refCon->WorkerThreadProc(refCon->mRealTimeThreadWorkQueuedSemaphore,
-                             refCon->mRealTimeThreadSyncTaskCompletedSemaphore,
-                             &refCon->mRealTimeThreadTasks,
-                             NULL,
-                             [&] (EFF_Task* inTask) { return refCon->ProcessRealTimeThreadTask(inTask); });
+    EFF_Worker* refCon = static_cast<EFF_Worker*>(inRefCon);
+    WorkerThreadProc(*refCon);
     
     return NULL;
 }
@@ -331,60 +274,69 @@ void* __nullable    EFF_TaskQueue::RealTimeThreadProc(void* inRefCon)
 //static
 void* __nullable    EFF_TaskQueue::NonRealTimeThreadProc(void* inRefCon)
 {
-    DebugMsg("EFF_TaskQueue::NonRealTimeThreadProc: The non-realtime worker thread has started");
+    DebugMsg("EFF_TaskQueue::NonRealTimeThreadProc: A non-realtime worker thread has started");
     
-    EFF_TaskQueue* refCon = static_cast<EFF_TaskQueue*>(inRefCon);
-    refCon->WorkerThreadProc(refCon->mNonRealTimeThreadWorkQueuedSemaphore,
-                             refCon->mNonRealTimeThreadSyncTaskCompletedSemaphore,
-                             &refCon->mNonRealTimeThreadTasks,
-                             &refCon->mNonRealTimeThreadTasksFreeList,
-                             [&] (EFF_Task* inTask) { return refCon->ProcessNonRealTimeThreadTask(inTask); });
+    EFF_Worker* refCon = static_cast<EFF_Worker*>(inRefCon);
+    WorkerThreadProc(*refCon);
     
     return NULL;
 }
 
-void    EFF_TaskQueue::WorkerThreadProc(semaphore_t inWorkQueuedSemaphore,
-                                        semaphore_t inSyncTaskCompletedSemaphore,
-                                        TAtomicStack<EFF_Task>* inTasks,
-                                        TAtomicStack2<EFF_Task>* __nullable inFreeList,
-                                        std::function<bool(EFF_Task*)> inProcessTask)
+//static
+void    EFF_TaskQueue::WorkerThreadProc(EFF_Worker& inWorker)
 {
-    bool theThreadShouldStop = false;
-    
-    while(!theThreadShouldStop)
+    // The workers are shared by every EFF_TaskQueue and never destroyed, so this never returns.
+    while(true)
     {
-        // Wait until a thread signals that it's added tasks to the queue.
-        //
-        // Note that we don't have to hold any lock before waiting. If the semaphore is signalled before we begin waiting
-        // we'll still get the signal after we do.
-        kern_return_t theError = semaphore_wait(inWorkQueuedSemaphore);
-        EFF_Utils::ThrowIfMachError("EFF_TaskQueue::WorkerThreadProc", "semaphore_wait", theError);
+        // Take the key before checking the queue, so if a thread adds a task after we find the queue
+        // empty, we'll still get its notification when we wait.
+        UInt32 theKey = inWorker.mWorkQueued.PrepareWait();
         
         // Fetch the tasks from the queue.
         //
         // The tasks need to be processed in the order they were added to the queue. Since pop_all_reversed is atomic,
         // other threads can't add new tasks while we're reading, which would mix up the order.
-        EFF_Task* theTask = inTasks->pop_all_reversed();
+        EFF_Task* theTask = inWorker.mTasks.pop_all_reversed();
+        
+        if(theTask == NULL)
+        {
+            // Wait until a thread notifies us that it's added tasks to the queue.
+            //
+            // Note that we don't have to hold any lock before waiting.
+            inWorker.mWorkQueued.Wait(theKey);
+            continue;
+        }
         
-        while(theTask != NULL &&
-              !theThreadShouldStop)  // Stop processing tasks if we're shutting down
+        while(theTask != NULL)
         {
             EFF_Task* theNextTask = theTask->mNext;
             
             EFFAssert(!theTask->IsComplete(),
-                      "EFF_TaskQueue::WorkerThreadProc: Cannot process already completed task (ID %d)",
-                      theTask->GetTaskID());
+                      "EFF_TaskQueue::WorkerThreadProc: Cannot process already completed task (%s)",
+                      theTask->GetName());
             
             EFFAssert(theTask != theNextTask,
-                      "EFF_TaskQueue::WorkerThreadProc: EFF_Task %p (ID %d) was added to %s multiple times. arg1=%llu arg2=%llu",
+                      "EFF_TaskQueue::WorkerThreadProc: EFF_Task %p (%s) was added to %s multiple times.",
                       theTask,
-                      theTask->GetTaskID(),
-                      (inTasks == &mRealTimeThreadTasks ? "mRealTimeThreadTasks" : "mNonRealTimeThreadTasks"),
-                      theTask->GetArg1(),
-                      theTask->GetArg2());
+                      theTask->GetName(),
+                      (inWorker.IsRealTime() ? "the realtime worker" : "a non-realtime worker"));
+            
+#if DEBUG  // Always checks the condition, if for some reason the compiler doesn't optimise it away, even in release builds
+            if(inWorker.IsRealTime())
+            {
+                AssertCurrentThreadIsRTWorkerThread("EFF_TaskQueue::WorkerThreadProc");
+            }
+            else
+            {
+                Assert(inWorker.mThread.IsCurrentThread(),
+                       "Non-realtime tasks should only be run on their non-realtime worker thread.");
+                Assert(inWorker.mThread.IsTimeShareThread(),
+                       "Non-realtime worker threads should not be in a time-constraint priority band.");
+            }
+#endif
             
             // Process the task
-            theThreadShouldStop = inProcessTask(theTask);
+            theTask->Run();
             
             // If the task was queued synchronously, let the thread that queued it know we're finished
             if(theTask->IsSync())
@@ -394,21 +346,20 @@ void    EFF_TaskQueue::WorkerThreadProc(semaphore_t inWorkQueuedSemaphore,
                 CAMemoryBarrier();
                 theTask->MarkCompleted();
                 
-                // Signal any threads waiting for their task to be processed.
+                // Notify any threads waiting for their task to be processed.
                 //
-                // We use semaphore_signal_all instead of semaphore_signal to avoid a race condition in QueueSync.
-                // It's possible for threads calling QueueSync to wait on the semaphore in an order
+                // We use NotifyAll instead of Notify to avoid a race condition in QueueSync.
+                // It's possible for threads calling QueueSync to wait in an order
                 // different to the order of the tasks they just added to the queue.
                 // So after each task is completed we have every waiting thread check if it was theirs.
                 //
-                // Note that semaphore_signal_all has an implicit barrier.
-                theError = semaphore_signal_all(inSyncTaskCompletedSemaphore);
-                EFF_Utils::ThrowIfMachError("EFF_TaskQueue::WorkerThreadProc", "semaphore_signal_all", theError);
+                // Note that notifying has an implicit barrier.
+                inWorker.mSyncTaskCompleted.NotifyAll();
             }
-            else if(inFreeList != NULL)
+            else if(inWorker.mFreeList != NULL)
             {
                 // After completing an async task, move it to the free list so the memory can be reused
-                inFreeList->push_atomic(theTask);
+                inWorker.mFreeList->push_atomic(theTask);
             }
             
             theTask = theNextTask;
@@ -416,103 +367,4 @@ void    EFF_TaskQueue::WorkerThreadProc(semaphore_t inWorkQueuedSemaphore,
     }
 }
 
-// Returns true if the task is to stop the thread, false otherwise
-bool    EFF_TaskQueue::ProcessRealTimeThreadTask(EFF_Task* inTask)
-{
-    AssertCurrentThreadIsRTWorkerThread("EFF_TaskQueue::ProcessRealTimeThreadTask");
-
-    switch(inTask->GetTaskID())
-    {
-        case kEFFTaskStopWorkerThread:
-            DebugMsg("EFF_TaskQueue::ProcessRealTimeThreadTask: Stopping");
-            return true;
-            
-        case kEFFTaskSwapClientShadowMaps:
-            {
-                DebugMsg("EFF_TaskQueue::ProcessRealTimeThreadTask: Swapping the shadow maps in EFF_ClientMap");
-                EFF_ClientMap* theClientMap = reinterpret_cast<EFF_ClientMap*>(inTask->GetArg1());
-                EFF_ClientTasks::SwapInShadowMapsRT(theClientMap);
-            }
-            break;
-            
-        default:
-            Assert(false, "EFF_TaskQueue::ProcessRealTimeThreadTask: Unexpected task ID");
-            break;
-    }
-    
-    return false;
-}
-
-// Returns true if the task is to stop the thread, false otherwise
-bool    EFF_TaskQueue::ProcessNonRealTimeThreadTask(EFF_Task* inTask)
-{
-#if DEBUG  // Always checks the condition, if for some reason the compiler doesn't optimise it away, even in release builds
-    Assert(mNonRealTimeThread.IsCurrentThread(),
-           "ProcessNonRealTimeThreadTask should only be called on the non-realtime worker thread.");
-    Assert(mNonRealTimeThread.IsTimeShareThread(),
-           "mNonRealTimeThread should not be in a time-constraint priority band.");
-#endif
-    
-    switch(inTask->GetTaskID())
-    {
-        case kEFFTaskStopWorkerThread:
-            DebugMsg("EFF_TaskQueue::ProcessNonRealTimeThreadTask: Stopping");
-            return true;
-            
-        case kEFFTaskStartClientIO:
-            DebugMsg("EFF_TaskQueue::ProcessNonRealTimeThreadTask: Processing kEFFTaskStartClientIO");
-            try
-            {
-                EFF_Clients* theClients = reinterpret_cast<EFF_Clients*>(inTask->GetArg1());
-                bool didStartIO = EFF_ClientTasks::StartIONonRT(theClients, static_cast<UInt32>(inTask->GetArg2()));
-                inTask->SetReturnValue(didStartIO);
-            }
-            // TODO: Catch the other types of exceptions EFF_ClientTasks::StartIONonRT can throw here as well.
-            // Set the task's return value (rather than rethrowing) so the exceptions can be handled
-            // if the task was queued sync.
-            // Then QueueSync_StartClientIO can throw some exception and EFF_StartIO can return
-            // an appropriate error code to the HAL, instead of the driver just crashing.
-            // Do the same for the kEFFTaskStopClientIO case below. And should we set a return value in the catch block for
-            // EFF_InvalidClientException as well, so it can also be rethrown in QueueSync_StartClientIO and then handled?
-            catch(EFF_InvalidClientException)
-            {
-                DebugMsg("EFF_TaskQueue::ProcessNonRealTimeThreadTask: Ignoring EFF_InvalidClientException thrown by StartIONonRT. %s",
-                         "It's possible the client was removed before this task was processed.");
-            }
-            break;
-
-        case kEFFTaskStopClientIO:
-            DebugMsg("EFF_TaskQueue::ProcessNonRealTimeThreadTask: Processing kEFFTaskStopClientIO");
-            try
-            {
-                EFF_Clients* theClients = reinterpret_cast<EFF_Clients*>(inTask->GetArg1());
-                bool didStopIO = EFF_ClientTasks::StopIONonRT(theClients, static_cast<UInt32>(inTask->GetArg2()));
-                inTask->SetReturnValue(didStopIO);
-            }
-            catch(EFF_InvalidClientException)
-            {
-                DebugMsg("EFF_TaskQueue::ProcessNonRealTimeThreadTask: Ignoring EFF_InvalidClientException thrown by StopIONonRT. %s",
-                         "It's possible the client was removed before this task was processed.");
-            }
-            break;
-
-        case kEFFTaskSendPropertyNotification:
-            DebugMsg("EFF_TaskQueue::ProcessNonRealTimeThreadTask: Processing kEFFTaskSendPropertyNotification");
-            {
-                AudioObjectPropertyAddress thePropertyAddress[] = {
-                    { static_cast<UInt32>(inTask->GetArg1()),
-                        kAudioObjectPropertyScopeGlobal,
-                        kAudioObjectPropertyElementMaster } };
-                EFF_PlugIn::Host_PropertiesChanged(static_cast<AudioObjectID>(inTask->GetArg2()), 1, thePropertyAddress);
-            }
-            break;
-            
-        default:
-            Assert(false, "EFF_TaskQueue::ProcessNonRealTimeThreadTask: Unexpected task ID");
-            break;
-    }
-    
-    return false;
-}
-
 #pragma clang assume_nonnull end
@@ -9,24 +9,32 @@
 #ifndef EFF_TaskQueue_h
 #define EFF_TaskQueue_h
 
+// Local Includes
+#include "EFF_EventCount.h"
+#include "EFF_WorkerThread.h"
+
 // PublicUtility Includes
-#include "CAPThread.h"
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wsign-conversion"
 #include "CAAtomicStack.h"
 #pragma clang diagnostic pop
 
 // STL Includes
-#include <functional>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
 
 // System Includes
-#include <mach/semaphore.h>
 #include <CoreAudio/AudioHardware.h>
 
 
 // Forward declarations
-class EFF_Clients;
 class EFF_ClientMap;
+class EFF_SpectrumAnalyzer;
+class EFF_Convolver;
+class EFF_Automation;
 
 
 #pragma clang assume_nonnull begin
@@ -34,10 +42,16 @@ class EFF_ClientMap;
 //==================================================================================================
 //    EFF_TaskQueue
 //
-//  This class has two worker threads, one with real-time priority and one with default priority,
-//  that tasks can be dispatched to. The two main use cases are dispatching work from a real-time
-//  thread to be done async, and dispatching work from a non-real-time thread that needs to run on
-//  a real-time thread to avoid priority inversions.
+//  Dispatches tasks to worker threads, one with real-time priority and the others with default
+//  priority. The two main use cases are dispatching work from a real-time thread to be done async,
+//  and dispatching work from a non-real-time thread that needs to run on a real-time thread to
+//  avoid priority inversions.
+//
+//  The worker threads are shared by every EFF_TaskQueue in the driver, so the number of threads
+//  doesn't depend on the number of devices. Each EFF_TaskQueue is an ordering domain: it sends all
+//  of its non-real-time tasks to the same worker thread, which runs them in the order they were
+//  queued, so e.g. a device's UpdateConvolver tasks can't be reordered. Tasks from
+//  different EFF_TaskQueues can run concurrently.
 //==================================================================================================
 
 class EFF_TaskQueue
@@ -47,44 +61,56 @@ class EFF_TaskQueue
 #pragma mark Internal Definitions
     
 private:
-    enum EFF_TaskID {
-        kEFFTaskUninitialized,
-        kEFFTaskStopWorkerThread,
-
-        // Realtime thread only
-        kEFFTaskSwapClientShadowMaps,
-
-        // Non-realtime thread only
-        kEFFTaskStartClientIO,
-        kEFFTaskStopClientIO,
-        kEFFTaskSendPropertyNotification
-    };
-
+    // A task is a closure, stored inline so queueing one never allocates memory, and a function to
+    // call it, so the worker threads don't need to know what the tasks do. To add a new kind of
+    // task, just queue a lambda.
+    //
+    // The closure's captures have to fit in kMaxClosureSize bytes and be trivially copyable and
+    // destructible, since tasks are copied into the free list's preallocated tasks as plain memory
+    // and are never destroyed. So capture pointers and small values, not e.g. std::strings or
+    // shared_ptrs. Both are checked at compile time.
     class EFF_Task
     {
     public:
-                                        EFF_Task(EFF_TaskID inTaskID    = kEFFTaskUninitialized,
-                                                 bool inIsSync          = false,
-                                                 UInt64 inArg1          = 0,
-                                                 UInt64 inArg2          = 0)
+        static constexpr size_t         kMaxClosureSize     = 4 * sizeof(void*);
+        
+                                        EFF_Task()
                                         :
                                             mNext(NULL),
-                                            mTaskID(inTaskID),
-                                            mIsSync(inIsSync),
-                                            mArg1(inArg1),
-                                            mArg2(inArg2) { };
+                                            mName("uninitialized"),
+                                            mInvoke(NULL),
+                                            mIsSync(false) { };
         
-        EFF_TaskID                      GetTaskID()         { return mTaskID; }
+        // inName is only used for logging, so it has to be a string literal. inClosure can return
+        // an integer, which QueueSync returns, or void.
+        template <typename Closure>
+                                        EFF_Task(const char* inName, bool inIsSync, Closure inClosure)
+                                        :
+                                            mNext(NULL),
+                                            mName(inName),
+                                            mInvoke(&Invoke<Closure>),
+                                            mIsSync(inIsSync)
+        {
+            static_assert(sizeof(Closure) <= kMaxClosureSize,
+                          "EFF_Task: The closure's captures are too large to store inline");
+            static_assert(alignof(Closure) <= alignof(UInt64),
+                          "EFF_Task: The closure's captures are over-aligned");
+            static_assert(std::is_trivially_copyable<Closure>::value &&
+                              std::is_trivially_destructible<Closure>::value,
+                          "EFF_Task: The closure's captures have to be trivially copyable and destructible");
+            
+            new (mClosure) Closure(inClosure);
+        }
+        
+        const char*                     GetName()           { return mName; }
         
         // True if the thread that queued this task is blocking until the task is completed
         bool                            IsSync()            { return mIsSync; }
         
-        UInt64                          GetArg1()           { return mArg1; }
-        UInt64                          GetArg2()           { return mArg2; }
+        // Calls the closure and stores its return value, if it has one.
+        void                            Run()               { mReturnValue = mInvoke(mClosure); }
         
         UInt64                          GetReturnValue()    { return mReturnValue; }
-        void                            SetReturnValue(UInt64 inReturnValue)
-                                                            { mReturnValue = inReturnValue; }
         
         bool                            IsComplete()        { return mIsComplete; }
         void                            MarkCompleted()     { mIsComplete = true; }
@@ -94,19 +120,39 @@ private:
         EFF_Task* __nullable            mNext;
         
     private:
-        EFF_TaskID                      mTaskID;
+        typedef UInt64                  (*Invoker)(void* inClosure);
+        
+        template <typename Closure>
+        static UInt64                   Invoke(void* inClosure)
+        {
+            Closure& theClosure = *static_cast<Closure*>(inClosure);
+            
+            if constexpr(std::is_void<decltype(theClosure())>::value)
+            {
+                theClosure();
+                return INT64_MAX;
+            }
+            else
+            {
+                return static_cast<UInt64>(theClosure());
+            }
+        }
+        
+        const char*                     mName;
+        Invoker __nullable              mInvoke;
         bool                            mIsSync;
-        UInt64                          mArg1;
-        UInt64                          mArg2;
         UInt64                          mReturnValue        = INT64_MAX;
         bool                            mIsComplete         = false;
+        alignas(UInt64) unsigned char   mClosure[kMaxClosureSize];
     };
 
     
 #pragma mark Construction/Destruction
 
 public:
+    // Cheap. Doesn't create any threads.
     EFF_TaskQueue();
+    // Waits for the tasks already queued to finish, since they can refer to the queue's owner.
     ~EFF_TaskQueue();
     // Disallow copying
     EFF_TaskQueue(const EFF_TaskQueue&)             = delete;
@@ -124,53 +170,102 @@ public:
     void                        QueueAsync_SendPropertyNotification(AudioObjectPropertySelector inProperty,
                                                                     AudioObjectID inDeviceID);
     
-    // Set/unset a client's is-doing-IO flag
-    inline bool                 QueueSync_StartClientIO(EFF_Clients* inClients, UInt32 inClientID)
-                                    { return Queue_UpdateClientIOState(true, inClients, inClientID, true); }
-    inline bool                 QueueSync_StopClientIO(EFF_Clients* inClients, UInt32 inClientID)
-                                    { return Queue_UpdateClientIOState(true, inClients, inClientID, false); }
+    // Runs EFF_SpectrumAnalyzer::ComputeSpectrumNonRT. Real-time safe.
+    void                        QueueAsync_ComputeSpectrum(EFF_SpectrumAnalyzer* inSpectrumAnalyzer);
     
-    inline void                 QueueAsync_StartClientIO(EFF_Clients* inClients, UInt32 inClientID)
-                                    { Queue_UpdateClientIOState(false, inClients, inClientID, true); }
-    inline void                 QueueAsync_StopClientIO(EFF_Clients* inClients, UInt32 inClientID)
-                                    { Queue_UpdateClientIOState(false, inClients, inClientID, false); }
+    // Runs EFF_Convolver::UpdateNonRT. Real-time safe.
+    void                        QueueAsync_UpdateConvolver(EFF_Convolver* inConvolver);
     
-    void                        AssertCurrentThreadIsRTWorkerThread(const char* inCallerMethodName);
+    // Runs EFF_Automation::CommitNonRT. Real-time safe.
+    void                        QueueAsync_CommitAutomation(EFF_Automation* inAutomation);
+    
+    static void                 AssertCurrentThreadIsRTWorkerThread(const char* inCallerMethodName);
 
     
 #pragma mark Implementation
 
 private:
-    static UInt32               NanosToAbsoluteTime(UInt32 inNanos);
+    // A worker thread and the tasks queued for it. Workers are never destroyed, so their threads
+    // never have to be stopped.
+    class EFF_Worker
+    {
+    public:
+        // A real-time worker.
+                                        EFF_Worker(UInt32 inComputation, UInt32 inConstraint);
+        // A non-real-time worker. Its async tasks are allocated from, and returned to, inFreeList.
+        explicit                        EFF_Worker(TAtomicStack2<EFF_Task>& inFreeList);
+                                        EFF_Worker(const EFF_Worker&)               = delete;
+        EFF_Worker&                     operator=(const EFF_Worker&)                = delete;
+
+        bool                            IsRealTime() const  { return mFreeList == NULL; }
+
+        EFF_WorkerThread                mThread;
+
+        // We use event counts for communication with the worker threads because notifying them is
+        // real-time safe and, while the worker is busy, doesn't need a system call.
 
-    bool                        Queue_UpdateClientIOState(bool          inSync,
-                                                          EFF_Clients*  inClients,
-                                                          UInt32        inClientID,
-                                                          bool          inDoingIO);
+        // Notified to tell the worker thread when there are tasks for it to process.
+        EFF_EventCount                  mWorkQueued;
+        // Notified when the worker thread completes a task, if the thread that queued that task is
+        // blocking on it.
+        EFF_EventCount                  mSyncTaskCompleted;
 
-    UInt64                      QueueSync(EFF_TaskID    inTaskID,
+        // When a task is queued for the worker, it's added to this. Using TAtomicStack lets us
+        // safely add and remove tasks on real-time threads.
+        //
+        // We use TAtomicStack rather than TAtomicStack2 because we need pop_all_reversed() to make
+        // sure we process the tasks in order.
+        TAtomicStack<EFF_Task>          mTasks;
+
+        // Null for the real-time worker, which only runs sync tasks.
+        TAtomicStack2<EFF_Task>* __nullable mFreeList;
+    };
+
+    // The worker threads and the memory for their tasks, shared by every EFF_TaskQueue.
+    struct EFF_WorkerPool
+    {
+                                        EFF_WorkerPool();
+
+        // The number of tasks to pre-allocate and add to the free list. Should be large enough that
+        // the free list is never emptied. (At least not while IO could be running.)
+        static const UInt32             kNonRealTimeTaskBufferSize = 512;
+        // Realtime threads can't safely allocate memory, so when they queue a task the memory for
+        // it comes from this free list. We pre-allocate as many tasks as they should ever need.
+        // (But if the free list runs out of tasks somehow the realtime thread will allocate a new
+        // one.)
+        //
+        // There's a similar free list used in Apple's CAThreadSafeList.h.
+        //
+        // We can use TAtomicStack2 instead of TAtomicStack because we never call pop_all on the
+        // free list.
+        TAtomicStack2<EFF_Task>         mNonRealTimeTasksFreeList;
+
+        // Our real-time tasks do very little work and never block for long, so one thread is
+        // enough for them.
+        EFF_Worker                      mRealTimeWorker;
+
+        // More than one so a slow task for one device, e.g. updating its convolver, doesn't hold up
+        // the others' tasks. Each EFF_TaskQueue is given one of these, in turn.
+        static const UInt32             kNumNonRealTimeWorkers = 2;
+        std::unique_ptr<EFF_Worker>     mNonRealTimeWorkers[kNumNonRealTimeWorkers];
+        std::atomic<UInt32>             mNextNonRealTimeWorker;
+    };
+
+    // Creates the worker pool and starts its threads the first time it's called. Thread safe.
+    static EFF_WorkerPool&      GetWorkerPool();
+
+    // Returns the closure's return value, or INT64_MAX if it doesn't return anything.
+    template <typename Closure>
+    UInt64                      QueueSync(const char*   inTaskName,
                                           bool          inRunOnRealtimeThread,
-                                          UInt64        inTaskArg1 = 0,
-                                          UInt64        inTaskArg2 = 0);
+                                          Closure       inClosure);
 
     void                        QueueOnNonRealtimeThread(EFF_Task inTask);
     
     static void* __nullable     RealTimeThreadProc(void* inRefCon);
     static void* __nullable     NonRealTimeThreadProc(void* inRefCon);
 
-    void                        WorkerThreadProc(semaphore_t inWorkQueuedSemaphore,
-                                                 semaphore_t inSyncTaskCompletedSemaphore,
-                                                 TAtomicStack<EFF_Task>* inTasks,
-                                                 TAtomicStack2<EFF_Task>* __nullable inFreeList,
-                                                 std::function<bool(EFF_Task*)> inProcessTask);
-    
-    // These return true when the thread should be stopped
-    bool                        ProcessRealTimeThreadTask(EFF_Task* inTask);
-    bool                        ProcessNonRealTimeThreadTask(EFF_Task* inTask);
-    
-    // The worker threads that perform the queued tasks
-    CAPThread                   mRealTimeThread;
-    CAPThread                   mNonRealTimeThread;
+    static void                 WorkerThreadProc(EFF_Worker& inWorker);
     
     // The approximate amount of time we'll need whenever our real-time thread is scheduled.
     // This is currently just set to the minimum (see sched_prim.c) because our real-time tasks do
@@ -179,40 +274,13 @@ private:
     // speed? Or even calculate them from the system's CPU/RAM speed? Note that none of our tasks actually have
     // a deadline (though that might change). They just have to run with real-time priority to avoid causing
     // priority inversions on the IO thread.
-    static const UInt32        kRealTimeThreadNominalComputationNs = 50 * NSEC_PER_USEC;
+    static const UInt32        kRealTimeThreadNominalComputationNs = 50 * 1000;
     // The maximum amount of time the real-time thread can take to finish its computation after being scheduled.
-    static const UInt32        kRealTimeThreadMaximumComputationNs = 60 * NSEC_PER_USEC;
-    
-    // We use Mach semaphores for communication with the worker threads because signalling them is real-time safe.
-    
-    // Signalled to tell the worker threads when there are tasks for them process.
-    semaphore_t                mRealTimeThreadWorkQueuedSemaphore;
-    semaphore_t                mNonRealTimeThreadWorkQueuedSemaphore;
-    // Signalled when a worker thread completes a task, if the thread that queued that task is blocking on it.
-    semaphore_t                mRealTimeThreadSyncTaskCompletedSemaphore;
-    semaphore_t                mNonRealTimeThreadSyncTaskCompletedSemaphore;
+    static const UInt32        kRealTimeThreadMaximumComputationNs = 60 * 1000;
     
-    // When a task is queued we add it to one of these, depending on which worker thread it will run on. Using
-    // TAtomicStack lets us safely add and remove tasks on real-time threads.
-    //
-    // We use TAtomicStack rather than TAtomicStack2 because we need pop_all_reversed() to make sure
-    // we process the tasks in order.
-    // (It might have been better to use OSAtomicFifoEnqueue/OSAtomicFifoDequeue, but I only
-    // recently found out about them.)
-    TAtomicStack<EFF_Task>      mRealTimeThreadTasks;
-    TAtomicStack<EFF_Task>      mNonRealTimeThreadTasks;
-    
-    // The number of tasks to pre-allocate and add to the non-realtime task free list. Should be large enough that
-    // the free list is never emptied. (At least not while IO could be running.)
-    static const UInt32         kNonRealTimeThreadTaskBufferSize = 512;
-    // Realtime threads can't safely allocate memory, so when they queue a task the memory for it comes from this
-    // free list. We pre-allocate as many tasks as they should ever need in the constructor. (But if the free list
-    // runs out of tasks somehow the realtime thread will allocate a new one.)
-    //
-    // There's a similar free list used in Apple's CAThreadSafeList.h.
-    //
-    // We can use TAtomicStack2 instead of TAtomicStack because we never call pop_all on the free list.
-    TAtomicStack2<EFF_Task>     mNonRealTimeThreadTasksFreeList;
+    EFF_WorkerPool&             mWorkerPool;
+    // The worker that runs this queue's non-real-time tasks.
+    EFF_Worker&                 mNonRealTimeWorker;
 };
 
 #pragma clang assume_nonnull end
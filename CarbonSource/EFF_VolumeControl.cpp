@@ -14,6 +14,7 @@
 
 // Local Includes
 #include "EFF_PlugIn.h"
+#include "EFF_PropertyTable.h"
 
 // PublicUtility Includes
 #include "CAException.h"
@@ -31,6 +32,22 @@
 
 #pragma clang assume_nonnull begin
 
+#pragma mark Property Table
+
+namespace
+{
+    constexpr EFF_PropertyInfo kVolumeControlPropertyList[] =
+    {
+        EFF_Property(kAudioLevelControlPropertyScalarValue,             sizeof(Float32), EFF_PropertyInfo::kSettable),
+        EFF_Property(kAudioLevelControlPropertyDecibelValue,            sizeof(Float32), EFF_PropertyInfo::kSettable),
+        EFF_Property(kAudioLevelControlPropertyDecibelRange,            sizeof(AudioValueRange)),
+        EFF_Property(kAudioLevelControlPropertyConvertScalarToDecibels, sizeof(Float32)),
+        EFF_Property(kAudioLevelControlPropertyConvertDecibelsToScalar, sizeof(Float32))
+    };
+
+    constexpr auto kVolumeControlProperties = EFF_MakePropertyTable(kVolumeControlPropertyList);
+}
+
 #pragma mark Construction/Destruction
 
 EFF_VolumeControl::EFF_VolumeControl(AudioObjectID inObjectID,
@@ -47,14 +64,20 @@ EFF_VolumeControl::EFF_VolumeControl(AudioObjectID inObjectID,
     mMutex("Volume Control"),
     mVolumeRaw(kDefaultMinRawVolume),
     mAmplitudeGain(0.0f),
+    mNotificationPending(false),
     mMinVolumeRaw(kDefaultMinRawVolume),
     mMaxVolumeRaw(kDefaultMaxRawVolume),
     mMinVolumeDb(kDefaultMinDbVolume),
     mMaxVolumeDb(kDefaultMaxDbVolume),
+    mVolumeCurve([this] {
+        // Setup the volume curve with the one range
+        CAVolumeCurve theCurve;
+        theCurve.AddRange(mMinVolumeRaw, mMaxVolumeRaw, mMinVolumeDb, mMaxVolumeDb);
+        return theCurve;
+    }()),
+    mVolumeCurveTable(mVolumeCurve),
     mWillApplyVolumeToAudio(false)
 {
-    // Setup the volume curve with the one range
-    mVolumeCurve.AddRange(mMinVolumeRaw, mMaxVolumeRaw, mMinVolumeDb, mMaxVolumeDb);
 }
 
 #pragma mark Property Operations
@@ -65,24 +88,14 @@ bool    EFF_VolumeControl::HasProperty(AudioObjectID inObjectID,
 {
     CheckObjectID(inObjectID);
 
-    bool theAnswer = false;
+    const EFF_PropertyInfo* theInfo = kVolumeControlProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioLevelControlPropertyScalarValue:
-        case kAudioLevelControlPropertyDecibelValue:
-        case kAudioLevelControlPropertyDecibelRange:
-        case kAudioLevelControlPropertyConvertScalarToDecibels:
-        case kAudioLevelControlPropertyConvertDecibelsToScalar:
-            theAnswer = true;
-            break;
-
-        default:
-            theAnswer = EFF_Control::HasProperty(inObjectID, inClientPID, inAddress);
-            break;
-    };
+        return kVolumeControlProperties.HasProperty(*theInfo, inAddress);
+    }
 
-    return theAnswer;
+    return EFF_Control::HasProperty(inObjectID, inClientPID, inAddress);
 }
 
 bool    EFF_VolumeControl::IsPropertySettable(AudioObjectID inObjectID,
@@ -91,27 +104,14 @@ bool    EFF_VolumeControl::IsPropertySettable(AudioObjectID inObjectID,
 {
     CheckObjectID(inObjectID);
 
-    bool theAnswer = false;
+    const EFF_PropertyInfo* theInfo = kVolumeControlProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioLevelControlPropertyDecibelRange:
-        case kAudioLevelControlPropertyConvertScalarToDecibels:
-        case kAudioLevelControlPropertyConvertDecibelsToScalar:
-            theAnswer = false;
-            break;
-
-        case kAudioLevelControlPropertyScalarValue:
-        case kAudioLevelControlPropertyDecibelValue:
-            theAnswer = true;
-            break;
-
-        default:
-            theAnswer = EFF_Control::IsPropertySettable(inObjectID, inClientPID, inAddress);
-            break;
-    };
+        return kVolumeControlProperties.IsPropertySettable(*theInfo);
+    }
 
-    return theAnswer;
+    return EFF_Control::IsPropertySettable(inObjectID, inClientPID, inAddress);
 }
 
 UInt32  EFF_VolumeControl::GetPropertyDataSize(AudioObjectID inObjectID,
@@ -122,40 +122,18 @@ UInt32  EFF_VolumeControl::GetPropertyDataSize(AudioObjectID inObjectID,
 {
     CheckObjectID(inObjectID);
 
-    UInt32 theAnswer = 0;
+    const EFF_PropertyInfo* theInfo = kVolumeControlProperties.Find(inAddress.mSelector);
 
-    switch(inAddress.mSelector)
+    if(theInfo != nullptr)
     {
-        case kAudioLevelControlPropertyScalarValue:
-            theAnswer = sizeof(Float32);
-            break;
-
-        case kAudioLevelControlPropertyDecibelValue:
-            theAnswer = sizeof(Float32);
-            break;
-
-        case kAudioLevelControlPropertyDecibelRange:
-            theAnswer = sizeof(AudioValueRange);
-            break;
-
-        case kAudioLevelControlPropertyConvertScalarToDecibels:
-            theAnswer = sizeof(Float32);
-            break;
-
-        case kAudioLevelControlPropertyConvertDecibelsToScalar:
-            theAnswer = sizeof(Float32);
-            break;
-
-        default:
-            theAnswer = EFF_Control::GetPropertyDataSize(inObjectID,
-                                                         inClientPID,
-                                                         inAddress,
-                                                         inQualifierDataSize,
-                                                         inQualifierData);
-            break;
-    };
+        return theInfo->dataSize;
+    }
 
-    return theAnswer;
+    return EFF_Control::GetPropertyDataSize(inObjectID,
+                                            inClientPID,
+                                            inAddress,
+                                            inQualifierDataSize,
+                                            inQualifierData);
 }
 
 void    EFF_VolumeControl::GetPropertyData(AudioObjectID inObjectID,
@@ -181,7 +159,7 @@ void    EFF_VolumeControl::GetPropertyData(AudioObjectID inObjectID,
 
                 CAMutex::Locker theLocker(mMutex);
 
-                *reinterpret_cast<Float32*>(outData) = mVolumeCurve.ConvertRawToScalar(mVolumeRaw);
+                *reinterpret_cast<Float32*>(outData) = mVolumeCurveTable.ConvertRawToScalar(mVolumeRaw);
                 outDataSize = sizeof(Float32);
             }
             break;
@@ -196,7 +174,7 @@ void    EFF_VolumeControl::GetPropertyData(AudioObjectID inObjectID,
 
                 CAMutex::Locker theLocker(mMutex);
 
-                *reinterpret_cast<Float32*>(outData) = mVolumeCurve.ConvertRawToDB(mVolumeRaw);
+                *reinterpret_cast<Float32*>(outData) = mVolumeCurveTable.ConvertRawToDB(mVolumeRaw);
                 outDataSize = sizeof(Float32);
             }
             break;
@@ -225,7 +203,8 @@ void    EFF_VolumeControl::GetPropertyData(AudioObjectID inObjectID,
                 Float32 theVolumeValue = *reinterpret_cast<Float32*>(outData);
                 theVolumeValue = std::min(1.0f, std::max(0.0f, theVolumeValue));
 
-                // do the conversion
+                // do the conversion, with the curve locked
+                CAMutex::Locker theLocker(mMutex);
                 *reinterpret_cast<Float32*>(outData) =
                         mVolumeCurve.ConvertScalarToDB(theVolumeValue);
 
@@ -247,7 +226,8 @@ void    EFF_VolumeControl::GetPropertyData(AudioObjectID inObjectID,
                 Float32 theVolumeValue = *reinterpret_cast<Float32*>(outData);
                 theVolumeValue = std::min(mMaxVolumeDb, std::max(mMinVolumeDb, theVolumeValue));
 
-                // do the conversion
+                // do the conversion, with the curve locked
+                CAMutex::Locker theLocker(mMutex);
                 *reinterpret_cast<Float32*>(outData) =
                         mVolumeCurve.ConvertDBToScalar(theVolumeValue);
 
@@ -327,11 +307,28 @@ void    EFF_VolumeControl::SetVolumeScalar(Float32 inNewVolumeScalar)
     // implies that the dB value changes too.
     inNewVolumeScalar = std::min(1.0f, std::max(0.0f, inNewVolumeScalar));
 
+    // Hold the mutex until the volume is stored so the curve can't change in between. (SetVolumeRaw
+    // locks it again, which CAMutex allows.)
+    CAMutex::Locker theLocker(mMutex);
+
     // Store the new volume.
-    SInt32 theNewVolumeRaw = mVolumeCurve.ConvertScalarToRaw(inNewVolumeScalar);
+    SInt32 theNewVolumeRaw = mVolumeCurveTable.ConvertScalarToRaw(inNewVolumeScalar);
     SetVolumeRaw(theNewVolumeRaw);
 }
 
+Float32    EFF_VolumeControl::ConvertScalarToAmplitudeGain(Float32 inVolumeScalar) const
+{
+    // The same conversions as SetVolumeScalar and SetVolumeRaw.
+    inVolumeScalar = std::min(1.0f, std::max(0.0f, inVolumeScalar));
+
+    CAMutex::Locker theLocker(mMutex);
+
+    SInt32 theVolumeRaw = mVolumeCurveTable.ConvertScalarToRaw(inVolumeScalar);
+    theVolumeRaw = std::min(std::max(mMinVolumeRaw, theVolumeRaw), mMaxVolumeRaw);
+
+    return ConvertRawToAmplitudeGain(theVolumeRaw);
+}
+
 void    EFF_VolumeControl::SetVolumeDb(Float32 inNewVolumeDb)
 {
     // For the dB value, we first convert it to a raw value since that is how the value is tracked.
@@ -340,11 +337,25 @@ void    EFF_VolumeControl::SetVolumeDb(Float32 inNewVolumeDb)
     // Clamp the new volume.
     inNewVolumeDb = std::min(mMaxVolumeDb, std::max(mMinVolumeDb, inNewVolumeDb));
 
+    // As in SetVolumeScalar.
+    CAMutex::Locker theLocker(mMutex);
+
     // Store the new volume.
-    SInt32 theNewVolumeRaw = mVolumeCurve.ConvertDBToRaw(inNewVolumeDb);
+    SInt32 theNewVolumeRaw = mVolumeCurveTable.ConvertDBToRaw(inNewVolumeDb);
     SetVolumeRaw(theNewVolumeRaw);
 }
 
+void    EFF_VolumeControl::SetVolumeCurveTransferFunction(UInt32 inTransferFunction)
+{
+    CAMutex::Locker theLocker(mMutex);
+
+    mVolumeCurve.SetTransferFunction(inTransferFunction);
+    mVolumeCurveTable = EFF_VolumeCurveTable(mVolumeCurve);
+
+    // The same raw volume gives a different gain on the new curve.
+    mAmplitudeGain.store(ConvertRawToAmplitudeGain(mVolumeRaw), std::memory_order_release);
+}
+
 void    EFF_VolumeControl::SetWillApplyVolumeToAudio(bool inWillApplyVolumeToAudio)
 {
     mWillApplyVolumeToAudio = inWillApplyVolumeToAudio;
@@ -358,20 +369,27 @@ bool    EFF_VolumeControl::WillApplyVolumeToAudioRT() const
 }
 
 void    EFF_VolumeControl::ApplyVolumeToAudioRT(Float32* ioBuffer, UInt32 inBufferFrameSize) const
+{
+    ApplyVolumeToAudioRT(ioBuffer, inBufferFrameSize, GetAmplitudeGainRT());
+}
+
+void    EFF_VolumeControl::ApplyVolumeToAudioRT(Float32* ioBuffer,
+                                                UInt32 inBufferFrameSize,
+                                                Float32 inAmplitudeGain) const
 {
     ThrowIf(!mWillApplyVolumeToAudio,
             CAException(kAudioHardwareIllegalOperationError),
             "EFF_VolumeControl::ApplyVolumeToAudioRT: This control doesn't process audio data");
 
     // Don't bother if the change is very unlikely to be perceptible.
-    if((mAmplitudeGain < 0.99f) || (mAmplitudeGain > 1.01f))
+    if((inAmplitudeGain < 0.99f) || (inAmplitudeGain > 1.01f))
     {
         // Apply the amount of gain/loss for the current volume to the audio signal by multiplying
         // each sample. This call to vDSP_vsmul is equivalent to
         //
         // for(UInt32 i = 0; i < inBufferFrameSize * 2; i++)
         // {
-        //     ioBuffer[i] *= mAmplitudeGain;
+        //     ioBuffer[i] *= inAmplitudeGain;
         // }
         //
         // but a bit faster on processors with newer SIMD instructions. However, it shouldn't take
@@ -382,7 +400,7 @@ void    EFF_VolumeControl::ApplyVolumeToAudioRT(Float32* ioBuffer, UInt32 inBuff
         // output buffers, but then we'd have to copy the data into the output buffer when the
         // volume is at 1.0. With our current use of this class, most people will leave the volume
         // at 1.0, so it wouldn't be worth it.
-        vDSP_vsmul(ioBuffer, 1, &mAmplitudeGain, ioBuffer, 1, inBufferFrameSize * 2);
+        vDSP_vsmul(ioBuffer, 1, &inAmplitudeGain, ioBuffer, 1, inBufferFrameSize * 2);
     }
 }
 
@@ -400,50 +418,68 @@ void    EFF_VolumeControl::SetVolumeRaw(SInt32 inNewVolumeRaw)
     {
         mVolumeRaw = inNewVolumeRaw;
 
-        // CAVolumeCurve deals with volumes in three different scales: scalar, dB and raw. Raw
-        // volumes are the number of steps along the dB curve, so dB and raw volumes are linearly
-        // related.
-        //
-        // macOS uses the scalar volume to set the position of its volume sliders for the
-        // device. We have to set the scalar volume to the position of our volume slider for a
-        // device (more specifically, a linear mapping of it onto [0,1]) or macOS's volume sliders
-        // or it will work differently to our own.
-        //
-        // When we set a new slider position as the device's scalar volume, we convert it to raw
-        // with CAVolumeCurve::ConvertScalarToRaw, which will "undo the curve". However, we haven't
-        // applied the curve at that point.
-        //
-        // So, to actually apply the curve, we use CAVolumeCurve::ConvertRawToScalar to get the
-        // linear slider position back, map it onto the range of raw volumes and use
-        // CAVolumeCurve::ConvertRawToScalar again to apply the curve.
-        //
-        // It might be that we should be using CAVolumeCurve with transfer functions x^n where
-        // 0 < n < 1, but a lot more of the transfer functions it supports have n >= 1, including
-        // the default one. So I'm a bit confused.
-        //
-        // TODO: I think this means the dB volume we report will be wrong. It also makes the code
-        //       pretty confusing.
-        Float32 theSliderPosition = mVolumeCurve.ConvertRawToScalar(mVolumeRaw);
+        Float32 theAmplitudeGain = ConvertRawToAmplitudeGain(mVolumeRaw);
 
-        // TODO: This assumes the control should never boost the signal. (So, technically, it never
-        //       actually applies gain, only loss.)
-        SInt32 theRawRange = mMaxVolumeRaw - mMinVolumeRaw;
-        SInt32 theSliderPositionInRawSteps = static_cast<SInt32>(theSliderPosition * theRawRange);
-        theSliderPositionInRawSteps += mMinVolumeRaw;
+        EFFAssert((theAmplitudeGain >= 0.0f) && (theAmplitudeGain <= 1.0f), "Gain not in [0,1]");
 
-        mAmplitudeGain = mVolumeCurve.ConvertRawToScalar(theSliderPositionInRawSteps);
+        // Publish the gain to the IO thread. A single aligned Float32 can't tear, and the release
+        // pairs with the acquire in GetAmplitudeGainRT.
+        mAmplitudeGain.store(theAmplitudeGain, std::memory_order_release);
 
-        EFFAssert((mAmplitudeGain >= 0.0f) && (mAmplitudeGain <= 1.0f), "Gain not in [0,1]");
+        // Send notifications, unless some are already queued. Dragging a volume slider can set the
+        // volume many times before the queue gets around to sending them, and the host only needs
+        // to know the volume has changed since it last read it.
+        if(!mNotificationPending.exchange(true, std::memory_order_acq_rel))
+        {
+            CADispatchQueue::GetGlobalSerialQueue().Dispatch(false, ^{
+                // Clear the flag before sending, so a change made while we're sending them gets its
+                // own notifications.
+                mNotificationPending.store(false, std::memory_order_release);
 
-        // Send notifications.
-        CADispatchQueue::GetGlobalSerialQueue().Dispatch(false, ^{
-            AudioObjectPropertyAddress theChangedProperties[2];
-            theChangedProperties[0] = { kAudioLevelControlPropertyScalarValue, mScope, mElement };
-            theChangedProperties[1] = { kAudioLevelControlPropertyDecibelValue, mScope, mElement };
+                AudioObjectPropertyAddress theChangedProperties[2];
+                theChangedProperties[0] = { kAudioLevelControlPropertyScalarValue, mScope, mElement };
+                theChangedProperties[1] = { kAudioLevelControlPropertyDecibelValue, mScope, mElement };
 
-            EFF_PlugIn::Host_PropertiesChanged(GetObjectID(), 2, theChangedProperties);
-        });
+                EFF_PlugIn::Host_PropertiesChanged(GetObjectID(), 2, theChangedProperties);
+            });
+        }
     }
 }
 
+Float32    EFF_VolumeControl::ConvertRawToAmplitudeGain(SInt32 inVolumeRaw) const
+{
+    // CAVolumeCurve deals with volumes in three different scales: scalar, dB and raw. Raw
+    // volumes are the number of steps along the dB curve, so dB and raw volumes are linearly
+    // related.
+    //
+    // macOS uses the scalar volume to set the position of its volume sliders for the
+    // device. We have to set the scalar volume to the position of our volume slider for a
+    // device (more specifically, a linear mapping of it onto [0,1]) or macOS's volume sliders
+    // or it will work differently to our own.
+    //
+    // When we set a new slider position as the device's scalar volume, we convert it to raw
+    // with CAVolumeCurve::ConvertScalarToRaw, which will "undo the curve". However, we haven't
+    // applied the curve at that point.
+    //
+    // So, to actually apply the curve, we use CAVolumeCurve::ConvertRawToScalar to get the
+    // linear slider position back, map it onto the range of raw volumes and use
+    // CAVolumeCurve::ConvertRawToScalar again to apply the curve.
+    //
+    // It might be that we should be using CAVolumeCurve with transfer functions x^n where
+    // 0 < n < 1, but a lot more of the transfer functions it supports have n >= 1, including
+    // the default one. So I'm a bit confused.
+    //
+    // TODO: I think this means the dB volume we report will be wrong. It also makes the code
+    //       pretty confusing.
+    Float32 theSliderPosition = mVolumeCurveTable.ConvertRawToScalar(inVolumeRaw);
+
+    // TODO: This assumes the control should never boost the signal. (So, technically, it never
+    //       actually applies gain, only loss.)
+    SInt32 theRawRange = mMaxVolumeRaw - mMinVolumeRaw;
+    SInt32 theSliderPositionInRawSteps = static_cast<SInt32>(theSliderPosition * theRawRange);
+    theSliderPositionInRawSteps += mMinVolumeRaw;
+
+    return mVolumeCurveTable.ConvertRawToScalar(theSliderPositionInRawSteps);
+}
+
 #pragma clang assume_nonnull end
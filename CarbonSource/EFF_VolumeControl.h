@@ -13,10 +13,16 @@
 // Superclass Includes
 #include "EFF_Control.h"
 
+// Local Includes
+#include "EFF_VolumeCurveTable.h"
+
 // PublicUtility Includes
 #include "CAVolumeCurve.h"
 #include "CAMutex.h"
 
+// STL Includes
+#include <atomic>
+
 
 #pragma clang assume_nonnull begin
 
@@ -70,7 +76,14 @@ public:
      @return The curve used by this control to convert volume values from scalar into signal gain
              and/or decibels. A continuous 2D function.
      */
-    CAVolumeCurve&      GetVolumeCurve() { return mVolumeCurve; }
+    const CAVolumeCurve& GetVolumeCurve() const { return mVolumeCurve; }
+    /*!
+     Set the transfer function of the control's volume curve. See CAVolumeCurve::SetTransferFunction.
+     Thread safe, since the control only uses the curve with mMutex held, but not real-time safe. The
+     IO thread applies the new curve from its next buffer. Callers of GetVolumeCurve get no locking,
+     so they shouldn't use the curve while this might be called.
+     */
+    void                SetVolumeCurveTransferFunction(UInt32 inTransferFunction);
 
     /*!
      Set the volume of this control to a given position along its volume curve. (See
@@ -94,6 +107,11 @@ public:
      */
     void                SetVolumeDb(Float32 inNewVolumeDb);
 
+    /*!
+     @return The gain this control would apply to audio if its scalar volume were inVolumeScalar.
+     */
+    Float32             ConvertScalarToAmplitudeGain(Float32 inVolumeScalar) const;
+
     /*!
      Set this volume control to apply its volume to audio data, which allows clients to call
      ApplyVolumeToAudioRT. When this is set true, WillApplyVolumeToAudioRT will return true. Set to
@@ -120,6 +138,16 @@ public:
                          its volume to audio data.
      */
     void                ApplyVolumeToAudioRT(Float32* ioBuffer, UInt32 inBufferFrameSize) const;
+    /*!
+     Apply inAmplitudeGain to the samples in ioBuffer instead of the control's current gain, e.g. to
+     apply a volume change from part way through the buffer. See ConvertScalarToAmplitudeGain.
+     */
+    void                ApplyVolumeToAudioRT(Float32* ioBuffer,
+                                             UInt32 inBufferFrameSize,
+                                             Float32 inAmplitudeGain) const;
+    /*! @return The gain ApplyVolumeToAudioRT applies for the current volume. */
+    Float32             GetAmplitudeGainRT() const
+                            { return mAmplitudeGain.load(std::memory_order_acquire); }
 
 #pragma mark Implementation
 
@@ -127,6 +155,9 @@ protected:
     void                SetVolumeRaw(SInt32 inNewVolumeRaw);
 
 private:
+    // mMutex must be held.
+    Float32             ConvertRawToAmplitudeGain(SInt32 inVolumeRaw) const;
+
     const SInt32        kDefaultMinRawVolume = 0;
     const SInt32        kDefaultMaxRawVolume = 96;
     const Float32       kDefaultMinDbVolume  = -96.0f;
@@ -141,9 +172,18 @@ private:
     Float32             mMaxVolumeDb;
 
     CAVolumeCurve       mVolumeCurve;
+    // mVolumeCurve's conversions between raw and scalar or dB volumes, precomputed. Rebuilt when
+    // the curve changes. Guarded by mMutex, like mVolumeCurve.
+    EFF_VolumeCurveTable mVolumeCurveTable;
     // The gain (or loss) to apply to an audio signal to increase/decrease its volume by the current
-    // volume of this control.
-    Float32             mAmplitudeGain;
+    // volume of this control. Written with mMutex held and read by the IO thread without it, so
+    // it's atomic rather than guarded by mMutex.
+    std::atomic<Float32> mAmplitudeGain;
+
+    // True while a notification of a volume change is queued and hasn't started being sent. The
+    // host reads the new value when it gets the notification, so further changes before then don't
+    // need their own notifications.
+    std::atomic<bool>   mNotificationPending;
 
     bool                mWillApplyVolumeToAudio;
 
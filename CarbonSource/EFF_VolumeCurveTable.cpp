@@ -0,0 +1,164 @@
+//
+//  EFF_VolumeCurveTable.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_VolumeCurveTable.h"
+
+// PublicUtility Includes
+#include "CADebugMacros.h"
+
+// STL Includes
+#include <algorithm>
+#include <cstring>
+
+
+#pragma clang assume_nonnull begin
+
+#pragma mark Float32 Ordering
+
+// Maps each Float32 to an integer such that the integers are in the same order as the floats and
+// adjacent floats map to adjacent integers, so we can bisect over every float in a range.
+static SInt64    FloatToOrderedInt(Float32 inFloat)
+{
+    UInt32 theBits;
+    std::memcpy(&theBits, &inFloat, sizeof(theBits));
+
+    // Negative floats are stored as sign and magnitude, so their order is reversed.
+    return (theBits & 0x80000000) ? -static_cast<SInt64>(theBits & 0x7FFFFFFF) : static_cast<SInt64>(theBits);
+}
+
+static Float32    OrderedIntToFloat(SInt64 inOrderedInt)
+{
+    UInt32 theBits = (inOrderedInt < 0) ?
+        (static_cast<UInt32>(-inOrderedInt) | 0x80000000) :
+        static_cast<UInt32>(inOrderedInt);
+
+    Float32 theFloat;
+    std::memcpy(&theFloat, &theBits, sizeof(theFloat));
+    return theFloat;
+}
+
+#pragma mark Construction/Destruction
+
+EFF_VolumeCurveTable::EFF_VolumeCurveTable(const CAVolumeCurve& inCurve)
+:
+    mMinimumRaw(inCurve.GetMinimumRaw()),
+    mMaximumRaw(inCurve.GetMaximumRaw()),
+    mScalarToRaw(BuildSteps(0.0f, 1.0f, [&inCurve] (Float32 inScalar) {
+        return inCurve.ConvertScalarToRaw(inScalar);
+    })),
+    mDBToRaw(BuildSteps(inCurve.GetMinimumDB(), inCurve.GetMaximumDB(), [&inCurve] (Float32 inDB) {
+        return inCurve.ConvertDBToRaw(inDB);
+    }))
+{
+    for(SInt32 theRaw = mMinimumRaw; theRaw <= mMaximumRaw; theRaw++)
+    {
+        mRawToScalar.push_back(inCurve.ConvertRawToScalar(theRaw));
+        mRawToDB.push_back(inCurve.ConvertRawToDB(theRaw));
+    }
+
+#if DEBUG
+    Validate(inCurve);
+#endif
+}
+
+#pragma mark Conversions
+
+Float32    EFF_VolumeCurveTable::ConvertRawToScalar(SInt32 inRaw) const
+{
+    inRaw = std::min(std::max(mMinimumRaw, inRaw), mMaximumRaw);
+    return mRawToScalar[inRaw - mMinimumRaw];
+}
+
+Float32    EFF_VolumeCurveTable::ConvertRawToDB(SInt32 inRaw) const
+{
+    inRaw = std::min(std::max(mMinimumRaw, inRaw), mMaximumRaw);
+    return mRawToDB[inRaw - mMinimumRaw];
+}
+
+SInt32    EFF_VolumeCurveTable::ConvertScalarToRaw(Float32 inScalar) const
+{
+    return mScalarToRaw.Find(inScalar);
+}
+
+SInt32    EFF_VolumeCurveTable::ConvertDBToRaw(Float32 inDB) const
+{
+    return mDBToRaw.Find(inDB);
+}
+
+#pragma mark Implementation
+
+SInt32    EFF_VolumeCurveTable::Steps::Find(Float32 inInput) const
+{
+    inInput = std::min(std::max(minimumInput, inInput), maximumInput);
+
+    // The number of thresholds at or below the input is the number of steps up from firstRaw.
+    auto theStep = std::upper_bound(thresholds.begin(), thresholds.end(), inInput);
+    return firstRaw + static_cast<SInt32>(theStep - thresholds.begin());
+}
+
+template <typename Conversion>
+EFF_VolumeCurveTable::Steps    EFF_VolumeCurveTable::BuildSteps(Float32 inMinimumInput,
+                                                                Float32 inMaximumInput,
+                                                                Conversion inConvert)
+{
+    Steps theSteps;
+    theSteps.minimumInput = inMinimumInput;
+    theSteps.maximumInput = inMaximumInput;
+    theSteps.firstRaw = inConvert(inMinimumInput);
+
+    const SInt32 theLastRaw = inConvert(inMaximumInput);
+    const SInt64 theMinimumOrderedInt = FloatToOrderedInt(inMinimumInput);
+    const SInt64 theMaximumOrderedInt = FloatToOrderedInt(inMaximumInput);
+
+    for(SInt32 theRaw = theSteps.firstRaw + 1; theRaw <= theLastRaw; theRaw++)
+    {
+        // The minimum input converts to less than theRaw and the maximum to at least theRaw. Narrow
+        // that down to two adjacent floats. Takes at most 32 conversions.
+        SInt64 theBelow = theMinimumOrderedInt;
+        SInt64 theAtOrAbove = theMaximumOrderedInt;
+
+        while(theAtOrAbove - theBelow > 1)
+        {
+            SInt64 theMiddle = theBelow + (theAtOrAbove - theBelow) / 2;
+
+            if(inConvert(OrderedIntToFloat(theMiddle)) >= theRaw)
+            {
+                theAtOrAbove = theMiddle;
+            }
+            else
+            {
+                theBelow = theMiddle;
+            }
+        }
+
+        theSteps.thresholds.push_back(OrderedIntToFloat(theAtOrAbove));
+    }
+
+    return theSteps;
+}
+
+void    EFF_VolumeCurveTable::Validate(const CAVolumeCurve& inCurve) const
+{
+    const UInt32 kNumPoints = 4096;
+
+    for(UInt32 i = 0; i <= kNumPoints; i++)
+    {
+        Float32 thePosition = static_cast<Float32>(i) / kNumPoints;
+
+        Float32 theScalar = thePosition;
+        Assert(ConvertScalarToRaw(theScalar) == inCurve.ConvertScalarToRaw(theScalar),
+               "EFF_VolumeCurveTable::Validate: ConvertScalarToRaw doesn't match the curve");
+
+        Float32 theDB = inCurve.GetMinimumDB() + thePosition * (inCurve.GetMaximumDB() - inCurve.GetMinimumDB());
+        Assert(ConvertDBToRaw(theDB) == inCurve.ConvertDBToRaw(theDB),
+               "EFF_VolumeCurveTable::Validate: ConvertDBToRaw doesn't match the curve");
+    }
+}
+
+#pragma clang assume_nonnull end
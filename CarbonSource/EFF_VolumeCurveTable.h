@@ -0,0 +1,101 @@
+//
+//  EFF_VolumeCurveTable.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_VolumeCurveTable_h
+#define EFF_VolumeCurveTable_h
+
+// PublicUtility Includes
+#include "CAVolumeCurve.h"
+
+// STL Includes
+#include <vector>
+
+// System Includes
+#include <MacTypes.h>
+
+
+#pragma clang assume_nonnull begin
+
+//==================================================================================================
+//    EFF_VolumeCurveTable
+//
+//  A CAVolumeCurve's raw, scalar and dB conversions, precomputed when the table is built so they
+//  can be looked up instead of calling pow and log each time. Setting every app's volume or copying
+//  kAudioDeviceCustomPropertyAppVolumes converts a volume for each client, and CAVolumeCurve's
+//  conversions are most of the cost.
+//
+//  Raw volumes are integers in a small range, so the conversions from raw are stored for every raw
+//  volume and are exactly the curve's. The conversions to raw are step functions, so the table
+//  stores the smallest input that converts to each raw volume, found by bisecting over every
+//  Float32 in the input range, and looks the input up among them. As long as the curve's
+//  conversions never decrease, which CAVolumeCurve's don't, that gives the same result as the curve
+//  for every input, so there's no interpolation error to bound. Debug builds check that when the
+//  table is built.
+//
+//  The table doesn't change after it's built, so it's safe to read from any thread. Rebuild it if
+//  the curve changes.
+//==================================================================================================
+
+class EFF_VolumeCurveTable
+{
+
+#pragma mark Construction/Destruction
+
+public:
+    explicit                    EFF_VolumeCurveTable(const CAVolumeCurve& inCurve);
+
+#pragma mark Conversions
+
+    SInt32                      GetMinimumRaw() const { return mMinimumRaw; }
+    SInt32                      GetMaximumRaw() const { return mMaximumRaw; }
+
+    // The same as the CAVolumeCurve methods with the same names. Inputs are clamped to the curve's
+    // range first, as CAVolumeCurve does.
+    Float32                     ConvertRawToScalar(SInt32 inRaw) const;
+    Float32                     ConvertRawToDB(SInt32 inRaw) const;
+    SInt32                      ConvertScalarToRaw(Float32 inScalar) const;
+    SInt32                      ConvertDBToRaw(Float32 inDB) const;
+
+#pragma mark Implementation
+
+private:
+    // The raw volumes a conversion to raw gives for the inputs in a range, as the smallest input
+    // that gives each one.
+    struct Steps
+    {
+        Float32                 minimumInput;
+        Float32                 maximumInput;
+        SInt32                  firstRaw;
+        // thresholds[i] is the smallest input that converts to firstRaw + i + 1 or more.
+        std::vector<Float32>    thresholds;
+
+        SInt32                  Find(Float32 inInput) const;
+    };
+
+    template <typename Conversion>
+    static Steps                BuildSteps(Float32 inMinimumInput,
+                                           Float32 inMaximumInput,
+                                           Conversion inConvert);
+    // Checks the table against the curve at evenly spaced inputs. Only called in debug builds.
+    void                        Validate(const CAVolumeCurve& inCurve) const;
+
+    SInt32                      mMinimumRaw;
+    SInt32                      mMaximumRaw;
+
+    // Indexed by raw volume minus mMinimumRaw.
+    std::vector<Float32>        mRawToScalar;
+    std::vector<Float32>        mRawToDB;
+
+    Steps                       mScalarToRaw;
+    Steps                       mDBToRaw;
+
+};
+
+#pragma clang assume_nonnull end
+
+#endif /* EFF_VolumeCurveTable_h */
@@ -0,0 +1,191 @@
+//
+//  EFF_WorkerThread.cpp
+//  effervescence-driver
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+// Self Include
+#include "EFF_WorkerThread.h"
+
+// STL Includes
+#if !defined(__APPLE__)
+#include <system_error>
+#endif
+
+// System Includes
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <sched.h>
+#include <syslog.h>
+#endif
+
+
+#if defined(__clang__)
+#pragma clang assume_nonnull begin
+#endif
+
+#if defined(__APPLE__)
+
+// MARK: macOS
+
+EFF_WorkerThread::EFF_WorkerThread(ThreadRoutine inThreadRoutine, void* inParameter)
+:
+    mThread(inThreadRoutine, inParameter)
+{
+}
+
+EFF_WorkerThread::EFF_WorkerThread(ThreadRoutine inThreadRoutine,
+                                   void* inParameter,
+                                   uint32_t inComputationNs,
+                                   uint32_t inConstraintNs)
+:
+    // The inline documentation for thread_time_constraint_policy.period says "A value of 0 indicates that there is no
+    // inherent periodicity in the computation". So I figure setting the period to 0 means the scheduler will take as long
+    // as it wants to wake our real-time thread, which is fine for us, but once it has only other real-time threads can
+    // preempt us. (And that's only if they won't make our computation take longer than inConstraintNs).
+    mThread(/* inThreadRoutine = */ inThreadRoutine,
+            /* inParameter */       inParameter,
+            /* inPeriod = */        0,
+            /* inComputation */     NanosToAbsoluteTime(inComputationNs),
+            /* inConstraint */      NanosToAbsoluteTime(inConstraintNs),
+            /* inIsPreemptible = */ true)
+{
+}
+
+void    EFF_WorkerThread::Start()
+{
+    mThread.Start();
+}
+
+bool    EFF_WorkerThread::IsCurrentThread() const
+{
+    return mThread.IsCurrentThread();
+}
+
+bool    EFF_WorkerThread::IsTimeConstraintThread() const
+{
+    return mThread.IsTimeConstraintThread();
+}
+
+bool    EFF_WorkerThread::IsTimeShareThread() const
+{
+    return mThread.IsTimeShareThread();
+}
+
+//static
+uint32_t    EFF_WorkerThread::NanosToAbsoluteTime(uint32_t inNanos)
+{
+    // Converts a duration from nanoseconds to absolute time (i.e. number of bus cycles). Used for calculating
+    // the real-time thread's time constraint policy.
+
+    mach_timebase_info_data_t theTimebaseInfo;
+    mach_timebase_info(&theTimebaseInfo);
+
+    Float64 theTicksPerNs = static_cast<Float64>(theTimebaseInfo.denom) / theTimebaseInfo.numer;
+    return static_cast<uint32_t>(inNanos * theTicksPerNs);
+}
+
+#else
+
+// MARK: POSIX
+
+EFF_WorkerThread::EFF_WorkerThread(ThreadRoutine inThreadRoutine, void* inParameter)
+:
+    mThreadRoutine(inThreadRoutine),
+    mParameter(inParameter),
+    mIsRealTime(false),
+    mThread(pthread_t())
+{
+}
+
+EFF_WorkerThread::EFF_WorkerThread(ThreadRoutine inThreadRoutine,
+                                   void* inParameter,
+                                   // SCHED_FIFO has no way to say how long the thread runs for.
+                                   uint32_t /* inComputationNs */,
+                                   uint32_t /* inConstraintNs */)
+:
+    mThreadRoutine(inThreadRoutine),
+    mParameter(inParameter),
+    mIsRealTime(true),
+    mThread(pthread_t())
+{
+}
+
+void    EFF_WorkerThread::Start()
+{
+    // The new thread sets mThread itself, since pthread_create might not have returned by the time
+    // it needs it.
+    pthread_t theThread;
+    int theError = pthread_create(&theThread, nullptr, &EFF_WorkerThread::ThreadProc, this);
+
+    if(theError != 0)
+    {
+        throw std::system_error(theError, std::generic_category(), "EFF_WorkerThread::Start: pthread_create failed");
+    }
+
+    // The thread is never joined.
+    pthread_detach(theThread);
+}
+
+bool    EFF_WorkerThread::IsCurrentThread() const
+{
+    return pthread_equal(pthread_self(), mThread.load(std::memory_order_relaxed)) != 0;
+}
+
+bool    EFF_WorkerThread::IsTimeConstraintThread() const
+{
+    // Check the worker's policy, rather than the calling thread's, so this means the same thing
+    // as it does on macOS even if it's called from another thread.
+    int thePolicy;
+    sched_param theParam;
+
+    if(pthread_getschedparam(mThread.load(std::memory_order_relaxed), &thePolicy, &theParam) != 0)
+    {
+        return false;
+    }
+
+    return thePolicy == SCHED_FIFO;
+}
+
+bool    EFF_WorkerThread::IsTimeShareThread() const
+{
+    return !IsTimeConstraintThread();
+}
+
+//static
+void* EFF_WORKER_THREAD_NULLABLE    EFF_WorkerThread::ThreadProc(void* inRefCon)
+{
+    EFF_WorkerThread* theThread = static_cast<EFF_WorkerThread*>(inRefCon);
+
+    theThread->mThread.store(pthread_self(), std::memory_order_relaxed);
+
+    if(theThread->mIsRealTime)
+    {
+        // In the middle of SCHED_FIFO's range, so it preempts normal threads but not audio servers'
+        // IO threads, which usually run near the top of it.
+        int theMin = sched_get_priority_min(SCHED_FIFO);
+        int theMax = sched_get_priority_max(SCHED_FIFO);
+        sched_param theParam = {};
+        theParam.sched_priority = theMin + (theMax - theMin) / 2;
+
+        int theError = pthread_setschedparam(pthread_self(), SCHED_FIFO, &theParam);
+
+        if(theError != 0)
+        {
+            // Usually EPERM, if the process has no RLIMIT_RTPRIO or CAP_SYS_NICE.
+            syslog(LOG_WARNING, "EFF_WorkerThread::ThreadProc: Couldn't use SCHED_FIFO. error=%d", theError);
+        }
+    }
+
+    return theThread->mThreadRoutine(theThread->mParameter);
+}
+
+#endif
+
+#if defined(__clang__)
+#pragma clang assume_nonnull end
+#endif
+
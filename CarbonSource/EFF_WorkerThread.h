@@ -0,0 +1,104 @@
+//
+//  EFF_WorkerThread.h
+//  effervescence-core
+//
+//  Created by Nerrons on 19/10/26.
+//  Copyright © 2020 nerrons. All rights reserved.
+//
+
+#ifndef EFF_WorkerThread_h
+#define EFF_WorkerThread_h
+
+// PublicUtility Includes
+#if defined(__APPLE__)
+#include "CAPThread.h"
+#endif
+
+// STL Includes
+#include <cstdint>
+#if !defined(__APPLE__)
+#include <atomic>
+#endif
+
+// System Includes
+#include <pthread.h>
+
+// Clang's nullability qualifier, which GCC doesn't have.
+#if defined(__clang__)
+#define EFF_WORKER_THREAD_NULLABLE __nullable
+#else
+#define EFF_WORKER_THREAD_NULLABLE
+#endif
+
+
+#if defined(__clang__)
+#pragma clang assume_nonnull begin
+#endif
+
+//==================================================================================================
+//    EFF_WorkerThread
+//
+//  A thread with either default priority or real-time priority, for EFF_TaskQueue's workers.
+//
+//  On macOS, it's a CAPThread and real-time threads get a time-constraint policy, like the IO
+//  thread's, with the computation and constraint converted to absolute time. On Linux, real-time
+//  threads are scheduled with SCHED_FIFO. (Not SCHED_DEADLINE, since the worker has no period, and
+//  reserving its computation time every constraint interval would take most of a CPU.) If the
+//  driver isn't allowed to use SCHED_FIFO, the thread logs a warning and runs with default priority.
+//
+//  The POSIX backend only uses standard types, rather than CoreAudio's, so it can be built and
+//  tested on Linux.
+//==================================================================================================
+
+class EFF_WorkerThread
+{
+
+public:
+    typedef void* EFF_WORKER_THREAD_NULLABLE (*ThreadRoutine)(void* inParameter);
+
+    // A thread with default priority.
+                                EFF_WorkerThread(ThreadRoutine inThreadRoutine, void* inParameter);
+    // A real-time thread. inComputationNs is roughly how long it needs to run each time it's woken
+    // and inConstraintNs is the most time it can take to finish after being woken.
+                                EFF_WorkerThread(ThreadRoutine inThreadRoutine,
+                                                 void* inParameter,
+                                                 uint32_t inComputationNs,
+                                                 uint32_t inConstraintNs);
+    // Disallow copying
+                                EFF_WorkerThread(const EFF_WorkerThread&)           = delete;
+    EFF_WorkerThread&           operator=(const EFF_WorkerThread&)                  = delete;
+
+    // Throws CAException on macOS, or std::system_error elsewhere, if the thread can't be created.
+    // Threads are never stopped or joined.
+    void                        Start();
+
+    bool                        IsCurrentThread() const;
+    // For assertions. Call them on the thread itself.
+    bool                        IsTimeConstraintThread() const;
+    bool                        IsTimeShareThread() const;
+
+private:
+#if defined(__APPLE__)
+    static uint32_t             NanosToAbsoluteTime(uint32_t inNanos);
+
+    CAPThread                   mThread;
+#else
+    static void* EFF_WORKER_THREAD_NULLABLE ThreadProc(void* inRefCon);
+
+    ThreadRoutine               mThreadRoutine;
+    void*                       mParameter;
+    bool                        mIsRealTime;
+    // Only written by the thread itself, before it calls mThreadRoutine, so the thread always sees
+    // its own ID. Other threads see a value-initialized pthread_t until then, which doesn't match any
+    // running thread.
+    std::atomic<pthread_t>      mThread;
+#endif
+
+};
+
+#if defined(__clang__)
+#pragma clang assume_nonnull end
+#endif
+
+#endif /* EFF_WorkerThread_h */
+